@@ -55,6 +55,10 @@ def gather_times(name):
         diffs.append(diff)
         print('{},{},{},{},{}'.format(bench, default_time, rkr_time, overhead, diff), file=csv)
   
+  # Not every benchmark records every kind of build
+  if len(overheads) == 0:
+    return
+
   print('Overhead for {}'.format(name), file=summary)
   print('  Max: {:.3f}'.format(max(overheads)), file=summary)
   print('  Min: {:.3f}'.format(min(overheads)), file=summary)
@@ -157,6 +161,7 @@ def case_study_savings():
 
 gather_times('full-build')
 gather_times('nop-build')
+gather_times('incremental-build')
 
 case_study_savings()
 
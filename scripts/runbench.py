@@ -9,6 +9,7 @@ import time
 
 RKR_DIR = path.abspath(path.join(path.dirname(__file__), '..'))
 BENCH_DIR = path.join(RKR_DIR, 'benchmarks')
+SYNTHPROJ = path.join(RKR_DIR, 'scripts', 'synthproj.py')
 BENCHMARKS = {}
 DEFAULT_REPS = 5
 COMMIT_COUNT = 100
@@ -85,9 +86,28 @@ def checkout(name):
       rev = BENCHMARKS[name]['commit']
       checkout_rev(name, rev)
 
+  elif 'generate' in BENCHMARKS[name]:
+    # Generate a synthetic project if there isn't one already
+    if not path.isdir(checkout_path):
+      print('  Generating synthetic project for benchmark {}'.format(name))
+      args = ' '.join(BENCHMARKS[name]['generate'])
+      rc = os.system('{} generate {} {} > /dev/null'.format(SYNTHPROJ, checkout_path, args))
+      if rc != 0:
+        raise Exception('Generating synthetic project for {} failed'.format(name))
+
   else:
     raise Exception('No method found to checkout a copy of {}'.format(name))
 
+def edit(name):
+  bench_path = path.join(BENCH_DIR, name)
+  checkout_path = path.join(bench_path, 'checkout')
+
+  args = ' '.join(BENCHMARKS[name]['edit'])
+  print('  Editing {} with {}'.format(name, args))
+  rc = os.system('{} edit {} {} > /dev/null'.format(SYNTHPROJ, checkout_path, args))
+  if rc != 0:
+    raise Exception('Editing synthetic project for {} failed'.format(name))
+
 def copy_files(name, build_tool):
   print('  Copying files to {} for {} build'.format(name, build_tool))
 
@@ -150,6 +170,10 @@ def full_build(name, build_tool):
   full_time = open(path.join(bench_path, 'full-build-{}.csv'.format(build_tool)), 'w')
   nop_time = open(path.join(bench_path, 'nop-build-{}.csv'.format(build_tool)), 'w')
 
+  # Benchmarks that can be edited also record the time for an incremental build
+  if 'edit' in BENCHMARKS[name]:
+    incremental_time = open(path.join(bench_path, 'incremental-build-{}.csv'.format(build_tool)), 'w')
+
   for i in range(0, reps):
     setup(name, build_tool)
     copy_files(name, build_tool)
@@ -172,6 +196,17 @@ def full_build(name, build_tool):
     print('{:.4f}'.format(end_time - start_time), file=nop_time)
     print('    Finished in {:.2f}s with exit code {}'.format(end_time - start_time, rc))
 
+    if 'edit' in BENCHMARKS[name]:
+      edit(name)
+
+      print('  Running incremental build {}'.format(i+1))
+      start_time = time.perf_counter()
+      rc = os.system('cd {}; {} 2> /dev/null 1> /dev/null'.format(checkout_path, build_cmd))
+      end_time = time.perf_counter()
+
+      print('{:.4f}'.format(end_time - start_time), file=incremental_time)
+      print('    Finished in {:.2f}s with exit code {}'.format(end_time - start_time, rc))
+
 # Count lines in a file (a list of commands) but exclude lines with known prefixes
 def count_lines(filepath, filter=[]):
   f = open(filepath, 'r')
@@ -0,0 +1,280 @@
+#!/usr/bin/env python3
+
+# Generate synthetic C projects for scalability benchmarks, and apply edits to them for
+# incremental builds. Projects are generated from a seed, so the same arguments always produce the
+# same project, and nothing is downloaded.
+#
+#   synthproj.py generate <dir> --units 1000 --fan-in 4 --fan-out 2 --depth 3 --driver rikerfile
+#   synthproj.py edit <dir> --pattern header --count 1
+
+import argparse
+import json
+import math
+import os
+from os import path
+import random
+import shutil
+
+# Generator settings are saved in the project so edits know its shape
+SETTINGS_FILE = '.synthproj.json'
+
+def dir_for(settings, d):
+  '''Get the source directory for directory number d, nested settings['depth'] levels deep'''
+  depth = settings['depth']
+  if depth == 0:
+    return 'src'
+
+  # Spread directories over a tree with the same branching factor at each level. Each directory's
+  # path spells out its number in that base.
+  dirs = math.ceil(settings['units'] / settings['per_dir'])
+  branch = 2
+  while branch ** depth < dirs:
+    branch += 1
+
+  parts = []
+  for level in range(depth):
+    parts.append('d{}'.format((d // branch ** (depth - level - 1)) % branch))
+
+  return path.join('src', *parts)
+
+def unit_path(settings, u):
+  '''Get the path to translation unit u, without an extension'''
+  return path.join(dir_for(settings, u // settings['per_dir']), 'u{}'.format(u))
+
+def header_path(h):
+  '''Get the path to header h'''
+  return path.join('include', 'h{}.h'.format(h))
+
+def plan(settings):
+  '''Choose the headers each unit and header includes. Headers only include headers with higher
+  numbers, so the include graph has no cycles.'''
+  rng = random.Random(settings['seed'])
+  headers = settings['headers']
+
+  unit_includes = []
+  for u in range(settings['units']):
+    unit_includes.append(sorted(rng.sample(range(headers), min(settings['fan_in'], headers))))
+
+  header_includes = []
+  for h in range(headers):
+    later = range(h + 1, headers)
+    header_includes.append(sorted(rng.sample(later, min(settings['fan_out'], len(later)))))
+
+  return (unit_includes, header_includes)
+
+def write_header(h, includes):
+  with open(header_path(h), 'w') as f:
+    print('#pragma once', file=f)
+    for i in includes:
+      print('#include "h{}.h"'.format(i), file=f)
+    print(file=f)
+    print('static inline int h{}(int x) {{'.format(h), file=f)
+    print('  return x * {} + {};'.format(2 * h + 1, h), file=f)
+    print('}', file=f)
+
+def write_unit(settings, u, includes):
+  with open(unit_path(settings, u) + '.c', 'w') as f:
+    for i in includes:
+      print('#include "h{}.h"'.format(i), file=f)
+    print(file=f)
+    for fn in range(settings['functions']):
+      print('int u{}_{}(int x) {{'.format(u, fn), file=f)
+      for i in includes:
+        print('  x = h{}(x);'.format(i), file=f)
+      print('  return x;', file=f)
+      print('}', file=f)
+      print(file=f)
+
+def write_main(settings):
+  '''Write a main function that calls the first function in each directory's first unit'''
+  firsts = range(0, settings['units'], settings['per_dir'])
+  with open(path.join('src', 'main.c'), 'w') as f:
+    for u in firsts:
+      print('int u{}_0(int x);'.format(u), file=f)
+    print(file=f)
+    print('int main(int argc, char** argv) {', file=f)
+    print('  int x = argc;', file=f)
+    for u in firsts:
+      print('  x = u{}_0(x);'.format(u), file=f)
+    print('  return x == 0;', file=f)
+    print('}', file=f)
+
+def write_rikerfile(settings):
+  '''Write a Rikerfile that runs every compile and link command itself'''
+  cflags = '-O{} -Iinclude'.format(settings['opt'])
+  with open('Rikerfile', 'w') as f:
+    print('#!/bin/sh', file=f)
+    print(file=f)
+    print('set -e', file=f)
+    print(file=f)
+    for u in range(settings['units']):
+      p = unit_path(settings, u)
+      print('gcc {} -c {}.c -o {}.o'.format(cflags, p, p), file=f)
+    print('gcc {} -c src/main.c -o src/main.o'.format(cflags), file=f)
+    print(file=f)
+
+    # Archive each directory's objects so the final link command stays short
+    libs = []
+    for first in range(0, settings['units'], settings['per_dir']):
+      d = first // settings['per_dir']
+      last = min(first + settings['per_dir'], settings['units'])
+      lib = path.join(dir_for(settings, d), 'lib{}.a'.format(d))
+      objs = ' '.join(unit_path(settings, u) + '.o' for u in range(first, last))
+      print('rm -f {}'.format(lib), file=f)
+      print('ar rcs {} {}'.format(lib, objs), file=f)
+      libs.append(lib)
+    print(file=f)
+    print('gcc -o program src/main.o {}'.format(' '.join(libs)), file=f)
+  os.chmod('Rikerfile', 0o755)
+
+def write_makefile(settings):
+  '''Write a Makefile that tracks header dependencies, and a Rikerfile that runs make'''
+  units = [unit_path(settings, u) + '.o' for u in range(settings['units'])]
+  libs = []
+  with open('Makefile', 'w') as f:
+    print('CFLAGS := -O{} -Iinclude -MMD -MP'.format(settings['opt']), file=f)
+    print(file=f)
+
+    lib_rules = []
+    for first in range(0, settings['units'], settings['per_dir']):
+      d = first // settings['per_dir']
+      last = min(first + settings['per_dir'], settings['units'])
+      lib = path.join(dir_for(settings, d), 'lib{}.a'.format(d))
+      libs.append(lib)
+      objs = ' '.join(units[first:last])
+      lib_rules.append('{}: {}\n\trm -f $@\n\tar rcs $@ $^\n'.format(lib, objs))
+
+    print('program: src/main.o {}'.format(' '.join(libs)), file=f)
+    print('\tgcc -o $@ $^', file=f)
+    print(file=f)
+    for rule in lib_rules:
+      print(rule, file=f)
+    print('%.o: %.c', file=f)
+    print('\tgcc $(CFLAGS) -c $< -o $@', file=f)
+    print(file=f)
+    print('-include $(shell find src -name "*.d")', file=f)
+
+  with open('Rikerfile', 'w') as f:
+    print('#!/bin/sh', file=f)
+    print(file=f)
+    print('make --quiet', file=f)
+  os.chmod('Rikerfile', 0o755)
+
+def generate(args):
+  settings = {
+    'units': args.units,
+    'headers': args.headers if args.headers is not None else max(1, args.units // 10),
+    'fan_in': args.fan_in,
+    'fan_out': args.fan_out,
+    'depth': args.depth,
+    'per_dir': args.per_dir,
+    'functions': args.functions,
+    'opt': args.opt,
+    'driver': args.driver,
+    'seed': args.seed,
+    'edits': 0
+  }
+
+  # Start from an empty directory
+  if path.exists(args.dir):
+    shutil.rmtree(args.dir)
+  os.makedirs(args.dir)
+  os.chdir(args.dir)
+
+  (unit_includes, header_includes) = plan(settings)
+
+  os.makedirs('include')
+  for h in range(settings['headers']):
+    write_header(h, header_includes[h])
+
+  os.makedirs('src', exist_ok=True)
+  for u in range(settings['units']):
+    os.makedirs(path.dirname(unit_path(settings, u)), exist_ok=True)
+    write_unit(settings, u, unit_includes[u])
+  write_main(settings)
+
+  if settings['driver'] == 'make':
+    write_makefile(settings)
+  else:
+    write_rikerfile(settings)
+
+  with open(SETTINGS_FILE, 'w') as f:
+    json.dump(settings, f, indent=2)
+
+  print('Generated {} units and {} headers in {}'.format(settings['units'], settings['headers'],
+                                                         args.dir))
+
+def edit(args):
+  os.chdir(args.dir)
+  with open(SETTINGS_FILE, 'r') as f:
+    settings = json.load(f)
+
+  # Each edit uses its own random stream, so a sequence of edits is repeatable
+  settings['edits'] += 1
+  n = settings['edits']
+  rng = random.Random('{}-{}'.format(settings['seed'], n))
+
+  # Choose the files to edit
+  units = settings['units']
+  headers = settings['headers']
+  if args.pattern == 'leaf':
+    chosen = rng.sample(range(units), min(args.count, units))
+    files = [unit_path(settings, u) + '.c' for u in chosen]
+  elif args.pattern == 'header':
+    # Headers only include higher-numbered headers, so the last headers reach the most units
+    candidates = range(max(0, headers - max(args.count, 10)), headers)
+    files = [header_path(h) for h in rng.sample(candidates, min(args.count, len(candidates)))]
+  elif args.pattern == 'hot':
+    # Edit the same units every time, as a developer working on one part of a project would
+    files = [unit_path(settings, u) + '.c' for u in range(min(args.count, units))]
+  else:
+    files = []
+    for i in range(args.count):
+      if rng.random() < 0.1:
+        files.append(header_path(rng.randrange(headers)))
+      else:
+        files.append(unit_path(settings, rng.randrange(units)) + '.c')
+
+  # Add a function to each file, so each edit changes what the compiler produces
+  for p in files:
+    with open(p, 'a') as f:
+      if p.endswith('.h'):
+        print('static inline int edit{}(void) {{ return {}; }}'.format(n, n), file=f)
+      else:
+        print('int {}_edit{}(void) {{ return {}; }}'.format(path.basename(p)[:-2], n, n), file=f)
+
+  with open(SETTINGS_FILE, 'w') as f:
+    json.dump(settings, f, indent=2)
+
+  print('Edit {} changed {} file(s)'.format(n, len(files)))
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Generate synthetic C projects for benchmarks')
+  commands = parser.add_subparsers(dest='command', required=True)
+
+  gen = commands.add_parser('generate', help='Create a new project, replacing the directory')
+  gen.add_argument('dir', help='The directory to create the project in')
+  gen.add_argument('--units', type=int, default=100, help='Number of translation units')
+  gen.add_argument('--headers', type=int, help='Number of headers (default: units / 10)')
+  gen.add_argument('--fan-in', type=int, default=4, help='Headers included by each unit')
+  gen.add_argument('--fan-out', type=int, default=2, help='Headers included by each header')
+  gen.add_argument('--depth', type=int, default=2, help='Directory nesting depth for sources')
+  gen.add_argument('--per-dir', type=int, default=100, help='Units in each source directory')
+  gen.add_argument('--functions', type=int, default=1, help='Functions in each unit')
+  gen.add_argument('--opt', type=int, default=0, help='Optimization level for compiles')
+  gen.add_argument('--driver', choices=['rikerfile', 'make'], default='rikerfile',
+                   help='Run commands from the Rikerfile, or from a Makefile')
+  gen.add_argument('--seed', type=int, default=0, help='Random seed for the include graph')
+
+  ed = commands.add_parser('edit', help='Edit files in a generated project')
+  ed.add_argument('dir', help='The project directory')
+  ed.add_argument('--pattern', choices=['leaf', 'header', 'hot', 'mixed'], default='leaf',
+                  help='Edit random units, widely-included headers, the same units every time, '
+                       'or a mix of units and headers')
+  ed.add_argument('--count', type=int, default=1, help='Number of files to edit')
+
+  args = parser.parse_args()
+  if args.command == 'generate':
+    generate(args)
+  else:
+    edit(args)
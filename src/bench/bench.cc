@@ -0,0 +1,555 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <list>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "artifacts/DirArtifact.hh"
+#include "data/AccessFlags.hh"
+#include "data/IRSink.hh"
+#include "data/IRSource.hh"
+#include "data/Trace.hh"
+#include "runtime/Build.hh"
+#include "runtime/Command.hh"
+#include "runtime/Ref.hh"
+#include "runtime/env.hh"
+#include "tracing/inject.h"
+#include "util/log.hh"
+#include "util/options.hh"
+#include "util/stats.hh"
+#include "versions/FileVersion.hh"
+#include "versions/MetadataVersion.hh"
+
+namespace fs = std::filesystem;
+
+using std::list;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::tuple;
+using std::vector;
+
+/**
+ * A SyntheticTrace produces a build trace shaped like a flat, compiler-driven build: a single
+ * build script launches many short commands, each of which resolves and reads a few input files.
+ * All of the inputs exist, so emulating the trace never rebuilds anything.
+ */
+class SyntheticTrace : public IRSource {
+ public:
+  /// Create a synthetic trace with a number of commands that read from a pool of input files
+  SyntheticTrace(size_t commands, size_t inputs) noexcept :
+      _commands(commands), _inputs(inputs) {}
+
+  /// Create the input files in the current directory
+  void createInputs() const noexcept {
+    for (size_t i = 0; i < _inputs; i++) {
+      std::ofstream(inputName(i)) << "int f" << i << "();" << std::endl;
+    }
+  }
+
+  /// Send the synthetic trace to an IRSink
+  void sendTo(IRSink& sink) const noexcept {
+    auto root = make_shared<Command>();
+    sink.start(root);
+
+    // Set up the root command's references, as DefaultTrace does
+    tuple<SpecialRef, Ref::ID> specials[] = {{SpecialRef::stdin, Ref::Stdin},
+                                             {SpecialRef::stdout, Ref::Stdout},
+                                             {SpecialRef::stderr, Ref::Stderr},
+                                             {SpecialRef::root, Ref::Root},
+                                             {SpecialRef::cwd, Ref::Cwd},
+                                             {SpecialRef::launch_exe, Ref::Exe}};
+    for (auto [entity, ref] : specials) {
+      sink.specialRef(*this, root, entity, ref);
+      sink.usingRef(*this, root, ref);
+    }
+
+    // Launch the build script
+    auto script = make_shared<Command>(vector<string>{"Rikerfile"});
+    list<tuple<Ref::ID, Ref::ID>> script_refs = {{Ref::Root, Ref::Root},
+                                                 {Ref::Cwd, Ref::Cwd},
+                                                 {Ref::Exe, Ref::Exe}};
+    sink.launch(*this, root, script, script_refs);
+
+    // Stat the inputs once so every MatchMetadata step expects the on-disk metadata
+    vector<MetadataVersion> metadata;
+    for (size_t i = 0; i < _inputs; i++) {
+      struct stat info;
+      FAIL_IF(::lstat(inputName(i).c_str(), &info) != 0) << "Missing input " << inputName(i);
+      metadata.emplace_back(info);
+    }
+
+    // The build script launches each command in turn and waits for it to finish
+    list<tuple<Ref::ID, Ref::ID>> child_refs = {{Ref::Cwd, Ref::Cwd}, {Ref::Exe, Ref::Exe}};
+    for (size_t i = 0; i < _commands; i++) {
+      auto child = make_shared<Command>(vector<string>{"cc", "-c", inputName(i % _inputs)});
+      sink.launch(*this, script, child, child_refs);
+
+      // Each command reads three inputs
+      for (size_t j = 0; j < 3; j++) {
+        size_t input = (i + j) % _inputs;
+        Ref::ID ref = Ref::ReservedRefs + j;
+        sink.pathRef(*this, child, Ref::Cwd, inputName(input), ReadAccess, ref);
+        sink.usingRef(*this, child, ref);
+        sink.expectResult(*this, child, Scenario::Build, ref, SUCCESS);
+        sink.matchMetadata(*this, child, Scenario::Build, ref, metadata[input]);
+        sink.doneWithRef(*this, child, ref);
+      }
+
+      sink.exit(*this, child, 0);
+      sink.join(*this, script, child, 0);
+    }
+
+    sink.exit(*this, script, 0);
+    sink.join(*this, root, script, 0);
+    sink.finish();
+  }
+
+  /// A synthetic trace is never an executing IRSource
+  virtual bool isExecuting() const override { return false; }
+
+ private:
+  /// Get the name of an input file
+  static string inputName(size_t i) noexcept { return "in" + std::to_string(i) + ".c"; }
+
+  /// The number of commands in the trace
+  size_t _commands;
+
+  /// The number of distinct input files
+  size_t _inputs;
+};
+
+/// An IRSink that discards every step, used to measure trace reading on its own
+class NullSink : public IRSink {};
+
+/// The time taken by repeated runs of a benchmark
+struct Timing {
+  /// The median time of a run, in seconds
+  double median;
+
+  /// The fastest run, in seconds
+  double min;
+};
+
+/**
+ * Time a benchmark over several runs. One untimed run comes first to warm up caches, and the
+ * median is reported so a single slow run does not skew comparisons between commits.
+ * \param runs  The number of timed runs
+ * \param setup Called before each run, outside the timed region
+ * \param body  The code to time
+ */
+template <class Setup, class Body>
+static Timing measure(size_t runs, Setup setup, Body body) noexcept {
+  setup();
+  body();
+
+  vector<double> times;
+  for (size_t i = 0; i < runs; i++) {
+    setup();
+    auto start = std::chrono::steady_clock::now();
+    body();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    times.push_back(elapsed.count());
+  }
+
+  std::sort(times.begin(), times.end());
+  return {times[times.size() / 2], times.front()};
+}
+
+/// Time a benchmark that needs no setup between runs
+template <class Body>
+static Timing measure(size_t runs, Body body) noexcept {
+  return measure(runs, [] {}, body);
+}
+
+/// Is the next result the first in the JSON output?
+static bool first_result = true;
+
+/**
+ * Print the result of one benchmark as a JSON field. Each count is printed as given, and also as
+ * a rate per second of the median run.
+ */
+static void report(const string& name,
+                   Timing t,
+                   std::initializer_list<tuple<const char*, size_t>> counts) noexcept {
+  printf("%s  \"%s\": {", first_result ? "" : ",\n", name.c_str());
+  first_result = false;
+
+  for (auto [count_name, value] : counts) {
+    printf("\"%s\": %zu, \"%s_per_sec\": %.0f, ", count_name, value, count_name,
+           value / t.median);
+  }
+  printf("\"median_sec\": %.6f, \"min_sec\": %.6f}", t.median, t.min);
+}
+
+/// Create a file of a given size filled with non-repeating data
+static void create_file(const fs::path& path, size_t size) noexcept {
+  std::ofstream out(path, std::ios::binary);
+  uint64_t x = 0x9e3779b97f4a7c15;
+  for (size_t i = 0; i < size; i += sizeof(x)) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    out.write(reinterpret_cast<const char*>(&x), std::min(sizeof(x), size - i));
+  }
+}
+
+/// Get a short label for a file size, such as 64k or 16m
+static string size_label(size_t size) noexcept {
+  if (size >= 1024 * 1024) return std::to_string(size / 1024 / 1024) + "m";
+  return std::to_string(size / 1024) + "k";
+}
+
+/**
+ * Measure how quickly a synthetic trace can be written to disk by a TraceWriter, with and without
+ * compression. The size of the saved trace is reported as well.
+ */
+static void bench_trace_write(size_t commands, size_t runs) noexcept {
+  SyntheticTrace synthetic(commands, 64);
+  synthetic.createInputs();
+
+  for (bool compress : {false, true}) {
+    options::compress_trace = compress;
+
+    auto t = measure(runs, [&] {
+      TraceWriter writer("trace");
+      synthetic.sendTo(writer);
+    });
+
+    report(compress ? "trace_write_compressed" : "trace_write", t,
+           {{"commands", commands}, {"bytes", fs::file_size("trace")}});
+  }
+
+  options::compress_trace = false;
+}
+
+/**
+ * Measure how quickly a trace on disk can be loaded and decoded by a TraceReader, with and without
+ * compression. The steps are sent to a sink that ignores them.
+ */
+static void bench_trace_read(size_t commands, size_t runs) noexcept {
+  SyntheticTrace synthetic(commands, 64);
+  synthetic.createInputs();
+
+  for (bool compress : {false, true}) {
+    options::compress_trace = compress;
+    {
+      TraceWriter writer("trace");
+      synthetic.sendTo(writer);
+    }
+
+    auto t = measure(runs, [&] {
+      auto input = TraceReader::load("trace");
+      FAIL_IF(!input) << "Failed to load synthetic trace";
+      input->sendTo(NullSink());
+    });
+
+    report(compress ? "trace_read_compressed" : "trace_read", t,
+           {{"commands", commands}, {"bytes", fs::file_size("trace")}});
+  }
+
+  options::compress_trace = false;
+}
+
+/**
+ * Measure replay throughput for the TraceReader -> Build -> TraceWriter pipeline used by each
+ * phase of `rkr build`.
+ */
+static void bench_replay(size_t commands, size_t runs) noexcept {
+  // Write the synthetic trace to disk once
+  SyntheticTrace synthetic(commands, 64);
+  synthetic.createInputs();
+  {
+    TraceWriter writer("trace");
+    synthetic.sendTo(writer);
+  }
+
+  auto t = measure(
+      runs,
+      [] {
+        env::rollback();
+        reset_stats();
+      },
+      [] {
+        auto input = TraceReader::load("trace");
+        FAIL_IF(!input) << "Failed to load synthetic trace";
+        TraceWriter output;
+        input->sendTo(Build(output));
+      });
+
+  report("replay", t, {{"commands", commands}, {"steps", stats::emulated_steps}});
+}
+
+/**
+ * Measure path resolution through the artifact graph. Every path is resolved once before timing,
+ * so this measures the steady state where each directory's entries are already known.
+ */
+static void bench_resolve(size_t runs) noexcept {
+  // Create a directory tree eight levels deep with a few files at each level
+  fs::path dir = fs::current_path();
+  vector<fs::path> paths;
+  for (size_t depth = 0; depth < 8; depth++) {
+    dir /= "d" + std::to_string(depth);
+    fs::create_directory(dir);
+    for (size_t i = 0; i < 8; i++) {
+      fs::path file = dir / ("f" + std::to_string(i));
+      std::ofstream(file).put('x');
+      paths.push_back(file.relative_path());
+    }
+  }
+
+  env::reset();
+  auto cmd = make_shared<Command>();
+  auto root = env::getRootDir();
+
+  size_t lookups = 0;
+  auto t = measure(runs, [&] {
+    lookups = 0;
+    for (size_t i = 0; i < 1000; i++) {
+      for (const auto& path : paths) {
+        auto ref = root->resolve(cmd, path, ReadAccess);
+        FAIL_IF(!ref.isResolved()) << "Failed to resolve " << path;
+        lookups++;
+      }
+    }
+  });
+
+  report("resolve", t, {{"lookups", lookups}});
+}
+
+/**
+ * Measure listing a large directory and matching the listing against an earlier one, as happens
+ * each time a command reads a directory's entries
+ */
+static void bench_dir_list(size_t runs) noexcept {
+  // Create a directory with 50000 entries
+  size_t entries = 50000;
+  fs::create_directory("big");
+  for (size_t i = 0; i < entries; i++) {
+    std::ofstream(fs::path("big") / ("f" + std::to_string(i)));
+  }
+
+  env::reset();
+  auto cmd = make_shared<Command>();
+  auto ref = env::getRootDir()->resolve(cmd, fs::absolute("big").relative_path(), ReadAccess);
+  FAIL_IF(!ref.isResolved()) << "Failed to resolve directory";
+  auto dir = ref.getArtifact();
+  auto expected = dir->getContent(cmd);
+
+  size_t listings = 100;
+  auto t = measure(runs, [&] {
+    for (size_t i = 0; i < listings; i++) {
+      auto observed = dir->getContent(cmd);
+      FAIL_IF(!observed->matches(expected)) << "Directory listing changed";
+    }
+  });
+
+  report("dir_list", t, {{"listings", listings}, {"entries", listings * entries}});
+}
+
+/**
+ * Measure BLAKE3 fingerprinting of files at several sizes. The files are in the page cache, so
+ * this measures hashing rather than disk reads.
+ */
+static void bench_fingerprint(size_t runs) noexcept {
+  for (size_t size : {4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024}) {
+    fs::path path = "fingerprint-" + size_label(size);
+    create_file(path, size);
+
+    // Hash about 64MB in each run, but at least 16 files
+    size_t files = std::max<size_t>(16, 64 * 1024 * 1024 / size);
+
+    auto t = measure(runs, [&] {
+      for (size_t i = 0; i < files; i++) {
+        auto v = make_shared<FileVersion>();
+        v->fingerprint(path, FingerprintType::Full);
+      }
+    });
+
+    report("fingerprint_" + size_label(size), t, {{"files", files}, {"bytes", files * size}});
+  }
+}
+
+/**
+ * Measure staging files from the cache, which copies each file with the cheapest method the
+ * filesystem supports. The cost of removing the previous copy is included.
+ */
+static void bench_stage(size_t runs) noexcept {
+  for (size_t size : {64 * 1024, 1024 * 1024}) {
+    fs::path path = "stage-" + size_label(size);
+    create_file(path, size);
+
+    auto v = make_shared<FileVersion>();
+    v->cache(path);
+    FAIL_IF(!v->canCommit()) << "Failed to cache " << path;
+
+    size_t files = 64;
+    auto t = measure(runs, [&] {
+      for (size_t i = 0; i < files; i++) {
+        fs::path dest = "staged-" + std::to_string(i);
+        ::unlink(dest.c_str());
+        v->commit(dest, 0644);
+      }
+    });
+
+    report("stage_" + size_label(size), t, {{"files", files}, {"bytes", files * size}});
+  }
+}
+
+/// Pause briefly inside a spin loop
+static inline void spin_pause() noexcept {
+#if defined(__x86_64__) || defined(_M_X64)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(_M_ARM64)
+  asm volatile("yield");
+#endif
+}
+
+/**
+ * Measure round trips through a shared memory tracing channel. A child process plays the part of
+ * the injected library, entering a syscall on a channel and waiting to be resumed. The parent
+ * plays the part of the tracer, polling the channels and resuming the child. Both sides follow
+ * the same protocol as rkr-inject.so and Tracer, so this measures the cost of a fast-path stop
+ * without any syscall handling.
+ */
+static void bench_channel(size_t runs) noexcept {
+  constexpr size_t round_trips = 100000;
+
+  auto shmem = static_cast<shared_tracing_data*>(::mmap(nullptr, sizeof(shared_tracing_data),
+                                                        PROT_READ | PROT_WRITE,
+                                                        MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+  FAIL_IF(shmem == MAP_FAILED) << "Failed to map shared tracing data: " << ERR;
+
+  sem_init(&shmem->available, 1, TRACING_CHANNEL_COUNT);
+  for (size_t i = 0; i < TRACING_CHANNEL_COUNT; i++) {
+    shmem->channels[i].state = CHANNEL_STATE_AVAILABLE;
+    sem_init(&shmem->channels[i].wake_tracee, 1, 0);
+  }
+
+  // The child enters a syscall on a channel over and over, as the injected library would
+  auto tracee = [shmem] {
+    size_t c = 0;
+    while (true) {
+      // Acquire the channel
+      while (sem_wait(&shmem->available) == -1) {}
+      __atomic_store_n(&shmem->channels[c].state, CHANNEL_STATE_ACQUIRED, __ATOMIC_RELAXED);
+      shmem->channels[c].tid = ::getpid();
+
+      // Wait to be resumed, spinning briefly before blocking
+      __atomic_store_n(&shmem->channels[c].state, CHANNEL_STATE_PRE_SYSCALL_WAIT,
+                       __ATOMIC_RELEASE);
+      for (size_t i = 0; i < 512; i++) {
+        if (__atomic_load_n(&shmem->channels[c].state, __ATOMIC_ACQUIRE) ==
+            CHANNEL_STATE_PROCEED) {
+          break;
+        }
+        spin_pause();
+      }
+      while (sem_wait(&shmem->channels[c].wake_tracee) != 0) {}
+
+      // The tracer asks the child to exit when the benchmark is done
+      if (shmem->channels[c].action == CHANNEL_ACTION_EXIT) ::_exit(0);
+
+      // Release the channel
+      __atomic_store_n(&shmem->channels[c].state, CHANNEL_STATE_AVAILABLE, __ATOMIC_RELEASE);
+      while (sem_post(&shmem->available) == -1) {}
+    }
+  };
+
+  pid_t child = ::fork();
+  FAIL_IF(child == -1) << "Failed to fork: " << ERR;
+  if (child == 0) tracee();
+
+  // The parent polls every channel and resumes the child, as the tracer would
+  auto resume_next = [shmem](uint8_t action) {
+    while (true) {
+      for (size_t i = 0; i < TRACING_CHANNEL_COUNT; i++) {
+        auto state = __atomic_load_n(&shmem->channels[i].state, __ATOMIC_ACQUIRE);
+        if (state == CHANNEL_STATE_PRE_SYSCALL_WAIT) {
+          shmem->channels[i].state = CHANNEL_STATE_OBSERVED;
+          shmem->channels[i].action = action;
+          __atomic_store_n(&shmem->channels[i].state, CHANNEL_STATE_PROCEED, __ATOMIC_RELEASE);
+          while (sem_post(&shmem->channels[i].wake_tracee) == -1) {}
+          return;
+        }
+      }
+    }
+  };
+
+  auto t = measure(runs, [&] {
+    for (size_t i = 0; i < round_trips; i++) {
+      resume_next(CHANNEL_ACTION_CONTINUE);
+    }
+  });
+
+  resume_next(CHANNEL_ACTION_EXIT);
+  ::waitpid(child, nullptr, 0);
+  ::munmap(shmem, sizeof(shared_tracing_data));
+
+  report("channel", t, {{"round_trips", round_trips}});
+}
+
+/// A benchmark that can be selected by name on the command line
+struct Benchmark {
+  const char* name;
+  void (*run)(size_t commands, size_t runs);
+};
+
+int main(int argc, char* argv[]) noexcept {
+  // Benchmarks use the first argument as the number of synthetic commands. Any later arguments
+  // select benchmarks to run by name.
+  size_t commands = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+  vector<string> selected(argv + std::min(argc, 2), argv + argc);
+
+  Benchmark benchmarks[] = {
+      {"trace_write", bench_trace_write},
+      {"trace_read", bench_trace_read},
+      {"replay", bench_replay},
+      {"resolve", [](size_t, size_t runs) { bench_resolve(runs); }},
+      {"dir_list", [](size_t, size_t runs) { bench_dir_list(runs); }},
+      {"fingerprint", [](size_t, size_t runs) { bench_fingerprint(runs); }},
+      {"stage", [](size_t, size_t runs) { bench_stage(runs); }},
+      {"channel", [](size_t, size_t runs) { bench_channel(runs); }},
+  };
+
+  // Run benchmarks in a scratch directory
+  char dir_template[] = "/tmp/rkr-bench-XXXXXX";
+  FAIL_IF(::mkdtemp(dir_template) == nullptr) << "Failed to create a scratch directory";
+  fs::path dir = dir_template;
+
+  printf("{\n");
+  for (const auto& b : benchmarks) {
+    bool skip = !selected.empty() &&
+                std::find(selected.begin(), selected.end(), b.name) == selected.end();
+    if (skip) continue;
+
+    // Give each benchmark a fresh directory and environment
+    fs::path bench_dir = dir / b.name;
+    fs::create_directory(bench_dir);
+    fs::current_path(bench_dir);
+    env::reset();
+    reset_stats();
+
+    b.run(commands, 5);
+    fflush(stdout);
+  }
+  printf("\n}\n");
+
+  fs::current_path("/");
+  fs::remove_all(dir);
+
+  return 0;
+}
@@ -660,6 +660,30 @@ int execve_untraced(const char* pathname, char* const* argv, char* const* envp)
   }
 }
 
+/// Allow the parallel compiler wrapper to talk to a jobserver without tracing
+long syscall_untraced(long nr,
+                      uint64_t arg1,
+                      uint64_t arg2,
+                      uint64_t arg3,
+                      uint64_t arg4,
+                      uint64_t arg5,
+                      uint64_t arg6) {
+  // Without the safe syscall page this call would be traced, so refuse it
+  if (safe_syscall == syscall) {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  long rc = safe_syscall(nr, arg1, arg2, arg3, arg4, arg5, arg6);
+
+  if (rc < 0) {
+    errno = -rc;
+    return -1;
+  } else {
+    return rc;
+  }
+}
+
 // Include architecture-specific register names
 #if defined(__x86_64__) || defined(_M_X64)
 
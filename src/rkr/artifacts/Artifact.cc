@@ -6,6 +6,7 @@
 #include <optional>
 #include <string>
 #include <tuple>
+#include <unordered_set>
 
 #include <fcntl.h>
 
@@ -13,6 +14,7 @@
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
 #include "runtime/env.hh"
+#include "util/Pool.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/DirVersion.hh"
 #include "versions/MetadataVersion.hh"
@@ -25,11 +27,12 @@ using std::optional;
 using std::shared_ptr;
 using std::string;
 using std::tuple;
+using std::unordered_set;
 
 Artifact::Artifact() noexcept {}
 
 Artifact::Artifact(MetadataVersion v) noexcept {
-  auto mv = make_shared<MetadataVersion>(v);
+  auto mv = make_pooled<MetadataVersion>(v);
   appendVersion(mv);
   _metadata.update(mv);
 }
@@ -288,7 +291,7 @@ void Artifact::matchMetadata(const shared_ptr<Command>& c,
 
 /// Apply a new metadata version to this artifact
 void Artifact::updateMetadata(const shared_ptr<Command>& c, MetadataVersion writing) noexcept {
-  auto mv = make_shared<MetadataVersion>(writing);
+  auto mv = make_pooled<MetadataVersion>(writing);
   appendVersion(mv);
   _metadata.update(c, mv);
 
@@ -300,6 +303,12 @@ void Artifact::appendVersion(shared_ptr<Version> v) noexcept {
   if (options::track_inputs_outputs) _versions.push_back(v);
 }
 
+size_t Artifact::compactVersions(const unordered_set<const Version*>& live) noexcept {
+  size_t before = _versions.size();
+  _versions.remove_if([&](const shared_ptr<Version>& v) { return live.count(v.get()) == 0; });
+  return before - _versions.size();
+}
+
 Ref Artifact::resolve(const shared_ptr<Command>& c,
                       shared_ptr<Artifact> prev,
                       fs::path::iterator current,
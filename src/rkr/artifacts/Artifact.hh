@@ -9,6 +9,7 @@
 #include <ostream>
 #include <string>
 #include <tuple>
+#include <unordered_set>
 
 #include "data/AccessFlags.hh"
 #include "data/IRSource.hh"
@@ -74,9 +75,14 @@ class Artifact : public std::enable_shared_from_this<Artifact> {
   /// Set the name of this artifact used for pretty-printing
   void setName(std::string newname) noexcept { _name = newname; }
 
-  /// Get a list of all the versions associated with this artifact
+  /// Get a list of the versions associated with this artifact. Versions are only recorded when
+  /// options::track_inputs_outputs is set, and compactVersions() may drop older ones.
   const std::list<std::shared_ptr<Version>>& getVersions() const noexcept { return _versions; }
 
+  /// Forget remembered versions that are not in the live set. Returns the number of versions
+  /// dropped.
+  size_t compactVersions(const std::unordered_set<const Version*>& live) noexcept;
+
   /// Get a file descriptor for this artifact
   virtual int getFD(AccessFlags flags) noexcept;
 
@@ -114,6 +120,9 @@ class Artifact : public std::enable_shared_from_this<Artifact> {
   /// Compare all final versions of this artifact to the filesystem state
   virtual void checkFinalState(fs::path path) noexcept = 0;
 
+  /// Commit pending content for this artifact and any artifacts below it, without fingerprinting
+  virtual void commitFinalState(fs::path path) noexcept {}
+
   /// Commit any pending versions and save fingerprints for this artifact
   virtual void applyFinalState(fs::path path) noexcept;
 
@@ -210,6 +219,10 @@ class Artifact : public std::enable_shared_from_this<Artifact> {
     FAIL << c << " attempted to write " << this;
   }
 
+  /// Does this artifact need to see the result of a write? If not, the tracer lets a write run
+  /// without waiting for it to finish, and afterWrite is not called.
+  virtual bool needsWriteResult() const noexcept { return true; }
+
   /// A traced command is about to (possibly) truncate this artifact to length zero
   virtual void beforeTruncate(Build& build,
                               const IRSource& source,
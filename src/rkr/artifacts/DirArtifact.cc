@@ -1,11 +1,13 @@
 #include "DirArtifact.hh"
 
+#include <algorithm>
 #include <cerrno>
 #include <filesystem>
 #include <memory>
 #include <sstream>
 #include <string>
 #include <tuple>
+#include <vector>
 
 #include "artifacts/SymlinkArtifact.hh"
 #include "data/AccessFlags.hh"
@@ -14,7 +16,9 @@
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
 #include "runtime/env.hh"
+#include "util/Pool.hh"
 #include "util/log.hh"
+#include "util/wrappers.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/DirListVersion.hh"
 #include "versions/DirVersion.hh"
@@ -24,6 +28,7 @@ using std::make_shared;
 using std::shared_ptr;
 using std::string;
 using std::tuple;
+using std::vector;
 
 namespace fs = std::filesystem;
 
@@ -52,7 +57,7 @@ void DirArtifact::createEmptyDir(std::shared_ptr<Command> c) noexcept {
   FAIL_IF(!c) << "A directory cannot be created by a null command";
 
   // Set up the base directory version
-  auto v = make_shared<BaseDirVersion>(true);
+  auto v = make_pooled<BaseDirVersion>(true);
   _base.update(c, v);
   appendVersion(v);
 
@@ -224,6 +229,34 @@ void DirArtifact::checkFinalState(fs::path path) noexcept {
   }
 }
 
+// Collect every non-directory artifact below this directory, in the order checkFinalState visits them
+void DirArtifact::gatherFinalState(
+    fs::path path,
+    vector<tuple<shared_ptr<Artifact>, fs::path>>& artifacts) noexcept {
+  for (const auto& [name, entry] : _entries) {
+    auto artifact = entry->peekTarget();
+    if (!artifact) continue;
+
+    // Directories have nothing to check themselves, so descend into them in place
+    if (auto dir = artifact->as<DirArtifact>()) {
+      dir->gatherFinalState(path / name, artifacts);
+    } else {
+      artifacts.emplace_back(artifact, path / name);
+    }
+  }
+}
+
+// Commit pending content for this directory and everything below it, without fingerprinting
+void DirArtifact::commitFinalState(fs::path path) noexcept {
+  // Create this directory and commit its entries before committing anything inside them
+  commitAll();
+
+  for (const auto& [name, entry] : _entries) {
+    auto artifact = entry->peekTarget();
+    if (artifact) artifact->commitFinalState(path / name);
+  }
+}
+
 // Commit any pending versions and save fingerprints for this artifact
 void DirArtifact::applyFinalState(fs::path path) noexcept {
   // First, commit this artifact and its metadata
@@ -273,6 +306,13 @@ void DirArtifact::afterRead(Build& build,
   build.matchContent(source, c, Scenario::Build, ref, getContent(c));
 }
 
+// Check whether stat results for a directory show it has not changed
+static bool same_directory_state(const struct stat& a, const struct stat& b) noexcept {
+  return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+         a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec &&
+         a.st_ctim.tv_sec == b.st_ctim.tv_sec && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec;
+}
+
 // Get a version that lists all the entries in this directory
 shared_ptr<ContentVersion> DirArtifact::getContent(const shared_ptr<Command>& c) noexcept {
   // Create a DirListVersion to hold the list of directory entries
@@ -289,12 +329,31 @@ shared_ptr<ContentVersion> DirArtifact::getContent(const shared_ptr<Command>& c)
     auto path = getCommittedPath();
     ASSERT(path.has_value()) << "Existing directory somehow has no committed path";
 
-    for (auto& entry : fs::directory_iterator(path.value())) {
-      auto name = entry.path().filename();
-      if (name != ".rkr") {
-        result->addEntry(name);
+    // List the directory again unless it is unchanged since it was last listed. If the stat
+    // fails, list it anyway and do not reuse that listing next time.
+    struct stat info;
+    bool have_info = lstatNoSync(path.value(), info) == 0;
+    if (!have_info || !_disk_entries_info.has_value() ||
+        !same_directory_state(info, _disk_entries_info.value())) {
+      _disk_entries.clear();
+      for (auto& entry : fs::directory_iterator(path.value())) {
+        auto name = entry.path().filename();
+        if (name != ".rkr") {
+          _disk_entries.push_back(DirListVersion::getEntryID(name));
+        }
+      }
+      std::sort(_disk_entries.begin(), _disk_entries.end());
+
+      if (have_info) {
+        _disk_entries_info = info;
+      } else {
+        _disk_entries_info.reset();
       }
     }
+
+    for (auto id : _disk_entries) {
+      result->addEntry(id);
+    }
   }
 
   // Get the latest version
@@ -316,6 +375,10 @@ shared_ptr<ContentVersion> DirArtifact::getContent(const shared_ptr<Command>& c)
     }
   }
 
+  // Reuse the last listing if this one has the same entries
+  if (_last_listing && *_last_listing == *result) return _last_listing;
+  _last_listing = result;
+
   return result;
 }
 
@@ -427,8 +490,8 @@ Ref DirArtifact::resolve(const shared_ptr<Command>& c,
       }
 
       // Add the entry to this directory's map of entries
-      auto entry_object = make_shared<DirEntry>(this->as<DirArtifact>(), entry);
-      auto entry_version = make_shared<DirEntryVersion>(entry, artifact);
+      auto entry_object = make_pooled<DirEntry>(this->as<DirArtifact>(), entry);
+      auto entry_version = make_pooled<DirEntryVersion>(entry, artifact);
       appendVersion(entry_version);
       entry_object->setCommittedState(entry_version);
       _entries.emplace_hint(entries_iter, entry, entry_object);
@@ -501,12 +564,12 @@ void DirArtifact::addEntry(const shared_ptr<Command>& c,
   // Make sure we have a record of this entry
   auto iter = _entries.find(name);
   if (iter == _entries.end()) {
-    auto entry = make_shared<DirEntry>(this->as<DirArtifact>(), name);
+    auto entry = make_pooled<DirEntry>(this->as<DirArtifact>(), name);
     iter = _entries.emplace_hint(iter, name, entry);
   }
 
   // Create a version to represent this update
-  auto version = make_shared<DirEntryVersion>(name, target);
+  auto version = make_pooled<DirEntryVersion>(name, target);
   appendVersion(version);
 
   // Update the entry
@@ -520,12 +583,12 @@ void DirArtifact::removeEntry(const shared_ptr<Command>& c,
   // Make sure we have a record of this entry
   auto iter = _entries.find(name);
   if (iter == _entries.end()) {
-    auto entry = make_shared<DirEntry>(this->as<DirArtifact>(), name);
+    auto entry = make_pooled<DirEntry>(this->as<DirArtifact>(), name);
     iter = _entries.emplace_hint(iter, name, entry);
   }
 
   // Create a version to represent this update
-  auto version = make_shared<DirEntryVersion>(name, nullptr);
+  auto version = make_pooled<DirEntryVersion>(name, nullptr);
   appendVersion(version);
 
   // Update the entry
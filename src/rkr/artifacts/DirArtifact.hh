@@ -7,10 +7,14 @@
 #include <optional>
 #include <string>
 #include <tuple>
+#include <vector>
+
+#include <sys/stat.h>
 
 #include "artifacts/Artifact.hh"
 #include "runtime/Ref.hh"
 #include "runtime/VersionState.hh"
+#include "versions/DirListVersion.hh"
 
 namespace fs = std::filesystem;
 
@@ -20,7 +24,6 @@ class Build;
 class Command;
 class ContentVersion;
 class DirEntry;
-class DirListVersion;
 class DirVersion;
 class DirEntryVersion;
 class MetadataVersion;
@@ -54,6 +57,15 @@ class DirArtifact final : public Artifact {
   /// Compare all final versions of this artifact to the filesystem state
   virtual void checkFinalState(fs::path path) noexcept override;
 
+  /// Collect every non-directory artifact below this directory along with its path, in the order
+  /// checkFinalState would check them
+  void gatherFinalState(
+      fs::path path,
+      std::vector<std::tuple<std::shared_ptr<Artifact>, fs::path>>& artifacts) noexcept;
+
+  /// Commit pending content for this artifact and any artifacts below it, without fingerprinting
+  virtual void commitFinalState(fs::path path) noexcept override;
+
   /// Commit any pending versions and save fingerprints for this artifact
   virtual void applyFinalState(fs::path path) noexcept override;
 
@@ -127,6 +139,15 @@ class DirArtifact final : public Artifact {
 
   /// The base directory content is the backstop for all resolution queries
   VersionState<BaseDirVersion> _base;
+
+  /// The entries found on disk the last time this directory was listed, in sorted order
+  std::vector<DirListVersion::EntryID> _disk_entries;
+
+  /// The directory's stat results when it was last listed, used to tell if it has changed since
+  std::optional<struct stat> _disk_entries_info;
+
+  /// The listing most recently returned by getContent(), which is reused if nothing has changed
+  std::shared_ptr<DirListVersion> _last_listing;
 };
 
 class DirEntry : public std::enable_shared_from_this<DirEntry> {
@@ -9,6 +9,7 @@
 #include "runtime/Build.hh"
 #include "runtime/Command.hh"
 #include "runtime/policy.hh"
+#include "util/Pool.hh"
 #include "util/log.hh"
 #include "util/options.hh"
 #include "versions/ContentVersion.hh"
@@ -34,6 +35,17 @@ void FileArtifact::rollback() noexcept {
   Artifact::rollback();
 }
 
+/// Replace this file's committed content and metadata with the state described by statbuf
+void FileArtifact::refreshCommittedState(const struct stat& statbuf) noexcept {
+  auto mv = make_pooled<MetadataVersion>(statbuf);
+  appendVersion(mv);
+  _metadata.update(mv);
+
+  auto cv = make_pooled<FileVersion>(statbuf);
+  appendVersion(cv);
+  _content.update(cv);
+}
+
 // Commit the content of this artifact to the filesystem
 void FileArtifact::commitContentTo(fs::path path) noexcept {
   // If content is already committed, do nothing
@@ -46,7 +58,8 @@ void FileArtifact::commitContentTo(fs::path path) noexcept {
     ASSERT(version->canCommit()) << "Cannot commit content to " << path << ": " << _content;
 
     // Commit the uncommitted content only
-    version->commit(path);
+    auto [metadata_version, _] = _metadata.getLatest();
+    version->commit(path, metadata_version->getMode());
 
   } else {
     // No committed content yet. Commit metadata along with the content
@@ -141,8 +154,19 @@ void FileArtifact::commitUnlink(shared_ptr<DirEntry> entry) noexcept {
   return;
 }
 
+/// Will checking the final state of this artifact need to stat the file?
+bool FileArtifact::needsFinalStat() noexcept {
+  auto [version, weak_creator] = _content.getLatest();
+  if (weak_creator.expired()) return false;
+
+  // Uncommitted content is compared to a fresh fingerprint of the committed file. Committed
+  // content is stat-ed when its fingerprint is incomplete.
+  return _content.isUncommitted() || !version->getModificationTime().has_value() ||
+         !version->getHash().has_value();
+}
+
 /// Compare all final versions of this artifact to the filesystem state
-void FileArtifact::checkFinalState(fs::path path) noexcept {
+void FileArtifact::checkFinalState(fs::path path, const struct stat* statbuf) noexcept {
   // Get the command that wrote this file. If there was no writer, no need to check
   auto [version, weak_creator] = _content.getLatest();
   auto creator = weak_creator.lock();
@@ -160,7 +184,7 @@ void FileArtifact::checkFinalState(fs::path path) noexcept {
     if (!matches && committed_version) {
       auto fingerprint_type =
           policy::chooseFingerprintType(nullptr, committed_creator.lock(), path);
-      committed_version->fingerprint(path, fingerprint_type);
+      committed_version->fingerprint(path, fingerprint_type, statbuf);
       matches = version->matches(committed_version);
     }
 
@@ -178,17 +202,13 @@ void FileArtifact::checkFinalState(fs::path path) noexcept {
     }
   }
 
-  fingerprintAndCache(nullptr);
+  fingerprintAndCache(nullptr, path, statbuf);
 }
 
-/// Commit any pending versions and save fingerprints for this artifact
-void FileArtifact::applyFinalState(fs::path path) noexcept {
-  // Get the content version and creator
-  auto [version, weak_creator] = _content.getLatest();
-  auto creator = weak_creator.lock();
-
-  // Make sure the content is committed
+/// Commit pending content for this artifact, without fingerprinting
+void FileArtifact::commitFinalState(fs::path path) noexcept {
   if (_content.isUncommitted()) {
+    auto [version, _] = _content.getLatest();
     auto [committed_version, committed_creator] = _content.getCommitted();
 
     // Does the uncommitted version match the committed version?
@@ -198,10 +218,21 @@ void FileArtifact::applyFinalState(fs::path path) noexcept {
 
     } else {
       // No. Commit now
-      version->commit(path);
+      auto [metadata_version, _] = _metadata.getLatest();
+      version->commit(path, metadata_version->getMode());
       _content.setCommitted();
     }
   }
+}
+
+/// Commit any pending versions and save fingerprints for this artifact
+void FileArtifact::applyFinalState(fs::path path) noexcept {
+  // Make sure the content is committed
+  commitFinalState(path);
+
+  // Get the content version and creator
+  auto [version, weak_creator] = _content.getLatest();
+  auto creator = weak_creator.lock();
 
   // If we don't already have a content fingerprint, take one
   auto fingerprint_type = policy::chooseFingerprintType(nullptr, creator, path);
@@ -267,7 +298,7 @@ void FileArtifact::afterWrite(Build& build,
                               const shared_ptr<Command>& c,
                               Ref::ID ref) noexcept {
   // Create a new version
-  auto writing = make_shared<FileVersion>();
+  auto writing = make_pooled<FileVersion>();
 
   // The command wrote to this file
   build.updateContent(source, c, ref, writing);
@@ -287,7 +318,7 @@ void FileArtifact::afterTruncate(Build& build,
                                  const shared_ptr<Command>& c,
                                  Ref::ID ref) noexcept {
   // The command wrote an empty content version to this artifact
-  auto written = make_shared<FileVersion>();
+  auto written = make_pooled<FileVersion>();
   written->makeEmptyFingerprint();
 
   build.updateContent(source, c, ref, written);
@@ -354,7 +385,9 @@ void FileArtifact::updateContent(const shared_ptr<Command>& c,
   c->addContentOutput(shared_from_this(), writing);
 }
 
-void FileArtifact::fingerprintAndCache(const shared_ptr<Command>& reader) const noexcept {
+void FileArtifact::fingerprintAndCache(const shared_ptr<Command>& reader,
+                                       const fs::path& stat_path,
+                                       const struct stat* statbuf) const noexcept {
   // If this artifact is not committed in its latest state, we can't fingerprint or cache it
   if (!_content.isCommitted()) return;
 
@@ -370,7 +403,8 @@ void FileArtifact::fingerprintAndCache(const shared_ptr<Command>& reader) const
   // If the artifact has a committed path, we may fingerprint or cache it
   if (path.has_value()) {
     auto fingerprint_type = policy::chooseFingerprintType(reader, writer, path.value());
-    version->fingerprint(path.value(), fingerprint_type);
+    version->fingerprint(path.value(), fingerprint_type,
+                         path.value() == stat_path ? statbuf : nullptr);
 
     // cache?
     if (!version->canCommit() && policy::isCacheable(reader, writer, path.value())) {
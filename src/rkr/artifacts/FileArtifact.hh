@@ -5,6 +5,8 @@
 #include <optional>
 #include <string>
 
+#include <sys/stat.h>
+
 #include "artifacts/Artifact.hh"
 #include "runtime/Ref.hh"
 #include "runtime/VersionState.hh"
@@ -43,7 +45,19 @@ class FileArtifact : public Artifact {
   virtual bool hasUncommittedContent() noexcept override { return !_content.isCommitted(); }
 
   /// Compare all final versions of this artifact to the filesystem state
-  virtual void checkFinalState(fs::path path) noexcept override;
+  virtual void checkFinalState(fs::path path) noexcept override {
+    checkFinalState(path, nullptr);
+  }
+
+  /// Compare all final versions of this artifact to the filesystem state, using stat results for
+  /// path that were collected ahead of time. A null statbuf means the file was not stat-ed yet.
+  void checkFinalState(fs::path path, const struct stat* statbuf) noexcept;
+
+  /// Will checking the final state of this artifact need to stat the file?
+  bool needsFinalStat() noexcept;
+
+  /// Commit pending content for this artifact and any artifacts below it, without fingerprinting
+  virtual void commitFinalState(fs::path path) noexcept override;
 
   /// Commit any pending versions and save fingerprints for this artifact
   virtual void applyFinalState(fs::path path) noexcept override;
@@ -54,6 +68,10 @@ class FileArtifact : public Artifact {
   /// Revert this artifact to its committed state
   virtual void rollback() noexcept override;
 
+  /// Replace this file's committed content and metadata with the state described by statbuf. This
+  /// is used when a file was changed in place outside of a build.
+  void refreshCommittedState(const struct stat& statbuf) noexcept;
+
   /************ Path Operations ************/
 
   /// Commit a link to this artifact at the given path
@@ -122,8 +140,11 @@ class FileArtifact : public Artifact {
                              std::shared_ptr<ContentVersion> writing) noexcept override;
 
  protected:
-  /// Cache and fingerprint this file's content if necessary
-  void fingerprintAndCache(const std::shared_ptr<Command>& reader) const noexcept;
+  /// Cache and fingerprint this file's content if necessary. If statbuf is provided, it holds the
+  /// results of an lstat of stat_path.
+  void fingerprintAndCache(const std::shared_ptr<Command>& reader,
+                           const fs::path& stat_path = fs::path(),
+                           const struct stat* statbuf = nullptr) const noexcept;
 
  private:
   /// The committed and uncommitted state that represent this file's content
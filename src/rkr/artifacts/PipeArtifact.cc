@@ -106,6 +106,17 @@ void PipeArtifact::beforeWrite(Build& build,
                                const IRSource& source,
                                const shared_ptr<Command>& c,
                                Ref::ID ref) noexcept {
+  // Readers depend on every write since the last read, so further writes from the command that
+  // made the latest write add nothing until the pipe is read or closed. Extend that write instead
+  // of creating a new version.
+  if (!_writes.empty()) {
+    const auto& [last_write, last_writer] = _writes.back();
+    if (!last_write->as<PipeCloseVersion>() && last_writer.lock() == c) {
+      LOG(artifact) << "Coalescing write to " << this << " by " << c << " with " << last_write;
+      return;
+    }
+  }
+
   // Create a new version
   auto writing = make_shared<PipeWriteVersion>();
 
@@ -93,6 +93,9 @@ class PipeArtifact : public Artifact {
                           const std::shared_ptr<Command>& c,
                           Ref::ID ref) noexcept override {}
 
+  /// A pipe's model does not depend on the result of a write
+  virtual bool needsWriteResult() const noexcept override { return false; }
+
   /************ Content Operations ************/
 
   /// Get this artifact's current content
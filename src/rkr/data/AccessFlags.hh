@@ -222,3 +222,6 @@ constexpr inline static AccessFlags operator+(const AccessFlags& f1,
   result.type = f1.type.intersect(f2.type);
   return result;
 }
+
+template <>
+struct fmt::formatter<AccessFlags> : fmt::ostream_formatter {};
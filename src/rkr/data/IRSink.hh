@@ -22,6 +22,12 @@ enum class SpecialRef : uint8_t { stdin, stdout, stderr, root, cwd, launch_exe }
 /// Different ways to compare references with a CompareRefs predicate
 enum class RefComparison : uint8_t { SameInstance, DifferentInstances };
 
+/**
+ * An IRSink receives the IR steps produced by a traced build or read from a saved trace. Payloads
+ * are passed by const reference, so a step can pass through a chain of sinks (for example
+ * ReadWriteCombiner<TraceWriter>) without being copied at each layer. Paths and entry names are
+ * still passed as strings, not interned IDs; TraceWriter interns them only when it writes a trace.
+ */
 class IRSink {
  public:
   virtual ~IRSink() noexcept {}
@@ -53,7 +59,7 @@ class IRSink {
   /// Handle a SymlinkRef IR step
   virtual void symlinkRef(const IRSource& source,
                           const std::shared_ptr<Command>& command,
-                          fs::path target,
+                          const fs::path& target,
                           Ref::ID output) noexcept {}
 
   /// Handle a DirRef IR step
@@ -66,7 +72,7 @@ class IRSink {
   virtual void pathRef(const IRSource& source,
                        const std::shared_ptr<Command>& command,
                        Ref::ID base,
-                       fs::path path,
+                       const fs::path& path,
                        AccessFlags flags,
                        Ref::ID output) noexcept {}
 
@@ -99,46 +105,46 @@ class IRSink {
                              const std::shared_ptr<Command>& command,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion version) noexcept {}
+                             const MetadataVersion& version) noexcept {}
 
   /// Handel a MatchContent IR step
   virtual void matchContent(const IRSource& source,
                             const std::shared_ptr<Command>& command,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> version) noexcept {}
+                            const std::shared_ptr<ContentVersion>& version) noexcept {}
 
   /// Handle an UpdateMetadata IR step
   virtual void updateMetadata(const IRSource& source,
                               const std::shared_ptr<Command>& command,
                               Ref::ID ref,
-                              MetadataVersion version) noexcept {}
+                              const MetadataVersion& version) noexcept {}
 
   /// Handle an UpdateContent IR step
   virtual void updateContent(const IRSource& source,
                              const std::shared_ptr<Command>& command,
                              Ref::ID ref,
-                             std::shared_ptr<ContentVersion> version) noexcept {}
+                             const std::shared_ptr<ContentVersion>& version) noexcept {}
 
   /// Handle an AddEntry IR step
   virtual void addEntry(const IRSource& source,
                         const std::shared_ptr<Command>& command,
                         Ref::ID dir,
-                        std::string name,
+                        const std::string& name,
                         Ref::ID target) noexcept {}
 
   /// Handle a RemoveEntry IR step
   virtual void removeEntry(const IRSource& source,
                            const std::shared_ptr<Command>& command,
                            Ref::ID dir,
-                           std::string name,
+                           const std::string& name,
                            Ref::ID target) noexcept {}
 
   /// Handle a Launch IR step
   virtual void launch(const IRSource& source,
                       const std::shared_ptr<Command>& command,
                       const std::shared_ptr<Command>& child,
-                      std::list<std::tuple<Ref::ID, Ref::ID>> refs) noexcept {}
+                      const std::list<std::tuple<Ref::ID, Ref::ID>>& refs) noexcept {}
 
   /// Handle a Join IR step
   virtual void join(const IRSource& source,
@@ -14,6 +14,9 @@ class MetadataVersion;
  * The PostBuildChecker class expects a template parameter that is an IRSink, which will receive all
  * of the original trace steps along with the additional steps for post-build checks. A likely use
  * case would be to instantiate a PostBuildChecker<IRBuffer>.
+ *
+ * Commands that a partial build left out still need to run, so their predicates keep the state
+ * they observed in both scenarios. A later build then sees the change and reruns them.
  */
 template <class Next>
 class PostBuildChecker : public Next {
@@ -29,6 +32,11 @@ class PostBuildChecker : public Next {
                             Ref::ID ref,
                             int8_t expected) noexcept override {
     if (scenario & Scenario::Build) {
+      if (command->isLeftOut()) {
+        Next::expectResult(source, command, Scenario::Both, ref, expected);
+        return;
+      }
+
       auto post_build = command->getRef(ref)->getResultCode();
       if (post_build == expected) {
         Next::expectResult(source, command, Scenario::Both, ref, expected);
@@ -44,8 +52,13 @@ class PostBuildChecker : public Next {
                              const std::shared_ptr<Command>& command,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion expected) noexcept override {
+                             const MetadataVersion& expected) noexcept override {
     if (scenario & Scenario::Build) {
+      if (command->isLeftOut()) {
+        Next::matchMetadata(source, command, Scenario::Both, ref, expected);
+        return;
+      }
+
       // Did the reference resolve in the post-build state?
       if (command->getRef(ref)->isResolved()) {
         // Yes. Grab the outcome from the post-build match.
@@ -72,8 +85,13 @@ class PostBuildChecker : public Next {
                             const std::shared_ptr<Command>& command,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> expected) noexcept override {
+                            const std::shared_ptr<ContentVersion>& expected) noexcept override {
     if (scenario & Scenario::Build) {
+      if (command->isLeftOut()) {
+        Next::matchContent(source, command, Scenario::Both, ref, expected);
+        return;
+      }
+
       // Did the reference resolve in the post-build state?
       if (command->getRef(ref)->isResolved()) {
         // Yes. Grab the outcome from the post-build match
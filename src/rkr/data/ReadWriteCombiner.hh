@@ -40,7 +40,7 @@ class MetadataReadCombiner : public Next {
                              const std::shared_ptr<Command>& command,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion expected) noexcept override {
+                             const MetadataVersion& expected) noexcept override {
     // Post-build checks should be emitted as-is
     if (scenario & Scenario::PostBuild) {
       Next::matchMetadata(source, command, scenario, ref, expected);
@@ -64,7 +64,7 @@ class MetadataReadCombiner : public Next {
   virtual void updateMetadata(const IRSource& source,
                               const std::shared_ptr<Command>& command,
                               Ref::ID ref,
-                              MetadataVersion writing) noexcept override {
+                              const MetadataVersion& writing) noexcept override {
     // Clear the last read
     _last_reader.reset();
     _last_ref = -1;
@@ -89,7 +89,7 @@ class MetadataWriteCombiner : public Next {
                              const std::shared_ptr<Command>& command,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion expected) noexcept override {
+                             const MetadataVersion& expected) noexcept override {
     // Does this read match the last write?
     if (command == _last_writer && ref == _last_ref) {
       // Yes. We can skip the read, since it's just reading the last write.
@@ -113,7 +113,7 @@ class MetadataWriteCombiner : public Next {
   virtual void updateMetadata(const IRSource& source,
                               const std::shared_ptr<Command>& command,
                               Ref::ID ref,
-                              MetadataVersion writing) noexcept override {
+                              const MetadataVersion& writing) noexcept override {
     // We can coalesce this new write with the previous write if the command and reference are the
     // same and the last write has not been accessed
     if (command == _last_writer && ref == _last_ref && !_accessed) {
@@ -178,7 +178,7 @@ class ContentReadCombiner : public Next {
                             const std::shared_ptr<Command>& command,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> expected) noexcept override {
+                            const std::shared_ptr<ContentVersion>& expected) noexcept override {
     if (scenario & Scenario::PostBuild) {
       Next::matchContent(source, command, scenario, ref, expected);
       return;
@@ -201,7 +201,7 @@ class ContentReadCombiner : public Next {
   virtual void updateContent(const IRSource& source,
                              const std::shared_ptr<Command>& command,
                              Ref::ID ref,
-                             std::shared_ptr<ContentVersion> writing) noexcept override {
+                             const std::shared_ptr<ContentVersion>& writing) noexcept override {
     // Clear the last read
     _last_reader.reset();
     _last_ref = -1;
@@ -231,7 +231,7 @@ class ContentWriteCombiner : public Next {
                             const std::shared_ptr<Command>& command,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> expected) noexcept override {
+                            const std::shared_ptr<ContentVersion>& expected) noexcept override {
     // Does this read match the last write?
     if (command == _last_writer && ref == _last_ref) {
       // Yes. We can skip the read, since it's just reading the last write.
@@ -261,7 +261,7 @@ class ContentWriteCombiner : public Next {
   virtual void updateContent(const IRSource& source,
                              const std::shared_ptr<Command>& command,
                              Ref::ID ref,
-                             std::shared_ptr<ContentVersion> writing) noexcept override {
+                             const std::shared_ptr<ContentVersion>& writing) noexcept override {
     // We can coalesce this new write with the previous write if the command and reference are the
     // same, the last write has not been accessed, and the specific versions allow coalescing
     if (command == _last_writer && ref == _last_ref && !_accessed &&
@@ -1,13 +1,17 @@
 #include "Trace.hh"
 
+#include <cstring>
 #include <filesystem>
 #include <limits>
 #include <list>
 #include <memory>
 #include <optional>
+#include <regex>
+#include <set>
 #include <string>
 #include <tuple>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include <sys/mman.h>
@@ -17,7 +21,11 @@
 
 #include "data/IRSink.hh"
 #include "runtime/Command.hh"
+#include "util/Pool.hh"
+#include "util/Timeline.hh"
+#include "util/compress.hh"
 #include "util/log.hh"
+#include "util/options.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/DirListVersion.hh"
 #include "versions/FileVersion.hh"
@@ -40,6 +48,29 @@ using std::vector;
 // Grow the trace file by 2MB as needed
 enum : size_t { TraceFileSizeIncrement = 2 * 1024 * 1024 };
 
+// Compressed traces are split into 1MB blocks that are compressed independently
+enum : size_t { TraceBlockSize = 1024 * 1024 };
+
+/// The ways the data after a trace header can be stored
+enum class TraceEncoding : uint8_t { Raw = 0, Blocks = 1 };
+
+/// Every trace starts with a header that identifies the format it is written in
+struct TraceHeader {
+  char magic[4];
+  uint8_t version;
+  TraceEncoding encoding;
+} __attribute__((packed));
+
+/// The header written at the start of new traces. Change the version when the format changes.
+static const TraceHeader CurrentTraceHeader = {{'r', 'k', 'r', 't'}, 2, TraceEncoding::Raw};
+
+/// Each block in a compressed trace starts with its size before and after compression. A block
+/// that did not shrink is stored as-is, with both sizes equal.
+struct TraceBlockHeader {
+  uint32_t raw_size;
+  uint32_t stored_size;
+} __attribute__((packed));
+
 /********** Trace File Operations **********/
 
 // Open a trace file at a given path
@@ -221,6 +252,102 @@ void TraceFile::destroy() noexcept {
   pos = 0;
 }
 
+// Write a buffer to a file descriptor, continuing after short writes. Returns true on success.
+static bool write_all(int fd, const void* data, size_t length) noexcept {
+  auto p = static_cast<const uint8_t*>(data);
+  while (length > 0) {
+    ssize_t rc = ::write(fd, p, length);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) return false;
+    p += rc;
+    length -= rc;
+  }
+  return true;
+}
+
+// Write trace data to a file descriptor as a series of compressed blocks
+static bool write_compressed(int fd, const uint8_t* data, size_t length) noexcept {
+  TraceHeader header = CurrentTraceHeader;
+  header.encoding = TraceEncoding::Blocks;
+  uint64_t raw_length = length;
+  if (!write_all(fd, &header, sizeof(header))) return false;
+  if (!write_all(fd, &raw_length, sizeof(raw_length))) return false;
+
+  vector<uint8_t> buffer(compress::maxCompressedSize(TraceBlockSize));
+  for (size_t pos = 0; pos < length; pos += TraceBlockSize) {
+    uint32_t raw_size = std::min<size_t>(TraceBlockSize, length - pos);
+    uint32_t stored_size = compress::compressBlock(data + pos, raw_size, buffer.data());
+    const uint8_t* stored = buffer.data();
+
+    // Store blocks that did not shrink as-is
+    if (stored_size >= raw_size) {
+      stored_size = raw_size;
+      stored = data + pos;
+    }
+
+    TraceBlockHeader block = {raw_size, stored_size};
+    if (!write_all(fd, &block, sizeof(block))) return false;
+    if (!write_all(fd, stored, stored_size)) return false;
+  }
+
+  return true;
+}
+
+// Replace a mapped compressed trace with its expanded contents. Returns false if it is corrupt.
+static bool expand_trace(TraceFile& file) noexcept {
+  // The trace header is followed by the length of the expanded trace
+  size_t pos = sizeof(TraceHeader);
+  uint64_t raw_length;
+  if (file.length < pos + sizeof(raw_length)) return false;
+  memcpy(&raw_length, &file.data[pos], sizeof(raw_length));
+  pos += sizeof(raw_length);
+
+  // The expanded trace has a header of its own
+  if (raw_length < sizeof(TraceHeader)) return false;
+
+  auto data = (uint8_t*)mmap(nullptr, raw_length, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) return false;
+
+  // Expand each block in turn
+  size_t expanded = 0;
+  bool ok = true;
+  while (ok && pos < file.length) {
+    TraceBlockHeader block;
+    if (file.length - pos < sizeof(block)) {
+      ok = false;
+      break;
+    }
+    memcpy(&block, &file.data[pos], sizeof(block));
+    pos += sizeof(block);
+
+    if (block.stored_size > file.length - pos || block.raw_size > raw_length - expanded) {
+      ok = false;
+    } else if (block.stored_size == block.raw_size) {
+      memcpy(&data[expanded], &file.data[pos], block.raw_size);
+    } else {
+      ok = compress::expandBlock(&file.data[pos], block.stored_size, &data[expanded],
+                                 block.raw_size);
+    }
+
+    pos += block.stored_size;
+    expanded += block.raw_size;
+  }
+
+  if (!ok || expanded != raw_length) {
+    munmap(data, raw_length);
+    return false;
+  }
+
+  // Swap the compressed mapping for the expanded one. The file stays open.
+  munmap(file.data, file.length);
+  file.data = data;
+  file.length = raw_length;
+  file.pos = 0;
+
+  return true;
+}
+
 /********** Trace Record Types **********/
 
 /// Tags to identify each type of record
@@ -250,6 +377,7 @@ enum class RecordType : uint8_t {
   String = 22,
   NewStrtab = 23,
   End = 24,
+  Profile = 25,
 
   // Content version subtypes
   FileVersion = 32,
@@ -271,6 +399,23 @@ optional<TraceReader> TraceReader::load(string path) noexcept {
   auto file = TraceFile::open(path);
   if (!file) return nullopt;
 
+  // Make sure the trace is in a format this version of rkr can read
+  TraceHeader header;
+  if (file.length < sizeof(header)) return nullopt;
+  memcpy(&header, file.data, sizeof(header));
+
+  if (memcmp(header.magic, CurrentTraceHeader.magic, sizeof(header.magic)) != 0 ||
+      header.version != CurrentTraceHeader.version) {
+    WARN << "Ignoring trace " << path << ", which was written by a different version of rkr";
+    return nullopt;
+  }
+
+  // Expand a compressed trace before reading it
+  if (header.encoding == TraceEncoding::Blocks && !expand_trace(file)) {
+    WARN << "Ignoring corrupt compressed trace " << path;
+    return nullopt;
+  }
+
   return TraceReader(std::move(file));
 }
 
@@ -281,8 +426,8 @@ TraceReader::TraceReader() noexcept {
 
 // Create a trace reader from an already open trace file
 TraceReader::TraceReader(TraceFile&& file) noexcept : _file(std::move(file)) {
-  // Jump back to the beginning of the file
-  _file.pos = 0;
+  // Jump back to the beginning of the file, just past the header
+  _file.pos = sizeof(TraceHeader);
 
   // Create a root command
   setCommand(0, make_shared<Command>());
@@ -298,6 +443,9 @@ TraceWriter::TraceWriter(optional<string> path) noexcept :
     _id(getNextID()), _path(path), _file(TraceFile::create()) {
   ASSERT(_file) << "Failed to create backing file for TraceWrite";
   ASSERT(_file.pos == 0) << "File is not at the beginning";
+
+  // Start the trace with a header that identifies its format
+  memcpy(_file.advance(sizeof(TraceHeader), true), &CurrentTraceHeader, sizeof(TraceHeader));
 }
 
 TraceWriter::~TraceWriter() noexcept {
@@ -340,6 +488,7 @@ void TraceWriter::link() const noexcept {
   // Was a path provided?
   if (_path.has_value()) {
     // Yes. Link the trace onto the filesystem before it vanishes
+    timeline::Span span("Write trace");
 
     // First make sure the output path doesn't exist
     int rc = ::unlink(_path.value().c_str());
@@ -348,6 +497,21 @@ void TraceWriter::link() const noexcept {
     FAIL_IF(rc != 0 && errno != ENOENT)
         << "Failed to unlink old trace output file " << _path.value() << ": " << ERR;
 
+    // A compressed trace is written out block by block instead of linked into place
+    if (options::compress_trace) {
+      int outfd = ::open(_path.value().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      FAIL_IF(outfd < 0) << "Failed to create trace database file: " << ERR;
+      FAIL_IF(!write_compressed(outfd, _file.data, _file.pos))
+          << "Failed to write compressed trace: " << ERR;
+      ::close(outfd);
+      return;
+    }
+
+    // Drop the unused space the file grew into before linking it in place. Nothing is written to
+    // the trace after it is linked.
+    rc = ::ftruncate(_file.fd, _file.pos);
+    FAIL_IF(rc != 0) << "Failed to trim trace file: " << ERR;
+
     // Now link in the temporary file from the /proc filesystem
     string fdpath = "/proc/self/fd/" + std::to_string(_file.fd);
     rc = linkat(AT_FDCWD, fdpath.c_str(), AT_FDCWD, _path.value().c_str(), AT_SYMLINK_FOLLOW);
@@ -378,6 +542,35 @@ void TraceWriter::link() const noexcept {
   }
 }
 
+/********** Field Encoding **********/
+
+/*
+ * Each record is a one-byte record type followed by the record's fields. Records list their
+ * fields with a fields() method, and each field is encoded according to its type:
+ *  - Integers and enums are LEB128 varints. Signed values are zigzag-encoded first.
+ *  - RefField values are zigzag varints of the difference from the last reference the current
+ *    command used in the trace. Consecutive steps in a command tend to use nearby references.
+ *  - A timespec is a pair of signed varints.
+ *  - Anything else is copied as raw bytes.
+ */
+
+/// A reference ID in a record, encoded relative to the last reference used by the same command
+struct RefField {
+  RefField(Ref::ID id = 0) noexcept : id(id) {}
+  operator Ref::ID() const noexcept { return id; }
+  Ref::ID id;
+};
+
+/// Map a signed integer to an unsigned one so values near zero have short encodings
+static inline uint64_t zigzag(int64_t value) noexcept {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+/// Reverse the zigzag mapping
+static inline int64_t unzigzag(uint64_t value) noexcept {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
 /********** TraceReader Reading Methods **********/
 
 // Look at the type of the next record without advancing the current position
@@ -385,22 +578,84 @@ RecordType TraceReader::peek() const noexcept {
   return *reinterpret_cast<RecordType*>(_file.peek());
 }
 
-// Get a reference to a record in the input trace
+// Decode the next record in the input trace
 template <RecordType T>
-const Record<T>& TraceReader::takeRecord() noexcept {
+Record<T> TraceReader::takeRecord() noexcept {
+  // Skip over the record type
+  _file.advance(sizeof(RecordType), false);
   return takeValue<Record<T>>();
 }
 
-// Get reference to data in the trace of a requested type
+// Decode a value with a list of fields from the input trace
+template <typename T>
+T TraceReader::takeValue() noexcept {
+  T value{};
+  std::apply([this](auto&... field) { (takeField(field), ...); }, value.fields());
+  return value;
+}
+
+// Decode an array of fields from the input trace
 template <typename T>
-const T& TraceReader::takeValue() noexcept {
-  return *reinterpret_cast<T*>(_file.advance(sizeof(T), false));
+vector<T> TraceReader::takeArray(size_t count) noexcept {
+  vector<T> result(count);
+  for (auto& elt : result) {
+    takeField(elt);
+  }
+  return result;
 }
 
-// Get a reference to an array in the trace
+// Decode a single field from the input trace
 template <typename T>
-const T* TraceReader::takeArray(size_t count) noexcept {
-  return reinterpret_cast<T*>(_file.advance(count * sizeof(T), false));
+void TraceReader::takeField(T& field) noexcept {
+  if constexpr (std::is_same_v<T, RefField>) {
+    auto& last = lastRef();
+    field = static_cast<Ref::ID>(last + unzigzag(takeVarint()));
+    last = field;
+
+  } else if constexpr (std::is_enum_v<T>) {
+    std::underlying_type_t<T> value;
+    takeField(value);
+    field = static_cast<T>(value);
+
+  } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+    field = static_cast<T>(unzigzag(takeVarint()));
+
+  } else if constexpr (std::is_integral_v<T>) {
+    field = static_cast<T>(takeVarint());
+
+  } else if constexpr (std::is_same_v<T, struct timespec>) {
+    takeField(field.tv_sec);
+    takeField(field.tv_nsec);
+
+  } else {
+    static_assert(std::is_trivially_copyable_v<T>, "Raw trace fields must be trivially copyable");
+    memcpy(&field, _file.advance(sizeof(T), false), sizeof(T));
+  }
+}
+
+// Decode a LEB128 varint from the input trace
+uint64_t TraceReader::takeVarint() noexcept {
+  const uint8_t* p = &_file.data[_file.pos];
+  const uint8_t* end = &_file.data[_file.length];
+
+  uint64_t result = 0;
+  for (size_t shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t b = *p++;
+    result |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      _file.pos = p - _file.data;
+      return result;
+    }
+  }
+
+  FAIL << "Invalid integer in trace at offset " << _file.pos;
+  return 0;
+}
+
+// Get the last reference used by the current command in the input trace
+Ref::ID& TraceReader::lastRef() noexcept {
+  if (_current_command_id >= _last_refs.size()) _last_refs.resize(_current_command_id + 1, 0);
+  return _last_refs[_current_command_id];
 }
 
 // Get a pointer to a string and advance the current position to the end of the string
@@ -416,23 +671,70 @@ const char* TraceReader::takeString() noexcept {
 // Write a record to the trace
 template <RecordType T, typename... Args>
 void TraceWriter::emitRecord(Args... args) noexcept {
-  using R = Record<T>;
-  R* r = reinterpret_cast<R*>(_file.advance(sizeof(R), true));
-  *r = R{T, args...};
+  *reinterpret_cast<RecordType*>(_file.advance(sizeof(RecordType), true)) = T;
+  emitValue<Record<T>>(args...);
 }
 
-// Write a value to the trace
+// Write a value with a list of fields to the trace
 template <typename T, typename... Args>
 void TraceWriter::emitValue(Args... args) noexcept {
-  T* p = reinterpret_cast<T*>(_file.advance(sizeof(T), true));
-  *p = T{args...};
+  T value{args...};
+  std::apply([this](const auto&... field) { (emitField(field), ...); }, value.fields());
 }
 
-// Emit an array to the trace
+// Emit an array of fields to the trace
 template <typename T>
-void TraceWriter::emitArray(T* src, size_t count) noexcept {
-  void* dest = _file.advance(sizeof(T) * count, true);
-  memcpy(dest, src, sizeof(T) * count);
+void TraceWriter::emitArray(const T* src, size_t count) noexcept {
+  for (size_t i = 0; i < count; i++) {
+    emitField(src[i]);
+  }
+}
+
+// Write a single field to the trace
+template <typename T>
+void TraceWriter::emitField(const T& field) noexcept {
+  if constexpr (std::is_same_v<T, RefField>) {
+    auto& last = lastRef();
+    emitVarint(zigzag(static_cast<int64_t>(field.id) - static_cast<int64_t>(last)));
+    last = field;
+
+  } else if constexpr (std::is_enum_v<T>) {
+    emitField(static_cast<std::underlying_type_t<T>>(field));
+
+  } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+    emitVarint(zigzag(field));
+
+  } else if constexpr (std::is_integral_v<T>) {
+    emitVarint(field);
+
+  } else if constexpr (std::is_same_v<T, struct timespec>) {
+    emitField(field.tv_sec);
+    emitField(field.tv_nsec);
+
+  } else {
+    static_assert(std::is_trivially_copyable_v<T>, "Raw trace fields must be trivially copyable");
+    memcpy(_file.advance(sizeof(T), true), &field, sizeof(T));
+  }
+}
+
+// Write a LEB128 varint to the trace
+void TraceWriter::emitVarint(uint64_t value) noexcept {
+  uint8_t buffer[10];
+  size_t length = 0;
+  do {
+    buffer[length] = value & 0x7f;
+    value >>= 7;
+    if (value != 0) buffer[length] |= 0x80;
+    length++;
+  } while (value != 0);
+
+  memcpy(_file.advance(length, true), buffer, length);
+}
+
+// Get the last reference used by the current command in the output trace
+Ref::ID& TraceWriter::lastRef() noexcept {
+  if (_current_command_id >= _last_refs.size()) _last_refs.resize(_current_command_id + 1, 0);
+  return _last_refs[_current_command_id];
 }
 
 /********** Instance ID Methods **********/
@@ -604,14 +906,13 @@ PathID TraceWriter::getPathID(const fs::path& path) noexcept {
 
 template <>
 struct Record<RecordType::Start> {
-  RecordType type;
   Command::ID root_command;
-} __attribute__((packed));
+  auto fields() { return std::tie(root_command); }
+};
 
 // Read a Start record from the input trace
 template <>
 void TraceReader::handleRecord<RecordType::Start>(IRSink& sink) noexcept {
-  ASSERT(_file.pos == 6) << "Reading a start record at a weird place (" << _file.pos << ")";
   const auto& data = takeRecord<RecordType::Start>();
   sink.start(getCommand(data.root_command));
 }
@@ -625,8 +926,8 @@ void TraceWriter::start(const shared_ptr<Command>& c) noexcept {
 
 template <>
 struct Record<RecordType::Finish> {
-  RecordType type;
-} __attribute__((packed));
+  auto fields() { return std::tie(); }
+};
 
 // Read a Finish record from the input trace
 template <>
@@ -644,10 +945,10 @@ void TraceWriter::finish() noexcept {
 
 template <>
 struct Record<RecordType::SpecialRef> {
-  RecordType type;
   SpecialRef entity;
-  Ref::ID output;
-} __attribute__((packed));
+  RefField output;
+  auto fields() { return std::tie(entity, output); }
+};
 
 // Read a SpecialRef record from the input trace
 template <>
@@ -669,10 +970,10 @@ void TraceWriter::specialRef(const IRSource& source,
 
 template <>
 struct Record<RecordType::PipeRef> {
-  RecordType type;
-  Ref::ID read_end;
-  Ref::ID write_end;
-} __attribute__((packed));
+  RefField read_end;
+  RefField write_end;
+  auto fields() { return std::tie(read_end, write_end); }
+};
 
 // Read a PipeRef record from the input trace
 template <>
@@ -694,10 +995,10 @@ void TraceWriter::pipeRef(const IRSource& source,
 
 template <>
 struct Record<RecordType::FileRef> {
-  RecordType type;
   mode_t mode;
-  Ref::ID output;
-} __attribute__((packed));
+  RefField output;
+  auto fields() { return std::tie(mode, output); }
+};
 
 // Read a FileRef record from the input trace
 template <>
@@ -719,10 +1020,10 @@ void TraceWriter::fileRef(const IRSource& source,
 
 template <>
 struct Record<RecordType::SymlinkRef> {
-  RecordType type;
   PathID target;
-  Ref::ID output;
-} __attribute__((packed));
+  RefField output;
+  auto fields() { return std::tie(target, output); }
+};
 
 // Read a SymlinkRef record from the input trace
 template <>
@@ -734,7 +1035,7 @@ void TraceReader::handleRecord<RecordType::SymlinkRef>(IRSink& sink) noexcept {
 // Write a SymlinkRef record to the output trace
 void TraceWriter::symlinkRef(const IRSource& source,
                              const shared_ptr<Command>& c,
-                             fs::path target,
+                             const fs::path& target,
                              Ref::ID output) noexcept {
   setCommand(c);
   emitRecord<RecordType::SymlinkRef>(getPathID(target), output);
@@ -744,10 +1045,10 @@ void TraceWriter::symlinkRef(const IRSource& source,
 
 template <>
 struct Record<RecordType::DirRef> {
-  RecordType type;
   mode_t mode;
-  Ref::ID output;
-} __attribute__((packed));
+  RefField output;
+  auto fields() { return std::tie(mode, output); }
+};
 
 // Read a DirRef record from the input trace
 template <>
@@ -769,12 +1070,12 @@ void TraceWriter::dirRef(const IRSource& source,
 
 template <>
 struct Record<RecordType::PathRef> {
-  RecordType type;
-  Ref::ID base;
+  RefField base;
   PathID path;
   AccessFlags flags;
-  Ref::ID output;
-} __attribute__((packed));
+  RefField output;
+  auto fields() { return std::tie(base, path, flags, output); }
+};
 
 // Read a PathRef record from the input trace
 template <>
@@ -787,7 +1088,7 @@ void TraceReader::handleRecord<RecordType::PathRef>(IRSink& sink) noexcept {
 void TraceWriter::pathRef(const IRSource& source,
                           const shared_ptr<Command>& c,
                           Ref::ID base,
-                          fs::path path,
+                          const fs::path& path,
                           AccessFlags flags,
                           Ref::ID output) noexcept {
   setCommand(c);
@@ -798,9 +1099,9 @@ void TraceWriter::pathRef(const IRSource& source,
 
 template <>
 struct Record<RecordType::UsingRef> {
-  RecordType type;
-  Ref::ID ref;
-} __attribute__((packed));
+  RefField ref;
+  auto fields() { return std::tie(ref); }
+};
 
 // Read a UsingRef record from the input trace
 template <>
@@ -821,9 +1122,9 @@ void TraceWriter::usingRef(const IRSource& source,
 
 template <>
 struct Record<RecordType::DoneWithRef> {
-  RecordType type;
-  Ref::ID ref;
-} __attribute__((packed));
+  RefField ref;
+  auto fields() { return std::tie(ref); }
+};
 
 // Read a DoneWithRef record from the input trace
 template <>
@@ -844,11 +1145,11 @@ void TraceWriter::doneWithRef(const IRSource& source,
 
 template <>
 struct Record<RecordType::CompareRefs> {
-  RecordType type;
-  Ref::ID ref1;
-  Ref::ID ref2;
+  RefField ref1;
+  RefField ref2;
   RefComparison cmp;
-} __attribute__((packed));
+  auto fields() { return std::tie(ref1, ref2, cmp); }
+};
 
 // Read a CompareRefs record from the input trace
 template <>
@@ -871,11 +1172,11 @@ void TraceWriter::compareRefs(const IRSource& source,
 
 template <>
 struct Record<RecordType::ExpectResult> {
-  RecordType type;
   Scenario scenario;
-  Ref::ID ref;
+  RefField ref;
   int8_t expected;
-} __attribute__((packed));
+  auto fields() { return std::tie(scenario, ref, expected); }
+};
 
 // Read an ExpectResult record from the input trace
 template <>
@@ -898,17 +1199,20 @@ void TraceWriter::expectResult(const IRSource& source,
 
 template <>
 struct Record<RecordType::MatchMetadata> {
-  RecordType type;
   Scenario scenario;
-  Ref::ID ref;
-  MetadataVersion version;
-} __attribute__((packed));
+  RefField ref;
+  uid_t uid;
+  gid_t gid;
+  mode_t mode;
+  auto fields() { return std::tie(scenario, ref, uid, gid, mode); }
+};
 
 // Read a MatchMetadata record from the input trace
 template <>
 void TraceReader::handleRecord<RecordType::MatchMetadata>(IRSink& sink) noexcept {
   const auto& data = takeRecord<RecordType::MatchMetadata>();
-  sink.matchMetadata(*this, _current_command, data.scenario, data.ref, data.version);
+  sink.matchMetadata(*this, _current_command, data.scenario, data.ref,
+                     MetadataVersion(data.uid, data.gid, data.mode));
 }
 
 // Write a MatchMetadata record to the output trace
@@ -916,20 +1220,21 @@ void TraceWriter::matchMetadata(const IRSource& source,
                                 const shared_ptr<Command>& c,
                                 Scenario scenario,
                                 Ref::ID ref,
-                                MetadataVersion version) noexcept {
+                                const MetadataVersion& version) noexcept {
   setCommand(c);
-  emitRecord<RecordType::MatchMetadata>(scenario, ref, version);
+  emitRecord<RecordType::MatchMetadata>(scenario, ref, version.getUID(), version.getGID(),
+                                        version.getMode());
 }
 
 /********** MatchContent Record **********/
 
 template <>
 struct Record<RecordType::MatchContent> {
-  RecordType type;
   Scenario scenario;
-  Ref::ID ref;
+  RefField ref;
   ContentVersion::ID version;
-} __attribute__((packed));
+  auto fields() { return std::tie(scenario, ref, version); }
+};
 
 // Read a MatchContent record from the input trace
 template <>
@@ -944,7 +1249,7 @@ void TraceWriter::matchContent(const IRSource& source,
                                const shared_ptr<Command>& c,
                                Scenario scenario,
                                Ref::ID ref,
-                               shared_ptr<ContentVersion> version) noexcept {
+                               const shared_ptr<ContentVersion>& version) noexcept {
   setCommand(c);
   emitRecord<RecordType::MatchContent>(scenario, ref, getContentVersionID(version));
 }
@@ -953,35 +1258,39 @@ void TraceWriter::matchContent(const IRSource& source,
 
 template <>
 struct Record<RecordType::UpdateMetadata> {
-  RecordType type;
-  Ref::ID ref;
-  MetadataVersion version;
-} __attribute__((packed));
+  RefField ref;
+  uid_t uid;
+  gid_t gid;
+  mode_t mode;
+  auto fields() { return std::tie(ref, uid, gid, mode); }
+};
 
 // Read an UpdateMetadata record from the input trace
 template <>
 void TraceReader::handleRecord<RecordType::UpdateMetadata>(IRSink& sink) noexcept {
   const auto& data = takeRecord<RecordType::UpdateMetadata>();
-  sink.updateMetadata(*this, _current_command, data.ref, data.version);
+  sink.updateMetadata(*this, _current_command, data.ref,
+                      MetadataVersion(data.uid, data.gid, data.mode));
 }
 
 // Write an UpdateMetadata record to the output trace
 void TraceWriter::updateMetadata(const IRSource& source,
                                  const shared_ptr<Command>& c,
                                  Ref::ID ref,
-                                 MetadataVersion version) noexcept {
+                                 const MetadataVersion& version) noexcept {
   setCommand(c);
-  emitRecord<RecordType::UpdateMetadata>(ref, version);
+  emitRecord<RecordType::UpdateMetadata>(ref, version.getUID(), version.getGID(),
+                                         version.getMode());
 }
 
 /********** UpdateContent Record **********/
 
 template <>
 struct Record<RecordType::UpdateContent> {
-  RecordType type;
-  Ref::ID ref;
+  RefField ref;
   ContentVersion::ID version;
-} __attribute__((packed));
+  auto fields() { return std::tie(ref, version); }
+};
 
 // Read an UpdateContent record from the input trace
 template <>
@@ -994,7 +1303,7 @@ void TraceReader::handleRecord<RecordType::UpdateContent>(IRSink& sink) noexcept
 void TraceWriter::updateContent(const IRSource& source,
                                 const shared_ptr<Command>& c,
                                 Ref::ID ref,
-                                shared_ptr<ContentVersion> version) noexcept {
+                                const shared_ptr<ContentVersion>& version) noexcept {
   setCommand(c);
   emitRecord<RecordType::UpdateContent>(ref, getContentVersionID(version));
 }
@@ -1003,11 +1312,11 @@ void TraceWriter::updateContent(const IRSource& source,
 
 template <>
 struct Record<RecordType::AddEntry> {
-  RecordType type;
-  Ref::ID dir;
+  RefField dir;
   StringID name;
-  Ref::ID target;
-} __attribute__((packed));
+  RefField target;
+  auto fields() { return std::tie(dir, name, target); }
+};
 
 // Read an AddEntry record from the input trace
 template <>
@@ -1020,7 +1329,7 @@ void TraceReader::handleRecord<RecordType::AddEntry>(IRSink& sink) noexcept {
 void TraceWriter::addEntry(const IRSource& source,
                            const shared_ptr<Command>& c,
                            Ref::ID dir,
-                           string name,
+                           const string& name,
                            Ref::ID target) noexcept {
   setCommand(c);
   emitRecord<RecordType::AddEntry>(dir, getStringID(name), target);
@@ -1030,11 +1339,11 @@ void TraceWriter::addEntry(const IRSource& source,
 
 template <>
 struct Record<RecordType::RemoveEntry> {
-  RecordType type;
-  Ref::ID dir;
+  RefField dir;
   StringID name;
-  Ref::ID target;
-} __attribute__((packed));
+  RefField target;
+  auto fields() { return std::tie(dir, name, target); }
+};
 
 // Read a RemoveEntry record from the input trace
 template <>
@@ -1047,7 +1356,7 @@ void TraceReader::handleRecord<RecordType::RemoveEntry>(IRSink& sink) noexcept {
 void TraceWriter::removeEntry(const IRSource& source,
                               const shared_ptr<Command>& c,
                               Ref::ID dir,
-                              string name,
+                              const string& name,
                               Ref::ID target) noexcept {
   setCommand(c);
   emitRecord<RecordType::RemoveEntry>(dir, getStringID(name), target);
@@ -1057,25 +1366,28 @@ void TraceWriter::removeEntry(const IRSource& source,
 
 template <>
 struct Record<RecordType::Launch> {
-  RecordType type;
   Command::ID child;
   uint16_t refs_length;
-} __attribute__((packed));
+  auto fields() { return std::tie(child, refs_length); }
+};
 
+// The parent's reference is encoded relative to the parent's other references. The child's
+// reference is stored as-is, since the child has not issued any steps yet.
 struct RefMapping {
-  Ref::ID in_parent;
+  RefField in_parent;
   Ref::ID in_child;
-} __attribute__((packed));
+  auto fields() { return std::tie(in_parent, in_child); }
+};
 
 // Read a Launch record from the input trace
 template <>
 void TraceReader::handleRecord<RecordType::Launch>(IRSink& sink) noexcept {
   const auto& data = takeRecord<RecordType::Launch>();
-  const RefMapping* refs = takeArray<RefMapping>(data.refs_length);
 
   list<tuple<Ref::ID, Ref::ID>> refs_list;
   for (size_t i = 0; i < data.refs_length; i++) {
-    refs_list.push_back(tuple{refs[i].in_parent, refs[i].in_child});
+    auto mapping = takeValue<RefMapping>();
+    refs_list.push_back(tuple{mapping.in_parent, mapping.in_child});
   }
 
   sink.launch(*this, _current_command, getCommand(data.child), refs_list);
@@ -1085,7 +1397,7 @@ void TraceReader::handleRecord<RecordType::Launch>(IRSink& sink) noexcept {
 void TraceWriter::launch(const IRSource& source,
                          const shared_ptr<Command>& parent,
                          const shared_ptr<Command>& child,
-                         list<tuple<Ref::ID, Ref::ID>> refs) noexcept {
+                         const list<tuple<Ref::ID, Ref::ID>>& refs) noexcept {
   // Compute the length of the ref mapping list, which should fit in a 16-bit integer
   uint16_t refs_length = refs.size();
 
@@ -1105,10 +1417,10 @@ void TraceWriter::launch(const IRSource& source,
 
 template <>
 struct Record<RecordType::Join> {
-  RecordType type;
   Command::ID child;
   int exit_status;
-} __attribute__((packed));
+  auto fields() { return std::tie(child, exit_status); }
+};
 
 // Read a Join record from the input trace
 template <>
@@ -1130,9 +1442,9 @@ void TraceWriter::join(const IRSource& source,
 
 template <>
 struct Record<RecordType::Exit> {
-  RecordType type;
   int exit_status;
-} __attribute__((packed));
+  auto fields() { return std::tie(exit_status); }
+};
 
 // Read an Exit record from the input trace
 template <>
@@ -1146,32 +1458,77 @@ void TraceWriter::exit(const IRSource& source,
                        const shared_ptr<Command>& c,
                        int exit_status) noexcept {
   setCommand(c);
+
+  // Save the resources used by the command's last traced run ahead of its exit
+  const auto& profile = c->getProfile();
+  if (profile.wall_ns > 0) {
+    emitRecord<RecordType::Profile>(profile.wall_ns, profile.user_ns, profile.sys_ns,
+                                    profile.max_rss_kb, profile.read_bytes, profile.write_bytes,
+                                    profile.syscalls);
+  }
+
   emitRecord<RecordType::Exit>(exit_status);
 }
 
+/********** Profile Record **********/
+
+template <>
+struct Record<RecordType::Profile> {
+  uint64_t wall_ns;
+  uint64_t user_ns;
+  uint64_t sys_ns;
+  uint64_t max_rss_kb;
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+  uint64_t syscalls;
+  auto fields() {
+    return std::tie(wall_ns, user_ns, sys_ns, max_rss_kb, read_bytes, write_bytes, syscalls);
+  }
+};
+
+// Read a Profile record from the input trace
+template <>
+void TraceReader::handleRecord<RecordType::Profile>(IRSink& sink) noexcept {
+  const auto& data = takeRecord<RecordType::Profile>();
+
+  // Profiles are not IR steps. Attach the profile to the current command, so it is written back
+  // out with the command's exit if the command is emulated. A command that is running in this
+  // build is collecting a new profile, so leave that one alone.
+  if (_current_command->mustRun()) return;
+
+  auto& profile = _current_command->getProfile();
+  profile.wall_ns = data.wall_ns;
+  profile.user_ns = data.user_ns;
+  profile.sys_ns = data.sys_ns;
+  profile.max_rss_kb = data.max_rss_kb;
+  profile.read_bytes = data.read_bytes;
+  profile.write_bytes = data.write_bytes;
+  profile.syscalls = data.syscalls;
+}
+
 /********** Command Record **********/
 
 // The fixed-size data written for each command in the trace
 template <>
 struct Record<RecordType::Command> {
-  RecordType type;
   bool has_executed;
   uint16_t argv_length;
   uint16_t initial_fds_length;
-} __attribute__((packed));
+  auto fields() { return std::tie(has_executed, argv_length, initial_fds_length); }
+};
 
 // A struct used to map a file descriptor to a reference ID
 struct FDRecord2 {
   int fd;
   Ref::ID ref;
-} __attribute__((packed));
+  auto fields() { return std::tie(fd, ref); }
+};
 
 // Read a Command record from the input trace
 template <>
 void TraceReader::handleRecord<RecordType::Command>(IRSink& sink) noexcept {
   const auto& data = takeRecord<RecordType::Command>();
-  const StringID* arg_ids = takeArray<StringID>(data.argv_length);
-  const FDRecord2* fds = takeArray<FDRecord2>(data.initial_fds_length);
+  auto arg_ids = takeArray<StringID>(data.argv_length);
 
   // Get argument strings
   vector<string> args;
@@ -1185,7 +1542,8 @@ void TraceReader::handleRecord<RecordType::Command>(IRSink& sink) noexcept {
 
   // Add initial file descriptors
   for (size_t i = 0; i < data.initial_fds_length; i++) {
-    cmd->addInitialFD(fds[i].fd, fds[i].ref);
+    auto fd = takeValue<FDRecord2>();
+    cmd->addInitialFD(fd.fd, fd.ref);
   }
 
   // Save the command in the commands table
@@ -1223,8 +1581,8 @@ void TraceWriter::emitCommand(const std::shared_ptr<Command>& c) noexcept {
 
 template <>
 struct Record<RecordType::String> {
-  RecordType type;
-} __attribute__((packed));
+  auto fields() { return std::tie(); }
+};
 
 // Read a String record from the input trace
 template <>
@@ -1238,15 +1596,15 @@ void TraceReader::handleRecord<RecordType::String>(IRSink& sink) noexcept {
 void TraceWriter::emitString(const string& str) noexcept {
   // Write out the string record
   emitRecord<RecordType::String>();
-  emitArray(str.c_str(), str.size() + 1);
+  memcpy(_file.advance(str.size() + 1, true), str.c_str(), str.size() + 1);
 }
 
 /********** NewStrtab Record **********/
 
 template <>
 struct Record<RecordType::NewStrtab> {
-  RecordType type;
-} __attribute__((packed));
+  auto fields() { return std::tie(); }
+};
 
 // Read a NewStrtab record from the input trace
 template <>
@@ -1264,8 +1622,8 @@ void TraceWriter::emitNewStrtab() noexcept {
 /********** End Record **********/
 template <>
 struct Record<RecordType::End> {
-  RecordType type;
-} __attribute__((packed));
+  auto fields() { return std::tie(); }
+};
 
 // Read an end record from the input trace
 template <>
@@ -1284,14 +1642,14 @@ void TraceWriter::emitEnd() noexcept {
 
 template <>
 struct Record<RecordType::FileVersion> {
-  RecordType type;
-  bool is_empty : 1;
-  bool is_cached : 1;
-  bool has_mtime : 1;
-  bool has_hash : 1;
-  struct timespec mtime;
-  FileVersion::Hash hash;
-} __attribute__((packed));
+  bool is_empty;
+  bool is_cached;
+  bool has_mtime;
+  bool has_hash;
+  auto fields() { return std::tie(is_empty, is_cached, has_mtime, has_hash); }
+};
+
+// The mtime and hash follow the fixed-size record, but only if the version has them
 
 // Read a FileVersion record from the input trace
 template <>
@@ -1299,34 +1657,40 @@ void TraceReader::handleRecord<RecordType::FileVersion>(IRSink& sink) noexcept {
   const auto& data = takeRecord<RecordType::FileVersion>();
 
   optional<struct timespec> mtime;
-  if (data.has_mtime) mtime = data.mtime;
+  if (data.has_mtime) {
+    mtime.emplace();
+    takeField(mtime.value());
+  }
 
   optional<FileVersion::Hash> hash;
-  if (data.has_hash) hash = data.hash;
+  if (data.has_hash) {
+    hash.emplace();
+    takeField(hash.value());
+  }
 
-  addVersion(make_shared<FileVersion>(data.is_empty, data.is_cached, mtime, hash));
+  addVersion(make_pooled<FileVersion>(data.is_empty, data.is_cached, mtime, hash));
 }
 
 // Write a FileVersion record to the output trace
 void TraceWriter::emitFileVersion(const shared_ptr<FileVersion>& v) noexcept {
   // Does the version have an mtime and/or hash?
-  bool has_mtime = v->getModificationTime().has_value();
-  auto mtime = v->getModificationTime().value_or(timespec{0, 0});
-  bool has_hash = v->getHash().has_value();
-  auto hash = v->getHash().value_or(FileVersion::Hash());
+  const auto& mtime = v->getModificationTime();
+  const auto& hash = v->getHash();
 
-  // Emit the file version
-  emitRecord<RecordType::FileVersion>(v->isEmpty(), v->isCached(), has_mtime, has_hash, mtime,
-                                      hash);
+  // Emit the file version, followed by the mtime and hash if it has them
+  emitRecord<RecordType::FileVersion>(v->isEmpty(), v->isCached(), mtime.has_value(),
+                                      hash.has_value());
+  if (mtime.has_value()) emitField(mtime.value());
+  if (hash.has_value()) emitField(hash.value());
 }
 
 /********** SymlinkVersion Record **********/
 
 template <>
 struct Record<RecordType::SymlinkVersion> {
-  RecordType type;
   StringID dest;
-} __attribute__((packed));
+  auto fields() { return std::tie(dest); }
+};
 
 // Read a SymlinkVersion record from the input trace
 template <>
@@ -1344,15 +1708,15 @@ void TraceWriter::emitSymlinkVersion(const shared_ptr<SymlinkVersion>& v) noexce
 
 template <>
 struct Record<RecordType::DirListVersion> {
-  RecordType type;
-  uint16_t entry_count;
-} __attribute__((packed));
+  uint32_t entry_count;
+  auto fields() { return std::tie(entry_count); }
+};
 
 // Read a DirListVersion record from the input trace
 template <>
 void TraceReader::handleRecord<RecordType::DirListVersion>(IRSink& sink) noexcept {
   const auto& data = takeRecord<RecordType::DirListVersion>();
-  const PathID* entry_ids = takeArray<PathID>(data.entry_count);
+  auto entry_ids = takeArray<PathID>(data.entry_count);
 
   auto v = make_shared<DirListVersion>();
   for (size_t i = 0; i < data.entry_count; i++) {
@@ -1364,11 +1728,8 @@ void TraceReader::handleRecord<RecordType::DirListVersion>(IRSink& sink) noexcep
 
 // Write a DirListVersion record to the output trace
 void TraceWriter::emitDirListVersion(const shared_ptr<DirListVersion>& v) noexcept {
-  // Get the number of directory entries, which should fit in a uint16_t
-  uint16_t entry_count = v->getEntries().size();
-
-  ASSERT(entry_count == v->getEntries().size())
-      << "A directory has too many entries to fit in a uint16_t...";
+  // Get the number of directory entries
+  uint32_t entry_count = v->getEntries().size();
 
   // Now build a vector of IDs for each of the paths
   vector<PathID> entries;
@@ -1376,8 +1737,8 @@ void TraceWriter::emitDirListVersion(const shared_ptr<DirListVersion>& v) noexce
 
   // Reserve enough paths so they all fit in the current path/string table
   reservePaths(entry_count);
-  for (const auto& entry : v->getEntries()) {
-    entries.push_back(getPathID(entry));
+  for (auto id : v->getEntries()) {
+    entries.push_back(getPathID(DirListVersion::getEntryName(id)));
   }
 
   // Write out the fixed-length portion of the directory list version
@@ -1391,8 +1752,8 @@ void TraceWriter::emitDirListVersion(const shared_ptr<DirListVersion>& v) noexce
 
 template <>
 struct Record<RecordType::PipeWriteVersion> {
-  RecordType type;
-} __attribute__((packed));
+  auto fields() { return std::tie(); }
+};
 
 // Read a PipeWriteVersion record from the input trace
 template <>
@@ -1410,8 +1771,8 @@ void TraceWriter::emitPipeWriteVersion(const shared_ptr<PipeWriteVersion>& v) no
 
 template <>
 struct Record<RecordType::PipeCloseVersion> {
-  RecordType type;
-} __attribute__((packed));
+  auto fields() { return std::tie(); }
+};
 
 // Read a PipeCloseVersion record from the input trace
 template <>
@@ -1429,8 +1790,8 @@ void TraceWriter::emitPipeCloseVersion(const shared_ptr<PipeCloseVersion>& v) no
 
 template <>
 struct Record<RecordType::PipeReadVersion> {
-  RecordType type;
-} __attribute__((packed));
+  auto fields() { return std::tie(); }
+};
 
 // Read a PipeReadVersion record from the input trace
 template <>
@@ -1448,9 +1809,9 @@ void TraceWriter::emitPipeReadVersion(const shared_ptr<PipeReadVersion>& v) noex
 
 template <>
 struct Record<RecordType::SpecialVersion> {
-  RecordType type;
   bool can_commit;
-} __attribute__((packed));
+  auto fields() { return std::tie(can_commit); }
+};
 
 // Read a SpecialVersion record from the input trace
 template <>
@@ -1468,14 +1829,15 @@ void TraceWriter::emitSpecialVersion(const shared_ptr<SpecialVersion>& v) noexce
 
 template <>
 struct Record<RecordType::SetCommand> {
-  RecordType type;
   Command::ID c;
-} __attribute__((packed));
+  auto fields() { return std::tie(c); }
+};
 
 // Read a SetCommand record from the trace
 template <>
 void TraceReader::handleRecord<RecordType::SetCommand>(IRSink& sink) noexcept {
   const auto& data = takeRecord<RecordType::SetCommand>();
+  _current_command_id = data.c;
   _current_command = getCommand(data.c);
 }
 
@@ -1483,147 +1845,442 @@ void TraceReader::handleRecord<RecordType::SetCommand>(IRSink& sink) noexcept {
 void TraceWriter::setCommand(std::shared_ptr<Command> c) noexcept {
   if (c != _current_command) {
     _current_command = c;
-    emitRecord<RecordType::SetCommand>(getCommandID(c));
+    _current_command_id = getCommandID(c);
+    emitRecord<RecordType::SetCommand>(_current_command_id);
+  }
+}
+
+/********** Trace Filtering **********/
+
+// Get the name of the IR step a record holds, or nullptr if the record is not an IR step
+static const char* getStepName(RecordType type) noexcept {
+  switch (type) {
+    case RecordType::SpecialRef:
+      return "SpecialRef";
+    case RecordType::PipeRef:
+      return "PipeRef";
+    case RecordType::FileRef:
+      return "FileRef";
+    case RecordType::SymlinkRef:
+      return "SymlinkRef";
+    case RecordType::DirRef:
+      return "DirRef";
+    case RecordType::PathRef:
+      return "PathRef";
+    case RecordType::UsingRef:
+      return "UsingRef";
+    case RecordType::DoneWithRef:
+      return "DoneWithRef";
+    case RecordType::CompareRefs:
+      return "CompareRefs";
+    case RecordType::ExpectResult:
+      return "ExpectResult";
+    case RecordType::MatchMetadata:
+      return "MatchMetadata";
+    case RecordType::MatchContent:
+      return "MatchContent";
+    case RecordType::UpdateMetadata:
+      return "UpdateMetadata";
+    case RecordType::UpdateContent:
+      return "UpdateContent";
+    case RecordType::AddEntry:
+      return "AddEntry";
+    case RecordType::RemoveEntry:
+      return "RemoveEntry";
+    case RecordType::Launch:
+      return "Launch";
+    case RecordType::Join:
+      return "Join";
+    case RecordType::Exit:
+      return "Exit";
+    default:
+      return nullptr;
   }
 }
 
+// Check if the current command's command line matches the active filter
+bool TraceReader::commandPassesFilter() noexcept {
+  if (!_filter->command.has_value()) return true;
+
+  // Match each command once, the first time it issues a step
+  auto [iter, added] = _filter_commands.emplace(_current_command_id, false);
+  if (added) {
+    iter->second = std::regex_search(_current_command->getFullName(), _filter->command.value());
+  }
+  return iter->second;
+}
+
+namespace {
+  /// An IRSink that collects what the active filter checks about a single decoded step
+  class StepFilter final : public IRSink {
+   public:
+    StepFilter(const TraceFilter& filter,
+               std::unordered_map<const Command*, std::set<Ref::ID>>& refs) noexcept :
+        _filter(filter), _refs(refs) {}
+
+    /// Does the step use a reference resolved from a path the filter selects?
+    bool selected = false;
+
+    /// The scenario a predicate step is checked in
+    optional<Scenario> scenario;
+
+    virtual void specialRef(const IRSource& source,
+                            const shared_ptr<Command>& c,
+                            SpecialRef entity,
+                            Ref::ID output) noexcept override {
+      resolves(c, output, false);
+    }
+
+    virtual void pipeRef(const IRSource& source,
+                         const shared_ptr<Command>& c,
+                         Ref::ID read_end,
+                         Ref::ID write_end) noexcept override {
+      resolves(c, read_end, false);
+      resolves(c, write_end, false);
+    }
+
+    virtual void fileRef(const IRSource& source,
+                         const shared_ptr<Command>& c,
+                         mode_t mode,
+                         Ref::ID output) noexcept override {
+      resolves(c, output, false);
+    }
+
+    virtual void symlinkRef(const IRSource& source,
+                            const shared_ptr<Command>& c,
+                            const fs::path& target,
+                            Ref::ID output) noexcept override {
+      resolves(c, output, false);
+    }
+
+    virtual void dirRef(const IRSource& source,
+                        const shared_ptr<Command>& c,
+                        mode_t mode,
+                        Ref::ID output) noexcept override {
+      resolves(c, output, false);
+    }
+
+    virtual void pathRef(const IRSource& source,
+                         const shared_ptr<Command>& c,
+                         Ref::ID base,
+                         const fs::path& path,
+                         AccessFlags flags,
+                         Ref::ID output) noexcept override {
+      if (_filter.path.has_value()) {
+        const auto& prefix = _filter.path.value();
+        selected = uses(c, base) || path.native().compare(0, prefix.size(), prefix) == 0;
+      }
+      resolves(c, output, selected);
+    }
+
+    virtual void usingRef(const IRSource& source,
+                          const shared_ptr<Command>& c,
+                          Ref::ID ref) noexcept override {
+      selected = uses(c, ref);
+    }
+
+    virtual void doneWithRef(const IRSource& source,
+                             const shared_ptr<Command>& c,
+                             Ref::ID ref) noexcept override {
+      selected = uses(c, ref);
+    }
+
+    virtual void compareRefs(const IRSource& source,
+                             const shared_ptr<Command>& c,
+                             Ref::ID ref1,
+                             Ref::ID ref2,
+                             RefComparison type) noexcept override {
+      selected = uses(c, ref1) || uses(c, ref2);
+    }
+
+    virtual void expectResult(const IRSource& source,
+                              const shared_ptr<Command>& c,
+                              Scenario scenario,
+                              Ref::ID ref,
+                              int8_t expected) noexcept override {
+      selected = uses(c, ref);
+      this->scenario = scenario;
+    }
+
+    virtual void matchMetadata(const IRSource& source,
+                               const shared_ptr<Command>& c,
+                               Scenario scenario,
+                               Ref::ID ref,
+                               const MetadataVersion& version) noexcept override {
+      selected = uses(c, ref);
+      this->scenario = scenario;
+    }
+
+    virtual void matchContent(const IRSource& source,
+                              const shared_ptr<Command>& c,
+                              Scenario scenario,
+                              Ref::ID ref,
+                              const shared_ptr<ContentVersion>& version) noexcept override {
+      selected = uses(c, ref);
+      this->scenario = scenario;
+    }
+
+    virtual void updateMetadata(const IRSource& source,
+                                const shared_ptr<Command>& c,
+                                Ref::ID ref,
+                                const MetadataVersion& version) noexcept override {
+      selected = uses(c, ref);
+    }
+
+    virtual void updateContent(const IRSource& source,
+                               const shared_ptr<Command>& c,
+                               Ref::ID ref,
+                               const shared_ptr<ContentVersion>& version) noexcept override {
+      selected = uses(c, ref);
+    }
+
+    virtual void addEntry(const IRSource& source,
+                          const shared_ptr<Command>& c,
+                          Ref::ID dir,
+                          const string& name,
+                          Ref::ID target) noexcept override {
+      selected = uses(c, dir) || uses(c, target);
+    }
+
+    virtual void removeEntry(const IRSource& source,
+                             const shared_ptr<Command>& c,
+                             Ref::ID dir,
+                             const string& name,
+                             Ref::ID target) noexcept override {
+      selected = uses(c, dir) || uses(c, target);
+    }
+
+    virtual void launch(const IRSource& source,
+                        const shared_ptr<Command>& c,
+                        const shared_ptr<Command>& child,
+                        const list<tuple<Ref::ID, Ref::ID>>& refs) noexcept override {
+      // The child starts with the selected references its parent passes to it
+      for (const auto& [parent_ref, child_ref] : refs) {
+        if (uses(c, parent_ref)) {
+          _refs[child.get()].insert(child_ref);
+          selected = true;
+        }
+      }
+    }
+
+   private:
+    /// Does a command's reference come from a selected path? Only tracked with a path filter.
+    bool uses(const shared_ptr<Command>& c, Ref::ID ref) noexcept {
+      if (!_filter.path.has_value()) return false;
+      auto iter = _refs.find(c.get());
+      return iter != _refs.end() && iter->second.count(ref) > 0;
+    }
+
+    /// Record whether a reference produced by a command was resolved from a selected path
+    void resolves(const shared_ptr<Command>& c, Ref::ID ref, bool selected) noexcept {
+      if (!_filter.path.has_value()) return;
+      if (selected) {
+        _refs[c.get()].insert(ref);
+      } else {
+        _refs[c.get()].erase(ref);
+      }
+    }
+
+    const TraceFilter& _filter;
+    std::unordered_map<const Command*, std::set<Ref::ID>>& _refs;
+  };
+}
+
+// Check the next record against the active filter. A record that does not pass is skipped.
+bool TraceReader::passesFilter(RecordType type) noexcept {
+  // Records that are not IR steps define commands, versions, and strings that later steps use
+  if (getStepName(type) == nullptr) return true;
+
+  // The step is decoded to check it, then rewound if it passes so it can be handled. Decoding
+  // moves the current command's last reference forward, so that has to be rewound too.
+  size_t start = _file.pos;
+  Ref::ID last_ref = lastRef();
+
+  StepFilter step(*_filter, _filter_refs);
+  handleNext(step);
+
+  // Check the step against each part of the filter
+  bool pass = _filter_types[static_cast<uint8_t>(type)] && commandPassesFilter();
+  if (pass && _filter->path.has_value()) pass = step.selected;
+  if (pass && _filter->scenario.has_value()) {
+    pass = step.scenario.has_value() && (step.scenario.value() & _filter->scenario.value());
+  }
+
+  // Rewind to the start of a step that passed. A step that did not pass is already skipped.
+  if (pass) {
+    _file.pos = start;
+    lastRef() = last_ref;
+  }
+
+  return pass;
+}
+
 /********** Process an input trace **********/
 
+// Send the steps in a loaded trace that pass a filter to an IRSink
+void TraceReader::sendTo(IRSink& sink, const TraceFilter& filter) noexcept {
+  _filter = &filter;
+
+  // Decide which record types pass the filter up front
+  _filter_types.assign(std::numeric_limits<uint8_t>::max() + 1, false);
+  for (size_t i = 0; i < _filter_types.size(); i++) {
+    auto name = getStepName(static_cast<RecordType>(i));
+    if (name && (filter.steps.empty() || filter.steps.count(name) > 0)) _filter_types[i] = true;
+  }
+
+  sendTo(sink);
+
+  _filter = nullptr;
+  _filter_commands.clear();
+  _filter_refs.clear();
+}
+
 void TraceReader::sendTo(IRSink& sink) noexcept {
   while (!done()) {
-    // Handle the next record
-    switch (peek()) {
-      case RecordType::Start:
-        handleRecord<RecordType::Start>(sink);
-        break;
+    // Skip over steps that do not pass the filter, if there is one
+    if (_filter && !passesFilter(peek())) continue;
 
-      case RecordType::Finish:
-        handleRecord<RecordType::Finish>(sink);
-        break;
+    handleNext(sink);
+  }
+}
 
-      case RecordType::SpecialRef:
-        handleRecord<RecordType::SpecialRef>(sink);
-        break;
+// Decode the next record in the trace and send it to an IRSink
+void TraceReader::handleNext(IRSink& sink) noexcept {
+  switch (peek()) {
+    case RecordType::Start:
+      handleRecord<RecordType::Start>(sink);
+      break;
 
-      case RecordType::PipeRef:
-        handleRecord<RecordType::PipeRef>(sink);
-        break;
+    case RecordType::Finish:
+      handleRecord<RecordType::Finish>(sink);
+      break;
 
-      case RecordType::FileRef:
-        handleRecord<RecordType::FileRef>(sink);
-        break;
+    case RecordType::SpecialRef:
+      handleRecord<RecordType::SpecialRef>(sink);
+      break;
 
-      case RecordType::SymlinkRef:
-        handleRecord<RecordType::SymlinkRef>(sink);
-        break;
+    case RecordType::PipeRef:
+      handleRecord<RecordType::PipeRef>(sink);
+      break;
 
-      case RecordType::DirRef:
-        handleRecord<RecordType::DirRef>(sink);
-        break;
+    case RecordType::FileRef:
+      handleRecord<RecordType::FileRef>(sink);
+      break;
 
-      case RecordType::PathRef:
-        handleRecord<RecordType::PathRef>(sink);
-        break;
-
-      case RecordType::UsingRef:
-        handleRecord<RecordType::UsingRef>(sink);
-        break;
-
-      case RecordType::DoneWithRef:
-        handleRecord<RecordType::DoneWithRef>(sink);
-        break;
-
-      case RecordType::CompareRefs:
-        handleRecord<RecordType::CompareRefs>(sink);
-        break;
-
-      case RecordType::ExpectResult:
-        handleRecord<RecordType::ExpectResult>(sink);
-        break;
-
-      case RecordType::MatchMetadata:
-        handleRecord<RecordType::MatchMetadata>(sink);
-        break;
-
-      case RecordType::MatchContent:
-        handleRecord<RecordType::MatchContent>(sink);
-        break;
-
-      case RecordType::UpdateMetadata:
-        handleRecord<RecordType::UpdateMetadata>(sink);
-        break;
-
-      case RecordType::UpdateContent:
-        handleRecord<RecordType::UpdateContent>(sink);
-        break;
-
-      case RecordType::AddEntry:
-        handleRecord<RecordType::AddEntry>(sink);
-        break;
-
-      case RecordType::RemoveEntry:
-        handleRecord<RecordType::RemoveEntry>(sink);
-        break;
-
-      case RecordType::Launch:
-        handleRecord<RecordType::Launch>(sink);
-        break;
-
-      case RecordType::Join:
-        handleRecord<RecordType::Join>(sink);
-        break;
-
-      case RecordType::Exit:
-        handleRecord<RecordType::Exit>(sink);
-        break;
-
-      case RecordType::Command:
-        handleRecord<RecordType::Command>(sink);
-        break;
-
-      case RecordType::String:
-        handleRecord<RecordType::String>(sink);
-        break;
-
-      case RecordType::NewStrtab:
-        handleRecord<RecordType::NewStrtab>(sink);
-        break;
-
-      case RecordType::End:
-        handleRecord<RecordType::End>(sink);
-        break;
-
-      case RecordType::FileVersion:
-        handleRecord<RecordType::FileVersion>(sink);
-        break;
+    case RecordType::SymlinkRef:
+      handleRecord<RecordType::SymlinkRef>(sink);
+      break;
 
-      case RecordType::SymlinkVersion:
-        handleRecord<RecordType::SymlinkVersion>(sink);
-        break;
+    case RecordType::DirRef:
+      handleRecord<RecordType::DirRef>(sink);
+      break;
 
-      case RecordType::DirListVersion:
-        handleRecord<RecordType::DirListVersion>(sink);
-        break;
+    case RecordType::PathRef:
+      handleRecord<RecordType::PathRef>(sink);
+      break;
 
-      case RecordType::PipeWriteVersion:
-        handleRecord<RecordType::PipeWriteVersion>(sink);
-        break;
+    case RecordType::UsingRef:
+      handleRecord<RecordType::UsingRef>(sink);
+      break;
 
-      case RecordType::PipeCloseVersion:
-        handleRecord<RecordType::PipeCloseVersion>(sink);
-        break;
+    case RecordType::DoneWithRef:
+      handleRecord<RecordType::DoneWithRef>(sink);
+      break;
 
-      case RecordType::PipeReadVersion:
-        handleRecord<RecordType::PipeReadVersion>(sink);
-        break;
+    case RecordType::CompareRefs:
+      handleRecord<RecordType::CompareRefs>(sink);
+      break;
 
-      case RecordType::SpecialVersion:
-        handleRecord<RecordType::SpecialVersion>(sink);
-        break;
+    case RecordType::ExpectResult:
+      handleRecord<RecordType::ExpectResult>(sink);
+      break;
 
-      case RecordType::SetCommand:
-        handleRecord<RecordType::SetCommand>(sink);
-        break;
-    }
+    case RecordType::MatchMetadata:
+      handleRecord<RecordType::MatchMetadata>(sink);
+      break;
+
+    case RecordType::MatchContent:
+      handleRecord<RecordType::MatchContent>(sink);
+      break;
+
+    case RecordType::UpdateMetadata:
+      handleRecord<RecordType::UpdateMetadata>(sink);
+      break;
+
+    case RecordType::UpdateContent:
+      handleRecord<RecordType::UpdateContent>(sink);
+      break;
+
+    case RecordType::AddEntry:
+      handleRecord<RecordType::AddEntry>(sink);
+      break;
+
+    case RecordType::RemoveEntry:
+      handleRecord<RecordType::RemoveEntry>(sink);
+      break;
+
+    case RecordType::Launch:
+      handleRecord<RecordType::Launch>(sink);
+      break;
+
+    case RecordType::Join:
+      handleRecord<RecordType::Join>(sink);
+      break;
+
+    case RecordType::Exit:
+      handleRecord<RecordType::Exit>(sink);
+      break;
+
+    case RecordType::Command:
+      handleRecord<RecordType::Command>(sink);
+      break;
+
+    case RecordType::String:
+      handleRecord<RecordType::String>(sink);
+      break;
+
+    case RecordType::NewStrtab:
+      handleRecord<RecordType::NewStrtab>(sink);
+      break;
+
+    case RecordType::End:
+      handleRecord<RecordType::End>(sink);
+      break;
+
+    case RecordType::Profile:
+      handleRecord<RecordType::Profile>(sink);
+      break;
+
+    case RecordType::FileVersion:
+      handleRecord<RecordType::FileVersion>(sink);
+      break;
+
+    case RecordType::SymlinkVersion:
+      handleRecord<RecordType::SymlinkVersion>(sink);
+      break;
+
+    case RecordType::DirListVersion:
+      handleRecord<RecordType::DirListVersion>(sink);
+      break;
+
+    case RecordType::PipeWriteVersion:
+      handleRecord<RecordType::PipeWriteVersion>(sink);
+      break;
+
+    case RecordType::PipeCloseVersion:
+      handleRecord<RecordType::PipeCloseVersion>(sink);
+      break;
+
+    case RecordType::PipeReadVersion:
+      handleRecord<RecordType::PipeReadVersion>(sink);
+      break;
+
+    case RecordType::SpecialVersion:
+      handleRecord<RecordType::SpecialVersion>(sink);
+      break;
+
+    case RecordType::SetCommand:
+      handleRecord<RecordType::SetCommand>(sink);
+      break;
   }
 }
@@ -3,9 +3,12 @@
 #include <map>
 #include <memory>
 #include <optional>
+#include <regex>
+#include <set>
 #include <string>
 #include <tuple>
 #include <unordered_map>
+#include <vector>
 
 #include "data/IRSink.hh"
 #include "data/IRSource.hh"
@@ -72,6 +75,32 @@ struct TraceFile {
   void destroy() noexcept;
 };
 
+/**
+ * A TraceFilter limits the IR steps a TraceReader sends to its sink. The reader checks each step
+ * record against the filter before it looks up any commands or versions, so steps that are
+ * filtered out cost no more than skipping over their bytes.
+ */
+struct TraceFilter {
+  /// The names of the IR steps a filter can select
+  inline static const std::set<std::string> StepTypes = {
+      "SpecialRef", "PipeRef", "FileRef", "SymlinkRef", "DirRef", "PathRef", "UsingRef",
+      "DoneWithRef", "CompareRefs", "ExpectResult", "MatchMetadata", "MatchContent",
+      "UpdateMetadata", "UpdateContent", "AddEntry", "RemoveEntry", "Launch", "Join", "Exit"};
+
+  /// Only send steps from commands whose full command line matches this pattern
+  std::optional<std::regex> command;
+
+  /// Only send steps that resolve a path starting with this prefix, or that use a reference
+  /// resolved that way
+  std::optional<std::string> path;
+
+  /// Only send these kinds of steps. An empty set sends every kind.
+  std::set<std::string> steps;
+
+  /// Only send predicate steps that are checked in this scenario
+  std::optional<Scenario> scenario;
+};
+
 class TraceReader : public IRSource {
  public:
   /// Create a new TraceReader to load from a provided path
@@ -94,6 +123,14 @@ class TraceReader : public IRSource {
   /// Accept r-value reference to a sink
   void sendTo(IRSink&& handler) noexcept { return sendTo(handler); }
 
+  /// Send the steps in a loaded trace that pass a filter to an IRSink
+  void sendTo(IRSink& sink, const TraceFilter& filter) noexcept;
+
+  /// Accept r-value reference to a sink
+  void sendTo(IRSink&& handler, const TraceFilter& filter) noexcept {
+    return sendTo(handler, filter);
+  }
+
   /// Get the root command
   std::shared_ptr<Command> getRootCommand() const noexcept;
 
@@ -113,17 +150,27 @@ class TraceReader : public IRSource {
   /// Peek at the type of the next record
   RecordType peek() const noexcept;
 
-  /// Get a reference to a record in the trace
+  /// Decode the next record in the trace
   template <RecordType T>
-  const Record<T>& takeRecord() noexcept;
+  Record<T> takeRecord() noexcept;
+
+  /// Decode a value with a list of fields from the trace
+  template <typename T>
+  T takeValue() noexcept;
 
-  /// Get a reference to data in the trace of a requested type
+  /// Decode an array of fields from the trace
   template <typename T>
-  const T& takeValue() noexcept;
+  std::vector<T> takeArray(size_t count) noexcept;
 
-  /// Get a reference to an array in the trace
+  /// Decode a single field from the trace
   template <typename T>
-  const T* takeArray(size_t count) noexcept;
+  void takeField(T& field) noexcept;
+
+  /// Decode a LEB128 varint from the trace
+  uint64_t takeVarint() noexcept;
+
+  /// Get the last reference used by the current command, which the next reference is relative to
+  Ref::ID& lastRef() noexcept;
 
   /// Get a pointer to a string in the trace and advance the current position past the string
   const char* takeString() noexcept;
@@ -132,6 +179,15 @@ class TraceReader : public IRSource {
   template <RecordType T>
   void handleRecord(IRSink& sink) noexcept;
 
+  /// Decode the next record and send it to an IRSink
+  void handleNext(IRSink& sink) noexcept;
+
+  /// Check the next record against the active filter. A record that does not pass is skipped.
+  bool passesFilter(RecordType type) noexcept;
+
+  /// Check if the current command's command line matches the active filter
+  bool commandPassesFilter() noexcept;
+
   /// Get a command from the table of commands
   const std::shared_ptr<Command>& getCommand(Command::ID id) const noexcept;
 
@@ -180,6 +236,21 @@ class TraceReader : public IRSource {
 
   /// The current command
   std::shared_ptr<Command> _current_command;
+
+  /// The last reference used by each command, indexed by command ID
+  std::vector<Ref::ID> _last_refs;
+
+  /// The filter applied to steps, or nullptr to send every step
+  const TraceFilter* _filter = nullptr;
+
+  /// The record types that pass the active filter, indexed by type
+  std::vector<bool> _filter_types;
+
+  /// The results of matching commands against the active filter, indexed by command ID
+  std::unordered_map<Command::ID, bool> _filter_commands;
+
+  /// The references in each command that were resolved from a path the active filter selects
+  std::unordered_map<const Command*, std::set<Ref::ID>> _filter_refs;
 };
 
 class TraceWriter : public IRSink {
@@ -229,7 +300,7 @@ class TraceWriter : public IRSink {
   /// Handle a SymlinkRef IR step
   virtual void symlinkRef(const IRSource& source,
                           const std::shared_ptr<Command>& command,
-                          fs::path target,
+                          const fs::path& target,
                           Ref::ID output) noexcept override;
 
   /// Handle a DirRef IR step
@@ -242,7 +313,7 @@ class TraceWriter : public IRSink {
   virtual void pathRef(const IRSource& source,
                        const std::shared_ptr<Command>& command,
                        Ref::ID base,
-                       fs::path path,
+                       const fs::path& path,
                        AccessFlags flags,
                        Ref::ID output) noexcept override;
 
@@ -275,46 +346,46 @@ class TraceWriter : public IRSink {
                              const std::shared_ptr<Command>& command,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion version) noexcept override;
+                             const MetadataVersion& version) noexcept override;
 
   /// Handel a MatchContent IR step
   virtual void matchContent(const IRSource& source,
                             const std::shared_ptr<Command>& command,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> version) noexcept override;
+                            const std::shared_ptr<ContentVersion>& version) noexcept override;
 
   /// Handle an UpdateMetadata IR step
   virtual void updateMetadata(const IRSource& source,
                               const std::shared_ptr<Command>& command,
                               Ref::ID ref,
-                              MetadataVersion version) noexcept override;
+                              const MetadataVersion& version) noexcept override;
 
   /// Handle an UpdateContent IR step
   virtual void updateContent(const IRSource& source,
                              const std::shared_ptr<Command>& command,
                              Ref::ID ref,
-                             std::shared_ptr<ContentVersion> version) noexcept override;
+                             const std::shared_ptr<ContentVersion>& version) noexcept override;
 
   /// Handle an AddEntry IR step
   virtual void addEntry(const IRSource& source,
                         const std::shared_ptr<Command>& command,
                         Ref::ID dir,
-                        std::string name,
+                        const std::string& name,
                         Ref::ID target) noexcept override;
 
   /// Handle a RemoveEntry IR step
   virtual void removeEntry(const IRSource& source,
                            const std::shared_ptr<Command>& command,
                            Ref::ID dir,
-                           std::string name,
+                           const std::string& name,
                            Ref::ID target) noexcept override;
 
   /// Handle a Launch IR step
   virtual void launch(const IRSource& source,
                       const std::shared_ptr<Command>& command,
                       const std::shared_ptr<Command>& child,
-                      std::list<std::tuple<Ref::ID, Ref::ID>> refs) noexcept override;
+                      const std::list<std::tuple<Ref::ID, Ref::ID>>& refs) noexcept override;
 
   /// Handle a Join IR step
   virtual void join(const IRSource& source,
@@ -332,13 +403,23 @@ class TraceWriter : public IRSink {
   template <RecordType T, typename... Args>
   void emitRecord(Args... args) noexcept;
 
-  /// Write a value to the trace
+  /// Write a value with a list of fields to the trace
   template <typename T, typename... Args>
   void emitValue(Args... args) noexcept;
 
-  /// Emit an array to the trace
+  /// Emit an array of fields to the trace
+  template <typename T>
+  void emitArray(const T* src, size_t count) noexcept;
+
+  /// Write a single field to the trace
   template <typename T>
-  void emitArray(T* src, size_t count) noexcept;
+  void emitField(const T& field) noexcept;
+
+  /// Write a LEB128 varint to the trace
+  void emitVarint(uint64_t value) noexcept;
+
+  /// Get the last reference used by the current command, which the next reference is relative to
+  Ref::ID& lastRef() noexcept;
 
   /// Get the ID of a command, possibly writing it to the output if it is new
   Command::ID getCommandID(const std::shared_ptr<Command>& command) noexcept;
@@ -426,4 +507,10 @@ class TraceWriter : public IRSink {
 
   /// The current command
   std::shared_ptr<Command> _current_command;
+
+  /// The ID of the current command
+  Command::ID _current_command_id = 0;
+
+  /// The last reference used by each command, indexed by command ID
+  std::vector<Ref::ID> _last_refs;
 };
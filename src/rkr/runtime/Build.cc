@@ -1,5 +1,6 @@
 #include "Build.hh"
 
+#include <algorithm>
 #include <cstdio>
 #include <filesystem>
 #include <iostream>
@@ -9,10 +10,14 @@
 #include <ostream>
 #include <sstream>
 #include <string>
+#include <tuple>
 #include <vector>
 
+#include <sys/stat.h>
+
 #include "artifacts/Artifact.hh"
 #include "artifacts/DirArtifact.hh"
+#include "artifacts/FileArtifact.hh"
 #include "artifacts/PipeArtifact.hh"
 #include "artifacts/SymlinkArtifact.hh"
 #include "data/AccessFlags.hh"
@@ -23,7 +28,10 @@
 #include "runtime/env.hh"
 #include "runtime/policy.hh"
 #include "tracing/Tracer.hh"
+#include "util/Pool.hh"
+#include "util/Timeline.hh"
 #include "util/TracePrinter.hh"
+#include "util/WorkQueue.hh"
 #include "util/log.hh"
 #include "util/options.hh"
 #include "util/stats.hh"
@@ -77,7 +85,7 @@ void Build::finish() noexcept {
   _tracer.wait(*this);
 
   // Compare the final state of all artifacts to the actual filesystem
-  env::getRootDir()->checkFinalState("/");
+  checkFinalState();
 
   // Finish the run of the root command and all descendants (recursively)
   _root_command->finishRun();
@@ -89,6 +97,50 @@ void Build::finish() noexcept {
   _root_command.reset();
 }
 
+void Build::checkFinalState() noexcept {
+  timeline::Span span("Check final state");
+
+  // Collect the artifacts to check, in the order a recursive walk from the root would visit them
+  vector<tuple<shared_ptr<Artifact>, fs::path>> artifacts;
+  env::getRootDir()->gatherFinalState("/", artifacts);
+
+  // Find the files whose checks will stat them
+  vector<size_t> to_stat;
+  for (size_t i = 0; i < artifacts.size(); i++) {
+    auto& [artifact, path] = artifacts[i];
+    auto file = artifact->as<FileArtifact>();
+    if (file && file->needsFinalStat()) to_stat.push_back(i);
+  }
+
+  // Stat those files in batches on worker threads. Each result goes in its own slot, so the
+  // workers share nothing.
+  vector<struct stat> stat_results(artifacts.size());
+  vector<char> stat_ok(artifacts.size(), false);
+  {
+    WorkQueue queue(options::io_threads);
+    for (size_t start = 0; start < to_stat.size(); start += StatBatchSize) {
+      size_t end = std::min(start + StatBatchSize, to_stat.size());
+      queue.add([&, start, end] {
+        for (size_t j = start; j < end; j++) {
+          size_t i = to_stat[j];
+          stat_ok[i] = lstatNoSync(std::get<1>(artifacts[i]), stat_results[i]) == 0;
+        }
+      });
+    }
+    queue.wait();
+  }
+
+  // Apply the checks in order on this thread
+  for (size_t i = 0; i < artifacts.size(); i++) {
+    auto& [artifact, path] = artifacts[i];
+    if (stat_ok[i]) {
+      artifact->as<FileArtifact>()->checkFinalState(path, &stat_results[i]);
+    } else {
+      artifact->checkFinalState(path);
+    }
+  }
+}
+
 void Build::specialRef(const IRSource& source,
                        const shared_ptr<Command>& c,
                        SpecialRef entity,
@@ -119,28 +171,28 @@ void Build::specialRef(const IRSource& source,
   if (entity == SpecialRef::stdin) {
     // Create the stdin ref. Add one user, which accounts for the build tool itself
     // That way we won't close stdin when the build is finishing
-    auto stdin_ref = make_shared<Ref>(ReadAccess, env::getStdin(c));
+    auto stdin_ref = make_pooled<Ref>(ReadAccess, env::getStdin(c));
     stdin_ref->addUser();
     c->setRef(output, stdin_ref);
 
   } else if (entity == SpecialRef::stdout) {
     // Create the stdout ref and add one user (the build tool)
-    auto stdout_ref = make_shared<Ref>(WriteAccess, env::getStdout(c));
+    auto stdout_ref = make_pooled<Ref>(WriteAccess, env::getStdout(c));
     stdout_ref->addUser();
     c->setRef(output, stdout_ref);
 
   } else if (entity == SpecialRef::stderr) {
     // Create the stderr ref and add one user (the build tool)
-    auto stderr_ref = make_shared<Ref>(WriteAccess, env::getStderr(c));
+    auto stderr_ref = make_pooled<Ref>(WriteAccess, env::getStderr(c));
     stderr_ref->addUser();
     c->setRef(output, stderr_ref);
 
   } else if (entity == SpecialRef::root) {
-    c->setRef(output, make_shared<Ref>(ReadAccess + ExecAccess, env::getRootDir()));
+    c->setRef(output, make_pooled<Ref>(ReadAccess + ExecAccess, env::getRootDir()));
 
   } else if (entity == SpecialRef::cwd) {
     auto cwd_path = fs::current_path().relative_path();
-    auto ref = make_shared<Ref>(env::getRootDir()->resolve(c, cwd_path, ReadAccess + ExecAccess));
+    auto ref = make_pooled<Ref>(env::getRootDir()->resolve(c, cwd_path, ReadAccess + ExecAccess));
     c->setRef(output, ref);
 
     ASSERT(ref->isSuccess()) << "Failed to resolve current working directory";
@@ -150,7 +202,7 @@ void Build::specialRef(const IRSource& source,
     auto rkr = readlink("/proc/self/exe");
     auto rkr_launch = (rkr.parent_path() / "rkr-launch").relative_path();
 
-    auto ref = make_shared<Ref>(env::getRootDir()->resolve(c, rkr_launch, ReadAccess + ExecAccess));
+    auto ref = make_pooled<Ref>(env::getRootDir()->resolve(c, rkr_launch, ReadAccess + ExecAccess));
     c->setRef(output, ref);
 
   } else {
@@ -190,8 +242,8 @@ void Build::pipeRef(const IRSource& source,
 
   // Resolve the reference and save the result in output
   auto pipe = env::getPipe(c);
-  c->setRef(read_end, make_shared<Ref>(ReadAccess, pipe));
-  c->setRef(write_end, make_shared<Ref>(WriteAccess, pipe));
+  c->setRef(read_end, make_pooled<Ref>(ReadAccess, pipe));
+  c->setRef(write_end, make_pooled<Ref>(WriteAccess, pipe));
 }
 
 // A command references a new anonymous file
@@ -225,13 +277,13 @@ void Build::fileRef(const IRSource& source,
   _output.fileRef(source, c, mode, output);
 
   // Resolve the reference and save the result in output
-  c->setRef(output, make_shared<Ref>(ReadAccess + WriteAccess, env::createFile(c, mode)));
+  c->setRef(output, make_pooled<Ref>(ReadAccess + WriteAccess, env::createFile(c, mode)));
 }
 
 // A command references a new anonymous symlink
 void Build::symlinkRef(const IRSource& source,
                        const shared_ptr<Command>& c,
-                       fs::path target,
+                       const fs::path& target,
                        Ref::ID output) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
@@ -260,7 +312,7 @@ void Build::symlinkRef(const IRSource& source,
 
   // Resolve the reference and save the result in output
   c->setRef(output,
-            make_shared<Ref>(ReadAccess + WriteAccess + ExecAccess, env::getSymlink(c, target)));
+            make_pooled<Ref>(ReadAccess + WriteAccess + ExecAccess, env::getSymlink(c, target)));
 }
 
 // A command references a new anonymous directory
@@ -294,14 +346,14 @@ void Build::dirRef(const IRSource& source,
   _output.dirRef(source, c, mode, output);
 
   // Resolve the reference and save the result in output
-  c->setRef(output, make_shared<Ref>(ReadAccess + WriteAccess + ExecAccess, env::getDir(c, mode)));
+  c->setRef(output, make_pooled<Ref>(ReadAccess + WriteAccess + ExecAccess, env::getDir(c, mode)));
 }
 
 // A command makes a reference with a path
 void Build::pathRef(const IRSource& source,
                     const shared_ptr<Command>& c,
                     Ref::ID base,
-                    fs::path path,
+                    const fs::path& path,
                     AccessFlags flags,
                     Ref::ID output) noexcept {
   // If the command must run but the step comes from a saved source, skip it
@@ -329,18 +381,19 @@ void Build::pathRef(const IRSource& source,
   // Get the directory where resolution should begin
   auto base_dir = c->getRef(base)->getArtifact();
 
-  // Is this a path to a temporary file?
+  // Is this a path to a temporary file? If so, the command may be running with different temporary
+  // file paths, so substitute the path now.
   bool is_tempfile = false;
+  fs::path substituted_path;
   if (base_dir == env::getRootDir() && path.string().substr(0, 4) == "tmp/") {
     is_tempfile = true;
-
-    // The command may be running different temporary file paths. Substitute the path now
     string newpath = c->substitutePath("/" + path.string());
-    path = fs::path(newpath.substr(1));
+    substituted_path = fs::path(newpath.substr(1));
   }
+  const fs::path& resolve_path = is_tempfile ? substituted_path : path;
 
   // Create an IR step and add it to the output trace
-  _output.pathRef(source, c, base, path, flags, output);
+  _output.pathRef(source, c, base, resolve_path, flags, output);
 
   // Is the base directory available?
   if (!base_dir) {
@@ -349,7 +402,7 @@ void Build::pathRef(const IRSource& source,
   }
 
   // Resolve the reference
-  shared_ptr<Ref> result = make_shared<Ref>(base_dir->resolve(c, path, flags));
+  shared_ptr<Ref> result = make_pooled<Ref>(base_dir->resolve(c, resolve_path, flags));
 
   // If this reference was to a temporary file, inform the command
   if (result->isSuccess() && is_tempfile) c->addTempfile(result->getArtifact());
@@ -540,7 +593,7 @@ void Build::matchMetadata(const IRSource& source,
                           const shared_ptr<Command>& c,
                           Scenario scenario,
                           Ref::ID ref_id,
-                          MetadataVersion expected) noexcept {
+                          const MetadataVersion& expected) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
 
@@ -589,7 +642,7 @@ void Build::matchContent(const IRSource& source,
                          const shared_ptr<Command>& c,
                          Scenario scenario,
                          Ref::ID ref_id,
-                         shared_ptr<ContentVersion> expected) noexcept {
+                         const shared_ptr<ContentVersion>& expected) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
 
@@ -631,7 +684,7 @@ void Build::matchContent(const IRSource& source,
 void Build::updateMetadata(const IRSource& source,
                            const shared_ptr<Command>& c,
                            Ref::ID ref_id,
-                           MetadataVersion written) noexcept {
+                           const MetadataVersion& written) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
 
@@ -682,7 +735,7 @@ void Build::updateMetadata(const IRSource& source,
 void Build::updateContent(const IRSource& source,
                           const shared_ptr<Command>& c,
                           Ref::ID ref_id,
-                          shared_ptr<ContentVersion> written) noexcept {
+                          const shared_ptr<ContentVersion>& written) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
 
@@ -733,7 +786,7 @@ void Build::updateContent(const IRSource& source,
 void Build::addEntry(const IRSource& source,
                      const shared_ptr<Command>& c,
                      Ref::ID dir_id,
-                     string name,
+                     const string& name,
                      Ref::ID target_id) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
@@ -761,6 +814,9 @@ void Build::addEntry(const IRSource& source,
   auto dir = c->getRef(dir_id);
   auto target = c->getRef(target_id);
 
+  // If the entry name is substituted for a temporary file, the new name is saved here
+  string substituted_name;
+
   // Did both references resolve?
   if (dir->isResolved() && target->isResolved()) {
     // Is this adding an entry in /tmp/? If so, do path substitution
@@ -770,12 +826,13 @@ void Build::addEntry(const IRSource& source,
       string newname = newpath.substr(dirname.size() + 1);
       if (newname != name) {
         LOG(exec) << "Replaced " << name << " with " << newname;
+        substituted_name = std::move(newname);
       }
-      name = newname;
     }
 
     // Yes. Add the entry to the directory
-    dir->getArtifact()->addEntry(c, name, target->getArtifact());
+    dir->getArtifact()->addEntry(c, substituted_name.empty() ? name : substituted_name,
+                                 target->getArtifact());
 
   } else {
     // No. Are we emulating or tracing?
@@ -791,14 +848,15 @@ void Build::addEntry(const IRSource& source,
   }
 
   // Create an IR step and add it to the output trace
-  _output.addEntry(source, c, dir_id, name, target_id);
+  _output.addEntry(source, c, dir_id, substituted_name.empty() ? name : substituted_name,
+                   target_id);
 }
 
 // Command c removes an entry from a directory
 void Build::removeEntry(const IRSource& source,
                         const shared_ptr<Command>& c,
                         Ref::ID dir_id,
-                        string name,
+                        const string& name,
                         Ref::ID target_id) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (c->mustRun() && !source.isExecuting()) return;
@@ -826,6 +884,9 @@ void Build::removeEntry(const IRSource& source,
   auto dir = c->getRef(dir_id);
   auto target = c->getRef(target_id);
 
+  // If the entry name is substituted for a temporary file, the new name is saved here
+  string substituted_name;
+
   // Did both references resolve?
   if (dir->isResolved() && target->isResolved()) {
     // Is this removing an entry in /tmp/? If so, do path substitution
@@ -835,12 +896,13 @@ void Build::removeEntry(const IRSource& source,
       string newname = newpath.substr(dirname.size() + 1);
       if (newname != name) {
         LOG(exec) << "Replaced " << name << " with " << newname;
+        substituted_name = std::move(newname);
       }
-      name = newname;
     }
 
     // Yes. Remove the entry from the directory
-    dir->getArtifact()->removeEntry(c, name, target->getArtifact());
+    dir->getArtifact()->removeEntry(c, substituted_name.empty() ? name : substituted_name,
+                                    target->getArtifact());
 
   } else {
     // No. Are we emulating or tracing?
@@ -856,14 +918,15 @@ void Build::removeEntry(const IRSource& source,
   }
 
   // Create an IR step and add it to the output trace
-  _output.removeEntry(source, c, dir_id, name, target_id);
+  _output.removeEntry(source, c, dir_id, substituted_name.empty() ? name : substituted_name,
+                      target_id);
 }
 
 // A parent command launches a child command
 void Build::launch(const IRSource& source,
                    const shared_ptr<Command>& parent,
                    const shared_ptr<Command>& child,
-                   list<tuple<Ref::ID, Ref::ID>> refs) noexcept {
+                   const list<tuple<Ref::ID, Ref::ID>>& refs) noexcept {
   // If the command must run but the step comes from a saved source, skip it
   if (parent->mustRun() && !source.isExecuting()) return;
 
@@ -894,6 +957,14 @@ void Build::launch(const IRSource& source,
   // Add the child to the parent's list of children
   parent->addChild(child);
 
+  // A MayRun child whose inputs have already changed would be marked MustRun by the next plan.
+  // With speculation enabled, run it in this phase instead of replaying the whole trace first.
+  if (options::speculate && child->mayRun() && child->hasExecuted() &&
+      child->hasChangedInputs(parent)) {
+    LOGF(rebuild, "{} must run: input changed before launch", child);
+    child->setMarking(RebuildMarking::MustRun);
+  }
+
   // Is the child going to run?
   if (child->mustRun()) {
     // Yes. The child is going to run
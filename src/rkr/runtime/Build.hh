@@ -75,7 +75,7 @@ class Build : public IRSink {
   /// A command references a new anonymous symlink
   virtual void symlinkRef(const IRSource& source,
                           const std::shared_ptr<Command>& c,
-                          fs::path target,
+                          const fs::path& target,
                           Ref::ID output) noexcept override;
 
   /// A command references a new anonymous directory
@@ -88,7 +88,7 @@ class Build : public IRSink {
   virtual void pathRef(const IRSource& source,
                        const std::shared_ptr<Command>& c,
                        Ref::ID base,
-                       fs::path path,
+                       const fs::path& path,
                        AccessFlags flags,
                        Ref::ID output) noexcept override;
 
@@ -121,46 +121,46 @@ class Build : public IRSink {
                              const std::shared_ptr<Command>& c,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion expected) noexcept override;
+                             const MetadataVersion& expected) noexcept override;
 
   /// A command accesses content for an artifact and expects to find a particular version
   virtual void matchContent(const IRSource& source,
                             const std::shared_ptr<Command>& c,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> expected) noexcept override;
+                            const std::shared_ptr<ContentVersion>& expected) noexcept override;
 
   /// A command modifies the metadata for an artifact
   virtual void updateMetadata(const IRSource& source,
                               const std::shared_ptr<Command>& c,
                               Ref::ID,
-                              MetadataVersion written) noexcept override;
+                              const MetadataVersion& written) noexcept override;
 
   /// A command writes a new version to an artifact
   virtual void updateContent(const IRSource& source,
                              const std::shared_ptr<Command>& c,
                              Ref::ID ref,
-                             std::shared_ptr<ContentVersion> written) noexcept override;
+                             const std::shared_ptr<ContentVersion>& written) noexcept override;
 
   /// A command adds an entry to a directory
   virtual void addEntry(const IRSource& source,
                         const std::shared_ptr<Command>& command,
                         Ref::ID dir,
-                        std::string name,
+                        const std::string& name,
                         Ref::ID target) noexcept override;
 
   /// A command removes an entry from a directory
   virtual void removeEntry(const IRSource& source,
                            const std::shared_ptr<Command>& command,
                            Ref::ID dir,
-                           std::string name,
+                           const std::string& name,
                            Ref::ID target) noexcept override;
 
   /// A parent command is launching a child command
   virtual void launch(const IRSource& source,
                       const std::shared_ptr<Command>& parent,
                       const std::shared_ptr<Command>& child,
-                      std::list<std::tuple<Ref::ID, Ref::ID>> refs) noexcept override;
+                      const std::list<std::tuple<Ref::ID, Ref::ID>>& refs) noexcept override;
 
   /// A command is joining with a child command
   virtual void join(const IRSource& source,
@@ -181,6 +181,14 @@ class Build : public IRSink {
                                        std::vector<std::string> args,
                                        const std::map<int, Ref::ID>& fds) noexcept;
 
+ private:
+  /// Compare the final state of all artifacts to the filesystem. Files are stat-ed in parallel
+  /// batches, then the checks are applied in order.
+  void checkFinalState() noexcept;
+
+  /// The number of files each worker stats at a time during the final state check
+  enum : size_t { StatBatchSize = 256 };
+
  private:
   /// Trace steps are sent to this trace handler, typically an OutputTrace
   IRSink& _output;
@@ -1,5 +1,6 @@
 #include "Command.hh"
 
+#include <algorithm>
 #include <filesystem>
 #include <list>
 #include <map>
@@ -168,7 +169,7 @@ string Command::getShortName(size_t limit) const noexcept {
       // Compute the new output length
       length = result.size();
       bool ellipsis = false;
-      for (int i = 1; i < _args.size(); i++) {
+      for (size_t i = 1; i < _args.size(); i++) {
         if (include_arg[i]) {
           length += _args[i].size() + 1;
           ellipsis = false;
@@ -271,6 +272,32 @@ bool Command::allFinished() const noexcept {
   return true;
 }
 
+// Has an input this command read from another command's output already changed?
+bool Command::hasChangedInputs(const shared_ptr<Command>& parent) noexcept {
+  // A command that exchanges uncached output with other commands, such as through a pipe, can
+  // only run alongside them in a planned phase
+  if (!_previous_run._needs_output_from.empty()) return false;
+  if (!_previous_run._output_needed_by.empty()) return false;
+
+  // Every command that produced an input must have exited, so its outputs are final. The parent
+  // is still running, but everything it did before launching this command has already happened.
+  for (const auto& weak_producer : _previous_run._uses_output_from) {
+    auto producer = weak_producer.lock();
+    if (producer == parent) continue;
+    if (!producer || producer->getExitStatus() == -1) return false;
+  }
+
+  // Compare each input to the artifact's current content
+  for (const auto& [artifact, expected] : _previous_run._content_inputs) {
+    if (!artifact->peekContent()->matches(expected)) {
+      LOGF(rebuild, "{} has a changed input {} (expected {})", *this, artifact, expected);
+      return true;
+    }
+  }
+
+  return false;
+}
+
 // Get a set of all commands including this one and its descendants
 set<shared_ptr<Command>> Command::collectCommands() noexcept {
   set<shared_ptr<Command>> result;
@@ -316,6 +343,74 @@ set<shared_ptr<Command>> Command::collectMustRun() noexcept {
   return result;
 }
 
+// Get the set of commands that can affect the artifacts at or below the given paths
+set<shared_ptr<Command>> Command::collectProducers(const set<fs::path>& paths) noexcept {
+  // Is a path equal to or inside one of the requested paths?
+  auto is_requested = [&](const fs::path& path) {
+    for (const auto& p : paths) {
+      if (std::mismatch(p.begin(), p.end(), path.begin(), path.end()).first == p.end()) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // Start with the commands that wrote to a requested path on their previous run
+  list<shared_ptr<Command>> worklist;
+  for (const auto& c : collectCommands()) {
+    for (const auto& [artifact, version] : c->_previous_run._outputs) {
+      auto path = artifact->getPath();
+      if (path.has_value() && is_requested(path.value())) {
+        worklist.push_back(c);
+        break;
+      }
+    }
+  }
+
+  set<shared_ptr<Command>> result;
+  while (!worklist.empty()) {
+    auto c = worklist.front();
+    worklist.pop_front();
+
+    // Skip commands that have already been added
+    if (!result.insert(c).second) continue;
+
+    // Any command that produced an input may change it. This covers uncached inputs too.
+    for (const auto& weak_producer : c->_previous_run._uses_output_from) {
+      if (auto producer = weak_producer.lock(); producer) worklist.push_back(producer);
+    }
+
+    // Commands that need uncached output from this one have to run alongside it
+    for (const auto& weak_user : c->_previous_run._output_needed_by) {
+      if (auto user = weak_user.lock(); user) worklist.push_back(user);
+    }
+
+    // If this command runs it launches its children again, and they may write the target for it.
+    // A command that is only emulated, like the shell that created a redirected output, replays
+    // its launches and does not pull in its other children.
+    if (c->_marking != RebuildMarking::Emulate) {
+      for (const auto& child : c->_previous_run._children) {
+        worklist.push_back(child);
+      }
+    }
+  }
+
+  return result;
+}
+
+// Emulate any command that is marked to run but is not in the given set
+void Command::limitPlan(const set<shared_ptr<Command>>& commands) noexcept {
+  _left_out = _marking != RebuildMarking::Emulate && commands.count(shared_from_this()) == 0;
+  if (_left_out) {
+    LOGF(rebuild, "{} will not run: it cannot affect the requested targets", *this);
+    _marking = RebuildMarking::Emulate;
+  }
+
+  for (const auto& child : _previous_run._children) {
+    child->limitPlan(commands);
+  }
+}
+
 // Assign a marking to this command. Return true if the marking is new.
 bool Command::mark(RebuildMarking m) noexcept {
   // See rebuild planning rules in docs/new-rebuild.md
@@ -461,6 +556,9 @@ bool Command::isLaunched() noexcept {
 void Command::setLaunched(shared_ptr<Process> p) noexcept {
   _current_run._launched = true;
   _current_run._process = p;
+
+  // A traced run replaces the profile from any earlier run
+  if (p) _profile = Profile();
 }
 
 const shared_ptr<Process>& Command::getProcess() noexcept {
@@ -668,6 +766,9 @@ void Command::addContentInput(shared_ptr<Artifact> a,
     _current_run._uses_output_from.emplace(writer);
     writer->_current_run._output_used_by.emplace(shared_from_this());
 
+    // Remember the version so a later phase can check it before this command launches
+    if (options::speculate) _current_run._content_inputs.emplace(a, v);
+
     // Is the version committable?
     if (!v->canCommit()) {
       // No. Is the input uncommitted? If so, the writer must produce it for this command
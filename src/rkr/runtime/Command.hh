@@ -133,6 +133,38 @@ class Command : public std::enable_shared_from_this<Command> {
   /// Record that this command has now been executed
   void setExecuted() noexcept { _executed = true; }
 
+  /// Resources used by a traced run of a command. CPU time, storage I/O, and memory use do not
+  /// include child processes the command waited for, since those are counted for their own
+  /// commands or for the same command as the process exits.
+  struct Profile {
+    /// Time from launch until the command's primary process exited
+    uint64_t wall_ns = 0;
+
+    /// CPU time spent in user mode
+    uint64_t user_ns = 0;
+
+    /// CPU time spent in the kernel
+    uint64_t sys_ns = 0;
+
+    /// The peak resident set size of any of the command's processes, in kilobytes
+    uint64_t max_rss_kb = 0;
+
+    /// Bytes read from storage, from the kernel's block input counts
+    uint64_t read_bytes = 0;
+
+    /// Bytes written to storage, from the kernel's block output counts
+    uint64_t write_bytes = 0;
+
+    /// The number of traced system calls
+    uint64_t syscalls = 0;
+  };
+
+  /// Get the resources used by the last traced run of this command
+  Profile& getProfile() noexcept { return _profile; }
+
+  /// Get the resources used by the last traced run of this command
+  const Profile& getProfile() const noexcept { return _profile; }
+
   /// Get the list of arguments this command was started with
   const std::vector<std::string>& getArguments() const noexcept { return _args; }
 
@@ -192,6 +224,11 @@ class Command : public std::enable_shared_from_this<Command> {
   /// Does this command or any of its descendants need to run? If not, return true.
   bool allFinished() const noexcept;
 
+  /// Has an input this command read from another command's output already changed? Only answers
+  /// yes once every command that produced its inputs has exited in the current phase, apart from
+  /// the parent that is launching this command.
+  bool hasChangedInputs(const std::shared_ptr<Command>& parent) noexcept;
+
   /// Get a set of all commands including this one and its descendants
   std::set<std::shared_ptr<Command>> collectCommands() noexcept;
 
@@ -201,6 +238,17 @@ class Command : public std::enable_shared_from_this<Command> {
   /// Get a set of all commands that must run from this command and its descendants
   std::set<std::shared_ptr<Command>> collectMustRun() noexcept;
 
+  /// Get the set of commands from this command and its descendants that can affect the artifacts
+  /// at or below the given paths. This includes the commands that wrote those artifacts on their
+  /// previous run, and every command whose output they used. Requires tracked outputs.
+  std::set<std::shared_ptr<Command>> collectProducers(const std::set<fs::path>& paths) noexcept;
+
+  /// Emulate any command in this subtree that is marked to run but is not in the given set
+  void limitPlan(const std::set<std::shared_ptr<Command>>& commands) noexcept;
+
+  /// Was this command marked to run in the latest plan, but left out by limitPlan?
+  bool isLeftOut() const noexcept { return _left_out; }
+
   /****** Types and struct used to track run-specific data ******/
 
   using WeakCommandSet = std::set<std::weak_ptr<Command>, std::owner_less<std::weak_ptr<Command>>>;
@@ -256,6 +304,10 @@ class Command : public std::enable_shared_from_this<Command> {
     /// Outputs from this command
     OutputList _outputs;
 
+    /// The first content version this command read from each artifact another command wrote. Only
+    /// recorded when speculation is enabled.
+    std::map<std::shared_ptr<Artifact>, std::shared_ptr<ContentVersion>> _content_inputs;
+
     /// The set of commands that produce any inputs to this command
     WeakCommandSet _uses_output_from;
 
@@ -417,6 +469,9 @@ class Command : public std::enable_shared_from_this<Command> {
   /// Has this command ever run?
   bool _executed = false;
 
+  /// Resources used by the last traced run of this command
+  Profile _profile;
+
   /// Transient data for the current run
   Run _current_run;
 
@@ -426,6 +481,9 @@ class Command : public std::enable_shared_from_this<Command> {
   /// The marking state for this command that determines how the command is run
   RebuildMarking _marking = RebuildMarking::Emulate;
 
+  /// Did the latest call to limitPlan keep this command from running?
+  bool _left_out = false;
+
   /// Short names of different lengths for this command
   mutable std::map<size_t, std::optional<std::string>> _short_names;
 
@@ -438,4 +496,10 @@ class Command : public std::enable_shared_from_this<Command> {
 };
 
 template <>
-struct fmt::formatter<Command> : fmt::ostream_formatter {};
+struct fmt::formatter<Command> : fmt::formatter<std::string> {
+  template <typename FormatContext>
+  auto format(const Command& c, FormatContext& ctx) const {
+    if (c.isEmptyCommand()) return fmt::format_to(ctx.out(), "[No Command]");
+    return fmt::format_to(ctx.out(), "[Command {}]", c.getShortName());
+  }
+};
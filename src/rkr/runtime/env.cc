@@ -2,12 +2,14 @@
 
 #include <cstddef>
 #include <filesystem>
-#include <list>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <tuple>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -21,7 +23,14 @@
 #include "artifacts/SpecialArtifact.hh"
 #include "artifacts/SymlinkArtifact.hh"
 #include "runtime/Command.hh"
+#include "util/ChangeJournal.hh"
+#include "util/InodeTable.hh"
+#include "util/Pool.hh"
+#include "util/SlotMap.hh"
+#include "util/Timeline.hh"
+#include "util/WorkQueue.hh"
 #include "util/log.hh"
+#include "util/options.hh"
 #include "util/stats.hh"
 #include "util/wrappers.hh"
 #include "versions/DirVersion.hh"
@@ -29,17 +38,20 @@
 #include "versions/MetadataVersion.hh"
 #include "versions/SymlinkVersion.hh"
 
-using std::list;
 using std::make_shared;
 using std::map;
-using std::pair;
-using std::set;
 using std::shared_ptr;
 using std::string;
+using std::tuple;
+using std::unordered_set;
+using std::vector;
 using std::weak_ptr;
 
 namespace fs = std::filesystem;
 
+// Limit the number of files staged from the cache whose data copies are waiting or in progress
+enum : size_t { MaxStagedCopies = 128 };
+
 namespace env {
   /// The next unique ID for a temporary file
   size_t _next_temp_id = 0;
@@ -50,11 +62,18 @@ namespace env {
   shared_ptr<Artifact> _stderr;       //< Standard error
   shared_ptr<DirArtifact> _root_dir;  //< The root directory
 
-  /// A set of all the artifacts used during the build
-  list<weak_ptr<Artifact>> _artifacts;
+  /// A registry of all the artifacts used during the build. Slots held by artifacts that have been
+  /// freed are reclaimed and reused.
+  SlotMap<Artifact> _artifacts;
+
+  /// A table of artifacts identified by inode, pointing to their slots in the artifact registry
+  InodeTable<SlotMap<Artifact>::Handle> _inodes;
+
+  /// The on-disk identity of each artifact with a committed path, recorded by snapshot()
+  map<fs::path, tuple<weak_ptr<Artifact>, struct stat>> _snapshot;
 
-  /// A map of artifacts identified by inode
-  map<pair<dev_t, ino_t>, weak_ptr<Artifact>> _inodes;
+  /// A journal of filesystem changes since the last snapshot
+  ChangeJournal _journal;
 
   // Reset the state of the environment by clearing all known artifacts
   void rollback() noexcept {
@@ -62,16 +81,186 @@ namespace env {
     _stdout.reset();
     _stderr.reset();
     if (_root_dir) _root_dir->rollback();
+
+    // Reclaim registry slots for artifacts that are no longer live, then drop their inode entries
+    if (_artifacts.collect() > 0) {
+      _inodes.eraseIf([](const SlotMap<Artifact>::Handle& h) { return !_artifacts.get(h); });
+    }
+  }
+
+  // Drop recorded versions that are not an input or output of any command in the build
+  void compactVersions(const shared_ptr<Command>& root) noexcept {
+    if (!options::track_inputs_outputs) return;
+
+    // Collect the versions referenced by the last run of every command in the tree
+    unordered_set<const Version*> live;
+    vector<shared_ptr<Command>> worklist = {root};
+    while (!worklist.empty()) {
+      auto c = worklist.back();
+      worklist.pop_back();
+
+      for (const auto& [a, v, writer] : c->getInputs()) live.insert(v.get());
+      for (const auto& [a, v] : c->getOutputs()) live.insert(v.get());
+      for (const auto& child : c->getChildren()) worklist.push_back(child);
+    }
+
+    size_t dropped = 0;
+    _artifacts.forEach(
+        [&](const shared_ptr<Artifact>& a) { dropped += a->compactVersions(live); });
+    LOGF(phase, "Dropped {} unreferenced versions from artifact histories", dropped);
+  }
+
+  // Discard every artifact in the environment
+  void reset() noexcept {
+    _stdin.reset();
+    _stdout.reset();
+    _stderr.reset();
+    _root_dir.reset();
+    _artifacts = SlotMap<Artifact>();
+    _inodes = InodeTable<SlotMap<Artifact>::Handle>();
+    _snapshot.clear();
+    _journal.clear();
+  }
+
+  // Record the on-disk identity of every artifact with a committed path
+  void snapshot() noexcept {
+    _snapshot.clear();
+
+    vector<tuple<shared_ptr<Artifact>, fs::path>> entries;
+    _artifacts.forEach([&](const shared_ptr<Artifact>& a) {
+      // Special artifacts are never cached from one build to the next, so skip them
+      if (a->as<SpecialArtifact>()) return;
+
+      auto path = a->getCommittedPath();
+      if (path.has_value()) entries.emplace_back(a, path.value());
+    });
+
+    // Start journaling changes before the paths are statted, so no change can fall in between.
+    // Watching each parent directory covers files, and directories are watched for new entries.
+    _journal.discard();
+    for (const auto& [a, path] : entries) {
+      _journal.watch(path.parent_path());
+      if (a->as<DirArtifact>()) _journal.watch(path);
+    }
+
+    for (const auto& [a, path] : entries) {
+      struct stat info;
+      if (::lstat(path.c_str(), &info) != 0) {
+        // The model does not match the filesystem, so the snapshot cannot be trusted
+        LOG(phase) << "Committed path " << path << " for " << a << " is missing: " << ERR;
+        info.st_ino = 0;
+      }
+
+      _snapshot.emplace(path, tuple{a, info});
+    }
+  }
+
+  // Check the artifacts recorded by the last snapshot against the filesystem
+  bool revalidate() noexcept {
+    // Nothing can be reused without a snapshot of a live environment
+    if (!_root_dir || _snapshot.empty()) {
+      reset();
+      return false;
+    }
+
+    // Look for files whose content or metadata changed in place, and any other kind of change
+    vector<tuple<shared_ptr<FileArtifact>, struct stat>> changed;
+    auto check = [&](const fs::path& path, const weak_ptr<Artifact>& weak_artifact,
+                     const struct stat& before) {
+      // Artifacts that have been freed do not need to be checked
+      auto a = weak_artifact.lock();
+      if (!a) return true;
+
+      // Did the path disappear, or does it now refer to a different inode or type?
+      struct stat info;
+      if (before.st_ino == 0 || lstatNoSync(path, info) != 0 || info.st_dev != before.st_dev ||
+          info.st_ino != before.st_ino || (info.st_mode & S_IFMT) != (before.st_mode & S_IFMT)) {
+        LOG(phase) << "Discarding environment: " << path << " was replaced or removed";
+        return false;
+      }
+
+      // Is the inode unchanged?
+      if (info.st_mtim.tv_sec == before.st_mtim.tv_sec &&
+          info.st_mtim.tv_nsec == before.st_mtim.tv_nsec &&
+          info.st_ctim.tv_sec == before.st_ctim.tv_sec &&
+          info.st_ctim.tv_nsec == before.st_ctim.tv_nsec && info.st_size == before.st_size) {
+        return true;
+      }
+
+      // Only regular files can be refreshed in place. A changed directory may have entries the
+      // model does not know about.
+      auto file = a->as<FileArtifact>();
+      if (!file) {
+        LOG(phase) << "Discarding environment: " << path << " changed";
+        return false;
+      }
+
+      changed.emplace_back(file, info);
+      return true;
+    };
+
+    // If the change journal is complete, only the paths it recorded can have changed. Otherwise
+    // every path in the snapshot has to be checked.
+    bool ok = true;
+    if (auto changes = _journal.getChanges(); changes != nullptr) {
+      LOG(phase) << "Checking " << changes->size() << " changed paths from the change journal";
+      for (const auto& path : *changes) {
+        auto iter = _snapshot.find(path);
+        if (iter == _snapshot.end()) continue;
+
+        const auto& [weak_artifact, before] = iter->second;
+        if (!(ok = check(path, weak_artifact, before))) break;
+      }
+    } else {
+      LOG(phase) << "Change journal is incomplete. Checking all " << _snapshot.size() << " paths";
+      for (const auto& [path, entry] : _snapshot) {
+        const auto& [weak_artifact, before] = entry;
+        if (!(ok = check(path, weak_artifact, before))) break;
+      }
+    }
+
+    if (!ok) {
+      reset();
+      return false;
+    }
+
+    // Refresh the files that changed in place
+    for (const auto& [file, info] : changed) {
+      LOG(phase) << "Refreshing " << file << " from the filesystem";
+      file->refreshCommittedState(info);
+    }
+
+    return true;
   }
 
   // Fingerprint and cache any versions on the filesystem
-  void cacheAll() noexcept { getRootDir()->cacheAll("/"); }
+  void cacheAll() noexcept {
+    timeline::Span span("Cache all");
+    getRootDir()->cacheAll("/");
+  }
 
   // Commit all changes to the filesystem
-  void commitAll() noexcept { getRootDir()->applyFinalState("/"); }
+  void commitAll() noexcept {
+    timeline::Span span("Commit all");
+
+    // Create directories and commit links, renames, and unlinks in order on this thread. Data for
+    // files staged from the cache is copied on worker threads in the meantime.
+    // Each queued copy holds two open files, so the number in flight is limited
+    WorkQueue staging(options::io_threads, MaxStagedCopies);
+    FileVersion::setStagingQueue(&staging);
+    getRootDir()->commitFinalState("/");
+    FileVersion::setStagingQueue(nullptr);
+
+    // Every copy has to land before the staged files are fingerprinted
+    staging.wait();
+    FileVersion::checkStagedCopies();
+
+    // Fingerprint and cache the final state, and commit any remaining metadata
+    getRootDir()->applyFinalState("/");
+  }
 
-  // Get the set of all artifacts
-  const list<weak_ptr<Artifact>>& getArtifacts() noexcept { return _artifacts; }
+  // Get the registry of all artifacts
+  const SlotMap<Artifact>& getArtifacts() noexcept { return _artifacts; }
 
   shared_ptr<Artifact> getStdin(const shared_ptr<Command>& c) noexcept {
     if (!_stdin) {
@@ -89,7 +278,7 @@ namespace env {
       a->setName("stdin");
 
       // Record stats for this artifact
-      _artifacts.push_back(_stdin);
+      _artifacts.insert(_stdin);
       stats::artifacts++;
     }
 
@@ -112,7 +301,7 @@ namespace env {
       a->setName("stdout");
 
       // Record stats for this artifact
-      _artifacts.push_back(_stdout);
+      _artifacts.insert(_stdout);
       stats::artifacts++;
     }
 
@@ -135,7 +324,7 @@ namespace env {
       a->setName("stderr");
 
       // Record stats for this artifact
-      _artifacts.push_back(_stderr);
+      _artifacts.insert(_stderr);
       stats::artifacts++;
     }
 
@@ -192,26 +381,25 @@ namespace env {
     if (rc != 0) return nullptr;
 
     // Does the inode for this path match an artifact we've already created?
-    auto inode_iter = _inodes.find({info.st_dev, info.st_ino});
-    if (inode_iter != _inodes.end()) {
-      // Found a match. Is the weak pointer still valid?
-      auto result = inode_iter->second.lock();
+    if (auto handle = _inodes.find(info.st_dev, info.st_ino); handle != nullptr) {
+      // Found a match. Does the handle still refer to a live artifact?
+      auto result = _artifacts.get(*handle);
       if (result) return result;
 
-      // Invalid weak pointer, so we can erase the entry
-      _inodes.erase(inode_iter);
+      // The artifact has been freed, so we can erase the entry
+      _inodes.erase(info.st_dev, info.st_ino);
     }
 
     // Create a new artifact for this inode
     shared_ptr<Artifact> a;
     if ((info.st_mode & S_IFMT) == S_IFREG) {
       // The path refers to a regular file
-      auto cv = make_shared<FileVersion>(info);
+      auto cv = make_pooled<FileVersion>(info);
       a = make_shared<FileArtifact>(MetadataVersion(info), cv);
 
     } else if ((info.st_mode & S_IFMT) == S_IFDIR) {
       // The path refers to a directory
-      auto dv = make_shared<BaseDirVersion>(false);
+      auto dv = make_pooled<BaseDirVersion>(false);
       a = make_shared<DirArtifact>(MetadataVersion(info), dv);
 
     } else if ((info.st_mode & S_IFMT) == S_IFLNK) {
@@ -235,16 +423,13 @@ namespace env {
       // The path refers to something else
       if (!a) {
         WARN << "Unexpected filesystem node type at " << path << ". Treating it as a file.";
-        auto cv = make_shared<FileVersion>(info);
+        auto cv = make_pooled<FileVersion>(info);
         a = make_shared<FileArtifact>(MetadataVersion(info), cv);
       }
     }
 
-    // Add the new artifact to the inode map
-    _inodes.emplace_hint(inode_iter, pair{info.st_dev, info.st_ino}, a);
-
-    // Also add the artifact to the set of all artifacts
-    _artifacts.push_back(a);
+    // Add the artifact to the registry of all artifacts, and record its slot in the inode table
+    _inodes.insert(info.st_dev, info.st_ino, _artifacts.insert(a));
     stats::artifacts++;
 
     // Return the artifact
@@ -263,7 +448,7 @@ namespace env {
     // Set the pipe's metadata on behalf of the command
     pipe->updateMetadata(c, MetadataVersion(uid, gid, mode));
 
-    _artifacts.push_back(pipe);
+    _artifacts.insert(pipe);
     stats::artifacts++;
 
     return pipe;
@@ -282,7 +467,7 @@ namespace env {
     symlink->updateMetadata(c, MetadataVersion(uid, gid, mode));
     symlink->updateContent(c, make_shared<SymlinkVersion>(target));
 
-    _artifacts.push_back(symlink);
+    _artifacts.insert(symlink);
     stats::artifacts++;
 
     return symlink;
@@ -303,7 +488,7 @@ namespace env {
     // Set the metadata for the new directory artifact
     dir->updateMetadata(c, MetadataVersion(uid, gid, stat_mode));
 
-    _artifacts.push_back(dir);
+    _artifacts.insert(dir);
     stats::artifacts++;
 
     return dir;
@@ -316,7 +501,7 @@ namespace env {
     mode_t stat_mode = S_IFREG | (mode & 0777);
 
     // Create an initial content version
-    auto cv = make_shared<FileVersion>();
+    auto cv = make_pooled<FileVersion>();
     cv->makeEmptyFingerprint();
 
     // Create the artifact and return it
@@ -329,7 +514,7 @@ namespace env {
     // Observe output to metadata and content for the new file
     c->addContentOutput(artifact, cv);
 
-    _artifacts.push_back(artifact);
+    _artifacts.insert(artifact);
     stats::artifacts++;
 
     return artifact;
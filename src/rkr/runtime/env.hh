@@ -1,12 +1,12 @@
 #pragma once
 
 #include <filesystem>
-#include <list>
 #include <memory>
-#include <set>
 
 #include <sys/types.h>
 
+#include "util/SlotMap.hh"
+
 namespace fs = std::filesystem;
 
 class Artifact;
@@ -23,6 +23,30 @@ namespace env {
   /// Reset the environment to match filesystem state
   void rollback() noexcept;
 
+  /**
+   * Drop the versions remembered by each artifact that are no longer an input or output of any
+   * command reachable from root. This only does work when options::track_inputs_outputs is set.
+   * Call it between phases, once the last run of every command has finished.
+   */
+  void compactVersions(const std::shared_ptr<Command>& root) noexcept;
+
+  /// Discard every artifact in the environment, so the next build starts from the filesystem
+  void reset() noexcept;
+
+  /// Record the on-disk identity of every artifact with a committed path, and start a journal of
+  /// changes to their directories. The environment must be fully committed, as it is after a build
+  /// and a rollback.
+  void snapshot() noexcept;
+
+  /**
+   * Check the artifacts recorded by the last snapshot against the filesystem. Only paths in the
+   * change journal are checked, unless the journal is incomplete. Files whose content or metadata
+   * changed in place are refreshed from disk. Any other change, or a missing snapshot, resets the
+   * environment.
+   * \returns true if the environment was kept
+   */
+  bool revalidate() noexcept;
+
   /// Fingerprint and cache any versions on the filesystem
   void cacheAll() noexcept;
 
@@ -44,8 +68,8 @@ namespace env {
   /// Get a unique path to a temporary file in the build directory
   fs::path getTempPath() noexcept;
 
-  /// Get a set of all the artifacts in the build
-  const std::list<std::weak_ptr<Artifact>>& getArtifacts() noexcept;
+  /// Get the registry of all the artifacts in the build
+  const SlotMap<Artifact>& getArtifacts() noexcept;
 
   /**
    * Get an artifact to represent a statted file/dir/pipe/symlink.
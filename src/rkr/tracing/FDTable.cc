@@ -0,0 +1,111 @@
+#include "FDTable.hh"
+
+#include <map>
+#include <memory>
+
+#include "runtime/Build.hh"
+#include "runtime/Command.hh"
+#include "util/log.hh"
+
+using std::map;
+using std::shared_ptr;
+
+FDTable::FDTable(Ref::ID cwd, Ref::ID root, map<int, FileDescriptor> fds) noexcept :
+    _cwd(cwd), _root(root), _fds(fds) {
+  _ref_counts[_cwd]++;
+  _ref_counts[_root]++;
+  for (const auto& [fd, desc] : _fds) {
+    _ref_counts[std::get<0>(desc)]++;
+  }
+}
+
+// Record a use of every Ref in this table
+void FDTable::use(Build& build, const IRSource& source, const shared_ptr<Command>& c) noexcept {
+  for (const auto& [ref, count] : _ref_counts) {
+    build.usingRef(source, c, ref);
+  }
+}
+
+// End this table's use of every Ref it contains
+void FDTable::release(Build& build, const IRSource& source, const shared_ptr<Command>& c) noexcept {
+  for (const auto& [ref, count] : _ref_counts) {
+    build.doneWithRef(source, c, ref);
+  }
+  _ref_counts.clear();
+}
+
+// Update the working directory
+void FDTable::setWorkingDir(Build& build,
+                            const IRSource& source,
+                            const shared_ptr<Command>& c,
+                            Ref::ID ref) noexcept {
+  addRef(build, source, c, ref);
+  removeRef(build, source, c, _cwd);
+  _cwd = ref;
+}
+
+// Add a file descriptor entry
+void FDTable::addFD(Build& build,
+                    const IRSource& source,
+                    const shared_ptr<Command>& c,
+                    int fd,
+                    Ref::ID ref,
+                    bool cloexec) noexcept {
+  // Take the new use first, so replacing an entry with the same Ref does not end the use
+  addRef(build, source, c, ref);
+
+  if (auto iter = _fds.find(fd); iter != _fds.end()) {
+    auto [old_ref, old_cloexec] = iter->second;
+    _fds.erase(iter);
+    removeRef(build, source, c, old_ref);
+  }
+
+  _fds.emplace(fd, FileDescriptor(ref, cloexec));
+}
+
+// Remove a file descriptor entry
+bool FDTable::closeFD(Build& build,
+                      const IRSource& source,
+                      const shared_ptr<Command>& c,
+                      int fd) noexcept {
+  auto iter = _fds.find(fd);
+  if (iter == _fds.end()) return false;
+
+  auto [old_ref, old_cloexec] = iter->second;
+  _fds.erase(iter);
+  removeRef(build, source, c, old_ref);
+  return true;
+}
+
+// Set a file descriptor's close-on-exec flag
+void FDTable::setCloexec(int fd, bool cloexec) noexcept {
+  auto iter = _fds.find(fd);
+  ASSERT(iter != _fds.end())
+      << "Attempted to set the cloexec flag for non-existent file descriptor " << fd;
+
+  const auto [ref, old_cloexec] = iter->second;
+  iter->second = FileDescriptor{ref, cloexec};
+}
+
+// Count an entry that refers to a Ref
+void FDTable::addRef(Build& build,
+                     const IRSource& source,
+                     const shared_ptr<Command>& c,
+                     Ref::ID ref) noexcept {
+  if (_ref_counts[ref]++ == 0) build.usingRef(source, c, ref);
+}
+
+// Remove an entry that refers to a Ref
+void FDTable::removeRef(Build& build,
+                        const IRSource& source,
+                        const shared_ptr<Command>& c,
+                        Ref::ID ref) noexcept {
+  auto iter = _ref_counts.find(ref);
+  ASSERT(iter != _ref_counts.end() && iter->second > 0)
+      << "Attempted to remove an unknown use of ref r" << ref << " from a file descriptor table";
+
+  if (--iter->second == 0) {
+    _ref_counts.erase(iter);
+    build.doneWithRef(source, c, ref);
+  }
+}
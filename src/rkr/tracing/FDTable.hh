@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <tuple>
+
+#include "data/IRSource.hh"
+#include "runtime/Ref.hh"
+
+class Build;
+class Command;
+
+/**
+ * An FDTable holds a process' file descriptors, along with references to its working and root
+ * directories. Processes forked from one another share a table until one of them changes it, so a
+ * fork adds no steps to the trace.
+ *
+ * A table holds one use of each Ref it contains, no matter how many entries refer to that Ref. The
+ * command running in the table's processes emits a usingRef step when a Ref enters the table and a
+ * doneWithRef step when its last entry leaves.
+ */
+class FDTable {
+ public:
+  /// Keep track of file descriptors with a reference, and a boolean to track whether or not the
+  /// descriptor is closed on an exec syscall
+  using FileDescriptor = std::tuple<Ref::ID, bool>;
+
+  /// Create a table. The caller is responsible for recording the table's uses of its Refs.
+  FDTable(Ref::ID cwd, Ref::ID root, std::map<int, FileDescriptor> fds) noexcept;
+
+  /// Record a use of every Ref in this table by a command
+  void use(Build& build, const IRSource& source, const std::shared_ptr<Command>& c) noexcept;
+
+  /// End this table's use of every Ref it contains
+  void release(Build& build, const IRSource& source, const std::shared_ptr<Command>& c) noexcept;
+
+  /// Get the working directory
+  Ref::ID getWorkingDir() const noexcept { return _cwd; }
+
+  /// Set the working directory
+  void setWorkingDir(Build& build,
+                     const IRSource& source,
+                     const std::shared_ptr<Command>& c,
+                     Ref::ID ref) noexcept;
+
+  /// Get the root directory
+  Ref::ID getRoot() const noexcept { return _root; }
+
+  /// Get the file descriptor entries in this table
+  const std::map<int, FileDescriptor>& getFDs() const noexcept { return _fds; }
+
+  /// Add a file descriptor entry, replacing any existing entry with the same number
+  void addFD(Build& build,
+             const IRSource& source,
+             const std::shared_ptr<Command>& c,
+             int fd,
+             Ref::ID ref,
+             bool cloexec) noexcept;
+
+  /// Remove a file descriptor entry. Return true if the entry existed.
+  bool closeFD(Build& build,
+               const IRSource& source,
+               const std::shared_ptr<Command>& c,
+               int fd) noexcept;
+
+  /// Set a file descriptor's close-on-exec flag
+  void setCloexec(int fd, bool cloexec) noexcept;
+
+ private:
+  /// Count an entry that refers to a Ref, and record a use if it is the first
+  void addRef(Build& build,
+              const IRSource& source,
+              const std::shared_ptr<Command>& c,
+              Ref::ID ref) noexcept;
+
+  /// Remove an entry that refers to a Ref, and end the use if it was the last
+  void removeRef(Build& build,
+                 const IRSource& source,
+                 const std::shared_ptr<Command>& c,
+                 Ref::ID ref) noexcept;
+
+ private:
+  /// A reference to the current working directory
+  Ref::ID _cwd;
+
+  /// A reference to the current root directory
+  Ref::ID _root;
+
+  /// The file descriptor entries
+  std::map<int, FileDescriptor> _fds;
+
+  /// The number of entries, including the working and root directories, that refer to each Ref
+  std::map<Ref::ID, size_t> _ref_counts;
+};
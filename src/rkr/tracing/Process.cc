@@ -1,5 +1,8 @@
 #include "Process.hh"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <list>
 #include <map>
@@ -10,14 +13,18 @@
 #include <utility>
 #include <vector>
 
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 
 #include "artifacts/Artifact.hh"
 #include "runtime/Build.hh"
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
+#include "util/Timeline.hh"
 #include "util/log.hh"
+#include "util/options.hh"
 
 using std::function;
 using std::list;
@@ -37,7 +44,7 @@ Process::Process(Build& build,
                  Ref::ID root,
                  map<int, FileDescriptor> fds,
                  optional<mode_t> umask) noexcept :
-    _command(command), _pid(pid), _cwd(cwd), _root(root), _fds(fds) {
+    _command(command), _pid(pid), _fds(make_shared<FDTable>(cwd, root, fds)) {
   // Set the process' default umask if one was not provided
   if (!umask.has_value()) {
     _umask = ::umask(0);
@@ -46,37 +53,52 @@ Process::Process(Build& build,
     _umask = umask.value();
   }
 
-  // The new process has an open handle to each file descriptor in the _fds table
-  for (auto& [index, desc] : _fds) {
-    auto& [ref, cloexec] = desc;
-    build.usingRef(source, _command, ref);
-  }
-
-  // The child process also duplicates references to the root and working directories
-  // TODO: Do we need to track _exe here as well?
-  build.usingRef(source, _command, _root);
-  build.usingRef(source, _command, _cwd);
+  // The new process uses each Ref in its file descriptor table, including the root and working
+  // directories
+  _fds->use(build, source, _command);
 }
 
+Process::Process(shared_ptr<Command> command,
+                 pid_t pid,
+                 shared_ptr<FDTable> fds,
+                 mode_t umask) noexcept :
+    _command(command), _pid(pid), _umask(umask), _fds(fds) {}
+
 /*******************************************/
 /********** Utilities for tracing **********/
 /*******************************************/
 
+// Get the file descriptor table to modify it
+FDTable& Process::writeFDs(Build& build, const IRSource& source) noexcept {
+  // Is the table shared with another process? If so, this process needs its own copy
+  if (_fds.use_count() > 1) {
+    _fds = make_shared<FDTable>(*_fds);
+    _fds->use(build, source, _command);
+  }
+
+  return *_fds;
+}
+
+// Stop using the file descriptor table
+void Process::releaseFDs(Build& build, const IRSource& source) noexcept {
+  // If this is the last process using the table, the command is done with its Refs
+  if (_fds.use_count() == 1) _fds->release(build, source, _command);
+
+  // Keep an empty table with the same directories in case the process is inspected after it exits.
+  // The table does not hold uses of its Refs, and is never released.
+  _fds = make_shared<FDTable>(getWorkingDir(), getRoot(), map<int, FileDescriptor>());
+}
+
 // Update a process' working directory
 void Process::setWorkingDir(Build& build, const IRSource& source, Ref::ID ref) noexcept {
-  // The process no longer saves its old cwd reference, and now saves the new working directory.
-  // Encode this with close and open steps in the IR layer
-  build.doneWithRef(source, _command, _cwd);
-  build.usingRef(source, _command, ref);
-
-  // Update the cwd
-  _cwd = ref;
+  writeFDs(build, source).setWorkingDir(build, source, _command, ref);
 }
 
 // Get a file descriptor entry
 Ref::ID Process::getFD(int fd) noexcept {
-  auto iter = _fds.find(fd);
-  ASSERT(iter != _fds.end()) << "Attempted to access an unknown fd " << fd << " in " << this;
+  const auto& fds = _fds->getFDs();
+  auto iter = fds.find(fd);
+  ASSERT(iter != fds.end()) << "Attempted to access an unknown fd " << fd << " in " << this;
 
   return std::get<0>(iter->second);
 }
@@ -87,59 +109,44 @@ void Process::addFD(Build& build,
                     int fd,
                     Ref::ID ref,
                     bool cloexec) noexcept {
-  if (auto iter = _fds.find(fd); iter != _fds.end()) {
+  if (hasFD(fd)) {
     WARN << "Overwriting an existing fd " << fd << " in " << this;
-    auto& [old_ref, old_cloexec] = iter->second;
-    WARN << "  Existing fd references " << getCommand()->getRef(old_ref)->getArtifact();
-    build.doneWithRef(source, _command, old_ref);
-    _fds.erase(iter);
+    WARN << "  Existing fd references " << getCommand()->getRef(getFD(fd))->getArtifact();
   }
 
-  // The command holds an additional handle to the provided Ref
-  build.usingRef(source, _command, ref);
-
   // Add the entry to the process' file descriptor table
-  _fds.emplace(fd, FileDescriptor(ref, cloexec));
+  writeFDs(build, source).addFD(build, source, _command, fd, ref, cloexec);
 }
 
 // Close a file descriptor
 void Process::closeFD(Build& build, const IRSource& source, int fd) noexcept {
-  auto iter = _fds.find(fd);
-  if (iter == _fds.end()) {
+  if (!tryCloseFD(build, source, fd)) {
     LOG(trace) << "Closing an unknown file descriptor " << fd << " in " << this;
-  } else {
-    auto& [old_ref, old_cloexec] = iter->second;
-    build.doneWithRef(source, _command, old_ref);
-    _fds.erase(iter);
   }
 }
 
 // Remove a file descriptor entry if it exists
 bool Process::tryCloseFD(Build& build, const IRSource& source, int fd) noexcept {
-  auto iter = _fds.find(fd);
-  if (iter != _fds.end()) {
-    auto& [old_ref, old_cloexec] = iter->second;
-    build.doneWithRef(source, _command, old_ref);
-    _fds.erase(iter);
-    return true;
-  }
-  return false;
+  // Closing a descriptor that does not exist should not copy a shared table
+  if (!hasFD(fd)) return false;
+  return writeFDs(build, source).closeFD(build, source, _command, fd);
 }
 
 // Set a file descriptor's close-on-exec flag
-void Process::setCloexec(int fd, bool cloexec) noexcept {
-  auto iter = _fds.find(fd);
-  ASSERT(iter != _fds.end())
-      << "Attempted to set the cloexec flag for non-existent file descriptor " << fd;
-
-  const auto& [ref, old_cloexec] = iter->second;
-  iter->second = FileDescriptor{ref, cloexec};
+void Process::setCloexec(Build& build, const IRSource& source, int fd, bool cloexec) noexcept {
+  writeFDs(build, source).setCloexec(fd, cloexec);
 }
 
 // The process is creating a new child
 shared_ptr<Process> Process::fork(Build& build, const IRSource& source, pid_t child_pid) noexcept {
+  // The child shares this process' file descriptor table until one of them modifies it
+  auto child = make_shared<Process>(_command, child_pid, _fds, _umask);
+
+  // The child reports its resource use back to this process when it exits
+  child->_parent = shared_from_this();
+
   // Return the child process object
-  return make_shared<Process>(build, source, _command, child_pid, _cwd, _root, _fds, _umask);
+  return child;
 }
 
 // The process is executing a new file
@@ -153,7 +160,7 @@ const shared_ptr<Command>& Process::exec(Build& build,
   map<int, Ref::ID> inherited_fds;
 
   // Loop over this process' file descriptors to find the ones that are inherited (not cloexec)
-  for (const auto& [fd, desc] : _fds) {
+  for (const auto& [fd, desc] : _fds->getFDs()) {
     const auto& [ref, cloexec] = desc;
 
     // If this fd is inherited by the child, record it
@@ -167,8 +174,8 @@ const shared_ptr<Command>& Process::exec(Build& build,
   list<tuple<Ref::ID, Ref::ID>> refs;
 
   // The child inherits standard references
-  refs.emplace_back(_root, Ref::Root);
-  refs.emplace_back(_cwd, Ref::Cwd);
+  refs.emplace_back(getRoot(), Ref::Root);
+  refs.emplace_back(getWorkingDir(), Ref::Cwd);
   refs.emplace_back(exe_ref, Ref::Exe);
 
   // The child also inherits references for initial file descriptors
@@ -194,30 +201,23 @@ const shared_ptr<Command>& Process::exec(Build& build,
 
   // The parent command is no longer using any references in this process
   //_build.traceDoneWithRef(_command, exe_ref);
-  build.doneWithRef(source, _command, _cwd);
-  build.doneWithRef(source, _command, _root);
-
-  for (const auto& [fd, desc] : _fds) {
-    auto [ref, cloexec] = desc;
-    build.doneWithRef(source, _command, ref);
-  }
+  releaseFDs(build, source);
 
   // This process is now running the child
   _command = child;
 
-  // This process is the primary process for its command
+  // This process is the primary process for its command, which starts running now
   _primary = true;
+  _start = std::chrono::steady_clock::now();
 
-  // Clear the file descriptor map and fill it in with the child command's reference IDs
-  _fds.clear();
-
+  // Start a new file descriptor table with the child command's reference IDs. The launch already
+  // recorded the child's use of these references.
+  map<int, FileDescriptor> fds;
   for (auto& [fd, ref] : child->getInitialFDs()) {
-    _fds.emplace(fd, FileDescriptor{ref, false});
+    fds.emplace(fd, FileDescriptor{ref, false});
   }
 
-  // Update the cwd and root references for the process to use refs from the new command
-  _cwd = Ref::Cwd;
-  _root = Ref::Root;
+  _fds = make_shared<FDTable>(Ref::Cwd, Ref::Root, fds);
 
   // TODO: Remove mmaps from the previous command, unless they're mapped in multiple processes
   // that participate in that command. This will require some extra bookkeeping. For now, we
@@ -226,6 +226,51 @@ const shared_ptr<Command>& Process::exec(Build& build,
   return _command;
 }
 
+// Convert a timeval to nanoseconds
+static uint64_t to_ns(const struct timeval& tv) noexcept {
+  return tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+}
+
+// Get the difference between two counters, or zero if the second is larger
+static uint64_t difference(uint64_t a, uint64_t b) noexcept {
+  return a > b ? a - b : 0;
+}
+
+// Add the resources this process used to its command's profile
+void Process::recordUsage(const struct rusage& usage) noexcept {
+  auto& profile = _command->getProfile();
+
+  // The kernel's totals include every child this process waited for. Those children added their
+  // own usage to a profile when they exited, so only count the difference here.
+  profile.user_ns += difference(to_ns(usage.ru_utime), to_ns(_child_usage.ru_utime));
+  profile.sys_ns += difference(to_ns(usage.ru_stime), to_ns(_child_usage.ru_stime));
+  profile.read_bytes += difference(usage.ru_inblock, _child_usage.ru_inblock) * 512;
+  profile.write_bytes += difference(usage.ru_oublock, _child_usage.ru_oublock) * 512;
+
+  // The peak RSS covers this process and its children. It only belongs to this process if it is
+  // larger than every child's peak.
+  if (usage.ru_maxrss > _child_usage.ru_maxrss) {
+    profile.max_rss_kb = std::max<uint64_t>(profile.max_rss_kb, usage.ru_maxrss);
+  }
+
+  // The command's wall time ends when its primary process exits
+  if (_primary) {
+    profile.wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - _start)
+                          .count();
+  }
+
+  // Pass the totals on to the parent, which will include them in its own usage
+  if (auto parent = _parent.lock()) {
+    auto& totals = parent->_child_usage;
+    timeradd(&totals.ru_utime, &usage.ru_utime, &totals.ru_utime);
+    timeradd(&totals.ru_stime, &usage.ru_stime, &totals.ru_stime);
+    totals.ru_inblock += usage.ru_inblock;
+    totals.ru_oublock += usage.ru_oublock;
+    totals.ru_maxrss = std::max(totals.ru_maxrss, usage.ru_maxrss);
+  }
+}
+
 // The process is exiting
 void Process::exit(Build& build, const IRSource& source, int exit_status) noexcept {
   // We only need to handle the exit if the process hasn't already been marked as exited. That will
@@ -234,18 +279,19 @@ void Process::exit(Build& build, const IRSource& source, int exit_status) noexce
     // Mark the process as exited
     _exited = true;
 
-    // References to the cwd and root directories are closed
-    build.doneWithRef(source, _command, _cwd);
-    build.doneWithRef(source, _command, _root);
-
-    // Any remaining file descriptors in this process are closed
-    for (const auto& [index, desc] : _fds) {
-      const auto& [ref, cloexec] = desc;
-      build.doneWithRef(source, _command, ref);
-    }
+    // References to the cwd and root directories and any remaining file descriptors are closed
+    // once no other process shares the table
+    releaseFDs(build, source);
 
     // If this process was the primary for its command, trace the exit
-    if (_primary) build.exit(source, _command, exit_status);
+    if (_primary) {
+      build.exit(source, _command, exit_status);
+
+      if (timeline::enabled) {
+        timeline::addCommand(_command->getShortName(options::command_length),
+                             _command->getFullName(), _start, timeline::Clock::now());
+      }
+    }
   }
 }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <map>
 #include <memory>
@@ -9,11 +10,13 @@
 #include <tuple>
 #include <vector>
 
+#include <sys/resource.h>
 #include <sys/types.h>
 
 #include "data/IRSource.hh"
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
+#include "tracing/FDTable.hh"
 
 class Build;
 
@@ -21,7 +24,7 @@ class Process : public std::enable_shared_from_this<Process> {
  public:
   /// Keep track of file descriptors with a reference, and a boolean to track whether or not the
   /// descriptor is closed on an exec syscall
-  using FileDescriptor = std::tuple<Ref::ID, bool>;
+  using FileDescriptor = FDTable::FileDescriptor;
 
   Process(Build& build,
           const IRSource& source,
@@ -32,6 +35,12 @@ class Process : public std::enable_shared_from_this<Process> {
           std::map<int, FileDescriptor> fds,
           std::optional<mode_t> umask = std::nullopt) noexcept;
 
+  /// Create a process that shares an existing file descriptor table
+  Process(std::shared_ptr<Command> command,
+          pid_t pid,
+          std::shared_ptr<FDTable> fds,
+          mode_t umask) noexcept;
+
   /// Get the process ID
   pid_t getID() const noexcept { return _pid; }
 
@@ -39,10 +48,10 @@ class Process : public std::enable_shared_from_this<Process> {
   const std::shared_ptr<Command>& getCommand() const noexcept { return _command; }
 
   /// Get the root directory
-  Ref::ID getRoot() const noexcept { return _root; }
+  Ref::ID getRoot() const noexcept { return _fds->getRoot(); }
 
   /// Get the working directory
-  Ref::ID getWorkingDir() const noexcept { return _cwd; }
+  Ref::ID getWorkingDir() const noexcept { return _fds->getWorkingDir(); }
 
   /// Set the working directory
   void setWorkingDir(Build& build, const IRSource& source, Ref::ID ref) noexcept;
@@ -51,7 +60,7 @@ class Process : public std::enable_shared_from_this<Process> {
   Ref::ID getFD(int fd) noexcept;
 
   /// Check if this process has a particular file descriptor
-  bool hasFD(int fd) const noexcept { return _fds.find(fd) != _fds.end(); }
+  bool hasFD(int fd) const noexcept { return _fds->getFDs().count(fd) > 0; }
 
   /// Add a file descriptor entry
   void addFD(Build& build,
@@ -67,7 +76,7 @@ class Process : public std::enable_shared_from_this<Process> {
   bool tryCloseFD(Build& build, const IRSource& source, int fd) noexcept;
 
   /// Set a file descriptor's close-on-exec flag
-  void setCloexec(int fd, bool cloexec) noexcept;
+  void setCloexec(Build& build, const IRSource& source, int fd, bool cloexec) noexcept;
 
   /// Mark this process as the primary process for its command
   void setPrimary() noexcept { _primary = true; }
@@ -90,6 +99,10 @@ class Process : public std::enable_shared_from_this<Process> {
                                        Ref::ID exe_ref,
                                        std::vector<std::string> args) noexcept;
 
+  /// Add the resources this process used, as reported when it exited, to its command's profile.
+  /// This must be called before the exit is handled.
+  void recordUsage(const struct rusage& usage) noexcept;
+
   /// This process is exiting
   void exit(Build& build, const IRSource& source, int exit_status) noexcept;
 
@@ -111,6 +124,14 @@ class Process : public std::enable_shared_from_this<Process> {
     return o << *p;
   }
 
+ private:
+  /// Get this process' file descriptor table to modify it, copying the table first if it is shared
+  FDTable& writeFDs(Build& build, const IRSource& source) noexcept;
+
+  /// Stop using this process' file descriptor table. If no other process shares the table, the
+  /// command is done with all of the table's Refs. Leaves an empty table in its place.
+  void releaseFDs(Build& build, const IRSource& source) noexcept;
+
  private:
   /// The command this process is running
   std::shared_ptr<Command> _command;
@@ -121,21 +142,26 @@ class Process : public std::enable_shared_from_this<Process> {
   /// The process' pid
   pid_t _pid;
 
-  /// A reference to the process' current working directory
-  Ref::ID _cwd;
-
-  /// A reference to the process' current root directory
-  Ref::ID _root;
-
   /// The current umask for the process
   mode_t _umask;
 
-  /// The process' file descriptor table
-  std::map<int, FileDescriptor> _fds;
+  /// The process' file descriptor table, shared with processes it forked or was forked from until
+  /// one of them modifies it
+  std::shared_ptr<FDTable> _fds;
 
   /// Has this process exited?
   bool _exited = false;
 
+  /// The process this process was forked from, if it was traced
+  std::weak_ptr<Process> _parent;
+
+  /// The time this process started running its current command
+  std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+
+  /// The total resource use reported by child processes that have exited. The kernel includes
+  /// these in this process' usage once they are waited for.
+  struct rusage _child_usage = {};
+
   /// The callback to force this process to exit
   std::function<void(int)> _force_exit_callback;
 };
@@ -0,0 +1,278 @@
+#include "SyscallStats.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "runtime/Build.hh"
+#include "tracing/SyscallTable.hh"
+#include "util/LatencyHistogram.hh"
+#include "util/constants.hh"
+#include "util/log.hh"
+
+using std::ifstream;
+using std::map;
+using std::optional;
+using std::set;
+using std::string;
+using std::tuple;
+using std::unique_ptr;
+using std::unordered_map;
+using std::vector;
+
+namespace syscall_stats {
+  /// A file-backed region of a process' address space
+  struct Mapping {
+    uintptr_t base;
+    uintptr_t limit;
+    size_t offset;
+    const string* path;
+  };
+
+  /// Histograms for every syscall, path, and stage, allocated on first use
+  vector<unique_ptr<LatencyHistogram>> _histograms;
+
+  /// Mapped file paths. Mappings and call sites point into this set.
+  set<string> _paths;
+
+  /// The cached memory map for each traced process, sorted by base address
+  unordered_map<pid_t, vector<Mapping>> _maps;
+
+  /// Counts of ptrace syscalls by syscall number, mapped file, and offset into that file
+  map<tuple<long, const string*, size_t>, size_t> _call_sites;
+
+  /// Get the index of the histogram for a syscall, path, and stage
+  static size_t index(long nr, Path path, Stage stage) noexcept {
+    return (nr * 2 + static_cast<size_t>(path)) * 2 + static_cast<size_t>(stage);
+  }
+
+  void recordLatency(long nr, Path path, Stage stage, Clock::duration elapsed) noexcept {
+    size_t i = index(nr, path, stage);
+    if (i >= _histograms.size()) _histograms.resize(index(SYSCALL_COUNT, Path::Fast, Stage::Entry));
+
+    auto& h = _histograms[i];
+    if (!h) h = std::make_unique<LatencyHistogram>();
+    h->record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+
+  /// Read the file-backed mappings for a process from /proc/<pid>/maps
+  static vector<Mapping> readMaps(pid_t pid) noexcept {
+    vector<Mapping> result;
+    ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+
+    while (maps.good() && !maps.eof()) {
+      uintptr_t base, limit;
+      char perms[5];
+      size_t offset;
+      size_t dev_major, dev_minor;
+      uintptr_t inode;
+      string path;
+
+      // Skip over whitespace
+      maps >> std::skipws;
+
+      // Read in "<base>-<limit> <perms> <offset> <dev_major>:<dev_minor> <inode>"
+      maps >> std::hex >> base;
+      if (maps.get() != '-') break;
+      maps >> std::hex >> limit;
+
+      if (maps.get() != ' ') break;
+      maps.get(perms, 5);
+
+      maps >> std::hex >> offset;
+      maps >> std::hex >> dev_major;
+      if (maps.get() != ':') break;
+      maps >> std::hex >> dev_minor;
+      maps >> std::dec >> inode;
+
+      // Skip over spaces and tabs
+      while (maps.peek() == ' ' || maps.peek() == '\t') {
+        maps.ignore(1);
+      }
+
+      // Read out the mapped file's path
+      getline(maps, path);
+
+      if (!path.empty()) {
+        result.push_back({base, limit, offset, &*_paths.insert(path).first});
+      }
+    }
+
+    // The kernel lists mappings in address order, but do not rely on it
+    std::sort(result.begin(), result.end(),
+              [](const auto& a, const auto& b) { return a.base < b.base; });
+
+    return result;
+  }
+
+  /// Find the mapping that holds an address
+  static const Mapping* findMapping(const vector<Mapping>& maps, uintptr_t ptr) noexcept {
+    auto iter = std::upper_bound(maps.begin(), maps.end(), ptr,
+                                 [](uintptr_t p, const Mapping& m) { return p < m.base; });
+    if (iter == maps.begin()) return nullptr;
+    --iter;
+    if (ptr >= iter->limit) return nullptr;
+    return &*iter;
+  }
+
+  void recordCallSite(pid_t pid, long nr, uintptr_t ip) noexcept {
+    auto [iter, added] = _maps.emplace(pid, vector<Mapping>());
+    if (added) iter->second = readMaps(pid);
+
+    // If the address is not in the cached map, the process may have mapped something new
+    auto m = findMapping(iter->second, ip);
+    if (m == nullptr && !added) {
+      iter->second = readMaps(pid);
+      m = findMapping(iter->second, ip);
+    }
+
+    if (m == nullptr) {
+      _call_sites[{nr, nullptr, ip}]++;
+    } else {
+      _call_sites[{nr, m->path, ip - m->base + m->offset}]++;
+    }
+  }
+
+  void forgetProcess(pid_t pid) noexcept {
+    _maps.erase(pid);
+  }
+
+  /// Get the name of a path
+  static const char* pathName(Path path) noexcept {
+    return path == Path::Fast ? "fast" : "ptrace";
+  }
+
+  /// Get the name of a stage
+  static const char* stageName(Stage stage) noexcept {
+    return stage == Stage::Entry ? "entry" : "exit";
+  }
+
+  /// Format a duration in nanoseconds for printing
+  static string formatTime(uint64_t ns) noexcept {
+    std::stringstream ss;
+    ss.precision(1);
+    ss << std::fixed;
+    if (ns < 1000) {
+      ss << ns << "ns";
+    } else if (ns < 1000000) {
+      ss << ns / 1000.0 << "us";
+    } else {
+      ss << ns / 1000000.0 << "ms";
+    }
+    return ss.str();
+  }
+
+  /// Call a function with the syscall number, path, stage, and histogram for each histogram
+  template <typename F>
+  static void forEachHistogram(F f) noexcept {
+    for (long nr = 0; nr < SYSCALL_COUNT; nr++) {
+      for (auto path : {Path::Fast, Path::Ptrace}) {
+        for (auto stage : {Stage::Entry, Stage::Exit}) {
+          size_t i = index(nr, path, stage);
+          if (i < _histograms.size() && _histograms[i]) f(nr, path, stage, *_histograms[i]);
+        }
+      }
+    }
+  }
+
+  void print() noexcept {
+    std::cout << "System Call Stats:" << std::endl;
+
+    // Print the busiest ptrace call sites
+    vector<std::pair<string, size_t>> sites;
+    for (const auto& [key, count] : _call_sites) {
+      if (count <= 100) continue;
+
+      auto [nr, path, offset] = key;
+      std::stringstream ss;
+      ss << SyscallTable<Build>::get(nr).getName() << " (ptrace ";
+      if (path == nullptr) {
+        ss << "unknown";
+      } else {
+        ss << *path << " + " << std::hex << offset;
+      }
+      ss << ")";
+      sites.emplace_back(ss.str(), count);
+    }
+
+    std::sort(sites.begin(), sites.end(),
+              [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    for (const auto& [name, count] : sites) {
+      std::cout << "  " << name << ": " << count << std::endl;
+    }
+
+    std::cout << std::endl;
+
+    // Print the handlers that took the most total time
+    vector<tuple<long, Path, Stage, const LatencyHistogram*>> handlers;
+    size_t fast_count = 0;
+    size_t ptrace_count = 0;
+    forEachHistogram([&](long nr, Path path, Stage stage, const LatencyHistogram& h) {
+      handlers.emplace_back(nr, path, stage, &h);
+      if (stage == Stage::Entry) (path == Path::Fast ? fast_count : ptrace_count) += h.getCount();
+    });
+
+    std::sort(handlers.begin(), handlers.end(), [](const auto& a, const auto& b) {
+      return std::get<3>(a)->getTotal() > std::get<3>(b)->getTotal();
+    });
+
+    std::cout << "Syscall Handler Latency:" << std::endl;
+    for (const auto& [nr, path, stage, h] : handlers) {
+      if (h->getCount() <= 100) continue;
+      std::cout << "  " << SyscallTable<Build>::get(nr).getName() << " (" << pathName(path) << " "
+                << stageName(stage) << "): " << h->getCount() << " calls, "
+                << formatTime(h->getTotal()) << " total, p50 " << formatTime(h->getPercentile(50))
+                << ", p99 " << formatTime(h->getPercentile(99)) << ", max "
+                << formatTime(h->getMax()) << std::endl;
+    }
+
+    std::cout << std::endl;
+
+    size_t total_syscalls = fast_count + ptrace_count;
+    size_t percent_fast = total_syscalls == 0 ? 0 : (100 * fast_count) / total_syscalls;
+    std::cout << fast_count << "/" << total_syscalls << " (" << percent_fast
+              << "%) syscalls handed by fast tracing" << std::endl;
+  }
+
+  void write(optional<fs::path> stats_log_path) noexcept {
+    fs::path path = constants::OutputDir / "syscall-stats.csv";
+    if (stats_log_path.has_value()) {
+      path = stats_log_path.value();
+      path.replace_extension("syscalls.csv");
+    }
+
+    std::ofstream out(path);
+    if (!out) {
+      WARN << "Failed to write syscall stats to " << path;
+      return;
+    }
+
+    out << "syscall,path,stage,count,total_ns,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns"
+        << std::endl;
+
+    forEachHistogram([&](long nr, Path path, Stage stage, const LatencyHistogram& h) {
+      out << SyscallTable<Build>::get(nr).getName() << "," << pathName(path) << ","
+          << stageName(stage) << "," << h.getCount() << "," << h.getTotal() << "," << h.getMean()
+          << "," << h.getPercentile(50) << "," << h.getPercentile(90) << ","
+          << h.getPercentile(99) << "," << h.getPercentile(99.9) << "," << h.getMax() << std::endl;
+    });
+
+    std::cout << "Syscall latency histograms written to " << path.string() << std::endl;
+  }
+}
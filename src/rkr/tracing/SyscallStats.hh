@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+#include <sys/types.h>
+
+namespace fs = std::filesystem;
+
+/**
+ * With --syscall-stats, rkr counts the system calls it handles. For each syscall it also keeps a
+ * latency histogram per tracing path (shared memory channel or ptrace) and per stage (entry or
+ * exit handler). Syscalls that reach the ptrace path are also counted by call site: the library
+ * and offset of the instruction that issued them. Call sites are resolved against a per-process
+ * copy of /proc/<pid>/maps, which is read again only on exec or when an address is not mapped.
+ */
+namespace syscall_stats {
+  using Clock = std::chrono::steady_clock;
+
+  /// The path a syscall stop was delivered through
+  enum class Path { Fast, Ptrace };
+
+  /// The handler that was timed
+  enum class Stage { Entry, Exit };
+
+  /// Record the time spent handling one stage of a syscall
+  void recordLatency(long nr, Path path, Stage stage, Clock::duration elapsed) noexcept;
+
+  /// Record the call site of a syscall that was delivered through ptrace
+  void recordCallSite(pid_t pid, long nr, uintptr_t ip) noexcept;
+
+  /// Drop the cached memory map for a process after it execs or exits
+  void forgetProcess(pid_t pid) noexcept;
+
+  /// Print a summary of the collected stats
+  void print() noexcept;
+
+  /// Write the latency histograms as CSV. The file goes next to the stats log if there is one, or
+  /// in the build state directory otherwise.
+  void write(std::optional<fs::path> stats_log_path) noexcept;
+}
@@ -72,6 +72,7 @@ class SyscallEntry {
   _syscalls[constant] = SyscallEntry(                                                           \
       #name, [](Output& out, const IRSource& source, Thread& t, const user_regs_struct& regs) { \
         stats::syscalls++;                                                                      \
+        t.getCommand()->getProfile().syscalls++;                                                \
         t.invokeHandler(&Thread::_##name, out, source, regs);                                   \
       });
 
@@ -30,6 +30,7 @@
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
 #include "tracing/Flags.hh"
+#include "tracing/SyscallStats.hh"
 #include "tracing/SyscallTable.hh"
 #include "tracing/Tracer.hh"
 #include "util/log.hh"
@@ -50,20 +51,42 @@ void Thread::syscallEntryChannel(Build& build, const IRSource& source, ssize_t c
   ASSERT(_channel == -1) << this << " is already using a shared memory channel";
   _channel = channel;
 
-  auto& entry = SyscallTable<Build>::get(Tracer::getSyscallNumber(_channel));
-
-  if (options::syscall_stats) {
-    Tracer::syscall_counts[string(entry.getName()) + " (fast)"]++;
-    Tracer::fast_syscall_count++;
-  }
+  _syscall = Tracer::getSyscallNumber(_channel);
+  auto& entry = SyscallTable<Build>::get(_syscall);
 
   LOG(trace) << this << " handling " << entry.getName() << " entry via shared memory channel";
 
+  syscall_stats::Clock::time_point start;
+  if (options::syscall_stats) start = syscall_stats::Clock::now();
+
   entry.runHandler(build, source, *this, Tracer::getRegisters(_channel));
 
+  if (options::syscall_stats) {
+    syscall_stats::recordLatency(_syscall, syscall_stats::Path::Fast, syscall_stats::Stage::Entry,
+                                 syscall_stats::Clock::now() - start);
+  }
+
   _channel = -1;
 }
 
+// Traced entry to a system call using ptrace
+void Thread::syscallEntryPtrace(Build& build,
+                                const IRSource& source,
+                                const user_regs_struct& regs) noexcept {
+  _syscall = regs.SYSCALL_NUMBER;
+  auto& entry = SyscallTable<Build>::get(_syscall);
+
+  syscall_stats::Clock::time_point start;
+  if (options::syscall_stats) start = syscall_stats::Clock::now();
+
+  entry.runHandler(build, source, *this, regs);
+
+  if (options::syscall_stats) {
+    syscall_stats::recordLatency(_syscall, syscall_stats::Path::Ptrace, syscall_stats::Stage::Entry,
+                                 syscall_stats::Clock::now() - start);
+  }
+}
+
 // Traced exit from a system call through the provided shared memory channel
 void Thread::syscallExitChannel(Build& build, const IRSource& source, ssize_t channel) noexcept {
   ASSERT(_channel == -1) << this << " is already using a shared memory channel";
@@ -76,11 +99,8 @@ void Thread::syscallExitChannel(Build& build, const IRSource& source, ssize_t ch
              << SyscallTable<Build>::get(Tracer::getSyscallNumber(_channel)).getName()
              << " exit via shared memory channel";
 
-  // Run the post-syscall handler
-  _post_syscall_handlers.top()(build, source, Tracer::getSyscallResult(_channel));
-
-  // Remove the used post-syscall handler
-  _post_syscall_handlers.pop();
+  runPostSyscallHandler(build, source, Tracer::getSyscallResult(_channel),
+                        syscall_stats::Path::Fast);
 
   _channel = -1;
 }
@@ -99,9 +119,25 @@ void Thread::syscallExitPtrace(Build& build, const IRSource& source) noexcept {
   // Make sure this is a syscall exit stop
   FAIL_IF(info.op != PTRACE_SYSCALL_INFO_EXIT) << "Not a syscall exit";
 
+  runPostSyscallHandler(build, source, info.exit.rval, syscall_stats::Path::Ptrace);
+}
+
+void Thread::runPostSyscallHandler(Build& build,
+                                   const IRSource& source,
+                                   long rval,
+                                   syscall_stats::Path path) noexcept {
+  syscall_stats::Clock::time_point start;
+  if (options::syscall_stats) start = syscall_stats::Clock::now();
+
   // Run the handler and remove it from the stack
-  _post_syscall_handlers.top()(build, source, info.exit.rval);
+  auto [handler, nr] = std::move(_post_syscall_handlers.top());
   _post_syscall_handlers.pop();
+  handler(build, source, rval);
+
+  if (options::syscall_stats) {
+    syscall_stats::recordLatency(nr, path, syscall_stats::Stage::Exit,
+                                 syscall_stats::Clock::now() - start);
+  }
 }
 
 void Thread::execPtrace(Build& build, const IRSource& source) noexcept {
@@ -221,7 +257,7 @@ void Thread::resume() noexcept {
 }
 
 void Thread::finishSyscall(function<void(Build&, const IRSource&, long)> handler) noexcept {
-  _post_syscall_handlers.push(handler);
+  _post_syscall_handlers.emplace(handler, _syscall);
 
   // Is this thread blocked on the shared memory channel?
   if (_channel >= 0) {
@@ -642,7 +678,7 @@ void Thread::_fcntl(Build& build,
   } else if (cmd == F_SETFD) {
     resume();
     // Set the cloexec flag using the argument flags
-    _process->setCloexec(fd, arg & FD_CLOEXEC);
+    _process->setCloexec(build, source, fd, arg & FD_CLOEXEC);
 
   } else {
     resume();
@@ -944,6 +980,12 @@ void Thread::_write(Build& build, const IRSource& source, int fd) noexcept {
   // Inform the artifact that we are about to write
   ref->getArtifact()->beforeWrite(build, source, getCommand(), ref_id);
 
+  // If the artifact does not need the result, let the write run without waiting for it
+  if (!ref->getArtifact()->needsWriteResult()) {
+    resume();
+    return;
+  }
+
   // Finish the syscall and resume the process
   finishSyscall([=](Build& build, const IRSource& source, long rc) {
     resume();
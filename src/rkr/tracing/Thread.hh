@@ -8,6 +8,7 @@
 #include <ostream>
 #include <stack>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <fcntl.h>
@@ -20,6 +21,7 @@
 #include "runtime/Ref.hh"
 #include "tracing/Flags.hh"
 #include "tracing/Process.hh"
+#include "tracing/SyscallStats.hh"
 #include "tracing/inject.h"
 #include "util/log.hh"
 
@@ -47,6 +49,11 @@ class Thread {
   /// Traced entry to a system call through the provided shared memory channel
   void syscallEntryChannel(Build& build, const IRSource& source, ssize_t channel) noexcept;
 
+  /// Traced entry to a system call using ptrace
+  void syscallEntryPtrace(Build& build,
+                          const IRSource& source,
+                          const user_regs_struct& regs) noexcept;
+
   /// Traced exit from a system call through the provided shared memory channel
   void syscallExitChannel(Build& build, const IRSource& source, ssize_t channel) noexcept;
 
@@ -548,6 +555,13 @@ class Thread {
                        wrap(regs.SYSCALL_ARG6));
   }
 
+ private:
+  /// Run and remove the most recent post-syscall handler, given the syscall's result
+  void runPostSyscallHandler(Build& build,
+                             const IRSource& source,
+                             long rval,
+                             syscall_stats::Path path) noexcept;
+
  private:
   /// The tracer that is executing this thread
   Tracer& _tracer;
@@ -558,9 +572,14 @@ class Thread {
   /// The thread's tid
   pid_t _tid;
 
-  /// The stack of post-syscall handlers to invoke. System calls can nest when a signal is delivered
-  /// during a blocked system call (e.g. SIGCHLD is sent to bash while it is reading)
-  std::stack<std::function<void(Build&, const IRSource&, long)>> _post_syscall_handlers;
+  /// The stack of post-syscall handlers to invoke, each with the number of the syscall it finishes.
+  /// System calls can nest when a signal is delivered during a blocked system call (e.g. SIGCHLD is
+  /// sent to bash while it is reading)
+  std::stack<std::pair<std::function<void(Build&, const IRSource&, long)>, long>>
+      _post_syscall_handlers;
+
+  /// The number of the system call whose entry was most recently handled
+  long _syscall = -1;
 
   /// Which channel is this thread using for the current trace event? Set to -1 if not using one.
   ssize_t _channel = -1;
@@ -1,18 +1,17 @@
 #include "Tracer.hh"
 
 #include <cerrno>
+#include <chrono>
 #include <csignal>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <filesystem>
-#include <fstream>
 #include <list>
 #include <map>
 #include <memory>
 #include <optional>
 #include <set>
-#include <sstream>
 #include <string>
 #include <tuple>
 #include <utility>
@@ -25,6 +24,7 @@
 #include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/ptrace.h>
+#include <sys/resource.h>
 #include <sys/user.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -34,15 +34,17 @@
 #include "runtime/Command.hh"
 #include "runtime/Ref.hh"
 #include "tracing/Process.hh"
+#include "tracing/SyscallStats.hh"
 #include "tracing/SyscallTable.hh"
 #include "tracing/Thread.hh"
 #include "tracing/inject.h"
+#include "util/Pool.hh"
+#include "util/Timeline.hh"
 #include "util/log.hh"
 #include "util/stats.hh"
 #include "util/wrappers.hh"
 #include "versions/FileVersion.hh"
 
-using std::ifstream;
 using std::list;
 using std::make_shared;
 using std::map;
@@ -88,6 +90,8 @@ optional<tuple<pid_t, int>> Tracer::getEvent(Build& build) noexcept {
 
   // Wait for an event from ptrace
   while (true) {
+    if (timeline::enabled) sampleCounters();
+
     // Check the shared memory channel
     if (_shmem != nullptr) {
       // Loop over all the shared memory channels
@@ -118,7 +122,8 @@ optional<tuple<pid_t, int>> Tracer::getEvent(Build& build) noexcept {
 
     // Check for a child, but do not block
     int wait_status;
-    pid_t child = ::waitpid(-1, &wait_status, WNOHANG);
+    struct rusage usage;
+    pid_t child = ::wait4(-1, &wait_status, WNOHANG, &usage);
 
     // Did waitpid return an error?
     if (child == -1) {
@@ -134,6 +139,9 @@ optional<tuple<pid_t, int>> Tracer::getEvent(Build& build) noexcept {
       // Count the ptrace stop for this event
       stats::ptrace_stops++;
 
+      // Save the resource usage reported for an exit until the exit is handled
+      if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) _exit_usage[child] = usage;
+
       // Does this event refer to a process we don't know about yet?
       if (_threads.find(child) == _threads.end()) {
         // Yes. Queue the event so we can try another one.
@@ -153,6 +161,34 @@ optional<tuple<pid_t, int>> Tracer::getEvent(Build& build) noexcept {
   }
 }
 
+void Tracer::sampleCounters() noexcept {
+  auto now = timeline::Clock::now();
+  if (now - _last_sample < std::chrono::milliseconds(10)) return;
+
+  // Count the shared memory channels that tracees are holding
+  size_t busy = 0;
+  if (_shmem != nullptr) {
+    for (size_t i = 0; i < TRACING_CHANNEL_COUNT; i++) {
+      auto state = __atomic_load_n(&_shmem->channels[i].state, __ATOMIC_ACQUIRE);
+      if (state != CHANNEL_STATE_AVAILABLE) busy++;
+    }
+  }
+  timeline::addCounter("Tracing channels in use", now, busy);
+
+  // The stats counters are reset between build phases
+  if (stats::ptrace_stops < _last_ptrace_stops) _last_ptrace_stops = 0;
+
+  // Report the rate of ptrace stops since the last sample
+  if (_last_sample != timeline::Clock::time_point()) {
+    std::chrono::duration<double> elapsed = now - _last_sample;
+    timeline::addCounter("ptrace stops/sec", now,
+                         (stats::ptrace_stops - _last_ptrace_stops) / elapsed.count());
+  }
+
+  _last_sample = now;
+  _last_ptrace_stops = stats::ptrace_stops;
+}
+
 void Tracer::wait(Build& build, shared_ptr<Process> p) noexcept {
   if (p) {
     LOG(exec) << "Waiting for " << p;
@@ -193,7 +229,8 @@ void Tracer::wait(Build& build, shared_ptr<Process> p) noexcept {
         thread.syscallExitPtrace(build, TracedIRSource());
 
       } else if (status == (SIGTRAP | (PTRACE_EVENT_EXEC << 8))) {
-        // This is a stop after an exec finishes.
+        // This is a stop after an exec finishes. The process has a new address space.
+        if (options::syscall_stats) syscall_stats::forgetProcess(thread.getProcess()->getID());
         thread.execPtrace(build, TracedIRSource());
 
       } else if (status == (PTRACE_EVENT_STOP << 8)) {
@@ -267,12 +304,20 @@ void Tracer::handleExit(Build& build, Thread& t, int exit_status) noexcept {
 
   // Is the thread that's exiting the main thread in its process?
   auto proc = t.getProcess();
+  auto usage = _exit_usage.find(t.getID());
   if (t.getID() == proc->getID()) {
     LOGF(trace, "{}: exited", proc);
+
+    // The main thread's usage covers every thread in the process
+    if (usage != _exit_usage.end()) proc->recordUsage(usage->second);
+
+    if (options::syscall_stats) syscall_stats::forgetProcess(proc->getID());
+
     proc->exit(build, TracedIRSource(), exit_status);
     _exited.emplace(proc->getID(), proc);
   }
 
+  if (usage != _exit_usage.end()) _exit_usage.erase(usage);
   _threads.erase(t.getID());
 }
 
@@ -310,7 +355,7 @@ void Tracer::handleKilled(Build& build, Thread& t, int exit_status, int term_sig
         // Make sure the reference resolved
         if (core) {
           // Create a version to represent the core file
-          auto cv = make_shared<FileVersion>(statbuf);
+          auto cv = make_pooled<FileVersion>(statbuf);
 
           // Trace a write to the core file from the command that's exiting
           build.updateContent(TracedIRSource(), t.getCommand(), core_ref, cv);
@@ -332,53 +377,6 @@ shared_ptr<Process> Tracer::getExited(pid_t pid) noexcept {
   return result;
 }
 
-string findLibraryOffset(pid_t pid, uintptr_t ptr) {
-  ifstream maps("/proc/" + std::to_string(pid) + "/maps");
-
-  while (maps.good() && !maps.eof()) {
-    uintptr_t base, limit;
-    char perms[5];
-    size_t offset;
-    size_t dev_major, dev_minor;
-    uintptr_t inode;
-    string path;
-
-    // Skip over whitespace
-    maps >> std::skipws;
-
-    // Read in "<base>-<limit> <perms> <offset> <dev_major>:<dev_minor> <inode>"
-    maps >> std::hex >> base;
-    if (maps.get() != '-') break;
-    maps >> std::hex >> limit;
-
-    if (maps.get() != ' ') break;
-    maps.get(perms, 5);
-
-    maps >> std::hex >> offset;
-    maps >> std::hex >> dev_major;
-    if (maps.get() != ':') break;
-    maps >> std::hex >> dev_minor;
-    maps >> std::dec >> inode;
-
-    // Skip over spaces and tabs
-    while (maps.peek() == ' ' || maps.peek() == '\t') {
-      maps.ignore(1);
-    }
-
-    // Read out the mapped file's path
-    getline(maps, path);
-
-    // Does the queried pointer fall in bounds?
-    if (!path.empty() && ptr >= base && ptr < limit) {
-      std::stringstream ss;
-      ss << path << " + " << std::hex << (ptr - base + offset);
-      return ss.str();
-    }
-  }
-
-  return "unknown";
-}
-
 void Tracer::handleSyscall(Build& build, Thread& t) noexcept {
   auto regs = t.getRegisters();
 
@@ -391,15 +389,12 @@ void Tracer::handleSyscall(Build& build, Thread& t) noexcept {
     LOG(trace) << t << ": stopped on syscall " << entry.getName();
 
     if (options::syscall_stats) {
-      std::stringstream ss;
-      ss << entry.getName() << " (ptrace "
-         << findLibraryOffset(t.getProcess()->getID(), regs.INSTRUCTION_POINTER) << ")";
-      Tracer::syscall_counts[ss.str()]++;
-      Tracer::ptrace_syscall_count++;
+      syscall_stats::recordCallSite(t.getProcess()->getID(), regs.SYSCALL_NUMBER,
+                                    regs.INSTRUCTION_POINTER);
     }
 
     // Run the system call handler
-    entry.runHandler(build, TracedIRSource(), t, regs);
+    t.syscallEntryPtrace(build, TracedIRSource(), regs);
 
   } else {
     FAIL << "Traced system call number " << regs.SYSCALL_NUMBER << " in " << t;
@@ -699,25 +694,6 @@ shared_ptr<Process> Tracer::launchTraced(Build& build, const shared_ptr<Command>
   return proc;
 }
 
-void Tracer::printSyscallStats() noexcept {
-  vector<std::pair<std::string, size_t>> sorted(Tracer::syscall_counts.begin(),
-                                                Tracer::syscall_counts.end());
-  std::sort(sorted.begin(), sorted.end(),
-            [](const auto& a, const auto& b) { return a.second > b.second; });
-
-  std::cout << "System Call Stats:" << std::endl;
-  for (const auto& [name, count] : sorted) {
-    if (count > 100) std::cout << "  " << name << ": " << count << std::endl;
-  }
-
-  std::cout << std::endl;
-
-  size_t total_syscalls = Tracer::fast_syscall_count + Tracer::ptrace_syscall_count;
-  size_t percent_fast = (100 * Tracer::fast_syscall_count) / total_syscalls;
-  std::cout << Tracer::fast_syscall_count << "/" << total_syscalls << " (" << percent_fast
-            << "%) syscalls handed by fast tracing" << std::endl;
-}
-
 // Get the system call being traced through the specified shared memory channel
 long Tracer::getSyscallNumber(ssize_t i) noexcept {
   return _shmem->channels[i].regs.SYSCALL_NUMBER;
@@ -1,11 +1,14 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
 #include <list>
 #include <memory>
 #include <optional>
 #include <tuple>
 #include <unordered_map>
 
+#include <sys/resource.h>
 #include <sys/types.h>
 
 #include "tracing/Thread.hh"
@@ -39,6 +42,9 @@ class Tracer {
   /// Get the next available traced event
   std::optional<std::tuple<pid_t, int>> getEvent(Build& build) noexcept;
 
+  /// Add samples of the tracer's counters to the timeline, at most once every few milliseconds
+  void sampleCounters() noexcept;
+
   /// Launch a command with tracing enabled
   std::shared_ptr<Process> launchTraced(Build& build, const std::shared_ptr<Command>& cmd) noexcept;
 
@@ -58,12 +64,6 @@ class Tracer {
   void handleKilled(Build& build, Thread& t, int exit_status, int term_sig) noexcept;
 
  public:
-  inline static std::map<std::string, size_t> syscall_counts;
-  inline static size_t ptrace_syscall_count = 0;
-  inline static size_t fast_syscall_count = 0;
-
-  static void printSyscallStats() noexcept;
-
   /// Get the system call being traced through the specified shared memory channel
   static long getSyscallNumber(ssize_t channel) noexcept;
 
@@ -102,6 +102,15 @@ class Tracer {
   /// seen its creation. Store them here.
   std::list<std::tuple<pid_t, int>> _event_queue;
 
+  /// The resource usage reported for threads that have exited but have not been handled yet
+  std::unordered_map<pid_t, struct rusage> _exit_usage;
+
+  /// The last time the tracer's counters were added to the timeline
+  std::chrono::steady_clock::time_point _last_sample;
+
+  /// The number of ptrace stops at the last timeline sample
+  size_t _last_ptrace_stops = 0;
+
   /// The file descriptor for the shared memory tracing channels
   inline static int _trace_data_fd = -1;
 
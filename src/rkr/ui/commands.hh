@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <filesystem>
 #include <optional>
 #include <string>
@@ -9,18 +10,35 @@ namespace fs = std::filesystem;
 
 void do_build(std::vector<std::string> args,
               std::optional<fs::path> stats_log_path,
-              std::string command_output) noexcept;
+              std::optional<fs::path> timeline_path,
+              std::string command_output,
+              std::vector<fs::path> targets = {}) noexcept;
 
 void do_audit(std::vector<std::string> args, std::string command_output) noexcept;
 
 void do_check(std::vector<std::string> args) noexcept;
 
-void do_trace(std::vector<std::string> args, std::string output) noexcept;
+void do_trace(std::vector<std::string> args,
+              std::string output,
+              std::optional<std::string> command,
+              std::optional<std::string> path,
+              std::vector<std::string> steps,
+              std::optional<std::string> scenario) noexcept;
 
 void do_graph(std::vector<std::string> args,
               std::string output,
               std::string type,
               bool show_all,
-              bool no_render) noexcept;
+              bool no_render,
+              std::optional<std::string> focus,
+              size_t hops,
+              bool by_directory) noexcept;
+
+void do_stats(std::vector<std::string> args,
+              bool list_artifacts,
+              bool profile,
+              size_t profile_count) noexcept;
+
+void do_daemon() noexcept;
 
-void do_stats(std::vector<std::string> args, bool list_artifacts) noexcept;
+bool send_to_daemon(std::string subcommand, const std::vector<std::string>& args) noexcept;
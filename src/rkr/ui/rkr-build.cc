@@ -1,19 +1,29 @@
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <memory>
 #include <optional>
+#include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <stdlib.h>
+
 #include "data/DefaultTrace.hh"
 #include "data/PostBuildChecker.hh"
 #include "data/ReadWriteCombiner.hh"
 #include "data/Trace.hh"
 #include "runtime/Build.hh"
+#include "runtime/Command.hh"
 #include "runtime/env.hh"
-#include "tracing/Tracer.hh"
+#include "tracing/SyscallStats.hh"
 #include "ui/commands.hh"
+#include "util/Jobserver.hh"
+#include "util/Timeline.hh"
 #include "util/constants.hh"
+#include "util/log.hh"
+#include "util/options.hh"
 #include "util/stats.hh"
 
 namespace fs = std::filesystem;
@@ -22,17 +32,31 @@ using std::make_unique;
 using std::ofstream;
 using std::optional;
 using std::ostream;
+using std::set;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::vector;
 
 /**
- * Run the `build` subcommand.
+ * Limit the next build phase to the commands that can affect the requested targets. Returns the
+ * number of commands that may run.
+ */
+static size_t limit_plan(const shared_ptr<Command>& root_cmd, const set<fs::path>& targets) {
+  auto required = root_cmd->collectProducers(targets);
+  root_cmd->limitPlan(required);
+  return required.size();
+}
+
+/**
+ * Run the `build` subcommand. If targets are given, only the commands needed to bring the
+ * artifacts at those paths up to date will run.
  */
 void do_build(vector<string> args,
               optional<fs::path> stats_log_path,
-              string command_output) noexcept {
+              optional<fs::path> timeline_path,
+              string command_output,
+              vector<fs::path> targets) noexcept {
   // Make sure the output directory exists
   fs::create_directories(constants::OutputDir);
 
@@ -51,6 +75,37 @@ void do_build(vector<string> args,
   // Reset the statistics counters
   reset_stats();
 
+  // Start recording a timeline if requested
+  if (timeline_path.has_value()) timeline::start();
+
+  // Share one limit on parallel compiles among all the compiler wrappers in the build
+  optional<Jobserver> jobserver;
+  if (options::parallel_wrapper) {
+    size_t jobs = options::jobs;
+    if (jobs == 0) jobs = std::max(1U, std::thread::hardware_concurrency());
+    jobserver.emplace(fs::absolute(constants::JobserverPipe), jobs);
+  }
+
+  // Tell the compiler wrappers where to find the compile cache, if it is enabled
+  if (options::parallel_wrapper && options::compile_cache) {
+    fs::create_directories(constants::CompileCacheDir);
+    ::setenv("RKR_COMPILE_CACHE", fs::absolute(constants::CompileCacheDir).c_str(), 1);
+  } else {
+    ::unsetenv("RKR_COMPILE_CACHE");
+  }
+
+  // Targets are matched against the paths of each command's outputs in the previous run
+  set<fs::path> target_paths;
+  for (const auto& target : targets) {
+    auto path = fs::absolute(target).lexically_normal();
+
+    // A trailing separator leaves an empty last component, which would never match an output
+    if (path.filename().empty() && path.has_relative_path()) path = path.parent_path();
+
+    target_paths.insert(path);
+  }
+  if (!target_paths.empty()) options::track_inputs_outputs = true;
+
   // The input TraceReader will supply the trace to each phase except the first
   TraceReader input;
 
@@ -58,6 +113,7 @@ void do_build(vector<string> args,
   shared_ptr<Command> root_cmd;
 
   LOG(phase) << "Starting build phase 0";
+  auto phase_span = std::make_optional<timeline::Span>("Build phase 0");
 
   // Is there a trace to load?
   if (auto loaded = TraceReader::load(constants::DatabaseFilename); loaded) {
@@ -75,7 +131,11 @@ void do_build(vector<string> args,
     input = output.getReader();
 
   } else {
-    // No trace was loaded. Set up a default trace
+    // No trace was loaded, so there is no record of which commands produce the targets
+    WARN_IF(!target_paths.empty()) << "No previous build to find targets in. Running a full build.";
+    target_paths.clear();
+
+    // Set up a default trace
     DefaultTrace def(args);
 
     // Remember the root command
@@ -95,7 +155,13 @@ void do_build(vector<string> args,
   // Plan the next phase of the build
   root_cmd->planBuild();
 
+  // Leave out commands that cannot affect the targets
+  if (!target_paths.empty() && limit_plan(root_cmd, target_paths) == 0) {
+    WARN << "No command in the previous build produced the requested targets";
+  }
+
   LOG(phase) << "Finished build phase 0";
+  phase_span.reset();
 
   // Write stats out to CSV & reset counters
   gather_stats(stats_log_path, stats, 0);
@@ -111,8 +177,10 @@ void do_build(vector<string> args,
 
     // Revert the environment to committed state
     env::rollback();
+    env::compactVersions(root_cmd);
 
     LOGF(phase, "Starting build phase {}", iteration);
+    phase_span.emplace("Build phase " + std::to_string(iteration));
 
     // Run the trace and send the new trace to output
     Build build(output, print_to ? *print_to : std::cout);
@@ -120,8 +188,10 @@ void do_build(vector<string> args,
 
     // Plan the next iteration
     root_cmd->planBuild();
+    if (!target_paths.empty()) limit_plan(root_cmd, target_paths);
 
     LOGF(phase, "Finished build phase {}", iteration);
+    phase_span.reset();
 
     // Write stats out to CSV & reset counters
     gather_stats(stats_log_path, stats, iteration);
@@ -141,12 +211,14 @@ void do_build(vector<string> args,
   // If more than one phase of the build ran, then we know the trace could have changed
   if (iteration > 1) {
     LOG(phase) << "Starting post-build checks";
+    timeline::Span span("Post-build checks");
 
     // Run the post-build checks and send the resulting trace directly to output
     PostBuildChecker<TraceWriter> output(constants::DatabaseFilename);
 
     // Reset the environment
     env::rollback();
+    env::compactVersions(root_cmd);
 
     // Evaluate the trace in the output buffer from the last phase
     Build build(output, print_to ? *print_to : std::cout);
@@ -159,6 +231,9 @@ void do_build(vector<string> args,
   write_stats(stats_log_path, stats);
 
   if (options::syscall_stats) {
-    Tracer::printSyscallStats();
+    syscall_stats::print();
+    syscall_stats::write(stats_log_path);
   }
+
+  if (timeline_path.has_value()) timeline::write(timeline_path.value());
 }
@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "runtime/env.hh"
+#include "ui/commands.hh"
+#include "util/constants.hh"
+#include "util/log.hh"
+#include "util/options.hh"
+
+namespace fs = std::filesystem;
+
+using std::cout;
+using std::endl;
+using std::nullopt;
+using std::string;
+using std::vector;
+
+/// Requests carry the client's stdin, stdout, and stderr
+enum : size_t { RequestFDs = 3 };
+
+/// Fill in a socket address for the daemon socket in the current directory
+static sockaddr_un daemon_address() noexcept {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, constants::DaemonSocket.c_str(), sizeof(addr.sun_path) - 1);
+  return addr;
+}
+
+/// Read exactly len bytes from a socket. Returns false on EOF or error.
+static bool read_all(int fd, void* buf, size_t len) noexcept {
+  char* p = static_cast<char*>(buf);
+  while (len > 0) {
+    ssize_t rc = ::read(fd, p, len);
+    if (rc <= 0) return false;
+    p += rc;
+    len -= rc;
+  }
+  return true;
+}
+
+/// Write exactly len bytes to a socket. Returns false on error.
+static bool write_all(int fd, const void* buf, size_t len) noexcept {
+  const char* p = static_cast<const char*>(buf);
+  while (len > 0) {
+    ssize_t rc = ::write(fd, p, len);
+    if (rc <= 0) return false;
+    p += rc;
+    len -= rc;
+  }
+  return true;
+}
+
+/// An option that travels with each request. The daemon applies the client's value while it
+/// serves the request, then restores its own.
+struct ForwardedOption {
+  /// The name of the option in a request
+  const char* name;
+
+  /// Get the option's current value as a string
+  std::function<string()> get;
+
+  /// Set the option from a string
+  std::function<void(const string&)> set;
+};
+
+/// Forward an on/off setting
+static ForwardedOption forward_flag(const char* name, bool& flag) noexcept {
+  return {name, [&flag] { return string(flag ? "1" : "0"); },
+          [&flag](const string& value) { flag = value == "1"; }};
+}
+
+/// Forward a numeric setting
+static ForwardedOption forward_count(const char* name, size_t& count) noexcept {
+  return {name, [&count] { return std::to_string(count); },
+          [&count](const string& value) { count = std::strtoull(value.c_str(), nullptr, 10); }};
+}
+
+/// Get the options that travel with each request. Any option that changes how a build runs or
+/// what it prints must be listed here, or a build served by the daemon will use the daemon's
+/// setting instead of the client's.
+static const vector<ForwardedOption>& forwarded_options() noexcept {
+  static const vector<ForwardedOption> forwarded = {
+      forward_flag("show", options::print_on_run),
+      forward_flag("show-full", options::print_full),
+      forward_flag("debug", options::debug),
+      forward_flag("no-color", options::disable_color),
+      {"fingerprint",
+       [] { return std::to_string(static_cast<int>(options::fingerprint_level)); },
+       [](const string& value) {
+         options::fingerprint_level =
+             static_cast<FingerprintLevel>(std::strtol(value.c_str(), nullptr, 10));
+       }},
+      forward_flag("caching", options::enable_cache),
+      forward_flag("hardlink-cache", options::hardlink_staging),
+      forward_count("io-threads", options::io_threads),
+      forward_flag("inject", options::inject_tracing_lib),
+      forward_flag("wrapper", options::parallel_wrapper),
+      forward_count("jobs", options::jobs),
+      forward_flag("compile-cache", options::compile_cache),
+      forward_flag("speculate", options::speculate),
+      forward_flag("log-warning", logger<LogCategory::warning>::enabled),
+      forward_flag("log-trace", logger<LogCategory::trace>::enabled),
+      forward_flag("log-ir", logger<LogCategory::ir>::enabled),
+      forward_flag("log-artifact", logger<LogCategory::artifact>::enabled),
+      forward_flag("log-rebuild", logger<LogCategory::rebuild>::enabled),
+      forward_flag("log-exec", logger<LogCategory::exec>::enabled),
+      forward_flag("log-phase", logger<LogCategory::phase>::enabled),
+      forward_flag("log-cache", logger<LogCategory::cache>::enabled),
+  };
+  return forwarded;
+}
+
+/// Get the current values of the forwarded options, in the order forwarded_options() lists them
+static vector<string> save_options() noexcept {
+  vector<string> values;
+  for (const auto& option : forwarded_options()) {
+    values.push_back(option.get());
+  }
+  return values;
+}
+
+/// Restore forwarded options from values returned by save_options()
+static void restore_options(const vector<string>& values) noexcept {
+  const auto& forwarded = forwarded_options();
+  for (size_t i = 0; i < forwarded.size() && i < values.size(); i++) {
+    forwarded[i].set(values[i]);
+  }
+}
+
+/// Get this process's environment as a list of NAME=value strings
+static vector<string> get_environment() noexcept {
+  vector<string> vars;
+  for (char** var = environ; var != nullptr && *var != nullptr; var++) {
+    vars.push_back(*var);
+  }
+  return vars;
+}
+
+/// Replace this process's environment with a list of NAME=value strings
+static void set_environment(const vector<string>& vars) noexcept {
+  ::clearenv();
+  for (const auto& var : vars) {
+    size_t eq = var.find('=');
+    if (eq == string::npos || eq == 0) continue;
+    ::setenv(var.substr(0, eq).c_str(), var.c_str() + eq + 1, 1);
+  }
+}
+
+/**
+ * Send a request to a running daemon, if there is one. A request is a length-prefixed list of
+ * NUL-terminated strings: the subcommand, the forwarded options as NAME=value, an empty string,
+ * the client's environment, another empty string, then the Rikerfile arguments. The client's
+ * standard fds travel with the length, so the daemon and any commands it runs write straight to
+ * the client's terminal.
+ * \returns true if a daemon handled the request
+ */
+bool send_to_daemon(string subcommand, const vector<string>& args) noexcept {
+  int sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1) return false;
+
+  // If there is no daemon listening, the caller will run the request itself
+  auto addr = daemon_address();
+  if (::connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    ::close(sock);
+    return false;
+  }
+
+  // Build the request payload
+  vector<string> fields = {subcommand};
+  for (const auto& option : forwarded_options()) {
+    fields.push_back(string(option.name) + "=" + option.get());
+  }
+  fields.emplace_back();
+  for (const auto& var : get_environment()) {
+    fields.push_back(var);
+  }
+  fields.emplace_back();
+  fields.insert(fields.end(), args.begin(), args.end());
+
+  string payload;
+  for (const auto& field : fields) {
+    payload += field;
+    payload.push_back('\0');
+  }
+
+  // Send the payload length along with the standard fds
+  uint32_t len = payload.size();
+  iovec iov = {&len, sizeof(len)};
+
+  int fds[RequestFDs] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+  memset(control, 0, sizeof(control));
+
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  FAIL_IF(::sendmsg(sock, &msg, 0) != sizeof(len) || !write_all(sock, payload.data(), len))
+      << "Failed to send a request to the rkr daemon: " << ERR;
+
+  // Wait for the daemon to report that it has finished
+  char done;
+  FAIL_IF(!read_all(sock, &done, 1))
+      << "The rkr daemon exited while handling this request. Check the daemon's output for the "
+         "error, then restart it or run with --no-daemon.";
+
+  ::close(sock);
+  return true;
+}
+
+/// Remove the daemon socket when the daemon exits
+static void remove_daemon_socket() noexcept {
+  ::unlink(constants::DaemonSocket.c_str());
+}
+
+/// Close every fd passed in a message's SCM_RIGHTS control data
+static void close_received_fds(msghdr& msg) noexcept {
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; i++) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+      ::close(fd);
+    }
+  }
+}
+
+/// Receive and run one request from a connected client
+static void serve(int conn) noexcept {
+  // Receive the payload length and the client's standard fds
+  uint32_t len;
+  iovec iov = {&len, sizeof(len)};
+
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * RequestFDs)];
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t rc = ::recvmsg(conn, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (rc != sizeof(len) || cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * RequestFDs)) {
+    WARN << "Ignoring a malformed daemon request";
+    if (rc > 0) close_received_fds(msg);
+    return;
+  }
+
+  int fds[RequestFDs];
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  // Read and split the payload
+  string payload(len, '\0');
+  vector<string> fields;
+  if (read_all(conn, payload.data(), len)) {
+    for (size_t pos = 0; pos < payload.size();) {
+      size_t end = payload.find('\0', pos);
+      if (end == string::npos) break;
+      fields.push_back(payload.substr(pos, end - pos));
+      pos = end + 1;
+    }
+  }
+
+  // The options and the environment each end with an empty field
+  auto options_end = std::find(fields.begin(), fields.end(), "");
+  auto env_end = options_end == fields.end() ? fields.end()
+                                             : std::find(options_end + 1, fields.end(), "");
+
+  if (env_end == fields.end() || (fields[0] != "build" && fields[0] != "check")) {
+    WARN << "Ignoring a malformed daemon request";
+    for (int fd : fds) ::close(fd);
+    return;
+  }
+
+  auto subcommand = fields[0];
+  vector<string> client_env(options_end + 1, env_end);
+  vector<string> args(env_end + 1, fields.end());
+
+  // Apply the client's options and environment for this request only
+  auto saved_options = save_options();
+  auto saved_env = get_environment();
+
+  for (auto iter = fields.begin() + 1; iter != options_end; iter++) {
+    size_t eq = iter->find('=');
+    if (eq == string::npos) continue;
+
+    auto name = iter->substr(0, eq);
+    for (const auto& option : forwarded_options()) {
+      if (name == option.name) option.set(iter->substr(eq + 1));
+    }
+  }
+
+  set_environment(client_env);
+
+  // Point our standard fds at the client's, saving the originals
+  cout.flush();
+  std::cerr.flush();
+  int saved[RequestFDs];
+  for (size_t i = 0; i < RequestFDs; i++) {
+    saved[i] = ::fcntl(i, F_DUPFD_CLOEXEC, 0);
+    ::dup2(fds[i], i);
+    ::close(fds[i]);
+  }
+
+  // Reuse the environment from the last request if the filesystem still matches it
+  bool warm = env::revalidate();
+  LOG(phase) << "Serving " << subcommand << " with a " << (warm ? "warm" : "cold") << " environment";
+
+  if (subcommand == "build") {
+    do_build(args, nullopt, nullopt, "-");
+  } else {
+    do_check(args);
+  }
+
+  // Drop any uncommitted state and remember what the filesystem looks like now
+  env::rollback();
+  env::snapshot();
+
+  // Restore our own standard fds, options, and environment
+  cout.flush();
+  std::cerr.flush();
+  for (size_t i = 0; i < RequestFDs; i++) {
+    ::dup2(saved[i], i);
+    ::close(saved[i]);
+  }
+
+  restore_options(saved_options);
+  set_environment(saved_env);
+
+  // Tell the client the request is finished
+  char done = 0;
+  write_all(conn, &done, 1);
+}
+
+/**
+ * Run the `daemon` subcommand
+ *
+ * Only the environment's artifacts stay in memory between requests. Each request still loads the
+ * trace from .rkr/db and replays it to rebuild the commands, just as a build without the daemon
+ * does; what it saves is re-creating and re-checking every artifact the trace touches.
+ *
+ * Limitation: requests are served in the daemon's own process, so an error that stops a build
+ * (anything reported with FAIL) ends the daemon too. The client reports that the daemon exited,
+ * and the daemon has to be started again.
+ */
+void do_daemon() noexcept {
+  fs::create_directories(constants::OutputDir);
+
+  // Make sure there is not already a daemon for this directory. A socket that refuses connections
+  // was left behind by a daemon that did not exit cleanly.
+  auto addr = daemon_address();
+  int probe = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  FAIL_IF(probe == -1) << "Failed to create a socket for the rkr daemon: " << ERR;
+  FAIL_IF(::connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0)
+      << "An rkr daemon is already running in this directory";
+  ::close(probe);
+  ::unlink(constants::DaemonSocket.c_str());
+
+  int sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  FAIL_IF(sock == -1) << "Failed to create a socket for the rkr daemon: " << ERR;
+
+  FAIL_IF(::bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+      << "Failed to bind the rkr daemon socket " << constants::DaemonSocket << ": " << ERR;
+  std::atexit(remove_daemon_socket);
+
+  FAIL_IF(::listen(sock, 16) != 0) << "Failed to listen on the rkr daemon socket: " << ERR;
+
+  cout << "rkr daemon listening on " << constants::DaemonSocket.string() << endl;
+
+  // Serve requests one at a time until the daemon is killed
+  while (true) {
+    int conn = ::accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn == -1) {
+      if (errno == EINTR) continue;
+      FAIL << "Failed to accept a connection on the rkr daemon socket: " << ERR;
+    }
+
+    serve(conn);
+    ::close(conn);
+  }
+}
@@ -2,6 +2,8 @@
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <optional>
+#include <regex>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -16,6 +18,7 @@
 #include "util/constants.hh"
 
 using std::ofstream;
+using std::optional;
 using std::string;
 using std::stringstream;
 using std::vector;
@@ -23,15 +26,21 @@ using std::vector;
 /**
  * Run the `graph` subcommand
  * \param output      The name of the output file, or "-" for stdout
- * \param type        The type of output to produce
+ * \param type        The type of output to produce. csv and jsonl produce an edge list.
  * \param show_all    If true, include system files in the graph
  * \param no_render   If set, generate graphviz source instead of a rendered graph
+ * \param focus       If set, only include vertices near commands or files that match this regex
+ * \param hops        The number of edges to follow out from vertices that match focus
+ * \param by_directory If true, replace commands with the directories they write to
  */
 void do_graph(vector<string> args,
               string output,
               string type,
               bool show_all,
-              bool no_render) noexcept {
+              bool no_render,
+              optional<string> focus,
+              size_t hops,
+              bool by_directory) noexcept {
   // Turn on input/output tracking
   options::track_inputs_outputs = true;
 
@@ -42,6 +51,16 @@ void do_graph(vector<string> args,
   // If the output filename is not empty, but has no extension, append one
   if (output.find('.') == string::npos) output += "." + type;
 
+  // Compile the focus pattern before doing any real work
+  optional<std::regex> focus_pattern;
+  if (focus.has_value()) {
+    try {
+      focus_pattern = std::regex(focus.value(), std::regex::nosubs);
+    } catch (std::regex_error& e) {
+      FAIL << "Invalid focus pattern " << focus.value() << ": " << e.what();
+    }
+  }
+
   // Load the build trace
   auto trace = TraceReader::load(constants::DatabaseFilename);
   FAIL_IF(!trace) << "A trace could not be loaded. Run a full build first.";
@@ -56,7 +75,23 @@ void do_graph(vector<string> args,
   Graph graph(show_all);
   graph.addCommands(root_cmd->collectCommands());
 
-  if (no_render) {
+  if (focus_pattern.has_value()) {
+    auto matches = graph.focus(focus_pattern.value(), hops);
+    WARN_IF(matches == 0) << "No commands or files in the build match " << focus.value();
+  }
+
+  if (by_directory) graph.collapseDirectories();
+
+  if (type == "csv" || type == "jsonl") {
+    // Edge lists are streamed straight to the output, and are never rendered
+    ofstream f(output);
+    if (type == "csv") {
+      graph.writeCSV(f);
+    } else {
+      graph.writeJSONLines(f);
+    }
+
+  } else if (no_render) {
     ofstream f(output);
     f << graph;
 
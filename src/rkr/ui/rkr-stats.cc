@@ -1,31 +1,169 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
 #include <sstream>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include "artifacts/Artifact.hh"
 #include "data/Trace.hh"
 #include "runtime/Build.hh"
+#include "runtime/Command.hh"
 #include "runtime/env.hh"
 #include "ui/commands.hh"
 #include "util/Graph.hh"
 #include "util/TracePrinter.hh"
 #include "util/constants.hh"
+#include "util/options.hh"
 #include "util/stats.hh"
 
 using std::cout;
 using std::endl;
+using std::map;
 using std::ofstream;
+using std::set;
+using std::setw;
+using std::shared_ptr;
 using std::string;
 using std::stringstream;
+using std::tuple;
 using std::vector;
 
+/// Format a time in nanoseconds as seconds
+static string format_time(uint64_t ns) noexcept {
+  stringstream ss;
+  ss << std::fixed << std::setprecision(3) << ns / 1e9 << "s";
+  return ss.str();
+}
+
+/// Format a number of bytes with a binary unit suffix
+static string format_bytes(uint64_t bytes) noexcept {
+  const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+  double value = bytes;
+  size_t unit = 0;
+  while (value >= 1024 && unit < 4) {
+    value /= 1024;
+    unit++;
+  }
+
+  stringstream ss;
+  ss << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << value << units[unit];
+  return ss.str();
+}
+
+/// Get the CPU time a command used in its last traced run
+static uint64_t cpu_time(const shared_ptr<Command>& c) noexcept {
+  return c->getProfile().user_ns + c->getProfile().sys_ns;
+}
+
+/**
+ * Find the chain of commands with the most CPU time that ends at a given command. Each command in
+ * the chain produces an input for the next one. Results are memoized in the provided map, and
+ * commands that are already on the current chain are skipped to break cycles.
+ * \returns the total CPU time along the chain
+ */
+static uint64_t longest_chain(const shared_ptr<Command>& c,
+                              map<shared_ptr<Command>, tuple<uint64_t, shared_ptr<Command>>>& chains,
+                              set<shared_ptr<Command>>& visiting) noexcept {
+  auto iter = chains.find(c);
+  if (iter != chains.end()) return std::get<0>(iter->second);
+
+  visiting.insert(c);
+
+  uint64_t best = 0;
+  shared_ptr<Command> best_producer;
+  for (const auto& weak_producer : c->getInputProducers()) {
+    auto producer = weak_producer.lock();
+    if (!producer || producer == c || visiting.find(producer) != visiting.end()) continue;
+
+    uint64_t total = longest_chain(producer, chains, visiting);
+    if (total > best) {
+      best = total;
+      best_producer = producer;
+    }
+  }
+
+  visiting.erase(c);
+
+  uint64_t total = best + cpu_time(c);
+  chains.emplace(c, tuple{total, best_producer});
+  return total;
+}
+
+/**
+ * Print the commands that used the most CPU time on their last traced run, followed by the
+ * critical path: the chain of commands linked by their inputs and outputs that used the most CPU
+ * time. Commands that were never traced with profiling have no data and are left out.
+ */
+static void print_profile(const shared_ptr<Command>& root, size_t count) noexcept {
+  vector<shared_ptr<Command>> commands;
+  for (const auto& c : root->collectCommands()) {
+    if (c->getProfile().wall_ns > 0) commands.push_back(c);
+  }
+
+  std::stable_sort(commands.begin(), commands.end(),
+                   [](const auto& a, const auto& b) { return cpu_time(a) > cpu_time(b); });
+
+  cout << endl;
+  cout << "Command Profile:" << endl;
+  cout << "  " << std::left << setw(10) << "Wall" << setw(10) << "User" << setw(10) << "System"
+       << setw(11) << "Max RSS" << setw(11) << "Read" << setw(11) << "Written" << setw(10)
+       << "Syscalls"
+       << "Command" << endl;
+
+  for (size_t i = 0; i < commands.size() && i < count; i++) {
+    const auto& c = commands[i];
+    const auto& p = c->getProfile();
+    cout << "  " << setw(10) << format_time(p.wall_ns) << setw(10) << format_time(p.user_ns)
+         << setw(10) << format_time(p.sys_ns) << setw(11)
+         << (p.max_rss_kb > 0 ? format_bytes(p.max_rss_kb * 1024) : "-")
+         << setw(11) << format_bytes(p.read_bytes) << setw(11) << format_bytes(p.write_bytes)
+         << setw(10) << p.syscalls << c->getShortName(options::command_length) << endl;
+  }
+
+  // Find the command at the end of the most expensive chain
+  map<shared_ptr<Command>, tuple<uint64_t, shared_ptr<Command>>> chains;
+  set<shared_ptr<Command>> visiting;
+  uint64_t critical_time = 0;
+  shared_ptr<Command> last;
+  for (const auto& c : commands) {
+    uint64_t total = longest_chain(c, chains, visiting);
+    if (total > critical_time) {
+      critical_time = total;
+      last = c;
+    }
+  }
+
+  // Walk the chain back to its first command
+  vector<shared_ptr<Command>> path;
+  for (auto c = last; c; c = std::get<1>(chains.at(c))) {
+    path.push_back(c);
+  }
+
+  cout << endl;
+  cout << "Critical Path: " << format_time(critical_time) << " CPU" << endl;
+  for (auto iter = path.rbegin(); iter != path.rend(); iter++) {
+    cout << "  " << setw(10) << format_time(cpu_time(*iter))
+         << (*iter)->getShortName(options::command_length) << endl;
+  }
+  cout << std::right;
+}
+
 /**
  * Run the `stats` subcommand
  * \param list_artifacts  Should the output include a list of artifacts and versions?
+ * \param profile         Should the output include a profile of the commands in the build?
+ * \param profile_count   The number of commands to include in the profile
  */
-void do_stats(vector<string> args, bool list_artifacts) noexcept {
+void do_stats(vector<string> args, bool list_artifacts, bool profile, size_t profile_count) noexcept {
   // Turn on input/output tracking
   options::track_inputs_outputs = true;
 
@@ -36,8 +174,10 @@ void do_stats(vector<string> args, bool list_artifacts) noexcept {
   auto trace = TraceReader::load(constants::DatabaseFilename);
   FAIL_IF(!trace) << "A trace could not be loaded. Run a full build first.";
 
-  // Emulate the trace
+  // Emulate the trace, timing how long it takes
+  auto start = std::chrono::high_resolution_clock::now();
   trace->sendTo(Build());
+  std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
 
   // Print statistics
   cout << "Build Statistics:" << endl;
@@ -46,13 +186,20 @@ void do_stats(vector<string> args, bool list_artifacts) noexcept {
   cout << "  Artifacts: " << stats::artifacts << endl;
   cout << "  Artifact Versions: " << stats::versions << endl;
 
+  // An emulation too short for the clock to measure reports zero throughput rather than dividing
+  // by zero
+  size_t steps_per_sec = 0;
+  if (elapsed.count() > 0) {
+    steps_per_sec = static_cast<size_t>(stats::emulated_steps / elapsed.count());
+  }
+  cout << "  Steps/sec: " << steps_per_sec << endl;
+
+  if (profile) print_profile(trace->getRootCommand(), profile_count);
+
   if (list_artifacts) {
     cout << endl;
     cout << "Artifacts:" << endl;
-    for (const auto& weak_artifact : env::getArtifacts()) {
-      auto a = weak_artifact.lock();
-      if (!a) continue;
-
+    env::getArtifacts().forEach([](const shared_ptr<Artifact>& a) {
       if (a->getName().empty()) {
         cout << "  " << a->getTypeName() << ": <anonymous>" << endl;
       } else {
@@ -65,6 +212,6 @@ void do_stats(vector<string> args, bool list_artifacts) noexcept {
         index++;
       }
       cout << endl;
-    }
+    });
   }
 }
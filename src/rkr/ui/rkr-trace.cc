@@ -1,5 +1,7 @@
 #include <fstream>
 #include <iostream>
+#include <optional>
+#include <regex>
 #include <string>
 #include <vector>
 
@@ -10,21 +12,57 @@
 
 using std::cout;
 using std::ofstream;
+using std::optional;
 using std::string;
 using std::vector;
 
 /**
  * Run the `trace` subcommand
  * \param output    The name of the output file, or "-" for stdout
+ * \param command   If set, only print steps from commands whose command line matches this regex
+ * \param path      If set, only print steps that resolve a path with this prefix or use the result
+ * \param steps     If not empty, only print steps of these types
+ * \param scenario  If set, only print predicates checked in this scenario
  */
-void do_trace(vector<string> args, string output) noexcept {
+void do_trace(vector<string> args,
+              string output,
+              optional<string> command,
+              optional<string> path,
+              vector<string> steps,
+              optional<string> scenario) noexcept {
   auto trace = TraceReader::load(constants::DatabaseFilename);
   FAIL_IF(!trace) << "A trace could not be loaded. Run a full build first.";
 
+  // Set up the filter
+  TraceFilter filter;
+
+  if (command.has_value()) {
+    try {
+      filter.command = std::regex(command.value(), std::regex::nosubs);
+    } catch (const std::regex_error& e) {
+      FAIL << "Invalid command pattern \"" << command.value() << "\": " << e.what();
+    }
+  }
+
+  filter.path = path;
+
+  for (const auto& step : steps) {
+    FAIL_IF(TraceFilter::StepTypes.count(step) == 0) << "Unknown step type " << step;
+    filter.steps.insert(step);
+  }
+
+  if (scenario == "build") {
+    filter.scenario = Scenario::Build;
+  } else if (scenario == "post-build") {
+    filter.scenario = Scenario::PostBuild;
+  } else {
+    FAIL_IF(scenario.has_value()) << "Unknown scenario " << scenario.value();
+  }
+
   // Are we printing to stdout or a file?
   if (output == "-") {
-    trace->sendTo(TracePrinter(cout));
+    trace->sendTo(TracePrinter(cout), filter);
   } else {
-    trace->sendTo(TracePrinter(ofstream(output)));
+    trace->sendTo(TracePrinter(ofstream(output)), filter);
   }
 }
@@ -1,3 +1,4 @@
+#include <cstddef>
 #include <cstdio>
 #include <filesystem>
 #include <iostream>
@@ -109,6 +110,36 @@ int main(int argc, char* argv[]) noexcept {
       ->description("Disable the build cache")
       ->group("Optimizations");
 
+  app.add_flag("--hardlink-cache", options::hardlink_staging,
+               "Stage read-only outputs from the cache with hard links")
+      ->group("Optimizations");
+
+  app.add_option("--io-threads", options::io_threads,
+                 "Threads used to check and stage files after a build (default: one per core)")
+      ->type_name("N")
+      ->group("Optimizations");
+
+  app.add_option("-j,--jobs", options::jobs,
+                 "Compilers the parallel compiler wrappers may run at once (default: one per core)")
+      ->type_name("N")
+      ->group("Optimizations");
+
+  app.add_flag("--speculate", options::speculate,
+               "Run commands that may need to run as soon as their inputs are known to change")
+      ->group("Optimizations");
+
+  app.add_flag("--compile-cache", options::compile_cache,
+               "Let the parallel compiler wrappers reuse objects for unchanged translation units")
+      ->group("Optimizations");
+
+  optional<fs::path> timeline;
+  app.add_option("--timeline", timeline,
+                 "Path to write a timeline of the build in Chrome trace-event JSON format")
+      ->type_name("FILE");
+
+  bool no_daemon = false;
+  app.add_flag("--no-daemon", no_daemon, "Run this command even if an rkr daemon is listening");
+
   /************* Build Subcommand *************/
   auto build = app.add_subcommand("build", "Perform a build (default)");
 
@@ -127,6 +158,9 @@ int main(int argc, char* argv[]) noexcept {
 
   build->add_flag("--syscall-stats", options::syscall_stats, "Collect system call statistics");
 
+  build->add_flag("--compress-trace", options::compress_trace,
+                  "Compress the build database when it is saved");
+
   // Flags to turn the parallel compiler wrapper on/off
   build
       ->add_flag_callback(
@@ -146,6 +180,10 @@ int main(int argc, char* argv[]) noexcept {
   build->add_option("-o,--output", command_output,
                     "Output file where commands should be printed (default: -)");
 
+  vector<fs::path> targets;
+  build->add_option("targets", targets,
+                    "Only run the commands needed to bring these paths up to date");
+
   /************* Audit Subcommand *************/
   auto audit = app.add_subcommand("audit", "Run a full build and print all commands");
 
@@ -158,8 +196,24 @@ int main(int argc, char* argv[]) noexcept {
   /************* Trace Subcommand *************/
   string trace_output = "-";
 
+  optional<string> trace_command;
+  optional<string> trace_path;
+  vector<string> trace_steps;
+  optional<string> trace_scenario;
+
   auto trace = app.add_subcommand("trace", "Print a build trace in human-readable format");
   trace->add_option("-o,--output", trace_output, "Output file for the trace (default: -)");
+  trace->add_option("-c,--command", trace_command,
+                    "Only print steps from commands whose command line matches this regex")
+      ->type_name("REGEX");
+  trace->add_option("-p,--path", trace_path,
+                    "Only print steps that resolve a path with this prefix, or use the result")
+      ->type_name("PREFIX");
+  trace->add_option("-s,--step", trace_steps, "Only print steps of these types (e.g. PathRef)")
+      ->type_name("TYPE");
+  trace->add_option("--scenario", trace_scenario,
+                    "Only print predicates checked in this scenario (build or post-build)")
+      ->check(CLI::IsMember({"build", "post-build"}));
 
   /************* Graph Subcommand *************/
   // Leave output file and type empty for later default processing
@@ -167,18 +221,39 @@ int main(int argc, char* argv[]) noexcept {
   string graph_type;
   bool show_all = false;
   bool no_render = false;
+  optional<string> graph_focus;
+  size_t graph_hops = 1;
+  bool by_directory = false;
 
   auto graph = app.add_subcommand("graph", "Generate a build graph");
   graph->add_option("-o,--output", graph_output, "Output file for the graph");
-  graph->add_option("-t,--type", graph_type, "Output format for the graph (png, pdf, jpg, etc.)");
+  graph->add_option("-t,--type", graph_type,
+                    "Output format for the graph (png, pdf, jpg, etc., or csv and jsonl for an "
+                    "edge list)");
   graph->add_flag("-n,--no-render", no_render, "Generate graphiz source instead of rendering");
   graph->add_flag("-a,--all", show_all, "Include all files in the graph");
+  graph->add_option("-f,--focus", graph_focus,
+                    "Only include commands and files near those that match this regex");
+  graph->add_option("--hops", graph_hops, "How far out from --focus matches to include");
+  graph->add_flag("-d,--by-directory", by_directory,
+                  "Group commands by the directories they write to");
 
   /************* Stats Subcommand *************/
   bool list_artifacts = false;
+  bool profile = false;
+  size_t profile_count = 10;
 
   auto stats = app.add_subcommand("stats", "Print build statistics");
   stats->add_flag("-a,--artifacts", list_artifacts, "Print a list of artifacts and their versions");
+  stats->add_flag("-p,--profile", profile,
+                  "Print the commands that used the most time, and the build's critical path");
+  stats->add_option("-n,--top", profile_count, "The number of commands to list with --profile");
+
+  /************* Daemon Subcommand *************/
+  auto daemon = app.add_subcommand(
+      "daemon",
+      "Serve build and check requests from this directory, keeping artifact state in memory "
+      "between requests");
 
   /************* Rikerfile Arguments ***********/
   vector<string> args;
@@ -190,18 +265,34 @@ int main(int argc, char* argv[]) noexcept {
   // Note: using lambdas with reference capture instead of std::bind, since we'd have to wrap
   // every argument in std::ref to pass values by reference.
 
-  // build subcommand
-  build->final_callback([&] { do_build(args, stats_log, command_output); });
+  // build subcommand. Builds that only print to stdout can be handed off to a running daemon.
+  build->final_callback([&] {
+    bool use_daemon = !no_daemon && !stats_log.has_value() && !timeline.has_value() &&
+                      !options::syscall_stats && !options::compress_trace && command_output == "-" &&
+                      targets.empty();
+    if (!use_daemon || !send_to_daemon("build", args)) {
+      do_build(args, stats_log, timeline, command_output, targets);
+    }
+  });
   // audit subcommand
   audit->final_callback([&] { do_audit(args, command_output); });
   // check subcommand
-  check->final_callback([&] { do_check(args); });
+  check->final_callback([&] {
+    if (no_daemon || !send_to_daemon("check", args)) do_check(args);
+  });
   // trace subcommand
-  trace->final_callback([&] { do_trace(args, trace_output); });
+  trace->final_callback([&] {
+    do_trace(args, trace_output, trace_command, trace_path, trace_steps, trace_scenario);
+  });
   // graph subcommand
-  graph->final_callback([&] { do_graph(args, graph_output, graph_type, show_all, no_render); });
+  graph->final_callback([&] {
+    do_graph(args, graph_output, graph_type, show_all, no_render, graph_focus, graph_hops,
+             by_directory);
+  });
   // stats subcommand
-  stats->final_callback([&] { do_stats(args, list_artifacts); });
+  stats->final_callback([&] { do_stats(args, list_artifacts, profile, profile_count); });
+  // daemon subcommand
+  daemon->final_callback([&] { do_daemon(); });
 
   /************* Argument Parsing *************/
 
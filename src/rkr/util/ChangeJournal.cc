@@ -0,0 +1,123 @@
+#include "ChangeJournal.hh"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <set>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "util/log.hh"
+
+namespace fs = std::filesystem;
+
+using std::set;
+
+/// The events that indicate a change to a watched directory or one of its entries
+enum : uint32_t {
+  EntryEvents = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO,
+  WatchEvents = IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | EntryEvents
+};
+
+ChangeJournal::~ChangeJournal() noexcept {
+  if (_fd != -1) ::close(_fd);
+}
+
+void ChangeJournal::clear() noexcept {
+  // Closing the inotify instance drops every watch at once
+  if (_fd != -1) ::close(_fd);
+  _fd = -1;
+  _watches.clear();
+  _watched.clear();
+  _changes.clear();
+  _complete = true;
+}
+
+void ChangeJournal::watch(const fs::path& dir) noexcept {
+  if (_watched.find(dir) != _watched.end()) return;
+
+  if (_fd == -1) {
+    _fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd == -1) {
+      LOG(phase) << "Unable to start a change journal: " << ERR;
+      _complete = false;
+      return;
+    }
+  }
+
+  // Watching a directory that is already watched through another path returns the same descriptor
+  int wd = ::inotify_add_watch(_fd, dir.c_str(), WatchEvents | IN_ONLYDIR);
+  if (wd == -1) {
+    LOG(phase) << "Unable to watch " << dir << " for changes: " << ERR;
+    _complete = false;
+    return;
+  }
+
+  _watches[wd].insert(dir);
+  _watched.insert(dir);
+}
+
+void ChangeJournal::discard() noexcept {
+  drain();
+  _changes.clear();
+  _complete = true;
+}
+
+const set<fs::path>* ChangeJournal::getChanges() noexcept {
+  drain();
+  if (!_complete) return nullptr;
+  return &_changes;
+}
+
+void ChangeJournal::drain() noexcept {
+  if (_fd == -1) return;
+
+  alignas(struct inotify_event) char buffer[64 * 1024];
+  while (true) {
+    ssize_t len = ::read(_fd, buffer, sizeof(buffer));
+    if (len == -1 && errno == EINTR) continue;
+    if (len <= 0) break;
+
+    for (char* p = buffer; p < buffer + len;) {
+      auto event = reinterpret_cast<struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + event->len;
+
+      // The kernel dropped events, so some changes were never reported
+      if (event->mask & IN_Q_OVERFLOW) {
+        LOG(phase) << "Change journal overflowed";
+        _complete = false;
+        continue;
+      }
+
+      auto iter = _watches.find(event->wd);
+      if (iter == _watches.end()) continue;
+
+      // The watch was removed because its directory was deleted or unmounted. The directory will
+      // have to be checked, and watched again if it still exists.
+      if (event->mask & IN_IGNORED) {
+        for (const auto& dir : iter->second) {
+          _changes.insert(dir);
+          _watched.erase(dir);
+        }
+        _watches.erase(iter);
+        continue;
+      }
+
+      for (const auto& dir : iter->second) {
+        if (event->len > 0) {
+          // An event on an entry in the directory
+          _changes.insert(dir / event->name);
+
+          // Adding, removing, or renaming an entry changes the directory as well
+          if (event->mask & EntryEvents) _changes.insert(dir);
+        } else {
+          // An event on the directory itself
+          _changes.insert(dir);
+        }
+      }
+    }
+  }
+}
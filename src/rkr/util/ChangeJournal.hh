@@ -0,0 +1,66 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <set>
+
+namespace fs = std::filesystem;
+
+/**
+ * A ChangeJournal records the paths that change inside a set of watched directories, using
+ * inotify. Each watch covers a directory's own attributes and every entry in it, so watching the
+ * parent directory of each file is enough to hear about writes to that file.
+ *
+ * The journal is only useful if it is complete. If a watch cannot be added, the kernel's event
+ * queue overflows, or a watch is dropped, the journal stops being trusted and callers have to fall
+ * back to checking every path themselves.
+ */
+class ChangeJournal {
+ public:
+  ChangeJournal() noexcept = default;
+
+  /// Stop watching and close the inotify instance
+  ~ChangeJournal() noexcept;
+
+  // Disallow Copy
+  ChangeJournal(const ChangeJournal&) = delete;
+  ChangeJournal& operator=(const ChangeJournal&) = delete;
+
+  /// Stop watching every directory and forget any recorded changes
+  void clear() noexcept;
+
+  /// Watch a directory for changes to it or its entries. Directories that are already watched are
+  /// skipped. A directory that cannot be watched leaves the journal untrusted.
+  void watch(const fs::path& dir) noexcept;
+
+  /// Discard the changes recorded so far, so only later changes are reported. Directories whose
+  /// watches were dropped are forgotten, so a later call to watch() adds them again.
+  void discard() noexcept;
+
+  /**
+   * Collect pending events from the kernel and get the set of paths that changed since the last
+   * call to discard(). Changes to a directory's entries also add the directory itself.
+   * \returns a pointer to the changed paths, or nullptr if the journal cannot be trusted
+   */
+  const std::set<fs::path>* getChanges() noexcept;
+
+ private:
+  /// Read every pending event from the inotify instance
+  void drain() noexcept;
+
+ private:
+  /// The inotify instance, or -1 if it has not been opened
+  int _fd = -1;
+
+  /// The paths watched by each watch descriptor. Paths that reach the same directory share a watch.
+  std::map<int, std::set<fs::path>> _watches;
+
+  /// The set of watched directories
+  std::set<fs::path> _watched;
+
+  /// Paths changed since the last call to discard()
+  std::set<fs::path> _changes;
+
+  /// Is every change since the last call to discard() in _changes?
+  bool _complete = true;
+};
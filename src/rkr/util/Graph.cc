@@ -1,21 +1,27 @@
 #include "Graph.hh"
 
+#include <deque>
 #include <filesystem>
 #include <list>
+#include <map>
 #include <memory>
 #include <ostream>
 #include <string>
 
 #include "artifacts/Artifact.hh"
 #include "runtime/Command.hh"
+#include "util/json.hh"
 #include "versions/ContentVersion.hh"
 #include "versions/DirVersion.hh"
 #include "versions/MetadataVersion.hh"
 
+using std::deque;
+using std::map;
 using std::ostream;
 using std::shared_ptr;
 using std::string;
 using std::to_string;
+using std::vector;
 
 namespace fs = std::filesystem;
 
@@ -28,19 +34,30 @@ string escape(string s) noexcept {
     return s.substr(0, pos) + "\\\"" + escape(s.substr(pos + 1));
 }
 
-string Graph::addCommand(shared_ptr<Command> c) noexcept {
+/// Write a string as a quoted CSV field
+static void write_csv_field(ostream& o, const string& s) noexcept {
+  o << '"';
+  for (char c : s) {
+    if (c == '"') o << '"';
+    o << c;
+  }
+  o << '"';
+}
+
+uint32_t Graph::addCommand(shared_ptr<Command> c) noexcept {
   // Look to see if we already have a record of this command. Return if we do.
-  auto iter = _command_ids.find(c);
+  auto iter = _command_ids.find(c.get());
   if (iter != _command_ids.end()) return iter->second;
 
   // Create an ID for this command and save it
-  string command_id = "c" + to_string(_command_ids.size());
-  _command_ids.emplace_hint(iter, c, command_id);
+  uint32_t command_id = _vertices.size();
+  _vertices.push_back({VertexKind::Command, c, nullptr, c->getFullName()});
+  _command_ids.emplace_hint(iter, c.get(), command_id);
 
   // Add this command's children
   for (auto& child : c->getChildren()) {
     auto child_id = addCommand(child);
-    _command_edges.emplace(command_id, child_id);
+    addEdge(command_id, child_id, NoVersion, EdgeKind::Child);
   }
 
   // Add this command's inputs
@@ -67,7 +84,7 @@ string Graph::addCommand(shared_ptr<Command> c) noexcept {
     auto version_id = addVersion(v);
 
     // Add the input edge
-    _io_edges.emplace(artifact_id + ":" + version_id, command_id);
+    addEdge(artifact_id, command_id, version_id, EdgeKind::Input);
   }
 
   // Add this command's outputs
@@ -77,21 +94,22 @@ string Graph::addCommand(shared_ptr<Command> c) noexcept {
     auto version_id = addVersion(v);
 
     // Add the output edge
-    _io_edges.emplace(command_id, artifact_id + ":" + version_id);
+    addEdge(command_id, artifact_id, version_id, EdgeKind::Output);
   }
 
   // Return the new command's ID
   return command_id;
 }
 
-string Graph::addArtifact(shared_ptr<Artifact> a) noexcept {
+uint32_t Graph::addArtifact(shared_ptr<Artifact> a) noexcept {
   // Look for the artifact. If it's already in the map, return its ID.
-  auto iter = _artifact_ids.find(a);
+  auto iter = _artifact_ids.find(a.get());
   if (iter != _artifact_ids.end()) return iter->second;
 
   // Create an ID for the artifact and save it
-  string artifact_id = "a" + to_string(_artifact_ids.size());
-  _artifact_ids.emplace_hint(iter, a, artifact_id);
+  uint32_t artifact_id = _vertices.size();
+  _vertices.push_back({VertexKind::Artifact, nullptr, a, a->getName()});
+  _artifact_ids.emplace_hint(iter, a.get(), artifact_id);
 
   // Add all of this artifact's versions to the graph
   for (auto& v : a->getVersions()) {
@@ -101,95 +119,299 @@ string Graph::addArtifact(shared_ptr<Artifact> a) noexcept {
   return artifact_id;
 }
 
-string Graph::addVersion(shared_ptr<Version> v) noexcept {
+uint32_t Graph::addVersion(shared_ptr<Version> v) noexcept {
   // Look for the version. If it's already in the map, return its ID.
-  auto iter = _version_ids.find(v);
+  auto iter = _version_ids.find(v.get());
   if (iter != _version_ids.end()) return iter->second;
 
   // Create an ID for the version and save it
-  string version_id = "v" + to_string(_version_ids.size());
-  _version_ids.emplace_hint(iter, v, version_id);
+  uint32_t version_id = _versions.size();
+  _versions.push_back(v);
+  _version_ids.emplace_hint(iter, v.get(), version_id);
 
   return version_id;
 }
 
-ostream& operator<<(ostream& o, Graph& g) noexcept {
-  o << "digraph {\n";
-  o << "  graph [rankdir=LR]\n";
+void Graph::addEdge(uint32_t src, uint32_t dest, uint32_t version, EdgeKind kind) noexcept {
+  Edge e{src, dest, version, kind};
+  if (_edge_set.insert(e).second) _edges.push_back(e);
+}
+
+void Graph::replaceVertices(vector<Vertex> vertices, const vector<uint32_t>& remap) noexcept {
+  _vertices = std::move(vertices);
+
+  // Rebuild the lookup tables for commands and artifacts
+  _command_ids.clear();
+  _artifact_ids.clear();
+  for (uint32_t id = 0; id < _vertices.size(); id++) {
+    if (_vertices[id].command) _command_ids.emplace(_vertices[id].command.get(), id);
+    if (_vertices[id].artifact) _artifact_ids.emplace(_vertices[id].artifact.get(), id);
+  }
 
-  // Create command vertices
-  for (const auto& [c, id] : g._command_ids) {
-    o << "  " << id << " [";
-    o << "label=\"" << escape(c->getShortName()) << "\" ";
-    o << "tooltip=\"" << escape(c->getFullName()) << "\" ";
-    o << "fontname=Courier ";
-
-    // Color the command based on its marking state
-    if (c->getMarking() == RebuildMarking::MayRun) {
-      // Commands that may run are yellow
-      o << "style=\"filled\" ";
-      o << "fillcolor=\"yellow\" ";
-
-    } else if (c->getMarking() == RebuildMarking::MustRun) {
-      // Commands that must run are red
-      o << "style=\"filled\" ";
-      o << "fillcolor=\"red\" ";
+  // Renumber the edges
+  auto old_edges = std::move(_edges);
+  _edges.clear();
+  _edge_set.clear();
+  for (const auto& e : old_edges) {
+    auto src = remap[e.src];
+    auto dest = remap[e.dest];
+    if (src == NoVertex || dest == NoVertex || src == dest) continue;
+    addEdge(src, dest, e.version, e.kind);
+  }
+}
+
+size_t Graph::focus(const std::regex& pattern, size_t hops) noexcept {
+  // Build an undirected adjacency list
+  vector<vector<uint32_t>> neighbors(_vertices.size());
+  for (const auto& e : _edges) {
+    neighbors[e.src].push_back(e.dest);
+    neighbors[e.dest].push_back(e.src);
+  }
+
+  // Start a breadth-first search from every vertex whose label matches the pattern
+  vector<size_t> distance(_vertices.size(), SIZE_MAX);
+  deque<uint32_t> queue;
+  for (uint32_t id = 0; id < _vertices.size(); id++) {
+    if (std::regex_search(_vertices[id].label, pattern)) {
+      distance[id] = 0;
+      queue.push_back(id);
     }
+  }
+
+  size_t matches = queue.size();
 
-    o << "]\n";
+  while (!queue.empty()) {
+    auto id = queue.front();
+    queue.pop_front();
+    if (distance[id] == hops) continue;
+
+    for (auto n : neighbors[id]) {
+      if (distance[n] == SIZE_MAX) {
+        distance[n] = distance[id] + 1;
+        queue.push_back(n);
+      }
+    }
   }
 
-  // Create command edges
-  for (const auto& [parent, child] : g._command_edges) {
-    o << "  " << parent << " -> " << child << " [style=dotted weight=1]\n";
+  // Keep the vertices the search reached
+  vector<Vertex> vertices;
+  vector<uint32_t> remap(_vertices.size(), NoVertex);
+  for (uint32_t id = 0; id < _vertices.size(); id++) {
+    if (distance[id] != SIZE_MAX) {
+      remap[id] = vertices.size();
+      vertices.push_back(std::move(_vertices[id]));
+    }
   }
 
-  // Create artifact vertices
-  for (const auto& [artifact, artifact_id] : g._artifact_ids) {
-    // Start the vertex with HTML output
-    o << "  " << artifact_id << " [label=<";
+  replaceVertices(std::move(vertices), remap);
+
+  return matches;
+}
+
+void Graph::collapseDirectories() noexcept {
+  // Place each command in the directory holding the first file it writes
+  vector<string> group(_vertices.size());
+  vector<uint32_t> parent(_vertices.size(), NoVertex);
+  for (const auto& e : _edges) {
+    if (e.kind == EdgeKind::Child) {
+      parent[e.dest] = e.src;
 
-    // Begin a table
-    o << "<table border=\"0\" cellspacing=\"0\" cellborder=\"1\" cellpadding=\"5\">";
+    } else if (e.kind == EdgeKind::Output && group[e.src].empty()) {
+      // Directory outputs say more about where the directory is than the command
+      if (_versions[e.version]->is_a<DirVersion>()) continue;
 
-    // Print the artifact type
-    o << "<tr><td border=\"0\"><sub>" << artifact->getTypeName() << "</sub></td></tr>";
+      const auto& name = _vertices[e.dest].label;
+      if (name.empty()) continue;
 
-    // Add a row with the artifact name, unless the artifact is unnamed
-    auto name = artifact->getName();
-    if (!name.empty()) {
-      o << "<tr><td>" + name + "</td></tr>";
+      auto dir = fs::path(name).parent_path().string();
+      group[e.src] = dir.empty() ? "." : dir;
     }
+  }
 
-    // Add a row for each version
-    for (const auto& v : artifact->getVersions()) {
-      o << "<tr><td port=\"" + g.addVersion(v) + "\"";
-      /*if (_changed_versions.find(v) != _changed_versions.end()) {
-        o << " bgcolor=\"yellow\"";
-      }*/
-      o << ">";
-      o << "<font point-size=\"10\">" << v->getTypeName() << "</font>";
-      o << "</td></tr>";
+  // Commands that do not write any files stay with their parents. Parents are always numbered
+  // before their children, so one pass in ID order is enough.
+  for (uint32_t id = 0; id < _vertices.size(); id++) {
+    if (_vertices[id].kind != VertexKind::Command || !group[id].empty()) continue;
+    if (parent[id] != NoVertex && !group[parent[id]].empty()) {
+      group[id] = group[parent[id]];
+    } else {
+      group[id] = ".";
     }
+  }
 
-    // Finish the vertex line
-    o << "</table>> shape=plain]\n";
+  // Replace commands with one vertex for each directory, and keep all other vertices
+  vector<Vertex> vertices;
+  vector<uint32_t> remap(_vertices.size(), NoVertex);
+  map<string, uint32_t> directory_ids;
+  for (uint32_t id = 0; id < _vertices.size(); id++) {
+    if (_vertices[id].kind == VertexKind::Command) {
+      auto [iter, added] = directory_ids.emplace(group[id], vertices.size());
+      if (added) vertices.push_back({VertexKind::Directory, nullptr, nullptr, group[id]});
+      remap[id] = iter->second;
+
+    } else {
+      remap[id] = vertices.size();
+      vertices.push_back(std::move(_vertices[id]));
+    }
   }
 
-  // Create I/O edges
-  for (const auto& [src, dest] : g._io_edges) {
-    // Does the reverse edges also appear in our set?
-    if (auto iter = g._io_edges.find({dest, src}); iter != g._io_edges.end()) {
-      // Yes. Draw this as a bidirectional edge
-      o << "  " << src << " -> " << dest
-        << " [arrowhead=empty weight=2 dir=both arrowtail=empty]\n";
+  replaceVertices(std::move(vertices), remap);
+}
+
+const char* Graph::getKindName(VertexKind kind) noexcept {
+  switch (kind) {
+    case VertexKind::Command:
+      return "command";
+    case VertexKind::Artifact:
+      return "artifact";
+    case VertexKind::Directory:
+      return "directory";
+  }
+  return "unknown";
+}
+
+const char* Graph::getKindName(EdgeKind kind) noexcept {
+  switch (kind) {
+    case EdgeKind::Child:
+      return "child";
+    case EdgeKind::Input:
+      return "input";
+    case EdgeKind::Output:
+      return "output";
+  }
+  return "unknown";
+}
+
+void Graph::writeCSV(ostream& o) const noexcept {
+  o << "record,id,src,dst,kind,label\n";
+
+  for (uint32_t id = 0; id < _vertices.size(); id++) {
+    const auto& v = _vertices[id];
+    o << "v," << id << ",,," << getKindName(v.kind) << ',';
+    write_csv_field(o, v.label);
+    o << '\n';
+  }
+
+  // Label input and output edges with the type of the version they read or write
+  for (const auto& e : _edges) {
+    o << "e,," << e.src << ',' << e.dest << ',' << getKindName(e.kind) << ',';
+    if (e.version != NoVersion) write_csv_field(o, _versions[e.version]->getTypeName());
+    o << '\n';
+  }
+}
+
+void Graph::writeJSONLines(ostream& o) const noexcept {
+  for (uint32_t id = 0; id < _vertices.size(); id++) {
+    const auto& v = _vertices[id];
+    o << "{\"id\":" << id << ",\"kind\":\"" << getKindName(v.kind) << "\",\"label\":";
+    writeJSONString(o, v.label);
+    o << "}\n";
+  }
+
+  for (const auto& e : _edges) {
+    o << "{\"src\":" << e.src << ",\"dst\":" << e.dest << ",\"kind\":\"" << getKindName(e.kind)
+      << "\"";
+    if (e.version != NoVersion) {
+      o << ",\"version\":";
+      writeJSONString(o, _versions[e.version]->getTypeName());
+    }
+    o << "}\n";
+  }
+}
+
+ostream& operator<<(ostream& o, Graph& g) noexcept {
+  o << "digraph {\n";
+  o << "  graph [rankdir=LR]\n";
+
+  // Get the graphviz name for a vertex, with a port for a version if there is one
+  auto name = [&](uint32_t id, uint32_t version = Graph::NoVersion) {
+    string prefix = g._vertices[id].kind == Graph::VertexKind::Artifact ? "a" : "c";
+    string n = prefix + to_string(id);
+    if (version != Graph::NoVersion) n += ":v" + to_string(version);
+    return n;
+  };
+
+  for (uint32_t id = 0; id < g._vertices.size(); id++) {
+    const auto& vertex = g._vertices[id];
+
+    if (vertex.kind == Graph::VertexKind::Command) {
+      // Create command vertices
+      const auto& c = vertex.command;
+      o << "  " << name(id) << " [";
+      o << "label=\"" << escape(c->getShortName()) << "\" ";
+      o << "tooltip=\"" << escape(c->getFullName()) << "\" ";
+      o << "fontname=Courier ";
+
+      // Color the command based on its marking state
+      if (c->getMarking() == RebuildMarking::MayRun) {
+        // Commands that may run are yellow
+        o << "style=\"filled\" ";
+        o << "fillcolor=\"yellow\" ";
+
+      } else if (c->getMarking() == RebuildMarking::MustRun) {
+        // Commands that must run are red
+        o << "style=\"filled\" ";
+        o << "fillcolor=\"red\" ";
+      }
 
-      // Erase the other edge, since we've already drawn it
-      g._io_edges.erase(iter);
+      o << "]\n";
+
+    } else if (vertex.kind == Graph::VertexKind::Directory) {
+      // Directories stand in for the commands that write to them
+      o << "  " << name(id) << " [label=\"" << escape(vertex.label) << "\" ";
+      o << "fontname=Courier shape=folder]\n";
 
     } else {
-      // No, this is just a regular input edge
+      const auto& artifact = vertex.artifact;
+
+      // Start the vertex with HTML output
+      o << "  " << name(id) << " [label=<";
+
+      // Begin a table
+      o << "<table border=\"0\" cellspacing=\"0\" cellborder=\"1\" cellpadding=\"5\">";
+
+      // Print the artifact type
+      o << "<tr><td border=\"0\"><sub>" << artifact->getTypeName() << "</sub></td></tr>";
+
+      // Add a row with the artifact name, unless the artifact is unnamed
+      if (!vertex.label.empty()) {
+        o << "<tr><td>" + vertex.label + "</td></tr>";
+      }
+
+      // Add a row for each version
+      for (const auto& v : artifact->getVersions()) {
+        o << "<tr><td port=\"v" << g.addVersion(v) << "\">";
+        o << "<font point-size=\"10\">" << v->getTypeName() << "</font>";
+        o << "</td></tr>";
+      }
+
+      // Finish the vertex line
+      o << "</table>> shape=plain]\n";
+    }
+  }
+
+  for (const auto& e : g._edges) {
+    if (e.kind == Graph::EdgeKind::Child) {
+      // Create command edges
+      o << "  " << name(e.src) << " -> " << name(e.dest) << " [style=dotted weight=1]\n";
+      continue;
+    }
+
+    // Create I/O edges. Only artifact ends of the edge have version ports.
+    auto src = e.kind == Graph::EdgeKind::Input ? name(e.src, e.version) : name(e.src);
+    auto dest = e.kind == Graph::EdgeKind::Output ? name(e.dest, e.version) : name(e.dest);
+
+    // Does the reverse edge also appear in the graph?
+    bool reversed = g._edge_set.count({e.dest, e.src, e.version, e.kind}) > 0;
+
+    if (!reversed) {
+      // No, this is just a regular edge
       o << "  " << src << " -> " << dest << " [arrowhead=empty weight=2]\n";
+
+    } else if (e.kind == Graph::EdgeKind::Input) {
+      // Yes. Draw the pair once, as a bidirectional edge
+      o << "  " << src << " -> " << dest
+        << " [arrowhead=empty weight=2 dir=both arrowtail=empty]\n";
     }
   }
 
@@ -1,22 +1,30 @@
 #pragma once
 
-#include <map>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <ostream>
-#include <set>
+#include <regex>
 #include <string>
-#include <utility>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 class Artifact;
 class Command;
 class Version;
 
+/**
+ * A Graph holds the commands and artifacts from a build, connected by parent/child, input, and
+ * output edges. Vertices and versions are numbered with dense integer IDs as they are added. A
+ * graph can be printed as graphviz source, or streamed out as a CSV or JSON lines edge list.
+ */
 class Graph {
  public:
   /// Create a graph from the commands in an input trace
   Graph(bool show_all) noexcept : _show_all(show_all) {}
 
-  /// Print a Graph reference
+  /// Print a Graph reference as graphviz source
   friend std::ostream& operator<<(std::ostream& o, Graph& g) noexcept;
 
   /// Add an iterable set of commands to the graph
@@ -27,32 +35,99 @@ class Graph {
     }
   }
 
+  /// Remove every vertex that is more than a number of hops from a vertex whose label matches a
+  /// pattern. Edges are followed in both directions. Returns the number of matching vertices.
+  size_t focus(const std::regex& pattern, size_t hops) noexcept;
+
+  /// Replace command vertices with one vertex for each directory the commands write to
+  void collapseDirectories() noexcept;
+
+  /// Stream the graph out as CSV. Vertex rows come first, then edge rows.
+  void writeCSV(std::ostream& o) const noexcept;
+
+  /// Stream the graph out as JSON lines, with one object for each vertex and each edge
+  void writeJSONLines(std::ostream& o) const noexcept;
+
  private:
+  /// The kinds of vertices in the graph
+  enum class VertexKind : uint8_t { Command, Artifact, Directory };
+
+  /// The kinds of edges in the graph
+  enum class EdgeKind : uint8_t { Child, Input, Output };
+
+  /// Edges that do not refer to a specific version use this version ID, and removed vertices are
+  /// remapped to NoVertex
+  enum : uint32_t { NoVersion = UINT32_MAX, NoVertex = UINT32_MAX };
+
+  struct Vertex {
+    VertexKind kind;
+    std::shared_ptr<Command> command;
+    std::shared_ptr<Artifact> artifact;
+    std::string label;
+  };
+
+  struct Edge {
+    uint32_t src;
+    uint32_t dest;
+    uint32_t version;
+    EdgeKind kind;
+
+    bool operator==(const Edge& other) const noexcept {
+      return src == other.src && dest == other.dest && version == other.version;
+    }
+  };
+
+  struct EdgeHash {
+    size_t operator()(const Edge& e) const noexcept {
+      return std::hash<uint64_t>()((static_cast<uint64_t>(e.src) << 32) | e.dest) ^ e.version;
+    }
+  };
+
   /// Add a command to the graph
-  std::string addCommand(std::shared_ptr<Command> c) noexcept;
+  uint32_t addCommand(std::shared_ptr<Command> c) noexcept;
 
   /// Add an artifact to the graph
-  std::string addArtifact(std::shared_ptr<Artifact> c) noexcept;
+  uint32_t addArtifact(std::shared_ptr<Artifact> a) noexcept;
 
   /// Add a version to the graph
-  std::string addVersion(std::shared_ptr<Version> c) noexcept;
+  uint32_t addVersion(std::shared_ptr<Version> v) noexcept;
+
+  /// Add an edge to the graph, unless an identical edge is already present
+  void addEdge(uint32_t src, uint32_t dest, uint32_t version, EdgeKind kind) noexcept;
+
+  /// Replace the graph's vertices. The remap vector gives the new ID for each old vertex, or
+  /// NoVertex if the old vertex was removed. Edges are renumbered, and edges that become self-loops
+  /// or duplicates are dropped.
+  void replaceVertices(std::vector<Vertex> vertices, const std::vector<uint32_t>& remap) noexcept;
+
+  /// Get the name used for a vertex kind in exported graphs
+  static const char* getKindName(VertexKind kind) noexcept;
+
+  /// Get the name used for an edge kind in exported graphs
+  static const char* getKindName(EdgeKind kind) noexcept;
 
  private:
   /// Should the graph output include all artifacts?
   bool _show_all;
 
-  /// A map from commands to their IDs in the graph output
-  std::map<std::shared_ptr<Command>, std::string> _command_ids;
+  /// The vertices in the graph, indexed by ID
+  std::vector<Vertex> _vertices;
+
+  /// The edges in the graph, in the order they were added
+  std::vector<Edge> _edges;
+
+  /// The set of edges, used to skip duplicates
+  std::unordered_set<Edge, EdgeHash> _edge_set;
 
-  /// A map from artifacts to the ID used to represent the entire artifact in the build graph
-  std::map<std::shared_ptr<Artifact>, std::string> _artifact_ids;
+  /// A map from commands to their vertex IDs
+  std::unordered_map<Command*, uint32_t> _command_ids;
 
-  /// A map from versions to their ID (not prefixed by artifact ID)
-  std::map<std::shared_ptr<Version>, std::string> _version_ids;
+  /// A map from artifacts to their vertex IDs
+  std::unordered_map<Artifact*, uint32_t> _artifact_ids;
 
-  /// A set of command edges, from parent to child
-  std::set<std::pair<std::string, std::string>> _command_edges;
+  /// A map from versions to their IDs
+  std::unordered_map<Version*, uint32_t> _version_ids;
 
-  // Command input edges (artifact -> command)
-  std::set<std::pair<std::string, std::string>> _io_edges;
+  /// The versions in the graph, indexed by ID
+  std::vector<std::shared_ptr<Version>> _versions;
 };
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+/**
+ * An open-addressing hash table keyed by (device, inode) pairs. Entries are stored inline in a
+ * single flat array and found with linear probing, so a lookup usually touches a single cache line
+ * instead of walking the nodes of a tree. Removal uses backward-shift deletion, so the table never
+ * accumulates tombstones.
+ */
+template <class V>
+class InodeTable {
+ public:
+  /// Find the value stored for an inode, or nullptr if there is none
+  V* find(dev_t dev, ino_t ino) noexcept {
+    if (_count == 0) return nullptr;
+    for (size_t i = home(dev, ino);; i = next(i)) {
+      auto& slot = _slots[i];
+      if (!slot.occupied) return nullptr;
+      if (slot.dev == dev && slot.ino == ino) return &slot.value;
+    }
+  }
+
+  /// Insert or replace the value stored for an inode
+  void insert(dev_t dev, ino_t ino, V value) noexcept {
+    // Keep the load factor at or below one half
+    if (2 * (_count + 1) > _slots.size()) resize(_slots.empty() ? 64 : 2 * _slots.size());
+
+    for (size_t i = home(dev, ino);; i = next(i)) {
+      auto& slot = _slots[i];
+      if (!slot.occupied) {
+        slot = Slot{dev, ino, std::move(value), true};
+        _count++;
+        return;
+      } else if (slot.dev == dev && slot.ino == ino) {
+        slot.value = std::move(value);
+        return;
+      }
+    }
+  }
+
+  /// Remove the entry for an inode. Returns true if an entry was removed.
+  bool erase(dev_t dev, ino_t ino) noexcept {
+    if (_count == 0) return false;
+
+    // Find the slot holding this inode
+    size_t hole = home(dev, ino);
+    while (true) {
+      auto& slot = _slots[hole];
+      if (!slot.occupied) return false;
+      if (slot.dev == dev && slot.ino == ino) break;
+      hole = next(hole);
+    }
+
+    // Shift later entries in the probe sequence back to fill the hole
+    for (size_t i = next(hole); _slots[i].occupied; i = next(i)) {
+      // Entries whose home lies cyclically in (hole, i] must stay where they are
+      size_t h = home(_slots[i].dev, _slots[i].ino);
+      bool stays = (hole <= i) ? (hole < h && h <= i) : (hole < h || h <= i);
+      if (!stays) {
+        _slots[hole] = std::move(_slots[i]);
+        hole = i;
+      }
+    }
+
+    _slots[hole] = Slot();
+    _count--;
+    return true;
+  }
+
+  /// Remove every entry whose value satisfies a predicate
+  template <class Pred>
+  void eraseIf(Pred pred) noexcept {
+    std::vector<Slot> old = std::move(_slots);
+    _slots = std::vector<Slot>(old.size());
+    _count = 0;
+    for (auto& slot : old) {
+      if (slot.occupied && !pred(slot.value)) insert(slot.dev, slot.ino, std::move(slot.value));
+    }
+  }
+
+  /// Get the number of entries in the table
+  size_t size() const noexcept { return _count; }
+
+ private:
+  /// A single entry in the table
+  struct Slot {
+    dev_t dev = 0;
+    ino_t ino = 0;
+    V value = V();
+    bool occupied = false;
+  };
+
+  /// Get the first slot to probe for an inode
+  size_t home(dev_t dev, ino_t ino) const noexcept {
+    // Mix the device and inode numbers (splitmix64 finalizer)
+    uint64_t x = static_cast<uint64_t>(ino) ^ (static_cast<uint64_t>(dev) * 0x9e3779b97f4a7c15);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    x ^= x >> 31;
+    return x & (_slots.size() - 1);
+  }
+
+  /// Get the slot that follows slot i in a probe sequence
+  size_t next(size_t i) const noexcept { return (i + 1) & (_slots.size() - 1); }
+
+  /// Rehash the table into a new array of slots. The capacity must be a power of two.
+  void resize(size_t capacity) noexcept {
+    std::vector<Slot> old = std::move(_slots);
+    _slots = std::vector<Slot>(capacity);
+    _count = 0;
+    for (auto& slot : old) {
+      if (slot.occupied) insert(slot.dev, slot.ino, std::move(slot.value));
+    }
+  }
+
+  /// The slots in this table. The size is always zero or a power of two.
+  std::vector<Slot> _slots;
+
+  /// The number of occupied slots
+  size_t _count = 0;
+};
@@ -0,0 +1,55 @@
+#include "Jobserver.hh"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "util/log.hh"
+
+namespace fs = std::filesystem;
+
+using std::string;
+
+/// The environment variable that tells wrappers where to find the jobserver
+static const char* JobserverVariable = "RKR_JOBSERVER";
+
+Jobserver::Jobserver(fs::path path, size_t jobs) noexcept : _path(path) {
+  // Replace any pipe left behind by an earlier build, along with its tokens
+  ::unlink(_path.c_str());
+  if (::mkfifo(_path.c_str(), 0600) != 0) {
+    WARN << "Failed to create a jobserver at " << _path << ": " << ERR;
+    return;
+  }
+
+  // Hold the pipe open for reading and writing, so it keeps its tokens while no wrapper has it open
+  _fd = ::open(_path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (_fd == -1) {
+    WARN << "Failed to open the jobserver at " << _path << ": " << ERR;
+    ::unlink(_path.c_str());
+    return;
+  }
+
+  // Every wrapper may run one compiler without a token
+  string tokens(jobs > 1 ? jobs - 1 : 0, '+');
+  if (::write(_fd, tokens.data(), tokens.size()) != static_cast<ssize_t>(tokens.size())) {
+    WARN << "Failed to fill the jobserver with " << tokens.size() << " tokens: " << ERR;
+  }
+
+  LOG(exec) << "Started a jobserver at " << _path << " with " << jobs << " job slots";
+
+  ::setenv(JobserverVariable, ("fifo:" + _path.string()).c_str(), 1);
+}
+
+Jobserver::~Jobserver() noexcept {
+  if (_fd == -1) return;
+
+  ::unsetenv(JobserverVariable);
+  ::close(_fd);
+  ::unlink(_path.c_str());
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+/**
+ * A Jobserver limits how many compilers the parallel compiler wrappers run at once across a whole
+ * build. It uses the named pipe form of the GNU make jobserver protocol: the pipe holds one token
+ * for every job slot after the first, and a wrapper takes a token before starting each extra
+ * compiler and puts it back when that compiler exits. Wrappers find the jobserver through the
+ * RKR_JOBSERVER environment variable, but prefer a jobserver passed down from make.
+ */
+class Jobserver {
+ public:
+  /// Create a jobserver with a number of job slots at a path, and advertise it to child processes
+  Jobserver(fs::path path, size_t jobs) noexcept;
+
+  /// Stop advertising the jobserver and remove its pipe
+  ~Jobserver() noexcept;
+
+  // Disallow Copy
+  Jobserver(const Jobserver&) = delete;
+  Jobserver& operator=(const Jobserver&) = delete;
+
+ private:
+  /// The path to the named pipe
+  fs::path _path;
+
+  /// A descriptor that keeps the pipe and its tokens alive, or -1 if the jobserver failed to start
+  int _fd = -1;
+};
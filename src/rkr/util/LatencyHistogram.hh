@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A LatencyHistogram counts durations in log-linear buckets, in the style of an HDR histogram.
+ * Each power of two is split into 16 buckets, so every bucket is at most 1/16th as wide as the
+ * values it holds. Recording a value takes a few integer operations and never allocates.
+ */
+class LatencyHistogram {
+ public:
+  /// Record a duration in nanoseconds
+  void record(uint64_t ns) noexcept {
+    _counts[bucket(ns)]++;
+    _count++;
+    _total += ns;
+    _max = std::max(_max, ns);
+  }
+
+  /// Get the number of recorded durations
+  size_t getCount() const noexcept { return _count; }
+
+  /// Get the sum of all recorded durations
+  uint64_t getTotal() const noexcept { return _total; }
+
+  /// Get the largest recorded duration
+  uint64_t getMax() const noexcept { return _max; }
+
+  /// Get the mean recorded duration
+  uint64_t getMean() const noexcept { return _count == 0 ? 0 : _total / _count; }
+
+  /// Get an upper bound on the duration at a percentile between 0 and 100
+  uint64_t getPercentile(double percentile) const noexcept {
+    if (_count == 0) return 0;
+
+    // Find the bucket that holds the requested rank
+    size_t rank = std::max<size_t>(1, percentile / 100 * _count + 0.5);
+    size_t seen = 0;
+    for (size_t i = 0; i < BucketCount; i++) {
+      seen += _counts[i];
+      if (seen >= rank) return std::min(upperBound(i), _max);
+    }
+    return _max;
+  }
+
+ private:
+  enum : size_t {
+    SubBucketBits = 4,
+    SubBuckets = 1 << SubBucketBits,
+    BucketCount = (64 - SubBucketBits + 1) * SubBuckets
+  };
+
+  /// Get the bucket index for a value. Values below 2 * SubBuckets get their own buckets.
+  static size_t bucket(uint64_t v) noexcept {
+    if (v < 2 * SubBuckets) return v;
+    size_t shift = 63 - __builtin_clzll(v) - SubBucketBits;
+    return (shift + 1) * SubBuckets + ((v >> shift) - SubBuckets);
+  }
+
+  /// Get the largest value that falls in a bucket
+  static uint64_t upperBound(size_t index) noexcept {
+    if (index < 2 * SubBuckets) return index;
+    size_t shift = index / SubBuckets - 1;
+    uint64_t sub = index % SubBuckets + SubBuckets;
+    return ((sub + 1) << shift) - 1;
+  }
+
+  /// The number of durations recorded in each bucket
+  std::array<uint64_t, BucketCount> _counts = {};
+
+  /// The number of durations recorded
+  size_t _count = 0;
+
+  /// The sum of all recorded durations
+  uint64_t _total = 0;
+
+  /// The largest recorded duration
+  uint64_t _max = 0;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+/**
+ * A SlabPool hands out fixed-size blocks carved from large slabs. Freed blocks go on a free list
+ * and are reused by later allocations of the same size, so the IR objects created and destroyed
+ * during emulation (versions, refs, directory entries) do not go through malloc and free one at a
+ * time. Slabs are never returned to the system; the memory they hold is recycled across build
+ * phases instead.
+ *
+ * The pools are not thread safe. Only allocate pooled objects from the main rkr thread.
+ */
+template <size_t Size, size_t Align>
+class SlabPool {
+ public:
+  /// Get a block from the pool
+  static void* allocate() noexcept {
+    if (_free == nullptr) refill();
+    Block* b = _free;
+    _free = b->next;
+    return b;
+  }
+
+  /// Return a block to the pool
+  static void deallocate(void* p) noexcept {
+    Block* b = static_cast<Block*>(p);
+    b->next = _free;
+    _free = b;
+  }
+
+ private:
+  /// A block is either free and linked into the free list, or holds an object
+  union Block {
+    Block* next;
+    alignas(Align) unsigned char storage[Size];
+  };
+
+  /// The number of blocks carved from each slab
+  static constexpr size_t BlocksPerSlab = (64 * 1024) / sizeof(Block);
+
+  /// Allocate a new slab and put all of its blocks on the free list
+  static void refill() noexcept {
+    Block* slab = static_cast<Block*>(::operator new(sizeof(Block) * BlocksPerSlab));
+    for (size_t i = 0; i < BlocksPerSlab; i++) {
+      slab[i].next = _free;
+      _free = &slab[i];
+    }
+  }
+
+  /// The head of the free list
+  inline static Block* _free = nullptr;
+};
+
+/**
+ * An allocator that draws single-object allocations from the SlabPool for that object's size.
+ * This is used with std::allocate_shared, which rebinds the allocator to a type that holds both
+ * the shared_ptr control block and the object, so each pooled object costs one pool block.
+ */
+template <class T>
+class PoolAllocator {
+ public:
+  using value_type = T;
+
+  PoolAllocator() noexcept = default;
+
+  template <class U>
+  PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    if (n != 1) return static_cast<T*>(::operator new(n * sizeof(T)));
+    return static_cast<T*>(SlabPool<sizeof(T), alignof(T)>::allocate());
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    if (n != 1) return ::operator delete(p);
+    SlabPool<sizeof(T), alignof(T)>::deallocate(p);
+  }
+
+  template <class U>
+  bool operator==(const PoolAllocator<U>&) const noexcept {
+    return true;
+  }
+
+  template <class U>
+  bool operator!=(const PoolAllocator<U>&) const noexcept {
+    return false;
+  }
+};
+
+/// Create a shared_ptr to an object allocated from the slab pools
+template <class T, class... Args>
+std::shared_ptr<T> make_pooled(Args&&... args) noexcept {
+  return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * A SlotMap holds weak references to objects in a flat array of slots. Inserting an object returns
+ * a Handle, which pairs the slot index with a generation counter. When the referenced object dies,
+ * its slot is reclaimed and reused; the generation counter is bumped so stale handles to the old
+ * occupant resolve to nullptr instead of the new one.
+ */
+template <class T>
+class SlotMap {
+ public:
+  /// A handle to an entry in the slot map
+  struct Handle {
+    uint32_t index;
+    uint32_t generation;
+  };
+
+  /// Add an object to the slot map and return a handle to its slot
+  Handle insert(std::weak_ptr<T> p) noexcept {
+    // Reclaim dead slots once the map has doubled in size since the last collection
+    if (_free.empty() && _slots.size() >= _collect_threshold) {
+      collect();
+      _collect_threshold = std::max(MinCollectThreshold, 2 * (_slots.size() - _free.size()));
+    }
+
+    uint32_t index;
+    if (_free.empty()) {
+      index = _slots.size();
+      _slots.emplace_back();
+    } else {
+      index = _free.back();
+      _free.pop_back();
+    }
+
+    auto& slot = _slots[index];
+    slot.ptr = std::move(p);
+    slot.occupied = true;
+
+    return Handle{index, slot.generation};
+  }
+
+  /// Get the object a handle refers to, or nullptr if the object or slot is no longer live
+  std::shared_ptr<T> get(Handle h) const noexcept {
+    if (h.index >= _slots.size()) return nullptr;
+    const auto& slot = _slots[h.index];
+    if (!slot.occupied || slot.generation != h.generation) return nullptr;
+    return slot.ptr.lock();
+  }
+
+  /// Release the slots of all objects that have died. Returns the number of slots reclaimed.
+  size_t collect() noexcept {
+    size_t reclaimed = 0;
+    for (uint32_t i = 0; i < _slots.size(); i++) {
+      auto& slot = _slots[i];
+      if (slot.occupied && slot.ptr.expired()) {
+        // Dropping the weak_ptr releases the control block (and with it the object's storage)
+        slot.ptr.reset();
+        slot.occupied = false;
+        slot.generation++;
+        _free.push_back(i);
+        reclaimed++;
+      }
+    }
+    return reclaimed;
+  }
+
+  /// Get the number of occupied slots. Some of these may hold objects that have died since the
+  /// last collection.
+  size_t size() const noexcept { return _slots.size() - _free.size(); }
+
+  /// Call a function on every live object in the slot map
+  template <class F>
+  void forEach(F f) const noexcept {
+    for (const auto& slot : _slots) {
+      if (!slot.occupied) continue;
+      if (auto p = slot.ptr.lock()) f(p);
+    }
+  }
+
+ private:
+  /// Do not bother collecting dead slots until the map holds at least this many
+  static constexpr size_t MinCollectThreshold = 64;
+
+  /// A single slot in the map
+  struct Slot {
+    std::weak_ptr<T> ptr;
+    uint32_t generation = 0;
+    bool occupied = false;
+  };
+
+  /// The slots in this map
+  std::vector<Slot> _slots;
+
+  /// Indices of unoccupied slots available for reuse
+  std::vector<uint32_t> _free;
+
+  /// Collect dead slots when an insertion would grow the map past this size
+  size_t _collect_threshold = MinCollectThreshold;
+};
@@ -0,0 +1,157 @@
+#include "Timeline.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "util/json.hh"
+#include "util/log.hh"
+
+namespace fs = std::filesystem;
+
+using std::ofstream;
+using std::string;
+using std::vector;
+
+namespace timeline {
+  namespace {
+    /// A span for a command or for rkr's own work
+    struct SpanEvent {
+      string name;
+      string full_name;
+      Clock::time_point start;
+      Clock::time_point end;
+    };
+
+    /// A sample of a counter
+    struct CounterEvent {
+      const char* name;
+      Clock::time_point time;
+      double value;
+    };
+
+    /// The time the timeline started. Event times are written relative to this.
+    Clock::time_point _start;
+
+    /// Traced command spans
+    vector<SpanEvent> _commands;
+
+    /// Spans of rkr's own work
+    vector<SpanEvent> _spans;
+
+    /// Counter samples
+    vector<CounterEvent> _counters;
+  }
+
+  void start() noexcept {
+    _start = Clock::now();
+    _commands.clear();
+    _spans.clear();
+    _counters.clear();
+    enabled = true;
+  }
+
+  void addCommand(string name,
+                  string full_name,
+                  Clock::time_point start,
+                  Clock::time_point end) noexcept {
+    if (!enabled) return;
+    _commands.push_back({std::move(name), std::move(full_name), start, end});
+  }
+
+  void addSpan(string name, Clock::time_point start, Clock::time_point end) noexcept {
+    if (!enabled) return;
+    _spans.push_back({std::move(name), "", start, end});
+  }
+
+  void addCounter(const char* name, Clock::time_point time, double value) noexcept {
+    if (!enabled) return;
+    _counters.push_back({name, time, value});
+  }
+
+  /// Get a time as microseconds since the start of the timeline
+  static double micros(Clock::time_point t) noexcept {
+    return std::chrono::duration<double, std::micro>(t - _start).count();
+  }
+
+  /// Write the metadata event that names a track
+  static void name_track(ofstream& out, size_t tid, const string& name) noexcept {
+    out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+        << ",\"args\":{\"name\":";
+    writeJSONString(out, name);
+    out << "}}";
+  }
+
+  /// Write a complete event for a span on a track
+  static void write_span(ofstream& out, const SpanEvent& span, size_t tid) noexcept {
+    out << ",\n{\"name\":";
+    writeJSONString(out, span.name);
+    out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << micros(span.start)
+        << ",\"dur\":" << micros(span.end) - micros(span.start);
+    if (!span.full_name.empty()) {
+      out << ",\"args\":{\"command\":";
+      writeJSONString(out, span.full_name);
+      out << "}";
+    }
+    out << "}";
+  }
+
+  void write(const fs::path& path) noexcept {
+    enabled = false;
+
+    ofstream out(path);
+    if (!out) {
+      WARN << "Failed to write timeline to " << path;
+      return;
+    }
+
+    out << std::fixed;
+    out.precision(3);
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"rkr\"}}";
+
+    // rkr's own work goes on the first track
+    name_track(out, 0, "rkr");
+    for (const auto& span : _spans) {
+      write_span(out, span, 0);
+    }
+
+    // Give each command the first track that is free when it starts, so commands that run at the
+    // same time appear on separate tracks
+    std::stable_sort(_commands.begin(), _commands.end(),
+                     [](const auto& a, const auto& b) { return a.start < b.start; });
+
+    vector<Clock::time_point> track_free;
+    for (const auto& command : _commands) {
+      size_t track = 0;
+      while (track < track_free.size() && track_free[track] > command.start) track++;
+
+      if (track == track_free.size()) {
+        track_free.push_back(command.end);
+        name_track(out, track + 1, "Commands " + std::to_string(track + 1));
+      } else {
+        track_free[track] = command.end;
+      }
+
+      write_span(out, command, track + 1);
+    }
+
+    for (const auto& counter : _counters) {
+      out << ",\n{\"name\":\"" << counter.name << "\",\"ph\":\"C\",\"pid\":1,\"ts\":"
+          << micros(counter.time) << ",\"args\":{\"value\":" << counter.value << "}}";
+    }
+
+    out << "\n]}\n";
+
+    _commands.clear();
+    _spans.clear();
+    _counters.clear();
+  }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+/**
+ * The timeline records when commands ran and where rkr spent its own time during a build, and
+ * writes them out as a Chrome trace-event JSON file that can be opened in ui.perfetto.dev or
+ * chrome://tracing. Nothing is recorded unless a timeline has been started.
+ */
+namespace timeline {
+  using Clock = std::chrono::steady_clock;
+
+  /// Is a timeline being recorded?
+  inline bool enabled = false;
+
+  /// Start recording a timeline, discarding any earlier events
+  void start() noexcept;
+
+  /// Record a traced command that ran from start until end
+  void addCommand(std::string name,
+                  std::string full_name,
+                  Clock::time_point start,
+                  Clock::time_point end) noexcept;
+
+  /// Record a span of rkr's own work
+  void addSpan(std::string name, Clock::time_point start, Clock::time_point end) noexcept;
+
+  /// Record the value of a counter at a point in time
+  void addCounter(const char* name, Clock::time_point time, double value) noexcept;
+
+  /// Stop recording and write the timeline to a file
+  void write(const fs::path& path) noexcept;
+
+  /// A Span records rkr's work from the time it is created until it goes out of scope
+  class Span {
+   public:
+    /// Start a span with a given name
+    Span(std::string name) noexcept : _active(enabled) {
+      if (_active) {
+        _name = std::move(name);
+        _start = Clock::now();
+      }
+    }
+
+    /// Finish the span
+    ~Span() noexcept {
+      if (_active && enabled) addSpan(std::move(_name), _start, Clock::now());
+    }
+
+    // Disallow Copy
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+   private:
+    /// Was a timeline being recorded when this span started?
+    bool _active;
+
+    /// The name of the span
+    std::string _name;
+
+    /// The time the span started
+    Clock::time_point _start;
+  };
+}
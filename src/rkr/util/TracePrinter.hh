@@ -1,9 +1,13 @@
 #pragma once
 
 #include <filesystem>
+#include <iterator>
 #include <memory>
 #include <ostream>
 
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+
 #include "data/IRSink.hh"
 #include "data/IRSource.hh"
 #include "runtime/Ref.hh"
@@ -16,20 +20,25 @@ namespace fs = std::filesystem;
 class Command;
 class Ref;
 
-inline static std::ostream& operator<<(std::ostream& o, Scenario s) {
+/// Get the label used for a scenario in printed traces
+inline const char* getScenarioLabel(Scenario s) noexcept {
   if (s == Scenario::None) {
-    return o << "[no scenario]";
+    return "[no scenario]";
   } else if (s == Scenario::Build) {
-    return o << "[build]";
+    return "[build]";
   } else if (s == Scenario::PostBuild) {
-    return o << "[post-build]";
+    return "[post-build]";
   } else if (s == Scenario::Both) {
-    return o << "[build, post-build]";
+    return "[build, post-build]";
   } else {
-    return o << "[unknown scenario]";
+    return "[unknown scenario]";
   }
 }
 
+inline static std::ostream& operator<<(std::ostream& o, Scenario s) {
+  return o << getScenarioLabel(s);
+}
+
 class TracePrinter : public IRSink {
  public:
   /// Create a trace printer that writes to a provided ostream
@@ -38,60 +47,65 @@ class TracePrinter : public IRSink {
   /// Create a trace printer that writes to a provided ostream (rvalue reference form)
   TracePrinter(std::ostream&& out) : _out(out) {}
 
+  /// Write out any buffered steps when the printer is done
+  ~TracePrinter() noexcept { flush(); }
+
+  virtual void finish() noexcept override { flush(); }
+
   virtual void specialRef(const IRSource& source,
                           const std::shared_ptr<Command>& c,
                           SpecialRef entity,
                           Ref::ID output) noexcept override {
-    _out << SpecialRefPrinter{c, entity, output} << std::endl;
+    write(SpecialRefPrinter{c, entity, output});
   }
 
   virtual void pipeRef(const IRSource& source,
                        const std::shared_ptr<Command>& c,
                        Ref::ID read_end,
                        Ref::ID write_end) noexcept override {
-    _out << PipeRefPrinter{c, read_end, write_end} << std::endl;
+    write(PipeRefPrinter{c, read_end, write_end});
   }
 
   virtual void fileRef(const IRSource& source,
                        const std::shared_ptr<Command>& c,
                        mode_t mode,
                        Ref::ID output) noexcept override {
-    _out << FileRefPrinter{c, mode, output} << std::endl;
+    write(FileRefPrinter{c, mode, output});
   }
 
   virtual void symlinkRef(const IRSource& source,
                           const std::shared_ptr<Command>& c,
-                          fs::path target,
+                          const fs::path& target,
                           Ref::ID output) noexcept override {
-    _out << SymlinkRefPrinter{c, target, output} << std::endl;
+    write(SymlinkRefPrinter{c, target, output});
   }
 
   virtual void dirRef(const IRSource& source,
                       const std::shared_ptr<Command>& c,
                       mode_t mode,
                       Ref::ID output) noexcept override {
-    _out << DirRefPrinter{c, mode, output} << std::endl;
+    write(DirRefPrinter{c, mode, output});
   }
 
   virtual void pathRef(const IRSource& source,
                        const std::shared_ptr<Command>& c,
                        Ref::ID base,
-                       fs::path path,
+                       const fs::path& path,
                        AccessFlags flags,
                        Ref::ID output) noexcept override {
-    _out << PathRefPrinter{c, base, path, flags, output} << std::endl;
+    write(PathRefPrinter{c, base, path, flags, output});
   }
 
   virtual void usingRef(const IRSource& source,
                         const std::shared_ptr<Command>& c,
                         Ref::ID ref) noexcept override {
-    _out << UsingRefPrinter{c, ref} << std::endl;
+    write(UsingRefPrinter{c, ref});
   }
 
   virtual void doneWithRef(const IRSource& source,
                            const std::shared_ptr<Command>& c,
                            Ref::ID ref) noexcept override {
-    _out << DoneWithRefPrinter{c, ref} << std::endl;
+    write(DoneWithRefPrinter{c, ref});
   }
 
   /// A command depends on the outcome of comparing two different references
@@ -100,7 +114,7 @@ class TracePrinter : public IRSink {
                            Ref::ID ref1,
                            Ref::ID ref2,
                            RefComparison type) noexcept override {
-    _out << CompareRefsPrinter{c, ref1, ref2, type} << std::endl;
+    write(CompareRefsPrinter{c, ref1, ref2, type});
   }
 
   virtual void expectResult(const IRSource& source,
@@ -108,339 +122,459 @@ class TracePrinter : public IRSink {
                             Scenario scenario,
                             Ref::ID ref,
                             int8_t expected) noexcept override {
-    _out << ExpectResultPrinter{c, scenario, ref, expected} << std::endl;
+    write(ExpectResultPrinter{c, scenario, ref, expected});
   }
 
   virtual void matchMetadata(const IRSource& source,
                              const std::shared_ptr<Command>& c,
                              Scenario scenario,
                              Ref::ID ref,
-                             MetadataVersion expected) noexcept override {
-    _out << MatchMetadataPrinter{c, scenario, ref, expected} << std::endl;
+                             const MetadataVersion& expected) noexcept override {
+    write(MatchMetadataPrinter{c, scenario, ref, expected});
   }
 
   virtual void matchContent(const IRSource& source,
                             const std::shared_ptr<Command>& c,
                             Scenario scenario,
                             Ref::ID ref,
-                            std::shared_ptr<ContentVersion> expected) noexcept override {
-    _out << MatchContentPrinter{c, scenario, ref, expected} << std::endl;
+                            const std::shared_ptr<ContentVersion>& expected) noexcept override {
+    write(MatchContentPrinter{c, scenario, ref, expected});
   }
 
   virtual void updateMetadata(const IRSource& source,
                               const std::shared_ptr<Command>& c,
                               Ref::ID ref,
-                              MetadataVersion written) noexcept override {
-    _out << UpdateMetadataPrinter{c, ref, written} << std::endl;
+                              const MetadataVersion& written) noexcept override {
+    write(UpdateMetadataPrinter{c, ref, written});
   }
 
   virtual void updateContent(const IRSource& source,
                              const std::shared_ptr<Command>& c,
                              Ref::ID ref,
-                             std::shared_ptr<ContentVersion> written) noexcept override {
-    _out << UpdateContentPrinter{c, ref, written} << std::endl;
+                             const std::shared_ptr<ContentVersion>& written) noexcept override {
+    write(UpdateContentPrinter{c, ref, written});
   }
 
   /// Handle an AddEntry IR step
   virtual void addEntry(const IRSource& source,
                         const std::shared_ptr<Command>& c,
                         Ref::ID dir,
-                        std::string name,
+                        const std::string& name,
                         Ref::ID target) noexcept override {
-    _out << AddEntryPrinter{c, dir, name, target} << std::endl;
+    write(AddEntryPrinter{c, dir, name, target});
   }
 
   /// Handle a RemoveEntry IR step
   virtual void removeEntry(const IRSource& source,
                            const std::shared_ptr<Command>& c,
                            Ref::ID dir,
-                           std::string name,
+                           const std::string& name,
                            Ref::ID target) noexcept override {
-    _out << RemoveEntryPrinter{c, dir, name, target} << std::endl;
+    write(RemoveEntryPrinter{c, dir, name, target});
   }
 
   virtual void launch(const IRSource& source,
                       const std::shared_ptr<Command>& c,
                       const std::shared_ptr<Command>& child,
-                      std::list<std::tuple<Ref::ID, Ref::ID>> refs) noexcept override {
-    _out << LaunchPrinter{c, child, refs} << std::endl;
+                      const std::list<std::tuple<Ref::ID, Ref::ID>>& refs) noexcept override {
+    write(LaunchPrinter{c, child, refs});
   }
 
   virtual void join(const IRSource& source,
                     const std::shared_ptr<Command>& c,
                     const std::shared_ptr<Command>& child,
                     int exit_status) noexcept override {
-    _out << JoinPrinter{c, child, exit_status} << std::endl;
+    write(JoinPrinter{c, child, exit_status});
   }
 
   virtual void exit(const IRSource& source,
                     const std::shared_ptr<Command>& c,
                     int exit_status) noexcept override {
-    _out << ExitPrinter{c, exit_status} << std::endl;
+    write(ExitPrinter{c, exit_status});
   }
 
   /// A wrapper struct used to print SpecialRef IR steps
   struct SpecialRefPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     SpecialRef entity;
     Ref::ID output;
-
-    friend std::ostream& operator<<(std::ostream& o, const SpecialRefPrinter& p) noexcept {
-      o << p.c << ": r" << p.output << " = ";
-      switch (p.entity) {
-        case SpecialRef::stdin:
-          o << "STDIN";
-          break;
-
-        case SpecialRef::stdout:
-          o << "STDOUT";
-          break;
-
-        case SpecialRef::stderr:
-          o << "STDERR";
-          break;
-
-        case SpecialRef::root:
-          o << "ROOT";
-          break;
-
-        case SpecialRef::cwd:
-          o << "CWD";
-          break;
-
-        case SpecialRef::launch_exe:
-          o << "LAUNCH_EXE";
-          break;
-      }
-      return o;
-    }
   };
 
   /// A wrapper struct used to print PipeRef IR steps
   struct PipeRefPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     Ref::ID read_end;
     Ref::ID write_end;
-
-    friend std::ostream& operator<<(std::ostream& o, const PipeRefPrinter& p) noexcept {
-      return o << p.c << ": [r" << p.read_end << ", r" << p.write_end << "] = PipeRef()";
-    }
   };
 
   /// A wrapper struct used to print FileRef IR steps
   struct FileRefPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     mode_t mode;
     Ref::ID output;
-
-    friend std::ostream& operator<<(std::ostream& o, const FileRefPrinter& p) noexcept {
-      return o << p.c << ": r" << p.output << " = FileRef(" << std::oct << p.mode << std::dec
-               << ")";
-    }
   };
 
   /// A wrapper struct used to print SymlinkRef IR steps
   struct SymlinkRefPrinter {
-    std::shared_ptr<Command> c;
-    fs::path target;
+    const std::shared_ptr<Command>& c;
+    const fs::path& target;
     Ref::ID output;
-
-    friend std::ostream& operator<<(std::ostream& o, const SymlinkRefPrinter& p) noexcept {
-      return o << p.c << ": r" << p.output << " = SymlinkRef(" << p.target << ")";
-    }
   };
 
   /// A wrapper struct used to print DirRef IR steps
   struct DirRefPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     mode_t mode;
     Ref::ID output;
-
-    friend std::ostream& operator<<(std::ostream& o, const DirRefPrinter& p) noexcept {
-      return o << p.c << ": r" << p.output << " = DirRef(" << std::oct << p.mode << ")";
-    }
   };
 
   /// A wrapper struct used to print PathRef IR steps
   struct PathRefPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     Ref::ID base;
-    fs::path path;
+    const fs::path& path;
     AccessFlags flags;
     Ref::ID output;
-
-    friend std::ostream& operator<<(std::ostream& o, const PathRefPrinter& p) noexcept {
-      return o << p.c << ": r" << p.output << " = PathRef(r" << p.base << ", " << p.path << ", "
-               << p.flags << ")";
-    }
   };
 
   /// A wrapper struct used to print Open IR steps
   struct UsingRefPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     Ref::ID ref;
-
-    friend std::ostream& operator<<(std::ostream& o, const UsingRefPrinter& p) noexcept {
-      return o << p.c << ": UsingRef(r" << p.ref << ")";
-    }
   };
 
   /// A wrapper struct used to print Close IR steps
   struct DoneWithRefPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     Ref::ID ref;
-
-    friend std::ostream& operator<<(std::ostream& o, const DoneWithRefPrinter& p) noexcept {
-      return o << p.c << ": DoneWithRef(r" << p.ref << ")";
-    }
   };
 
   /// A wrapper struct used to print CompareRefs IR steps
   struct CompareRefsPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     Ref::ID ref1;
     Ref::ID ref2;
     RefComparison type;
-
-    friend std::ostream& operator<<(std::ostream& o, const CompareRefsPrinter& p) noexcept {
-      o << p.c << ": ";
-      std::string typestr;
-      if (p.type == RefComparison::SameInstance) {
-        typestr = "SameInstance";
-      } else if (p.type == RefComparison::DifferentInstances) {
-        typestr = "DifferentInstances";
-      } else {
-        typestr = "Unknown";
-      }
-
-      return o << "CompareRefs(r" << p.ref1 << ", r" << p.ref2 << ", " << typestr << ")";
-    }
   };
 
   /// A wrapper struct used to print ExpectResult IR steps
   struct ExpectResultPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     Scenario scenario;
     Ref::ID ref;
     int8_t expected;
-
-    friend std::ostream& operator<<(std::ostream& o, const ExpectResultPrinter& p) noexcept {
-      o << p.c << ": ";
-      return o << "ExpectResult(r" << p.ref << ", " << getErrorName(p.expected) << ") "
-               << p.scenario;
-    }
   };
 
   /// A wrapper struct used to print MatchMetadata IR steps
   struct MatchMetadataPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     Scenario scenario;
     Ref::ID ref;
-    MetadataVersion expected;
-
-    friend std::ostream& operator<<(std::ostream& o, const MatchMetadataPrinter& p) noexcept {
-      return o << p.c << ": MatchMetadata(r" << p.ref << ", " << p.expected << ") " << p.scenario;
-    }
+    const MetadataVersion& expected;
   };
 
   /// A wrapper struct used to print MatchContent IR steps
   struct MatchContentPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     Scenario scenario;
     Ref::ID ref;
-    std::shared_ptr<ContentVersion> expected;
-
-    friend std::ostream& operator<<(std::ostream& o, const MatchContentPrinter& p) noexcept {
-      return o << p.c << ": MatchContent(r" << p.ref << ", " << p.expected << ") " << p.scenario;
-    }
+    const std::shared_ptr<ContentVersion>& expected;
   };
 
   /// A wrapper struct used to print UpdateMetadata IR steps
   struct UpdateMetadataPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     Ref::ID ref;
-    MetadataVersion written;
-
-    friend std::ostream& operator<<(std::ostream& o, const UpdateMetadataPrinter& p) noexcept {
-      return o << p.c << ": UpdateMetadata(r" << p.ref << ", " << p.written << ")";
-    }
+    const MetadataVersion& written;
   };
 
   /// A wrapper struct used to print UpdateContent IR steps
   struct UpdateContentPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     Ref::ID ref;
-    std::shared_ptr<ContentVersion> written;
-
-    friend std::ostream& operator<<(std::ostream& o, const UpdateContentPrinter& p) noexcept {
-      return o << p.c << ": UpdateContent(r" << p.ref << ", " << p.written << ")";
-    }
+    const std::shared_ptr<ContentVersion>& written;
   };
 
   /// A wrapper struct used to print AddEntry IR steps
   struct AddEntryPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     Ref::ID dir;
-    std::string name;
+    const std::string& name;
     Ref::ID target;
-
-    friend std::ostream& operator<<(std::ostream& o, const AddEntryPrinter& p) noexcept {
-      return o << p.c << ": AddEntry(r" << p.dir << ", \"" << p.name << "\", r" << p.target << ")";
-    }
   };
 
   /// A wrapper struct used to print RemoveEntry IR steps
   struct RemoveEntryPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     Ref::ID dir;
-    std::string name;
+    const std::string& name;
     Ref::ID target;
-
-    friend std::ostream& operator<<(std::ostream& o, const RemoveEntryPrinter& p) noexcept {
-      return o << p.c << ": RemoveEntry(r" << p.dir << ", \"" << p.name << "\", r" << p.target
-               << ")";
-    }
   };
 
   /// A wrapper struct used to print Launch IR steps
   struct LaunchPrinter {
-    std::shared_ptr<Command> c;
-    std::shared_ptr<Command> child;
-    std::list<std::tuple<Ref::ID, Ref::ID>> refs;
-
-    friend std::ostream& operator<<(std::ostream& o, const LaunchPrinter& p) noexcept {
-      o << p.c << ": Launch(" << p.child << ", [";
-      bool first = true;
-      for (const auto& [parent_ref_id, child_ref_id] : p.refs) {
-        if (!first) o << ", ";
-        first = false;
-        o << "r" << child_ref_id << "=r" << parent_ref_id;
-      }
-      return o << "])";
-    }
+    const std::shared_ptr<Command>& c;
+    const std::shared_ptr<Command>& child;
+    const std::list<std::tuple<Ref::ID, Ref::ID>>& refs;
   };
 
   /// A wrapper struct used to print Join IR steps
   struct JoinPrinter {
-    std::shared_ptr<Command> c;
-    std::shared_ptr<Command> child;
+    const std::shared_ptr<Command>& c;
+    const std::shared_ptr<Command>& child;
     int exit_status;
-
-    friend std::ostream& operator<<(std::ostream& o, const JoinPrinter& p) noexcept {
-      return o << p.c << ": Join(" << p.child << ", " << p.exit_status << ")";
-    }
   };
 
   /// A wrapper struct used to print Exit IR steps
   struct ExitPrinter {
-    std::shared_ptr<Command> c;
+    const std::shared_ptr<Command>& c;
     int exit_status;
-
-    friend std::ostream& operator<<(std::ostream& o, const ExitPrinter& p) noexcept {
-      return o << p.c << ": Exit(" << p.exit_status << ")";
-    }
   };
 
+  /// Print any of the wrapper structs above to an ostream, using its formatter
+  template <typename Step>
+  friend std::ostream& operator<<(std::ostream& o, const Step& step) noexcept {
+    fmt::print(o, "{}", step);
+    return o;
+  }
+
  private:
+  /// Format a step into the output buffer, and pass the buffer to the ostream once it fills
+  template <typename T>
+  void write(const T& step) noexcept {
+    fmt::format_to(std::back_inserter(_buffer), "{}\n", step);
+    if (_buffer.size() >= FlushSize) flush();
+  }
+
+  /// Pass everything in the output buffer to the ostream
+  void flush() noexcept {
+    _out.write(_buffer.data(), _buffer.size());
+    _out.flush();
+    _buffer.clear();
+  }
+
+  /// Buffered output is passed to the ostream once it reaches this size
+  enum : size_t { FlushSize = 64 * 1024 };
+
   std::ostream& _out;
+
+  /// Steps that have been formatted but not yet written to the ostream
+  fmt::memory_buffer _buffer;
+};
+
+/// The IR step printers take no format specifiers
+struct TraceStepFormatter {
+  constexpr auto parse(fmt::format_parse_context& ctx) { return ctx.begin(); }
+
+  /// Write a path in quotes, escaped the same way as printing it to an ostream
+  template <typename OutputIt>
+  static OutputIt formatPath(OutputIt out, const fs::path& path) {
+    *out++ = '"';
+    for (char ch : path.native()) {
+      if (ch == '"' || ch == '\\') *out++ = '\\';
+      *out++ = ch;
+    }
+    *out++ = '"';
+    return out;
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::SpecialRefPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::SpecialRefPrinter& p, FormatContext& ctx) const {
+    const char* name = "";
+    switch (p.entity) {
+      case SpecialRef::stdin:
+        name = "STDIN";
+        break;
+
+      case SpecialRef::stdout:
+        name = "STDOUT";
+        break;
+
+      case SpecialRef::stderr:
+        name = "STDERR";
+        break;
+
+      case SpecialRef::root:
+        name = "ROOT";
+        break;
+
+      case SpecialRef::cwd:
+        name = "CWD";
+        break;
+
+      case SpecialRef::launch_exe:
+        name = "LAUNCH_EXE";
+        break;
+    }
+    return fmt::format_to(ctx.out(), "{}: r{} = {}", p.c, p.output, name);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::PipeRefPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::PipeRefPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: [r{}, r{}] = PipeRef()", p.c, p.read_end, p.write_end);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::FileRefPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::FileRefPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: r{} = FileRef({:o})", p.c, p.output, p.mode);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::SymlinkRefPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::SymlinkRefPrinter& p, FormatContext& ctx) const {
+    auto out = fmt::format_to(ctx.out(), "{}: r{} = SymlinkRef(", p.c, p.output);
+    out = formatPath(out, p.target);
+    return fmt::format_to(out, ")");
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::DirRefPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::DirRefPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: r{} = DirRef({:o})", p.c, p.output, p.mode);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::PathRefPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::PathRefPrinter& p, FormatContext& ctx) const {
+    auto out = fmt::format_to(ctx.out(), "{}: r{} = PathRef(r{}, ", p.c, p.output, p.base);
+    out = formatPath(out, p.path);
+    return fmt::format_to(out, ", {})", p.flags);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::UsingRefPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::UsingRefPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: UsingRef(r{})", p.c, p.ref);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::DoneWithRefPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::DoneWithRefPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: DoneWithRef(r{})", p.c, p.ref);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::CompareRefsPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::CompareRefsPrinter& p, FormatContext& ctx) const {
+    const char* type = "Unknown";
+    if (p.type == RefComparison::SameInstance) {
+      type = "SameInstance";
+    } else if (p.type == RefComparison::DifferentInstances) {
+      type = "DifferentInstances";
+    }
+    return fmt::format_to(ctx.out(), "{}: CompareRefs(r{}, r{}, {})", p.c, p.ref1, p.ref2, type);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::ExpectResultPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::ExpectResultPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: ExpectResult(r{}, {}) {}", p.c, p.ref,
+                          getErrorName(p.expected), getScenarioLabel(p.scenario));
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::MatchMetadataPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::MatchMetadataPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: MatchMetadata(r{}, {}) {}", p.c, p.ref, p.expected,
+                          getScenarioLabel(p.scenario));
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::MatchContentPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::MatchContentPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: MatchContent(r{}, {}) {}", p.c, p.ref, p.expected,
+                          getScenarioLabel(p.scenario));
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::UpdateMetadataPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::UpdateMetadataPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: UpdateMetadata(r{}, {})", p.c, p.ref, p.written);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::UpdateContentPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::UpdateContentPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: UpdateContent(r{}, {})", p.c, p.ref, p.written);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::AddEntryPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::AddEntryPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: AddEntry(r{}, \"{}\", r{})", p.c, p.dir, p.name,
+                          p.target);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::RemoveEntryPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::RemoveEntryPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: RemoveEntry(r{}, \"{}\", r{})", p.c, p.dir, p.name,
+                          p.target);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::LaunchPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::LaunchPrinter& p, FormatContext& ctx) const {
+    auto out = fmt::format_to(ctx.out(), "{}: Launch({}, [", p.c, p.child);
+    bool first = true;
+    for (const auto& [parent_ref_id, child_ref_id] : p.refs) {
+      if (!first) out = fmt::format_to(out, ", ");
+      first = false;
+      out = fmt::format_to(out, "r{}=r{}", child_ref_id, parent_ref_id);
+    }
+    return fmt::format_to(out, "])");
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::JoinPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::JoinPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: Join({}, {})", p.c, p.child, p.exit_status);
+  }
+};
+
+template <>
+struct fmt::formatter<TracePrinter::ExitPrinter> : TraceStepFormatter {
+  template <typename FormatContext>
+  auto format(const TracePrinter::ExitPrinter& p, FormatContext& ctx) const {
+    return fmt::format_to(ctx.out(), "{}: Exit({})", p.c, p.exit_status);
+  }
 };
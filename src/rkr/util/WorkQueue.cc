@@ -0,0 +1,82 @@
+#include "WorkQueue.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+using std::function;
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+WorkQueue::WorkQueue(size_t max_threads, size_t max_pending) noexcept :
+    _max_threads(max_threads), _max_pending(max_pending) {
+  if (_max_threads == 0) {
+    _max_threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+}
+
+WorkQueue::~WorkQueue() noexcept {
+  wait();
+
+  {
+    lock_guard<mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _job_added.notify_all();
+
+  for (auto& t : _threads) {
+    t.join();
+  }
+}
+
+void WorkQueue::add(function<void()> job) noexcept {
+  {
+    unique_lock<mutex> lock(_mutex);
+
+    // Wait for room in the queue
+    if (_max_pending > 0) {
+      _job_finished.wait(lock, [this] { return _pending < _max_pending; });
+    }
+
+    _jobs.push_back(std::move(job));
+    _pending++;
+
+    // Start another worker if every existing worker is busy
+    if (_idle == 0 && _threads.size() < _max_threads) {
+      _threads.emplace_back(&WorkQueue::work, this);
+    }
+  }
+  _job_added.notify_one();
+}
+
+void WorkQueue::wait() noexcept {
+  unique_lock<mutex> lock(_mutex);
+  _jobs_done.wait(lock, [this] { return _pending == 0; });
+}
+
+void WorkQueue::work() noexcept {
+  unique_lock<mutex> lock(_mutex);
+  while (true) {
+    // Wait for a job or a request to stop
+    _idle++;
+    _job_added.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+    _idle--;
+
+    if (_jobs.empty()) return;
+
+    // Take the next job and run it without holding the lock
+    auto job = std::move(_jobs.front());
+    _jobs.pop_front();
+
+    lock.unlock();
+    job();
+    lock.lock();
+
+    if (--_pending == 0) _jobs_done.notify_all();
+    _job_finished.notify_one();
+  }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A WorkQueue runs independent jobs on a small pool of worker threads. Workers are started lazily
+ * as jobs arrive, up to a fixed limit, so a queue that never receives work never starts a thread.
+ *
+ * Jobs run concurrently with the main thread and with each other. They must not allocate pooled
+ * objects or touch any state the main thread may be using.
+ */
+class WorkQueue {
+ public:
+  /// Create a work queue that runs jobs on up to the given number of threads. A limit of zero
+  /// uses one thread per available core. If max_pending is nonzero, add() blocks while that many
+  /// jobs are queued or running.
+  WorkQueue(size_t max_threads, size_t max_pending = 0) noexcept;
+
+  /// Wait for all queued jobs to finish, then stop the worker threads
+  ~WorkQueue() noexcept;
+
+  // Disallow Copy
+  WorkQueue(const WorkQueue&) = delete;
+  WorkQueue& operator=(const WorkQueue&) = delete;
+
+  /// Add a job to the queue, first waiting for a job to finish if the queue is full
+  void add(std::function<void()> job) noexcept;
+
+  /// Block until every job added so far has finished
+  void wait() noexcept;
+
+ private:
+  /// The main loop for each worker thread
+  void work() noexcept;
+
+ private:
+  /// The maximum number of worker threads
+  size_t _max_threads;
+
+  /// The maximum number of jobs that may be queued or running, or zero for no limit
+  size_t _max_pending;
+
+  /// The worker threads started so far
+  std::vector<std::thread> _threads;
+
+  /// Jobs waiting for a worker
+  std::deque<std::function<void()>> _jobs;
+
+  /// The number of workers waiting for a job
+  size_t _idle = 0;
+
+  /// The number of jobs that have been added but have not finished
+  size_t _pending = 0;
+
+  /// Set when the workers should exit
+  bool _stopping = false;
+
+  /// Protects all of the fields above, except for _max_threads and _max_pending
+  std::mutex _mutex;
+
+  /// Signaled when a job is added or the workers should exit
+  std::condition_variable _job_added;
+
+  /// Signaled when the last pending job finishes
+  std::condition_variable _jobs_done;
+
+  /// Signaled when any job finishes
+  std::condition_variable _job_finished;
+};
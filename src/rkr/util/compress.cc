@@ -0,0 +1,171 @@
+#include "compress.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+/*
+ * A compressed block is a series of sequences. Each sequence starts with a token byte. The high
+ * four bits of the token give the number of literal bytes that follow, and the low four bits give
+ * the length of a match that copies earlier output. A nibble of 15 means the length continues in
+ * the following bytes, each adding up to 255. After the literals comes a two-byte little-endian
+ * offset back to the start of the match, then any extra match length bytes. The last sequence in
+ * a block has only literals.
+ */
+
+namespace compress {
+  // Matches shorter than this are not worth an offset
+  enum : size_t { MinMatch = 4 };
+
+  // The largest offset that fits in a sequence
+  enum : size_t { MaxOffset = 65535 };
+
+  // The compressor remembers the last position of each of 2^HashBits four-byte strings
+  enum : size_t { HashBits = 14 };
+
+  /// Read four bytes from a possibly unaligned pointer
+  static inline uint32_t read32(const uint8_t* p) noexcept {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+  }
+
+  /// Hash four bytes of input to a slot in the match table
+  static inline uint32_t hash(uint32_t value) noexcept {
+    return (value * 2654435761u) >> (32 - HashBits);
+  }
+
+  /// Write the part of a length that did not fit in a token nibble
+  static uint8_t* write_length(uint8_t* out, size_t length) noexcept {
+    while (length >= 255) {
+      *out++ = 255;
+      length -= 255;
+    }
+    *out++ = length;
+    return out;
+  }
+
+  /// Read the part of a length that did not fit in a token nibble. Returns false at end of input.
+  static bool read_length(const uint8_t*& in, const uint8_t* end, size_t& length) noexcept {
+    uint8_t b;
+    do {
+      if (in >= end) return false;
+      b = *in++;
+      length += b;
+    } while (b == 255);
+    return true;
+  }
+
+  /// Write one sequence. A match length of zero writes a final, literal-only sequence.
+  static uint8_t* write_sequence(uint8_t* out,
+                                 const uint8_t* literals,
+                                 size_t literal_length,
+                                 size_t offset,
+                                 size_t match_length) noexcept {
+    uint8_t* token = out++;
+    *token = std::min<size_t>(literal_length, 15) << 4;
+    if (literal_length >= 15) out = write_length(out, literal_length - 15);
+
+    if (literal_length > 0) memcpy(out, literals, literal_length);
+    out += literal_length;
+
+    if (match_length > 0) {
+      *out++ = offset & 0xff;
+      *out++ = offset >> 8;
+
+      size_t extra = match_length - MinMatch;
+      *token |= std::min<size_t>(extra, 15);
+      if (extra >= 15) out = write_length(out, extra - 15);
+    }
+
+    return out;
+  }
+
+  size_t maxCompressedSize(size_t length) noexcept {
+    return length + length / 255 + 16;
+  }
+
+  size_t compressBlock(const uint8_t* src, size_t length, uint8_t* dest) noexcept {
+    // Each slot holds one plus the position of the last string with that hash, or zero if empty
+    std::vector<uint32_t> table(1 << HashBits, 0);
+
+    const uint8_t* end = src + length;
+    const uint8_t* anchor = src;
+    const uint8_t* in = src;
+    uint8_t* out = dest;
+
+    while (length >= MinMatch && in <= end - MinMatch) {
+      uint32_t value = read32(in);
+      uint32_t& slot = table[hash(value)];
+      const uint8_t* candidate = slot == 0 ? nullptr : src + slot - 1;
+      slot = in - src + 1;
+
+      // Move on if there is no earlier copy of these four bytes within reach
+      if (candidate == nullptr || size_t(in - candidate) > MaxOffset || read32(candidate) != value) {
+        in++;
+        continue;
+      }
+
+      // Extend the match as far as it goes
+      size_t match_length = MinMatch;
+      while (in + match_length < end && in[match_length] == candidate[match_length]) {
+        match_length++;
+      }
+
+      out = write_sequence(out, anchor, in - anchor, in - candidate, match_length);
+      in += match_length;
+      anchor = in;
+    }
+
+    // Finish with the remaining input as literals
+    out = write_sequence(out, anchor, end - anchor, 0, 0);
+    return out - dest;
+  }
+
+  bool expandBlock(const uint8_t* src, size_t length, uint8_t* dest, size_t dest_length) noexcept {
+    const uint8_t* in = src;
+    const uint8_t* end = src + length;
+    uint8_t* out = dest;
+    uint8_t* out_end = dest + dest_length;
+
+    while (in < end) {
+      uint8_t token = *in++;
+
+      // Copy literals
+      size_t literal_length = token >> 4;
+      if (literal_length == 15 && !read_length(in, end, literal_length)) return false;
+      if (literal_length > size_t(end - in) || literal_length > size_t(out_end - out)) return false;
+
+      if (literal_length > 0) memcpy(out, in, literal_length);
+      in += literal_length;
+      out += literal_length;
+
+      // The last sequence has no match
+      if (in == end) break;
+
+      // Copy the match
+      if (end - in < 2) return false;
+      size_t offset = in[0] | (in[1] << 8);
+      in += 2;
+      if (offset == 0 || offset > size_t(out - dest)) return false;
+
+      size_t match_length = token & 15;
+      if (match_length == 15 && !read_length(in, end, match_length)) return false;
+      match_length += MinMatch;
+      if (match_length > size_t(out_end - out)) return false;
+
+      const uint8_t* match = out - offset;
+      if (offset >= match_length) {
+        memcpy(out, match, match_length);
+      } else {
+        // The match overlaps the output it produces, so it has to be copied one byte at a time
+        for (size_t i = 0; i < match_length; i++) {
+          out[i] = match[i];
+        }
+      }
+      out += match_length;
+    }
+
+    return out == out_end;
+  }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * A small LZ77 block compressor in the style of LZ4. It needs no external library, and favors
+ * decompression speed over compression ratio. Each block is compressed independently.
+ */
+namespace compress {
+  /// Get the largest size a block of a given length can take once compressed
+  size_t maxCompressedSize(size_t length) noexcept;
+
+  /**
+   * Compress a block of data
+   * \param src     The data to compress
+   * \param length  The number of bytes to compress
+   * \param dest    The output buffer, which must hold at least maxCompressedSize(length) bytes
+   * \returns The number of bytes written to dest
+   */
+  size_t compressBlock(const uint8_t* src, size_t length, uint8_t* dest) noexcept;
+
+  /**
+   * Expand a compressed block
+   * \param src          The compressed data
+   * \param length       The number of compressed bytes
+   * \param dest         The output buffer
+   * \param dest_length  The size of the block before it was compressed
+   * \returns true if the block expanded to exactly dest_length bytes, or false if it is corrupt
+   */
+  bool expandBlock(const uint8_t* src, size_t length, uint8_t* dest, size_t dest_length) noexcept;
+}
@@ -20,4 +20,13 @@ namespace constants {
 
   /// Where are cached files saved?
   const fs::path NewCacheDir = OutputDir / "newcache";
+
+  /// Where is the named pipe for the jobserver shared by compiler wrappers?
+  const fs::path JobserverPipe = OutputDir / "jobserver";
+
+  /// Where do the compiler wrappers save object files, keyed on their preprocessed input?
+  const fs::path CompileCacheDir = OutputDir / "compile-cache";
+
+  /// Where does `rkr daemon` listen for build requests?
+  const fs::path DaemonSocket = OutputDir / "daemon.sock";
 }
\ No newline at end of file
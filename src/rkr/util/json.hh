@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdio>
+#include <ostream>
+#include <string>
+
+/// Write a string to an output stream as a quoted JSON string, escaping characters as needed
+inline void writeJSONString(std::ostream& o, const std::string& s) noexcept {
+  o << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      o << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      o << buf;
+    } else {
+      o << c;
+    }
+  }
+  o << '"';
+}
@@ -56,7 +56,7 @@ static std::ostream& operator<<(std::ostream& o, const std::unique_ptr<T>& p) {
 template <typename T>
 struct fmt::formatter<std::shared_ptr<T>> : fmt::formatter<T> {
   template <typename FormatContext>
-  auto format(std::shared_ptr<T> p, FormatContext& ctx) const {
+  auto format(const std::shared_ptr<T>& p, FormatContext& ctx) const {
     if (p) {
       return fmt::formatter<T>::format(*p, ctx);
     } else {
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 enum class FingerprintLevel { None, Local, All };
 
 // Namespace to contain global flags that control build behavior
@@ -32,9 +34,31 @@ namespace options {
   /// Enable file-staging cache
   inline bool enable_cache = true;
 
+  /// Stage read-only outputs from the cache with hard links instead of copies
+  inline bool hardlink_staging = false;
+
+  /// The number of threads that stat files and copy them out of the cache at the end of a build.
+  /// Zero uses one thread per core.
+  inline size_t io_threads = 0;
+
+  /// Run a MayRun command in the current build phase, instead of waiting for the next phase, if
+  /// its inputs have already changed by the time it launches
+  inline bool speculate = false;
+
+  /// Compress the build database when it is saved
+  inline bool compress_trace = false;
+
   /// Inject the shared memory tracing library
   inline bool inject_tracing_lib = true;
 
   /// Use the parallel compiler wrapper
   inline bool parallel_wrapper = true;
+
+  /// The number of compilers the parallel compiler wrappers may run at once across the whole
+  /// build, unless make provides a jobserver. Zero uses one job per core.
+  inline size_t jobs = 0;
+
+  /// Let the parallel compiler wrappers reuse object files for translation units they have already
+  /// compiled with the same flags
+  inline bool compile_cache = false;
 }
\ No newline at end of file
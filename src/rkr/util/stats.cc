@@ -13,10 +13,14 @@ using std::to_string;
 
 namespace fs = std::filesystem;
 
-#define HEADER                                                                         \
-  {                                                                                    \
-    "phase", "emulated_commands", "traced_commands", "emulated_steps", "traced_steps", \
-        "artifacts", "versions", "ptrace_stops", "syscalls", "elapsed_ns"              \
+#define HEADER                                                                             \
+  {                                                                                        \
+    "phase", "emulated_commands", "traced_commands", "emulated_steps", "traced_steps",     \
+        "artifacts", "versions", "ptrace_stops", "syscalls", "elapsed_ns", "reflink_files", \
+        "reflink_bytes", "reflink_ns", "hardlink_files", "hardlink_bytes", "hardlink_ns",   \
+        "copy_range_files", "copy_range_bytes", "copy_range_ns", "sendfile_files",          \
+        "sendfile_bytes", "sendfile_ns", "readwrite_files", "readwrite_bytes",              \
+        "readwrite_ns"                                                                     \
   }
 
 /**
@@ -106,5 +110,13 @@ void gather_stats(optional<fs::path> p, optional<string>& stats_opt, int phase)
     stats_opt.value() += q(to_string(stats::ptrace_stops)) + ",";
     stats_opt.value() += q(std::to_string(stats::syscalls)) + ",";
     stats_opt.value() += q(std::to_string((end_time - stats::start_time).count()));
+
+    // Add the counters for each file copying method
+    for (const auto& c : {stats::reflink_copies, stats::hardlink_copies, stats::copy_range_copies,
+                          stats::sendfile_copies, stats::readwrite_copies}) {
+      stats_opt.value() += "," + q(to_string(c.files));
+      stats_opt.value() += "," + q(to_string(c.bytes));
+      stats_opt.value() += "," + q(to_string(c.time.count()));
+    }
   }
 }
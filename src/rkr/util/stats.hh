@@ -9,6 +9,18 @@
 namespace fs = std::filesystem;
 
 namespace stats {
+  /// Counters for one method of copying files into or out of the cache
+  struct CopyStats {
+    /// The number of files copied with this method
+    size_t files = 0;
+
+    /// The number of bytes copied with this method
+    size_t bytes = 0;
+
+    /// The time spent copying with this method
+    std::chrono::nanoseconds time = std::chrono::nanoseconds(0);
+  };
+
   /// The time set when the stats counters were last reset
   inline std::chrono::time_point start_time = std::chrono::high_resolution_clock::now();
 
@@ -35,6 +47,21 @@ namespace stats {
 
   /// The total number of traced syscalls
   inline size_t syscalls = 0;
+
+  /// Files cloned with a FICLONE reflink
+  inline CopyStats reflink_copies;
+
+  /// Files staged from the cache with a hard link
+  inline CopyStats hardlink_copies;
+
+  /// Files copied with copy_file_range
+  inline CopyStats copy_range_copies;
+
+  /// Files copied with sendfile
+  inline CopyStats sendfile_copies;
+
+  /// Files copied with read and write calls
+  inline CopyStats readwrite_copies;
 }
 
 /// Reset all stats counters to their default values
@@ -48,6 +75,11 @@ inline static void reset_stats() noexcept {
   stats::versions = 0;
   stats::ptrace_stops = 0;
   stats::syscalls = 0;
+  stats::reflink_copies = stats::CopyStats();
+  stats::hardlink_copies = stats::CopyStats();
+  stats::copy_range_copies = stats::CopyStats();
+  stats::sendfile_copies = stats::CopyStats();
+  stats::readwrite_copies = stats::CopyStats();
 }
 
 /**
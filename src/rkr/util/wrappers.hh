@@ -7,9 +7,11 @@
 #include <string>
 #include <tuple>
 
+#include <fcntl.h>
 #include <grp.h>
 #include <limits.h>
 #include <signal.h>
+#include <sys/sysmacros.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -122,4 +124,33 @@ inline loff_t fileLength(fs::path p) noexcept {
     return -1;
   }
   return statbuf.st_size;
-}
\ No newline at end of file
+}
+
+/// Get stat information for a path without following symlinks. This uses statx with
+/// AT_STATX_DONT_SYNC so network and overlay filesystems can answer from cached attributes, and
+/// falls back to lstat on kernels without statx. Returns 0 on success, or -1 and sets errno.
+inline int lstatNoSync(fs::path p, struct stat& statbuf) noexcept {
+  struct statx stx;
+  int rc = ::statx(AT_FDCWD, p.c_str(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                   STATX_BASIC_STATS, &stx);
+  if (rc != 0) {
+    if (errno == ENOSYS) return ::lstat(p.c_str(), &statbuf);
+    return rc;
+  }
+
+  statbuf = {};
+  statbuf.st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+  statbuf.st_ino = stx.stx_ino;
+  statbuf.st_mode = stx.stx_mode;
+  statbuf.st_nlink = stx.stx_nlink;
+  statbuf.st_uid = stx.stx_uid;
+  statbuf.st_gid = stx.stx_gid;
+  statbuf.st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+  statbuf.st_size = stx.stx_size;
+  statbuf.st_blksize = stx.stx_blksize;
+  statbuf.st_blocks = stx.stx_blocks;
+  statbuf.st_atim = {stx.stx_atime.tv_sec, stx.stx_atime.tv_nsec};
+  statbuf.st_mtim = {stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec};
+  statbuf.st_ctim = {stx.stx_ctime.tv_sec, stx.stx_ctime.tv_nsec};
+  return 0;
+}
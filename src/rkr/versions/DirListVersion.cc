@@ -0,0 +1,114 @@
+#include "DirListVersion.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+/**
+ * The table of interned entry names. The table has no lock, so it must only be used from the main
+ * thread. Names are never removed, so it grows with every distinct name listed for the life of
+ * the process, including across requests served by `rkr daemon`.
+ */
+struct EntryNameTable {
+  /// A map from each name to its ID
+  unordered_map<string, DirListVersion::EntryID> ids;
+
+  /// The names indexed by ID. These point to the keys in the ids map, which do not move.
+  vector<const string*> names;
+};
+
+static EntryNameTable& entry_names() noexcept {
+  static EntryNameTable table;
+  return table;
+}
+
+DirListVersion::EntryID DirListVersion::getEntryID(const string& name) noexcept {
+  auto& table = entry_names();
+  auto [iter, added] = table.ids.emplace(name, table.names.size());
+  if (added) table.names.push_back(&iter->first);
+  return iter->second;
+}
+
+const string& DirListVersion::getEntryName(EntryID id) noexcept {
+  auto& table = entry_names();
+  ASSERT(id < table.names.size()) << "Invalid directory entry ID " << id;
+  return *table.names[id];
+}
+
+/// Scramble the bits of a 64-bit value
+static inline uint64_t mix(uint64_t x) noexcept {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+void DirListVersion::finishChanges() const noexcept {
+  if (_finished && _changes.empty()) return;
+
+  // Group the changes by entry. The sort is stable, so the last change to each entry is the last
+  // one in its group.
+  std::stable_sort(_changes.begin(), _changes.end(),
+                   [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  // Merge the changes with the current entries
+  vector<EntryID> result;
+  result.reserve(_entries.size() + _changes.size());
+
+  auto existing = _entries.begin();
+  for (size_t i = 0; i < _changes.size(); i++) {
+    EntryID id = _changes[i].first;
+    if (i + 1 < _changes.size() && _changes[i + 1].first == id) continue;
+
+    while (existing != _entries.end() && *existing < id) result.push_back(*existing++);
+    if (existing != _entries.end() && *existing == id) existing++;
+    if (_changes[i].second) result.push_back(id);
+  }
+  result.insert(result.end(), existing, _entries.end());
+
+  _entries = std::move(result);
+  _changes.clear();
+  _changes.shrink_to_fit();
+
+  // Hash the entries with two independent mixes
+  uint64_t h1 = _entries.size();
+  uint64_t h2 = ~h1;
+  for (EntryID id : _entries) {
+    h1 = mix(h1 + id + 0x9e3779b97f4a7c15ULL);
+    h2 = mix(h2 ^ (id * 0xbf58476d1ce4e5b9ULL + 1));
+  }
+  _hash = {h1, h2};
+  _finished = true;
+}
+
+bool DirListVersion::operator==(const DirListVersion& other) const noexcept {
+  finishChanges();
+  other.finishChanges();
+  return _hash == other._hash && _entries == other._entries;
+}
+
+std::ostream& DirListVersion::print(std::ostream& o) const noexcept {
+  // Print entries in name order, not ID order
+  vector<fs::path> names;
+  for (EntryID id : getEntries()) {
+    names.push_back(getEntryName(id));
+  }
+  std::sort(names.begin(), names.end());
+
+  o << "[dir: {";
+  bool first = true;
+  for (const auto& name : names) {
+    if (!first) o << ", ";
+    first = false;
+    o << name;
+  }
+  return o << "}]";
+}
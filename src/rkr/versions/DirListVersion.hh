@@ -1,10 +1,12 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <memory>
 #include <ostream>
-#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "util/log.hh"
 #include "versions/ContentVersion.hh"
@@ -15,43 +17,75 @@ namespace fs = std::filesystem;
  * A DirListVersion stores a list of all entries in a directory. This version is created
  * on-demand when a command lists the contents of a directory. These versions can be matched against
  * a directory, but are never used to update the contents of a directory.
+ *
+ * Entry names are interned, and a listing is stored as a sorted vector of entry IDs along with a
+ * 128-bit hash of that vector. Two listings with different hashes are known to differ without
+ * comparing their entries.
  */
 class DirListVersion : public ContentVersion {
  public:
+  /// The ID of an interned entry name
+  using EntryID = uint32_t;
+
   DirListVersion() noexcept = default;
 
+  /// Get the ID for an entry name, interning the name if it has not been seen before. Interned
+  /// names are kept for the life of the process. Only call this from the main thread.
+  static EntryID getEntryID(const std::string& name) noexcept;
+
+  /// Get the name of an interned entry. Only call this from the main thread.
+  static const std::string& getEntryName(EntryID id) noexcept;
+
   /// Check if this list matches another list
   virtual bool matches(std::shared_ptr<ContentVersion> other) noexcept override {
     auto other_list = other->as<DirListVersion>();
     if (!other_list) return false;
-    return _entries == other_list->_entries;
+    if (other_list.get() == this) return true;
+    return *this == *other_list;
   }
 
+  /// Compare the entries in two listings
+  bool operator==(const DirListVersion& other) const noexcept;
+
   /// Get the name for the type of version this is
   virtual std::string getTypeName() const noexcept override { return "dir list"; }
 
   /// Print this version
-  virtual std::ostream& print(std::ostream& o) const noexcept override {
-    o << "[dir: {";
-    bool first = true;
-    for (const auto& entry : _entries) {
-      if (!first) o << ", ";
-      first = false;
-      o << entry;
-    }
-    return o << "}]";
-  }
+  virtual std::ostream& print(std::ostream& o) const noexcept override;
+
+  /// Add an entry to this listed directory version
+  void addEntry(EntryID id) noexcept { _changes.emplace_back(id, true); }
 
   /// Add an entry to this listed directory version
-  void addEntry(fs::path name) noexcept { _entries.insert(name); }
+  void addEntry(const std::string& name) noexcept { addEntry(getEntryID(name)); }
 
   /// Remove an entry from this listed directory version
-  void removeEntry(fs::path name) noexcept { _entries.erase(name); }
+  void removeEntry(EntryID id) noexcept { _changes.emplace_back(id, false); }
 
-  /// Get the entries in this version
-  const std::set<fs::path>& getEntries() const noexcept { return _entries; }
+  /// Remove an entry from this listed directory version
+  void removeEntry(const std::string& name) noexcept { removeEntry(getEntryID(name)); }
+
+  /// Get the IDs of the entries in this version, in sorted order
+  const std::vector<EntryID>& getEntries() const noexcept {
+    finishChanges();
+    return _entries;
+  }
+
+ private:
+  /// Apply pending adds and removes to the sorted entry list, and compute the hash. The hash is
+  /// computed even for a listing that never had any changes, so all empty listings are equal.
+  void finishChanges() const noexcept;
 
  private:
-  /// The names of entries in the directory
-  std::set<fs::path> _entries;
-};
\ No newline at end of file
+  /// The IDs of entries in the directory, in sorted order
+  mutable std::vector<EntryID> _entries;
+
+  /// A hash of the entries, valid once _finished is set
+  mutable std::pair<uint64_t, uint64_t> _hash = {0, 0};
+
+  /// Has the hash been computed for the current entries?
+  mutable bool _finished = false;
+
+  /// Adds (true) and removes (false) that have not been applied to the entry list yet, in order
+  mutable std::vector<std::pair<EntryID, bool>> _changes;
+};
@@ -1,25 +1,36 @@
 #include "FileVersion.hh"
 
 #include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <iomanip>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "blake3.h"
+#include "util/WorkQueue.hh"
 #include "util/constants.hh"
 #include "util/log.hh"
 #include "util/options.hh"
+#include "util/stats.hh"
 #include "util/wrappers.hh"
 
+using std::lock_guard;
+using std::mutex;
 using std::nullopt;
 using std::optional;
 using std::ostream;
@@ -32,6 +43,9 @@ namespace fs = std::filesystem;
 // The number of bytes read from a file at once when using read() for blake3 hashing
 enum : size_t { BLAKE3BUFSZ = 65536 };
 
+// The number of bytes read from a file at once when copying with read() and write()
+enum : size_t { COPYBUFSZ = 1024 * 1024 };
+
 /// Convert a BLAKE3 byte array to a hexadecimal string
 static string b3hex(FileVersion::Hash b3hash) noexcept {
   stringstream ss;
@@ -187,7 +201,9 @@ void FileVersion::commitEmptyFile(fs::path path, mode_t mode) noexcept {
 }
 
 /// Save a fingerprint of this version
-void FileVersion::fingerprint(fs::path path, FingerprintType type) noexcept {
+void FileVersion::fingerprint(fs::path path,
+                              FingerprintType type,
+                              const struct stat* statbuf) noexcept {
   // If no fingerprint was requested, return immediately
   if (type == FingerprintType::None) return;
 
@@ -197,27 +213,28 @@ void FileVersion::fingerprint(fs::path path, FingerprintType type) noexcept {
   // If a full fingerprint was requested and we already have an mtime and hash, return immediately
   if (type == FingerprintType::Full && _mtime.has_value() && _hash.has_value()) return;
 
-  // Stat the file to get mtime, empty, and size
-  struct stat statbuf;
-  int rc = ::lstat(path.c_str(), &statbuf);
-  if (rc) {
+  // Stat the file to get mtime, empty, and size, unless the caller already did
+  struct stat info;
+  if (statbuf) {
+    info = *statbuf;
+  } else if (::lstat(path.c_str(), &info) != 0) {
     LOG(cache) << "Failed stat call in FileVersion::fingerprint(" << path << "): " << ERR;
     return;
   }
 
   // Update the empty and mtime fields
-  _empty = statbuf.st_size == 0;
-  _mtime = statbuf.st_mtim;
+  _empty = info.st_size == 0;
+  _mtime = info.st_mtim;
 
   // If a full fingerprint was requested and we don't have one already, collect it
   if (type == FingerprintType::Full && !_hash.has_value()) {
     // if file is a not regular file, bail
-    if (!(statbuf.st_mode & S_IFREG)) return;
+    if (!(info.st_mode & S_IFREG)) return;
 
     // WARN << "Fingerprinting " << path;
 
     // finally save hash
-    _hash = blake3(path, statbuf);
+    _hash = blake3(path, info);
 
     LOG(cache) << "Collected full fingerprint for version " << this << " at path " << path << ".";
   }
@@ -228,72 +245,218 @@ void FileVersion::makeEmptyFingerprint() noexcept {
   _empty = true;
 }
 
-bool fast_copy(fs::path src, fs::path dest, mode_t mode = 0600) noexcept {
-  // Get the length of the src file
-  loff_t len = fileLength(src);
-  if (len == -1) {
-    WARN << "Failed to stat " << src << " for fast copy: " << ERR;
+/// Record a completed copy in the stats counters for the method that performed it. Copies may
+/// finish on staging worker threads, so updates are serialized.
+static void count_copy(stats::CopyStats& counters,
+                       loff_t bytes,
+                       std::chrono::high_resolution_clock::time_point start) noexcept {
+  static mutex counters_mutex;
+  lock_guard<mutex> lock(counters_mutex);
+
+  counters.files++;
+  counters.bytes += bytes;
+  counters.time += std::chrono::high_resolution_clock::now() - start;
+}
+
+/// Copy len bytes from src_fd to dst_fd with copy_file_range. Returns false if the kernel cannot
+/// copy between these files, in which case the caller should fall back to another method.
+static bool copy_range(int src_fd, int dst_fd, loff_t len) noexcept {
+  while (len > 0) {
+    ssize_t bytes_cp = ::copy_file_range(src_fd, NULL, dst_fd, NULL, len, 0);
+    if (bytes_cp <= 0) return bytes_cp == 0;
+    len -= bytes_cp;
+  }
+  return true;
+}
+
+/// Copy len bytes from src_fd to dst_fd with sendfile, which stays in the kernel but works across
+/// filesystems. Returns false if sendfile cannot be used with these files.
+static bool copy_sendfile(int src_fd, int dst_fd, loff_t len) noexcept {
+  while (len > 0) {
+    ssize_t bytes_cp = ::sendfile(dst_fd, src_fd, NULL, len);
+    if (bytes_cp <= 0) return bytes_cp == 0;
+    len -= bytes_cp;
+  }
+  return true;
+}
+
+/// Copy everything from src_fd to dst_fd with read and write calls
+static bool copy_readwrite(int src_fd, int dst_fd) noexcept {
+  auto buf = std::make_unique<char[]>(COPYBUFSZ);
+  ssize_t bytes_read;
+  while ((bytes_read = ::read(src_fd, buf.get(), COPYBUFSZ)) > 0) {
+    ssize_t pos = 0;
+    while (pos < bytes_read) {
+      ssize_t rc = ::write(dst_fd, buf.get() + pos, bytes_read - pos);
+      if (rc <= 0) return false;
+      pos += rc;
+    }
+  }
+  return bytes_read == 0;
+}
+
+/// A copy whose files have been opened, but whose data has not yet been moved
+struct FileCopy {
+  fs::path src;
+  fs::path dest;
+  int src_fd = -1;
+  int dst_fd = -1;
+  loff_t len = 0;
+  std::chrono::high_resolution_clock::time_point start;
+
+  /// The errno value from a failed data copy
+  int error = 0;
+};
+
+/**
+ * Set up a copy by creating the destination file. When a hard link is allowed and succeeds, the
+ * copy is complete and the returned FileCopy holds no open files. Otherwise the destination
+ * exists, empty, by the time this returns; finish_copy moves the data.
+ * \param copy     The copy to set up. The src and dest fields must be filled in.
+ * \param mode     The permissions for the new file
+ * \param hardlink If true, read-only destinations may be hard linked to src
+ * \returns true if the copy was set up successfully
+ */
+static bool start_copy(FileCopy& copy, mode_t mode, bool hardlink) noexcept {
+  copy.start = std::chrono::high_resolution_clock::now();
+
+  // Get the length and permissions of the src file
+  struct stat src_info;
+  if (::lstat(copy.src.c_str(), &src_info) != 0) {
+    WARN << "Failed to stat " << copy.src << " for fast copy: " << ERR;
     return false;
   }
+  copy.len = src_info.st_size;
+
+  // A hard link shares its inode, and so its permissions, with src. Only link read-only files
+  // whose permissions already match src, since changing them would change every other link too.
+  if (hardlink && (mode & 0222) == 0 && (mode & 07777) == (src_info.st_mode & 07777)) {
+    ::unlink(copy.dest.c_str());
+    if (::link(copy.src.c_str(), copy.dest.c_str()) == 0) {
+      count_copy(stats::hardlink_copies, copy.len, copy.start);
+      return true;
+    }
+    LOG(cache) << "Unable to hard link " << copy.src << " to " << copy.dest << ": " << ERR;
+  }
 
   // Open source and destination fds
-  int src_fd = ::open(src.c_str(), O_RDONLY);
-  if (src_fd == -1) {
-    WARN << "Unable to open source file " << src << ": " << ERR;
+  copy.src_fd = ::open(copy.src.c_str(), O_RDONLY);
+  if (copy.src_fd == -1) {
+    WARN << "Unable to open source file " << copy.src << ": " << ERR;
     return false;
   }
 
-  int dst_fd = ::open(dest.c_str(), O_CREAT | O_TRUNC | O_WRONLY, mode);
-  if (dst_fd == -1) {
-    WARN << "Unable to create file " << dest << ": " << ERR;
+  // If dest is a hard link to src from an earlier staging, unlink it so truncating dest does not
+  // also truncate src
+  struct stat dst_info;
+  if (::lstat(copy.dest.c_str(), &dst_info) == 0 &&
+      src_info.st_dev == dst_info.st_dev && src_info.st_ino == dst_info.st_ino) {
+    ::unlink(copy.dest.c_str());
+  }
+
+  copy.dst_fd = ::open(copy.dest.c_str(), O_CREAT | O_TRUNC | O_WRONLY, mode);
+  if (copy.dst_fd == -1) {
+    WARN << "Unable to create file " << copy.dest << ": " << ERR;
+    ::close(copy.src_fd);
+    copy.src_fd = -1;
     return false;
   }
 
-  // copy file to cache using non-POSIX fast copy
-  loff_t bytes_cp;
-  bool use_fallback_copy = false;
-  do {
-    bytes_cp = ::copy_file_range(src_fd, NULL, dst_fd, NULL, len, 0);
-
-    // Did the copy fail?
-    if (bytes_cp == -1) {
-      // Yes. Was it because we're copying across devices?
-      if (errno == EXDEV) {
-        use_fallback_copy = true;
-        break;
-      } else {
-        WARN << "Could not copy file " << src << " to cache location '" << dest << ": " << ERR;
-        return false;
-      }
-    }
+  return true;
+}
 
-    len -= bytes_cp;
-  } while (len > 0 && bytes_cp > 0);
-
-  // Do we need to use a fallback copy?
-  if (use_fallback_copy) {
-    // Seek both files back to the beginning
-    ::lseek(src_fd, 0, SEEK_SET);
-    ::lseek(dst_fd, 0, SEEK_SET);
-
-    // Copy chunks
-    char buf[128];
-    int bytes_read;
-    while ((bytes_read = ::read(src_fd, buf, 128)) != 0) {
-      int rc = ::write(dst_fd, buf, bytes_read);
-      if (rc != bytes_read) {
-        WARN << "Write failed during copy: " << ERR;
-        return false;
+/**
+ * Move the data for a copy set up by start_copy, using the cheapest method the filesystem
+ * supports: a FICLONE reflink, copy_file_range, sendfile, and finally read/write. This only works
+ * through the open file descriptors, so it is safe to run on a worker thread even if the main
+ * thread renames or unlinks the destination in the meantime. Nothing is logged here; a failure
+ * leaves its errno in copy.error for the caller to report on the main thread.
+ * \returns true if the copy succeeded
+ */
+static bool finish_copy(FileCopy& copy) noexcept {
+  // Nothing to do if start_copy created a hard link
+  if (copy.src_fd == -1) return true;
+
+  bool result = true;
+  if (::ioctl(copy.dst_fd, FICLONE, copy.src_fd) == 0) {
+    // The filesystem shared the source file's extents with the destination
+    count_copy(stats::reflink_copies, copy.len, copy.start);
+
+  } else if (copy_range(copy.src_fd, copy.dst_fd, copy.len)) {
+    // The kernel copied the data without passing it through userspace
+    count_copy(stats::copy_range_copies, copy.len, copy.start);
+
+  } else {
+    // Seek both files back to the beginning, since copy_file_range may have made partial progress
+    ::lseek(copy.src_fd, 0, SEEK_SET);
+    ::lseek(copy.dst_fd, 0, SEEK_SET);
+
+    if (copy_sendfile(copy.src_fd, copy.dst_fd, copy.len)) {
+      count_copy(stats::sendfile_copies, copy.len, copy.start);
+
+    } else {
+      ::lseek(copy.src_fd, 0, SEEK_SET);
+      ::lseek(copy.dst_fd, 0, SEEK_SET);
+
+      if (copy_readwrite(copy.src_fd, copy.dst_fd)) {
+        count_copy(stats::readwrite_copies, copy.len, copy.start);
+      } else {
+        copy.error = errno;
+        result = false;
       }
     }
   }
 
-  close(src_fd);
-  close(dst_fd);
+  ::close(copy.src_fd);
+  ::close(copy.dst_fd);
+  copy.src_fd = -1;
+  copy.dst_fd = -1;
+
+  return result;
+}
+
+/**
+ * Copy a file, using the cheapest method the filesystem supports. In order, this tries a hard link
+ * (only when allowed), a FICLONE reflink, copy_file_range, sendfile, and finally read/write.
+ * \param src      The file to copy from
+ * \param dest     The path to create or overwrite
+ * \param mode     The permissions for the new file
+ * \param hardlink If true, read-only destinations may be hard linked to src
+ * \returns true if the copy succeeded
+ */
+bool fast_copy(fs::path src, fs::path dest, mode_t mode = 0600, bool hardlink = false) noexcept {
+  FileCopy copy{src, dest};
+  if (!start_copy(copy, mode, hardlink)) return false;
+
+  if (!finish_copy(copy)) {
+    WARN << "Could not copy file " << copy.src << " to " << copy.dest << ": "
+         << strerror(copy.error);
+    return false;
+  }
 
   return true;
 }
 
+/// Data copies that failed on the staging queue, reported by checkStagedCopies()
+static std::vector<FileCopy> staging_failures;
+
+/// Protects staging_failures
+static mutex staging_failures_mutex;
+
+void FileVersion::checkStagedCopies() noexcept {
+  lock_guard<mutex> lock(staging_failures_mutex);
+  for (const auto& copy : staging_failures) {
+    WARN << "Could not copy file " << copy.src << " to " << copy.dest << ": "
+         << strerror(copy.error);
+  }
+
+  FAIL_IF(!staging_failures.empty())
+      << "Failed to stage file " << staging_failures.front().dest << " from cache"
+      << (staging_failures.size() > 1
+              ? " (and " + std::to_string(staging_failures.size() - 1) + " more)"
+              : "");
+}
+
 /// Restores a file to the given path from the cache.
 /// Returns true if the cache file exists and restoration was successful.
 /// The exact error message can be printed by the caller by inspecting errno.
@@ -305,8 +468,25 @@ bool FileVersion::stage(fs::path path, mode_t mode) noexcept {
   // Path to cached file
   fs::path hash_file = constants::CacheDir / hashPath(_hash.value());
 
-  // Copy the cached file into place
-  FAIL_IF(!fast_copy(hash_file, path, mode)) << "Failed to stage file " << path << " from cache";
+  // Create the file, then copy the cached data into place. If there is a staging queue, move the
+  // data on a worker thread. Only the open file descriptors are used from that point, so the main
+  // thread can keep committing links, renames, and unlinks.
+  FileCopy copy{hash_file, path};
+  FAIL_IF(!start_copy(copy, mode, options::hardlink_staging))
+      << "Failed to stage file " << path << " from cache";
+
+  if (_staging_queue) {
+    // Failures are recorded for checkStagedCopies(), since a worker thread must not end the build
+    _staging_queue->add([copy]() mutable {
+      if (!finish_copy(copy)) {
+        lock_guard<mutex> lock(staging_failures_mutex);
+        staging_failures.push_back(copy);
+      }
+    });
+  } else {
+    FAIL_IF(!finish_copy(copy)) << "Failed to stage file " << path << " from cache: "
+                                << strerror(copy.error);
+  }
 
   LOG(cache) << "Staged in file version at path " << path << " from cache file " << hash_file;
 
@@ -352,8 +532,9 @@ void FileVersion::cache(fs::path path) noexcept {
   // Create the directories, if needed
   fs::create_directories(hash_dir);
 
-  // Copy the file, fast hopefully
-  if (fast_copy(path, hash_file)) {
+  // Copy the file, fast hopefully. Cached files are read-only, so outputs with the same
+  // permissions can be staged as hard links when --hardlink-cache is set.
+  if (fast_copy(path, hash_file, S_IRUSR | S_IRGRP | S_IROTH)) {
     LOG(artifact) << "Cached file version at path " << path << " in " << hash_file;
     _cached = true;
   }
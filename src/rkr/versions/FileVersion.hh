@@ -16,6 +16,8 @@
 
 namespace fs = std::filesystem;
 
+class WorkQueue;
+
 class FileVersion final : public ContentVersion {
  public:
   /// The type that holds a hash of this file content version
@@ -49,11 +51,15 @@ class FileVersion final : public ContentVersion {
   /// Can this version be committed to the filesystem?
   bool canCommit() const noexcept override;
 
-  /// Commit this version to the filesystem
+  /// Commit this version to the filesystem. The mode should be the file's permissions once its
+  /// metadata is committed, since hard-linked staging depends on it.
   void commit(fs::path path, mode_t mode = 0) noexcept;
 
-  /// Save a fingerprint of this version
-  void fingerprint(fs::path path, FingerprintType type) noexcept;
+  /// Save a fingerprint of this version. If statbuf is provided, it must hold the results of an
+  /// lstat of path, and the file is not stat-ed again.
+  void fingerprint(fs::path path,
+                   FingerprintType type,
+                   const struct stat* statbuf = nullptr) noexcept;
 
   /// Save an empty fingerprint of this version
   void makeEmptyFingerprint() noexcept;
@@ -85,6 +91,14 @@ class FileVersion final : public ContentVersion {
   /// Get this version's hash
   const std::optional<Hash>& getHash() const noexcept { return _hash; }
 
+  /// Send the data copies for cache staging to a work queue, or run them immediately if the queue
+  /// is null. Files are always created on the calling thread, so only the data moves in parallel.
+  static void setStagingQueue(WorkQueue* queue) noexcept { _staging_queue = queue; }
+
+  /// Stop the build if any data copy run on the staging queue failed. Call this on the main thread
+  /// once the queue has finished.
+  static void checkStagedCopies() noexcept;
+
  private:
   /// Compare to another fingerprint instance
   bool fingerprints_match(std::shared_ptr<FileVersion> other) const noexcept;
@@ -110,4 +124,7 @@ class FileVersion final : public ContentVersion {
 
   /// Transient field: has this version been linked into the new cache directory?
   bool _linked = false;
+
+  /// The queue that runs data copies for staged files, if any
+  inline static WorkQueue* _staging_queue = nullptr;
 };
@@ -91,6 +91,16 @@ bool MetadataVersion::checkAccess(AccessFlags flags) noexcept {
   return !read_needed && !write_needed && !execute_needed;
 }
 
+// Get the user id from this metadata version
+uid_t MetadataVersion::getUID() const noexcept {
+  return _uid;
+}
+
+// Get the group id from this metadata version
+gid_t MetadataVersion::getGID() const noexcept {
+  return _gid;
+}
+
 // Get the mode field from this metadata version
 mode_t MetadataVersion::getMode() const noexcept {
   return _mode;
@@ -1,15 +1,25 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
 #include <filesystem>
 #include <optional>
 #include <string>
 #include <vector>
 
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "blake3.h"
+
 namespace fs = std::filesystem;
 
 using std::nullopt;
@@ -23,6 +33,19 @@ vector<string> path;
 /// Is this a wrapper around clang?
 bool is_clang = false;
 
+/// The jobserver descriptor to take tokens from, or -1 if there is no jobserver. This is always
+/// opened by the wrapper itself so reads can be non-blocking without affecting make.
+int jobserver_read_fd = -1;
+
+/// The jobserver descriptor to return tokens to
+int jobserver_write_fd = -1;
+
+/// Tokens taken from the jobserver that have not been returned yet
+vector<char> jobserver_tokens;
+
+/// The directory that holds cached object files, or empty if the compile cache is disabled
+string compile_cache_dir;
+
 void init_path() {
   string newpath = "";
 
@@ -104,6 +127,28 @@ int execvp_untraced(const vector<string>& args) {
   return execvp_untraced(argv[0], argv);
 }
 
+typedef long (*syscall_fn_t)(long, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+
+/// Make an untraced system call through the injected library. Jobserver traffic must not be
+/// traced, or rkr would see every wrapper reading from and writing to a shared pipe. Fails with
+/// ENOSYS when the injected library is not available.
+long syscall_untraced(long nr,
+                      uint64_t arg1 = 0,
+                      uint64_t arg2 = 0,
+                      uint64_t arg3 = 0,
+                      uint64_t arg4 = 0,
+                      uint64_t arg5 = 0,
+                      uint64_t arg6 = 0) {
+  static syscall_fn_t _fn = reinterpret_cast<syscall_fn_t>(dlsym(RTLD_NEXT, "syscall_untraced"));
+
+  if (!_fn) {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  return _fn(nr, arg1, arg2, arg3, arg4, arg5, arg6);
+}
+
 bool one_of(const string& str, const std::initializer_list<string>& options) {
   for (const auto& option : options) {
     if (str == option) return true;
@@ -137,6 +182,357 @@ bool has_suffix(const string& str, const std::initializer_list<string>& suffixes
   return false;
 }
 
+/// Get the last jobserver option passed down from make, either "R,W" or "fifo:PATH"
+optional<string> get_make_jobserver() {
+  char* makeflags = getenv("MAKEFLAGS");
+  if (makeflags == NULL) return nullopt;
+
+  // Look at each word in MAKEFLAGS. Older versions of make use --jobserver-fds.
+  optional<string> result;
+  string flags(makeflags);
+  size_t start = 0;
+  while (start < flags.size()) {
+    size_t sep = flags.find(' ', start);
+    if (sep == string::npos) sep = flags.size();
+
+    const auto word = flags.substr(start, sep - start);
+    for (const string prefix : {"--jobserver-auth=", "--jobserver-fds="}) {
+      if (has_prefix(word, {prefix})) result = word.substr(prefix.size());
+    }
+
+    start = sep + 1;
+  }
+
+  return result;
+}
+
+/// Connect to a jobserver, given as "R,W" for an inherited pipe or "fifo:PATH" for a named pipe
+bool jobserver_connect(const string& auth) {
+  if (has_prefix(auth, {"fifo:"})) {
+    const auto fifo = auth.substr(5);
+    long fd = syscall_untraced(__NR_openat, AT_FDCWD, (uintptr_t)fifo.c_str(),
+                               O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) return false;
+
+    jobserver_read_fd = jobserver_write_fd = fd;
+    return true;
+  }
+
+  int read_fd, write_fd;
+  if (sscanf(auth.c_str(), "%d,%d", &read_fd, &write_fd) != 2) return false;
+  if (read_fd < 0 || write_fd < 0) return false;
+
+  // make closes the jobserver pipe for commands it does not know are recursive
+  if (syscall_untraced(__NR_fcntl, read_fd, F_GETFD) == -1) return false;
+  if (syscall_untraced(__NR_fcntl, write_fd, F_GETFD) == -1) return false;
+
+  // Open the read end again so this wrapper has its own non-blocking descriptor
+  const auto fd_path = "/proc/self/fd/" + std::to_string(read_fd);
+  long fd = syscall_untraced(__NR_openat, AT_FDCWD, (uintptr_t)fd_path.c_str(),
+                             O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) return false;
+
+  jobserver_read_fd = fd;
+  jobserver_write_fd = write_fd;
+  return true;
+}
+
+/// Find a jobserver, preferring one from make over the one rkr runs for the whole build
+void jobserver_init() {
+  if (auto auth = get_make_jobserver(); auth.has_value() && jobserver_connect(auth.value())) {
+    return;
+  }
+
+  if (char* auth = getenv("RKR_JOBSERVER"); auth != NULL) {
+    jobserver_connect(auth);
+  }
+}
+
+/// Try to take a token from the jobserver without blocking
+bool jobserver_acquire() {
+  char token;
+  if (syscall_untraced(__NR_read, jobserver_read_fd, (uintptr_t)&token, 1) != 1) return false;
+  jobserver_tokens.push_back(token);
+  return true;
+}
+
+/// Return a token to the jobserver
+void jobserver_release() {
+  char token = jobserver_tokens.back();
+  jobserver_tokens.pop_back();
+  while (syscall_untraced(__NR_write, jobserver_write_fd, (uintptr_t)&token, 1) == -1 &&
+         errno == EINTR) {
+  }
+}
+
+/// Wait a short time for the jobserver to have a token available
+void jobserver_wait() {
+  struct pollfd pfd = {jobserver_read_fd, POLLIN, 0};
+  struct timespec timeout = {0, 10 * 1000 * 1000};
+  syscall_untraced(__NR_ppoll, (uintptr_t)&pfd, 1, (uintptr_t)&timeout, 0, 0);
+}
+
+/// Enable the compile cache if rkr advertised one. Cache entries are read and written with untraced
+/// system calls, so the cache is only usable when the injected library is available.
+void compile_cache_init() {
+  char* dir = getenv("RKR_COMPILE_CACHE");
+  if (dir == NULL) return;
+  if (syscall_untraced(__NR_getpid) == -1) return;
+  compile_cache_dir = dir;
+}
+
+/// How many arguments does a preprocessor-only option take up? Returns zero for any other option.
+/// These options are left out of a compile cache key because they only affect the preprocessed
+/// source, which is already part of the key.
+size_t preprocessor_arg_count(const string& arg) {
+  for (const string option : {"-I", "-D", "-U", "-isystem", "-iquote", "-idirafter", "-include",
+                              "-imacros"}) {
+    if (arg == option) return 2;
+  }
+
+  if (has_prefix(arg, {"-I", "-D", "-U", "-isystem", "-iquote", "-idirafter"})) return 1;
+
+  return 0;
+}
+
+/// Can a compile with these arguments be served from the compile cache? Compiles that write
+/// dependency files or other side outputs cannot, since a cache hit only produces the object file.
+bool is_cacheable(const vector<string>& compile_args, const string& source) {
+  if (compile_cache_dir.empty()) return false;
+
+  // Plain assembly is not preprocessed, so there is nothing to key it on
+  if (has_suffix(source, {".s"})) return false;
+
+  for (const auto& arg : compile_args) {
+    if (has_prefix(arg, {"-M", "-save-temps", "-fdump-"}) || one_of(arg, {"-E", "-S", "-"})) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// Fork and run a command with an untraced exec. Returns the command's exit status, or nullopt if
+/// it could not be run.
+optional<int> run_and_wait(const vector<string>& args) {
+  pid_t child_id = fork();
+  if (child_id == -1) return nullopt;
+
+  if (child_id == 0) {
+    execvp_untraced(args);
+    _exit(EXIT_FAILURE);
+  }
+
+  int status;
+  if (waitpid(child_id, &status, 0) == -1) return nullopt;
+  if (!WIFEXITED(status)) return nullopt;
+  return WEXITSTATUS(status);
+}
+
+/// Compute the compile cache key for a source file: a BLAKE3 hash of the compiler, the working
+/// directory, the flags that are not preprocessor-only, and the preprocessed source. The compiler
+/// reads every header while preprocessing, so rkr still records them as inputs to this command.
+optional<string> compile_cache_key(const vector<string>& compile_args, const string& source) {
+  blake3_hasher hasher;
+  blake3_hasher_init(&hasher);
+
+  // Hash each string with its terminating NUL so adjacent strings cannot run together
+  auto add = [&](const string& str) { blake3_hasher_update(&hasher, str.c_str(), str.size() + 1); };
+
+  // Identify the compiler by where it was found in PATH, along with its size and mtime
+  const auto& compiler = compile_args[0];
+  optional<string> compiler_path;
+  if (compiler.find('/') != string::npos) {
+    compiler_path = compiler;
+  } else {
+    for (const auto& entry : path) {
+      if (access((entry + '/' + compiler).c_str(), X_OK) == 0) {
+        compiler_path = entry + '/' + compiler;
+        break;
+      }
+    }
+  }
+
+  struct stat statbuf;
+  if (!compiler_path.has_value() || stat(compiler_path.value().c_str(), &statbuf) != 0) {
+    return nullopt;
+  }
+
+  add(compiler_path.value());
+  add(std::to_string(statbuf.st_size));
+  add(std::to_string(statbuf.st_mtim.tv_sec) + "." + std::to_string(statbuf.st_mtim.tv_nsec));
+
+  // Debug info records the working directory
+  add(fs::current_path().string());
+
+  // Hash the normalized flags
+  for (size_t i = 1; i < compile_args.size(); i++) {
+    if (size_t count = preprocessor_arg_count(compile_args[i]); count > 0) {
+      i += count - 1;
+    } else {
+      add(compile_args[i]);
+    }
+  }
+
+  // Run the preprocessor on the source file and hash its output as it arrives. Any diagnostics are
+  // dropped here, since the real compile will print them again on a cache miss.
+  int pipe_fds[2];
+  if (pipe2(pipe_fds, O_CLOEXEC) != 0) return nullopt;
+
+  int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+  vector<string> preprocess_args = compile_args;
+  preprocess_args.push_back("-E");
+  preprocess_args.push_back(source);
+
+  pid_t child_id = fork();
+  if (child_id == 0) {
+    dup2(pipe_fds[1], STDOUT_FILENO);
+    if (null_fd != -1) dup2(null_fd, STDERR_FILENO);
+
+    // rkr does not see the untraced exec close these, so close them here
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    if (null_fd != -1) close(null_fd);
+
+    execvp_untraced(preprocess_args);
+    _exit(EXIT_FAILURE);
+  }
+
+  close(pipe_fds[1]);
+  if (null_fd != -1) close(null_fd);
+
+  if (child_id == -1) {
+    close(pipe_fds[0]);
+    return nullopt;
+  }
+
+  char buf[1 << 16];
+  ssize_t n;
+  while ((n = read(pipe_fds[0], buf, sizeof(buf))) != 0) {
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) break;
+    blake3_hasher_update(&hasher, buf, n);
+  }
+  close(pipe_fds[0]);
+
+  int status;
+  if (waitpid(child_id, &status, 0) == -1) return nullopt;
+  if (n != 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return nullopt;
+
+  uint8_t hash[BLAKE3_OUT_LEN];
+  blake3_hasher_finalize(&hasher, hash, BLAKE3_OUT_LEN);
+
+  string key;
+  for (auto byte : hash) {
+    char hex[3];
+    snprintf(hex, sizeof(hex), "%02x", byte);
+    key += hex;
+  }
+  return key;
+}
+
+/// Copy the rest of one file to another. Each side can be traced or untraced.
+bool copy_file(int from_fd, bool untraced_from, int to_fd, bool untraced_to) {
+  char buf[1 << 16];
+  while (true) {
+    ssize_t n = untraced_from ? syscall_untraced(__NR_read, from_fd, (uintptr_t)buf, sizeof(buf))
+                              : read(from_fd, buf, sizeof(buf));
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) return false;
+    if (n == 0) return true;
+
+    ssize_t done = 0;
+    while (done < n) {
+      ssize_t m = untraced_to
+                      ? syscall_untraced(__NR_write, to_fd, (uintptr_t)(buf + done), n - done)
+                      : write(to_fd, buf + done, n - done);
+      if (m == -1 && errno == EINTR) continue;
+      if (m == -1) return false;
+      done += m;
+    }
+  }
+}
+
+/// Get the path to the cache entry with a given key
+string compile_cache_path(const string& key) {
+  return compile_cache_dir + '/' + key.substr(0, 2) + '/' + key.substr(2) + ".o";
+}
+
+/// Copy a cached object file to an output path. The cache entry is read without tracing, but the
+/// output is written normally so rkr records it as an output of this command.
+bool compile_cache_fetch(const string& key, const string& output) {
+  const auto entry = compile_cache_path(key);
+  long from_fd = syscall_untraced(__NR_openat, AT_FDCWD, (uintptr_t)entry.c_str(),
+                                  O_RDONLY | O_CLOEXEC);
+  if (from_fd == -1) return false;
+
+  int to_fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (to_fd == -1) {
+    syscall_untraced(__NR_close, from_fd);
+    return false;
+  }
+
+  bool copied = copy_file(from_fd, true, to_fd, false);
+  syscall_untraced(__NR_close, from_fd);
+  close(to_fd);
+
+  return copied;
+}
+
+/// Save a freshly compiled object file in the cache. Entries are written to a temporary name and
+/// renamed into place, so concurrent wrappers never see a partial entry.
+void compile_cache_store(const string& key, const string& output) {
+  const auto dir = compile_cache_dir + '/' + key.substr(0, 2);
+  syscall_untraced(__NR_mkdirat, AT_FDCWD, (uintptr_t)dir.c_str(), 0755);
+
+  const auto entry = compile_cache_path(key);
+  const auto temp = entry + "." + std::to_string(getpid()) + ".tmp";
+
+  long from_fd = syscall_untraced(__NR_openat, AT_FDCWD, (uintptr_t)output.c_str(),
+                                  O_RDONLY | O_CLOEXEC);
+  if (from_fd == -1) return;
+
+  long to_fd = syscall_untraced(__NR_openat, AT_FDCWD, (uintptr_t)temp.c_str(),
+                                O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (to_fd == -1) {
+    syscall_untraced(__NR_close, from_fd);
+    return;
+  }
+
+  bool copied = copy_file(from_fd, true, to_fd, true);
+  syscall_untraced(__NR_close, from_fd);
+  syscall_untraced(__NR_close, to_fd);
+
+  if (copied) {
+    copied = syscall_untraced(__NR_renameat, AT_FDCWD, (uintptr_t)temp.c_str(), AT_FDCWD,
+                              (uintptr_t)entry.c_str()) == 0;
+  }
+
+  if (!copied) syscall_untraced(__NR_unlinkat, AT_FDCWD, (uintptr_t)temp.c_str(), 0);
+}
+
+/// Compile one source file, reusing a cached object file if this translation unit has been
+/// compiled with the same flags before. Returns the exit status of the compile.
+int cached_compile(const vector<string>& compile_args,
+                   const vector<string>& new_args,
+                   const string& source,
+                   const string& output) {
+  auto key = compile_cache_key(compile_args, source);
+  if (key.has_value() && compile_cache_fetch(key.value(), output)) return 0;
+
+  auto status = run_and_wait(new_args);
+  if (!status.has_value()) {
+    fprintf(stderr, "rkr-wrapper failed to launch %s: ", new_args[0].c_str());
+    perror("");
+    return EXIT_FAILURE;
+  }
+
+  if (key.has_value() && status.value() == 0) compile_cache_store(key.value(), output);
+
+  return status.value();
+}
+
 optional<int> assemble(vector<string>& args, vector<string>& tempfiles) {
   return nullopt;
 }
@@ -231,12 +627,29 @@ optional<int> compile(vector<string>& args, vector<string>& tempfiles) {
 
   size_t launched = 0;
   size_t finished = 0;
-  size_t jobs = 12;
   optional<int> exit_code = nullopt;
 
+  // Without a jobserver, run up to one compiler per core
+  size_t local_jobs = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+
   while (finished < source_files.size()) {
+    size_t running = launched - finished;
+
+    // The first compiler runs in this wrapper's own job slot. Each additional compiler needs a
+    // token from the jobserver, or a free core if there is no jobserver.
+    bool can_launch = false;
+    if (launched < source_files.size()) {
+      if (running == 0) {
+        can_launch = true;
+      } else if (jobserver_read_fd == -1) {
+        can_launch = running < local_jobs;
+      } else {
+        can_launch = jobserver_tokens.size() >= running || jobserver_acquire();
+      }
+    }
+
     // Can we launch a job now?
-    if (launched < source_files.size() && launched - finished < jobs) {
+    if (can_launch) {
       vector<string> new_args = compile_args;
       new_args.push_back("-o");
       new_args.push_back(output_files[launched]);
@@ -249,7 +662,12 @@ optional<int> compile(vector<string>& args, vector<string>& tempfiles) {
         return EXIT_FAILURE;
 
       } else if (child_id == 0) {
-        // In the child
+        // In the child. Go through the compile cache if this compile can use it.
+        if (is_cacheable(compile_args, source_files[launched])) {
+          exit(cached_compile(compile_args, new_args, source_files[launched],
+                              output_files[launched]));
+        }
+
         execvp_untraced(new_args);
 
         // Print an error message if the compiler did not exec
@@ -263,9 +681,20 @@ optional<int> compile(vector<string>& args, vector<string>& tempfiles) {
       launched++;
 
     } else {
-      // We've hit the maximum number of simultaneous jobs. Wait for one
+      // If there are jobs waiting on the jobserver, a token could arrive before any job exits
       int status;
-      if (wait(&status) == -1) {
+      pid_t child;
+      if (launched < source_files.size() && jobserver_read_fd != -1) {
+        child = waitpid(-1, &status, WNOHANG);
+        if (child == 0) {
+          jobserver_wait();
+          continue;
+        }
+      } else {
+        child = wait(&status);
+      }
+
+      if (child == -1) {
         perror("wait failed");
         return EXIT_FAILURE;
       }
@@ -277,6 +706,11 @@ optional<int> compile(vector<string>& args, vector<string>& tempfiles) {
 
       // One more job is finished
       finished++;
+
+      // Give back any tokens the remaining jobs no longer need
+      while (!jobserver_tokens.empty() && jobserver_tokens.size() >= launched - finished) {
+        jobserver_release();
+      }
     }
   }
 
@@ -333,6 +767,12 @@ int main(int argc, char* argv[]) {
 
   // TODO: if cc or c++ is a link to clang we'd want to detect that
 
+  // Find a jobserver to limit how many compilers run at once
+  jobserver_init();
+
+  // Reuse objects for unchanged translation units if rkr enabled the compile cache
+  compile_cache_init();
+
   // Set up a container for temporary file paths we need to clean up
   vector<string> tempfiles;
 
@@ -349,6 +789,11 @@ int main(int argc, char* argv[]) {
     exit_code = link(args, tempfiles);
   }
 
+  // Return any tokens still held if a step stopped early
+  while (!jobserver_tokens.empty()) {
+    jobserver_release();
+  }
+
   // TODO: clean up temporary files
 
   // Exit with the provided exit code (or 0 by default)
@@ -0,0 +1,77 @@
+Build with the compile cache and verify that unchanged translation units reuse cached objects
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr prog
+  $ echo '#define MESSAGE "Hello"' > message.h
+
+Run the build. The wrapper preprocesses each source to look it up in the cache, then compiles it
+on a miss. Run one compiler at a time so the commands print in a fixed order.
+  $ rkr --show --compile-cache -j 1
+  rkr-launch
+  Rikerfile
+  gcc -o prog main.c message.c
+  cc1 -E * (glob)
+  cc1 * (glob)
+  as * (glob)
+  cc1 -E * (glob)
+  cc1 * (glob)
+  as * (glob)
+  collect2 * (glob)
+  ld * (glob)
+
+Check the output
+  $ ./prog
+  Hello
+
+There should be a cached object for each source file
+  $ find .rkr/compile-cache -name '*.o' | wc -l
+  2
+
+Change the header, which only message.c includes
+  $ echo '#define MESSAGE "Goodbye"' > message.h
+
+Run a rebuild. Both sources are preprocessed again, but only message.c misses the cache.
+  $ rkr --show --compile-cache -j 1
+  gcc -o prog main.c message.c
+  cc1 -E * (glob)
+  cc1 -E * (glob)
+  cc1 * (glob)
+  as * (glob)
+  collect2 * (glob)
+  ld * (glob)
+
+Check the output
+  $ ./prog
+  Goodbye
+
+Only message.c was compiled again
+  $ find .rkr/compile-cache -name '*.o' | wc -l
+  3
+
+Put the header back
+  $ echo '#define MESSAGE "Hello"' > message.h
+
+Run a rebuild, which can use the cached object from the first build. Nothing is compiled.
+  $ rkr --show --compile-cache -j 1
+  gcc -o prog main.c message.c
+  cc1 -E * (glob)
+  cc1 -E * (glob)
+  collect2 * (glob)
+  ld * (glob)
+
+Check the output
+  $ ./prog
+  Hello
+
+No new objects were cached
+  $ find .rkr/compile-cache -name '*.o' | wc -l
+  3
+
+Run a rebuild, which should do nothing
+  $ rkr --show --compile-cache -j 1
+
+Clean up
+  $ rm -rf .rkr prog
@@ -0,0 +1,8 @@
+#include <stdio.h>
+
+const char* message();
+
+int main() {
+  printf("%s\n", message());
+  return 0;
+}
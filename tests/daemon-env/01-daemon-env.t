@@ -0,0 +1,30 @@
+Builds served by an rkr daemon run with the client's environment and options
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr output
+
+Start the daemon without the variable the build uses, and wait for its socket to appear
+  $ env -u GREETING rkr daemon > /dev/null 2>&1 &
+  $ while [ ! -S .rkr/daemon.sock ]; do sleep 0.1; done
+
+Run a build through the daemon with the variable set and command printing on
+  $ GREETING=Hello rkr --show
+  rkr-launch
+  Rikerfile
+
+The command saw the client's environment
+  $ cat output
+  Hello
+
+Run a rebuild without --show, which should print nothing
+  $ rkr
+
+Stop the daemon
+  $ kill $!
+  $ wait
+
+Clean up
+  $ rm -rf .rkr output
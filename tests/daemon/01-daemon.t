@@ -0,0 +1,47 @@
+Run builds through a resident rkr daemon and verify it picks up changes between builds
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
+
+Start the daemon and wait for its socket to appear
+  $ rkr daemon > /dev/null 2>&1 &
+  $ while [ ! -S .rkr/daemon.sock ]; do sleep 0.1; done
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat input
+
+Check the output
+  $ cat output
+  Hello
+
+Run a rebuild with a warm daemon
+  $ rkr --show
+
+Change the input in place
+  $ echo "Goodbye" > input
+
+Run a rebuild
+  $ rkr --show
+  cat input
+
+Check the output
+  $ cat output
+  Goodbye
+
+Run the same build without the daemon
+  $ rkr --no-daemon --show
+
+Stop the daemon
+  $ kill $!
+  $ wait
+
+Clean up
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
@@ -0,0 +1,43 @@
+Check that a warm daemon only revalidates the paths its change journal recorded between builds
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
+
+Start the daemon and wait for its socket to appear
+  $ rkr daemon > /dev/null 2>&1 &
+  $ while [ ! -S .rkr/daemon.sock ]; do sleep 0.1; done
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat input
+
+Nothing changed since the last build, so the journal is empty
+  $ rkr --show --log phase 2>&1 > /dev/null | grep -e journal -e Refreshing
+  (phase) Checking 0 changed paths from the change journal
+
+Change the input in place. The journal names it, and it is refreshed before the rebuild.
+  $ echo "Goodbye" > input
+  $ rkr --show --log phase 2>&1 > /dev/null | grep -e journal -e Refreshing
+  (phase) Checking 1 changed paths from the change journal
+  (phase) Refreshing [File input] from the filesystem
+
+Check the output
+  $ cat output
+  Goodbye
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Stop the daemon
+  $ kill $!
+  $ wait
+
+Clean up
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
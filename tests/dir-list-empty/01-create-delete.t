@@ -0,0 +1,28 @@
+List a directory whose only entry was created and removed during the build
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr dir listing
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  mkdir -p dir
+  touch dir/tmp
+  rm dir/tmp
+  ls dir
+
+The listing is empty
+  $ cat listing
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Run another rebuild, which should also do nothing
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr dir listing
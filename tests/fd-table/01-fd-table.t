@@ -0,0 +1,66 @@
+Check that commands are tracked through descriptors inherited across fork and exec, and that
+close-on-exec descriptors and working directory changes stay with the process that made them
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr out1 out2 out3
+  $ echo one > input1
+  $ echo two > input2
+  $ echo three > dir/input
+
+Run the build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat
+  cat input
+  cat input2
+
+Check the output
+  $ cat out1 out2 out3
+  one
+  three
+  two
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Change the file cat reads through its inherited descriptor. Only that cat runs again.
+  $ echo ONE > input1
+  $ rkr --show
+  cat
+  $ cat out1
+  ONE
+
+Change the file the subshell reads from its own working directory
+  $ echo THREE > dir/input
+  $ rkr --show
+  cat input
+  $ cat out2
+  THREE
+
+Change the input to the command that ran while the shell held a close-on-exec descriptor
+  $ echo TWO > input2
+  $ rkr --show
+  cat input2
+  $ cat out3
+  TWO
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Remove the outputs, which are restored from the cache without running anything
+  $ rm out1 out2 out3
+  $ rkr --show
+  $ cat out1 out2 out3
+  ONE
+  THREE
+  TWO
+
+Clean up
+  $ rm -rf .rkr out1 out2 out3
+  $ echo one > input1
+  $ echo two > input2
+  $ echo three > dir/input
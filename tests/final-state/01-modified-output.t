@@ -0,0 +1,37 @@
+Check the final state of a build's outputs, including more files than fit in one batch of stats
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr out output
+  $ echo "Hello" > input
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  mkdir -p out
+  seq 1 300
+  cat input
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Modify one output from the middle of the list. The check finds it, and the build puts back the cached version.
+  $ echo "Modified" > out/150
+  $ rkr --show
+  $ cat out/150
+  150
+
+Modify the output of the last command
+  $ echo "Modified" > output
+  $ rkr --show
+  $ cat output
+  Hello
+
+Run another rebuild, which should do nothing
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr out output input
@@ -0,0 +1,33 @@
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any previous build
+  $ rm -rf .rkr output out.csv out.jsonl
+
+Run a build
+  $ rkr
+
+Export the graph as a CSV edge list. This does not need graphviz.
+  $ rkr graph -t csv
+  $ head -n 1 out.csv
+  record,id,src,dst,kind,label
+
+The output file should appear as a vertex
+  $ grep -c '^v,[0-9]*,,,artifact,"output"$' out.csv
+  1
+
+Export the graph as JSON lines
+  $ rkr graph -t jsonl
+  $ grep -c '"kind":"output"' out.jsonl
+  [1-9][0-9]* (re)
+
+Focus on the output file, and group commands by directory
+  $ rkr graph -t csv --focus '^output$' --hops 1 --by-directory
+  $ grep -c ',directory,"."$' out.csv
+  1
+  $ grep -c ',command,' out.csv
+  0
+  [1]
+
+Clean up
+  $ rm -rf .rkr output out.csv out.jsonl
@@ -0,0 +1,51 @@
+Stage read-only outputs from the cache with hard links
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr readonly executable
+  $ echo Hello > input
+
+Run the first build
+  $ rkr --show --hardlink-cache
+  rkr-launch
+  Rikerfile
+  cat input
+  chmod 444 readonly
+  cat input
+  chmod 555 executable
+
+Both outputs have the same content, so there is one read-only file in the cache
+  $ find .rkr/cache -type f -exec stat -c %a {} \;
+  444
+
+Remove both outputs
+  $ rm -f readonly executable
+
+Run a rebuild, which restores the outputs from the cache without running anything
+  $ rkr --show --hardlink-cache
+  $ cat readonly executable
+  Hello
+  Hello
+  $ stat -c %a readonly executable
+  444
+  555
+
+The read-only output is a hard link to the cached file
+  $ test "$(stat -c %i readonly)" = "$(stat -c %i $(find .rkr/cache -type f))" && echo linked
+  linked
+
+The executable output has different permissions, so it was copied
+  $ test "$(stat -c %i executable)" = "$(stat -c %i $(find .rkr/cache -type f))" || echo copied
+  copied
+
+The cached file's permissions did not change
+  $ find .rkr/cache -type f -exec stat -c %a {} \;
+  444
+
+Run another rebuild, which should do nothing
+  $ rkr --show --hardlink-cache
+
+Clean up
+  $ rm -rf .rkr readonly executable input
@@ -0,0 +1,36 @@
+Build with make -j, which hands its jobserver to the compiler wrapper
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr prog
+  $ echo '#define MESSAGE "world"' > message.h
+
+Run the build. The wrapper takes tokens from make to compile in parallel, and make reports an
+error if any token is not returned when it exits.
+  $ rkr
+
+Check the output
+  $ ./prog
+  Hello world
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Change the header, which only b.c includes
+  $ echo '#define MESSAGE "jobserver"' > message.h
+
+Run a rebuild
+  $ rkr
+
+Check the output
+  $ ./prog
+  Hello jobserver
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr prog
+  $ echo '#define MESSAGE "world"' > message.h
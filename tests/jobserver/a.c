@@ -0,0 +1,3 @@
+const char* a() {
+  return "Hello";
+}
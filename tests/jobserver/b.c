@@ -0,0 +1,5 @@
+#include "message.h"
+
+const char* b() {
+  return MESSAGE;
+}
@@ -0,0 +1,9 @@
+#include <stdio.h>
+
+const char* a();
+const char* b();
+
+int main() {
+  printf("%s %s\n", a(), b());
+  return 0;
+}
@@ -0,0 +1,38 @@
+Build only the commands that write into a directory named with a trailing slash
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr out other
+  $ echo "A1" > a
+  $ echo "B1" > b
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  mkdir -p out
+  cat a
+  cat b
+
+Change both inputs
+  $ echo "A2" > a
+  $ echo "B2" > b
+
+Build only the out directory. The command that writes other does not run.
+  $ rkr build --show out/
+  cat a
+
+Check the outputs
+  $ cat out/a
+  A2
+  $ cat other
+  B1
+
+Run a full build, which runs the command that was left out
+  $ rkr --show
+  cat b
+
+Clean up
+  $ rm -rf .rkr out other a b
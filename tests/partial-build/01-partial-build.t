@@ -0,0 +1,46 @@
+Build only the commands needed for one target, then let a full build catch up
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr mid outa outb
+  $ echo "A1" > a
+  $ echo "B1" > b
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat a
+  cat mid
+  cat b
+
+Change both inputs
+  $ echo "A2" > a
+  $ echo "B2" > b
+
+Build only outa. The command that writes outb does not run.
+  $ rkr build --show outa
+  cat a
+  cat mid
+
+Check the outputs
+  $ cat outa
+  A2
+  $ cat outb
+  B1
+
+Run a full build, which runs the command that was left out
+  $ rkr --show
+  cat b
+
+Check the output
+  $ cat outb
+  B2
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr mid outa outb a b
@@ -0,0 +1,43 @@
+Stream enough data through a pipeline that each command makes many writes to its pipe. Writes made
+between two reads are recorded as one, and the pipeline must still build and rebuild correctly.
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr input output
+  $ seq 1 50000 > input
+
+Run the build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  ((cat input)|(tr 0-9 a-j)|(sort)|(md5sum)) (re)
+  ((cat input)|(tr 0-9 a-j)|(sort)|(md5sum)) (re)
+  ((cat input)|(tr 0-9 a-j)|(sort)|(md5sum)) (re)
+  ((cat input)|(tr 0-9 a-j)|(sort)|(md5sum)) (re)
+
+Check the output against the same pipeline run without rkr
+  $ tr 0-9 a-j < input | sort | md5sum | cmp - output
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Change the input
+  $ seq 2 50001 > input
+
+Run a rebuild. Every command in the pipeline runs again.
+  $ rkr --show
+  ((cat input)|(tr 0-9 a-j)|(sort)|(md5sum)) (re)
+  ((cat input)|(tr 0-9 a-j)|(sort)|(md5sum)) (re)
+  ((cat input)|(tr 0-9 a-j)|(sort)|(md5sum)) (re)
+  ((cat input)|(tr 0-9 a-j)|(sort)|(md5sum)) (re)
+
+Check the output
+  $ tr 0-9 a-j < input | sort | md5sum | cmp - output
+
+Run a rebuild, which should do nothing
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr input output
@@ -0,0 +1,49 @@
+Run a chain of commands with speculation and verify each change reaches the final output
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr mid output log
+  $ echo "Hello" > input
+
+Run the first build
+  $ rkr --show --speculate
+  rkr-launch
+  Rikerfile
+  cat input
+  cat mid
+
+Check the output
+  $ cat output
+  Hello
+
+Run a rebuild, which should do nothing
+  $ rkr --show --speculate
+
+Change the input
+  $ echo "Goodbye" > input
+
+Run a rebuild. The second command runs in the same phase as the first.
+  $ rkr --show --speculate --log rebuild,phase 2> log
+  cat input
+  cat mid
+
+Speculation started the second command because its input changed before it launched
+  $ grep -c "must run: input changed before launch" log
+  1
+
+Without speculation this rebuild would take three phases, since the second command would wait
+for a third phase
+  $ grep -c "Starting build phase" log
+  2
+
+Check the output
+  $ cat output
+  Goodbye
+
+Run a rebuild, which should do nothing
+  $ rkr --show --speculate
+
+Clean up
+  $ rm -rf .rkr mid output input log
@@ -0,0 +1,26 @@
+Report a file that cannot be staged from the cache
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
+
+Run the first build, which caches the output
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat input
+
+Remove the output so it has to be staged from the cache, and replace each cached file with a directory so the copy fails
+  $ rm output
+  $ for f in $(find .rkr/cache -type f); do rm $f; mkdir $f; done
+
+The failed copy is reported, and the build stops
+  $ rkr --show 2>&1 | grep -E '^\((warning|error)\)'
+  (warning) Could not copy file ".rkr/cache/*" to "*/output": Is a directory (glob)
+  (error) Failed to stage file "*/output" from cache (glob)
+
+Clean up
+  $ rm -rf .rkr output input
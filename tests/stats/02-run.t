@@ -17,14 +17,25 @@ Verify the output is correct
     Steps: [0-9]+ (re)
     Artifacts: [0-9]+ (re)
     Artifact Versions: [0-9]+ (re)
+    Steps/sec: [0-9]+ (re)
 
 Verify the -a output is correct
-  $ rkr stats -a | head -n 8
+  $ rkr stats -a | head -n 9
   Build Statistics:
     Commands: [0-9]+ (re)
     Steps: [0-9]+ (re)
     Artifacts: [0-9]+ (re)
     Artifact Versions: [0-9]+ (re)
+    Steps/sec: [0-9]+ (re)
   
   Artifacts:
-    .+ (re)
\ No newline at end of file
+    .+ (re)
+
+Verify the --profile output is correct
+  $ rkr stats --profile | grep -A2 "Command Profile:"
+  Command Profile:
+    Wall      User      System    Max RSS    Read       Written    Syscalls  Command
+    [0-9]+\.[0-9]{3}s .* (re)
+
+  $ rkr stats --profile | grep "Critical Path:"
+  Critical Path: [0-9]+\.[0-9]{3}s CPU (re)
@@ -0,0 +1,38 @@
+Collect system call statistics and latency histograms during a build
+
+Move to test directory
+  $ cd $TESTDIR
+
+Clean up any leftover state
+  $ rm -rf .rkr output stats.csv stats.syscalls.csv
+
+Run the build with syscall stats. Leave out the listed call sites and handlers, which vary by machine.
+  $ rkr --syscall-stats | grep -v "^  "
+  System Call Stats:
+  
+  Syscall Handler Latency:
+  
+  [0-9]+/[0-9]+ \([0-9]+%\) syscalls handed by fast tracing (re)
+  Syscall latency histograms written to .rkr/syscall-stats.csv
+
+Check the output
+  $ cat output
+  Hello
+
+The histograms hold one row per syscall, tracing path, and handler stage
+  $ head -n 1 .rkr/syscall-stats.csv
+  syscall,path,stage,count,total_ns,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns
+  $ grep -c '^openat,ptrace,entry,' .rkr/syscall-stats.csv
+  1
+
+Every row has a count and percentiles that do not decrease
+  $ awk -F, 'NR > 1 && (NF != 11 || $4 < 1 || $7 > $8 || $8 > $9 || $9 > $10 || $10 > $11)' .rkr/syscall-stats.csv
+
+When a stats log is given, the histograms are written next to it
+  $ rkr --syscall-stats --stats stats.csv | tail -n 1
+  Syscall latency histograms written to stats.syscalls.csv
+  $ head -n 1 stats.syscalls.csv
+  syscall,path,stage,count,total_ns,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns
+
+Clean up
+  $ rm -rf .rkr output stats.csv stats.syscalls.csv
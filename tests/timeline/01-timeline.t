@@ -0,0 +1,29 @@
+Write a timeline of the build as Chrome trace-event JSON
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr output timeline.json 'a "quoted" \ name'
+  $ echo "Hello" > input
+
+Run a build and write a timeline
+  $ rkr --show --timeline timeline.json
+  rkr-launch
+  Rikerfile
+  cat input
+  cp input a "quoted" \ name
+
+The timeline is valid JSON, and each command that ran has a span named for it
+  $ python3 -c '
+  > import json
+  > events = json.load(open("timeline.json"))["traceEvents"]
+  > for name in sorted(e["args"]["command"] for e in events if e["ph"] == "X" and "args" in e):
+  >     print(name)
+  > '
+  Rikerfile
+  cat input
+  cp input a "quoted" \ name
+
+Clean up
+  $ rm -rf .rkr output timeline.json 'a "quoted" \ name' input
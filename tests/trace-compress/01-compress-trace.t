@@ -0,0 +1,33 @@
+Save a compressed build database and load it on the next build
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
+
+Run the build and compress the database
+  $ rkr --show --compress-trace
+  rkr-launch
+  Rikerfile
+  cat input
+
+Make sure the output is correct
+  $ cat output
+  Hello
+
+Run a rebuild, which should load the compressed database and do nothing
+  $ rkr --show --compress-trace
+
+Change the input and run a rebuild
+  $ echo "Goodbye" > input
+  $ rkr --show --compress-trace
+  cat input
+
+Make sure the output was updated
+  $ cat output
+  Goodbye
+
+Clean up
+  $ rm -rf .rkr output input
@@ -0,0 +1,25 @@
+Print filtered steps from a build trace
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr output
+  $ echo "Hello" > input
+
+Run the build
+  $ rkr
+
+Print the exit step for the cat command
+  $ rkr trace --command '^cat' --step Exit
+  [Command cat input]: Exit(0)
+
+Exit steps are not predicates, so a scenario filter leaves nothing to print
+  $ rkr trace --command '^cat' --step Exit --scenario post-build
+
+Unknown step types are rejected
+  $ rkr trace --step Bogus 2>&1 | grep -c "Unknown step type"
+  1
+
+Clean up
+  $ rm -rf .rkr output input
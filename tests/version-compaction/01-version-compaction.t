@@ -0,0 +1,45 @@
+Drop versions no command refers to between the phases of a targeted build
+
+Move to test directory
+  $ cd $TESTDIR
+
+Prepare for a clean run
+  $ rm -rf .rkr mid out
+  $ echo "A1" > a
+
+Run the first build
+  $ rkr --show
+  rkr-launch
+  Rikerfile
+  cat a
+  cat mid
+
+Change the input
+  $ echo "A2" > a
+
+Build the target. The versions left behind by each earlier run are dropped at the next phase.
+  $ rkr build --show out --log phase
+  (phase) Starting build phase 0
+  (phase) Finished build phase 0
+  \(phase\) Dropped [0-9]+ unreferenced versions from artifact histories (re)
+  (phase) Starting build phase 1
+  cat a
+  (phase) Finished build phase 1
+  \(phase\) Dropped [1-9][0-9]* unreferenced versions from artifact histories (re)
+  (phase) Starting build phase 2
+  cat mid
+  (phase) Finished build phase 2
+  (phase) Committing environment changes
+  (phase) Starting post-build checks
+  \(phase\) Dropped [1-9][0-9]* unreferenced versions from artifact histories (re)
+  (phase) Finished post-build checks
+
+Check the output
+  $ cat out
+  A2
+
+The versions the commands still refer to are all there, so a rebuild does nothing
+  $ rkr --show
+
+Clean up
+  $ rm -rf .rkr mid out a